@@ -42,6 +42,14 @@ if (LM_USE_DOUBLE_PRECISION)
     add_definitions(-DLM_USE_DOUBLE_PRECISION)
 endif()
 
+# LM_USE_SINGLE_PRECISION_GEOMETRY
+cmake_dependent_option(
+    LM_USE_SINGLE_PRECISION_GEOMETRY "Store geometry data in single precision in double precision mode" OFF
+    "LM_USE_DOUBLE_PRECISION" OFF)
+if (LM_USE_SINGLE_PRECISION_GEOMETRY)
+    add_definitions(-DLM_USE_SINGLE_PRECISION_GEOMETRY)
+endif()
+
 # Build type must be specified for make-like generators
 if (NOT CMAKE_BUILD_TYPE)
     set(CMAKE_BUILD_TYPE "Release" CACHE STRING
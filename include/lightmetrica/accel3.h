@@ -40,7 +40,7 @@ class Accel3 : public Accel
 {
 public:
 
-    LM_INTERFACE_CLASS(Accel3, Accel, 1);
+    LM_INTERFACE_CLASS(Accel3, Accel, 5);
 
 public:
 
@@ -67,6 +67,72 @@ public:
     */
     LM_INTERFACE_F(0, Intersect, bool(const Scene* scene, const Ray& ray, Intersection& isect, Float minT, Float maxT));
 
+    /*!
+        \brief Refit the acceleration structure.
+
+        Updates the acceleration structure after the transforms of the primitives are changed.
+        The topology of the scene (primitives, meshes, and their order) must be same as
+        the one given to the last `Build` call. The implementation can rebuild
+        the structure if the quality of the refitted structure is degraded.
+        This function is optional; if not implemented, the scene falls back to `Build`.
+
+        \param scene  Scene with updated transforms.
+        \retval true  Succeeded to refit.
+        \retval false Failed to refit.
+    */
+    LM_INTERFACE_F(1, Refit, bool(const Scene* scene));
+
+    /*!
+        \brief Occlusion query with triangles.
+
+        The function checks if `ray` hits with any triangle within the range of
+        the distance between `minT` and `maxT`. Unlike `Intersect`, the closest hit
+        is not required and the implementation can terminate on the first hit.
+        This function is optional; if not implemented, the scene falls back to `Intersect`.
+
+        \param scene  Scene.
+        \param ray    Ray.
+        \param minT   Minimum range of the distance.
+        \param maxT   Maximum range of the distance.
+        \retval true  The ray is occluded.
+        \retval false The ray is not occluded.
+    */
+    LM_INTERFACE_F(2, Occluded, bool(const Scene* scene, const Ray& ray, Float minT, Float maxT));
+
+    /*!
+        \brief Intersection query with a stream of rays.
+
+        Processes `numRays` intersection queries at once.
+        `hits[i]` is set to true if `rays[i]` intersected with the scene
+        within the range of `minT[i]` and `maxT[i]`, and then `isects[i]` is filled.
+        This function is optional; if not implemented, the scene falls back to `Intersect`.
+
+        \param scene   Scene.
+        \param numRays Number of rays.
+        \param rays    Rays.
+        \param minT    Minimum range of the distance for each ray.
+        \param maxT    Maximum range of the distance for each ray.
+        \param isects  Intersection data for each ray.
+        \param hits    Intersection flags for each ray.
+    */
+    LM_INTERFACE_F(3, IntersectStream, void(const Scene* scene, int numRays, const Ray* rays, const Float* minT, const Float* maxT, Intersection* isects, bool* hits));
+
+    /*!
+        \brief Occlusion query with a stream of rays.
+
+        Processes `numRays` occlusion queries at once.
+        `occluded[i]` is set to true if `rays[i]` is occluded within the range of `minT[i]` and `maxT[i]`.
+        This function is optional; if not implemented, the scene falls back to `Occluded`.
+
+        \param scene    Scene.
+        \param numRays  Number of rays.
+        \param rays     Rays.
+        \param minT     Minimum range of the distance for each ray.
+        \param maxT     Maximum range of the distance for each ray.
+        \param occluded Occlusion flags for each ray.
+    */
+    LM_INTERFACE_F(4, OccludedStream, void(const Scene* scene, int numRays, const Ray* rays, const Float* minT, const Float* maxT, bool* occluded));
+
 };
 
 LM_NAMESPACE_END
@@ -50,7 +50,7 @@ class Assets : public BasicComponent
 {
 public:
 
-    LM_INTERFACE_CLASS(Assets, BasicComponent, 4);
+    LM_INTERFACE_CLASS(Assets, BasicComponent, 5);
 
 public:
 
@@ -106,6 +106,23 @@ public:
     */
     LM_INTERFACE_F(3, GetByIndex, Asset*(int index));
 
+    /*!
+        \brief Load assets in parallel.
+
+        Loads the assets specified by `ids` concurrently.
+        The interface types are taken from the `interface` nodes.
+        Assets depending on other assets wait until the dependencies are loaded.
+        The assets are loaded without primitives,
+        so the assets requiring a primitive in loading must not be given.
+        This function is optional; the assets not preloaded are loaded
+        when they are referenced by AssetByIDAndType.
+
+        \param ids IDs of the assets.
+        \retval true Succeeded to load all assets.
+        \retval false Failed to load some of the assets.
+    */
+    LM_INTERFACE_F(4, Preload, bool(const std::vector<std::string>& ids));
+
 };
 
 LM_NAMESPACE_END
\ No newline at end of file
@@ -115,6 +115,48 @@ namespace Math
 
 // --------------------------------------------------------------------------------
 
+/*!
+    Axis-aligned bounding box stored in GeomFloat.
+    Used for the nodes of the acceleration structures,
+    which are stored in single precision in the mixed precision mode.
+    The conversion from Bound rounds outward so that the original bound is contained.
+*/
+struct GeomBound
+{
+
+    GeomFloat min[3] = {  std::numeric_limits<GeomFloat>::infinity(),  std::numeric_limits<GeomFloat>::infinity(),  std::numeric_limits<GeomFloat>::infinity() };
+    GeomFloat max[3] = { -std::numeric_limits<GeomFloat>::infinity(), -std::numeric_limits<GeomFloat>::infinity(), -std::numeric_limits<GeomFloat>::infinity() };
+
+    GeomBound() = default;
+
+    explicit GeomBound(const Bound& b)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            min[i] = (GeomFloat)(b.min[i]);
+            max[i] = (GeomFloat)(b.max[i]);
+            if ((Float)(min[i]) > b.min[i]) { min[i] = std::nextafter(min[i], -std::numeric_limits<GeomFloat>::infinity()); }
+            if ((Float)(max[i]) < b.max[i]) { max[i] = std::nextafter(max[i],  std::numeric_limits<GeomFloat>::infinity()); }
+        }
+    }
+
+    LM_INLINE auto ToBound() const -> Bound
+    {
+        Bound b;
+        b.min = Vec3((Float)(min[0]), (Float)(min[1]), (Float)(min[2]));
+        b.max = Vec3((Float)(max[0]), (Float)(max[1]), (Float)(max[2]));
+        return b;
+    }
+
+    LM_INLINE auto Intersect(const Ray& ray, Float tMin, Float tMax) const -> bool
+    {
+        return ToBound().Intersect(ray, tMin, tMax);
+    }
+
+};
+
+// --------------------------------------------------------------------------------
+
 //! Bounding sphere.
 struct SphereBound
 {
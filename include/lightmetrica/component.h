@@ -38,6 +38,8 @@
 #include <type_traits>
 #include <memory>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <sstream>
 #include <cassert>
 #include <unordered_map>
@@ -154,6 +156,7 @@ class Component;
 //! \cond
 using CreateFuncPointerType = Component* (*)();
 using ReleaseFuncPointerType = void(*)(Component*);
+using KeyFuncPointerType = void(*)(const char* key, void* userData);
 //! \endcond
 
 //! Base class for all component classes
@@ -442,6 +445,7 @@ extern "C"
     LM_PUBLIC_API auto ComponentFactory_Unregister(const char* key) -> void;
     LM_PUBLIC_API auto ComponentFactory_Create(const char* key) -> Component*;
     LM_PUBLIC_API auto ComponentFactory_ReleaseFunc(const char* key) -> ReleaseFuncPointerType;
+    LM_PUBLIC_API auto ComponentFactory_EnumerateKeys(KeyFuncPointerType func, void* userData) -> void;
     LM_PUBLIC_API auto ComponentFactory_LoadPlugin(const char* path) -> bool;
     LM_PUBLIC_API auto ComponentFactory_LoadPlugins(const char* directory) -> void;
     LM_PUBLIC_API auto ComponentFactory_UnloadPlugins() -> void;
@@ -469,6 +473,23 @@ public:
     static auto LoadPlugins(const std::string& directory) -> void { LM_EXPORTED_F(ComponentFactory_LoadPlugins, directory.c_str()); }
     static auto UnloadPlugins() -> void { LM_EXPORTED_F(ComponentFactory_UnloadPlugins); }
 
+    /*!
+        \brief Get the keys of the registered implementations.
+        Returns the sorted keys starting with the given prefix (e.g., "accel::"),
+        including the implementations in the loaded plugins.
+    */
+    static auto Keys(const std::string& prefix = "") -> std::vector<std::string>
+    {
+        std::vector<std::string> keys;
+        LM_EXPORTED_F(ComponentFactory_EnumerateKeys, [](const char* key, void* userData) -> void
+        {
+            static_cast<std::vector<std::string>*>(userData)->emplace_back(key);
+        }, &keys);
+        keys.erase(std::remove_if(keys.begin(), keys.end(), [&](const std::string& key) { return key.compare(0, prefix.size(), prefix) != 0; }), keys.end());
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }
+
 public:
     
     /*!
@@ -0,0 +1,187 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <lightmetrica/macros.h>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <type_traits>
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    Bump allocator for short-lived allocations.
+
+    Allocates memory by advancing the pointer in the current block,
+    and releases everything at once with `Reset`.
+    The blocks are kept over resets, so that repeated use with the same
+    memory footprint (e.g., per-sample path construction) allocates
+    no heap memory in the steady state.
+    If a sample overflowed the first block, the blocks are merged into one on reset.
+
+    An arena is activated for the current thread with `MemoryArena::Scope`.
+    `ArenaAllocator` constructed inside the scope allocates from the arena,
+    and outside any scope it falls back to the heap.
+    Thus objects created inside the scope must not outlive it.
+*/
+class MemoryArena
+{
+public:
+
+    /*!
+        Activates the arena for the current thread.
+        The arena is reset on the construction of the scope,
+        unless the arena is already active for the thread (nested scope).
+        The previously active arena is restored on destruction.
+    */
+    class Scope
+    {
+    public:
+
+        LM_PUBLIC_API Scope(MemoryArena& arena);
+        LM_PUBLIC_API ~Scope();
+        LM_DISABLE_COPY_AND_MOVE(Scope);
+
+    private:
+
+        MemoryArena* prev_;
+
+    };
+
+public:
+
+    LM_PUBLIC_API MemoryArena(size_t blockSize = 64 * 1024);
+    LM_PUBLIC_API ~MemoryArena();
+    LM_DISABLE_COPY_AND_MOVE(MemoryArena);
+
+public:
+
+    //! Allocate `size` bytes with the alignment `align`.
+    LM_PUBLIC_API auto Allocate(size_t size, size_t align) -> void*;
+
+    //! Release all allocations.
+    LM_PUBLIC_API auto Reset() -> void;
+
+    //! Number of heap allocations made by the arena so far.
+    auto NumHeapAllocations() const -> long long { return numHeapAllocations_; }
+
+    //! Number of resets so far.
+    auto NumResets() const -> long long { return numResets_; }
+
+    //! Number of resets since the last heap allocation.
+    auto NumResetsSinceHeapAllocation() const -> long long { return numResetsSinceHeapAllocation_; }
+
+    //! Arena active for the current thread (nullptr if none).
+    LM_PUBLIC_API static auto Current() -> MemoryArena*;
+
+private:
+
+    auto AllocateBlock(size_t size) -> void;
+
+private:
+
+    struct Block
+    {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size;
+    };
+
+    size_t blockSize_;
+    std::vector<Block> blocks_;
+    size_t currBlock_ = 0;                  // Index of the block in use
+    size_t currOffset_ = 0;                 // Offset in the block in use
+    long long numHeapAllocations_ = 0;
+    long long numResets_ = 0;
+    long long numResetsSinceHeapAllocation_ = 0;
+
+};
+
+/*!
+    STL allocator using the arena active on construction.
+    Deallocation is no-op for the memory from the arena; the memory is released on reset.
+    Allocators with different arenas compare unequal. They are propagated on move assignment
+    and swap, so a container always frees its memory with the allocator it came from.
+    \tparam T Data type.
+*/
+template <typename T>
+class ArenaAllocator
+{
+public:
+
+    using value_type = T;
+    using is_always_equal = std::false_type;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template <typename U>
+    friend class ArenaAllocator;
+
+public:
+
+    ArenaAllocator() : arena_(MemoryArena::Current()) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& o) : arena_(o.arena_) {}
+
+public:
+
+    auto allocate(size_t n) -> T*
+    {
+        if (!arena_)
+        {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    auto deallocate(T* p, size_t /*n*/) -> void
+    {
+        if (!arena_)
+        {
+            ::operator delete(p);
+        }
+    }
+
+    //! Copies of the containers use the arena active at the time of copy.
+    auto select_on_container_copy_construction() const -> ArenaAllocator { return ArenaAllocator(); }
+
+    template <typename U>
+    auto operator==(const ArenaAllocator<U>& o) const -> bool { return arena_ == o.arena_; }
+    template <typename U>
+    auto operator!=(const ArenaAllocator<U>& o) const -> bool { return arena_ != o.arena_; }
+
+private:
+
+    MemoryArena* arena_;
+
+};
+
+//! Vector with the arena allocator.
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+LM_NAMESPACE_END
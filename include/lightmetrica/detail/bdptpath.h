@@ -0,0 +1,840 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <lightmetrica/component.h>
+#include <lightmetrica/scene3.h>
+#include <lightmetrica/primitive.h>
+#include <lightmetrica/random.h>
+#include <lightmetrica/ray.h>
+#include <lightmetrica/intersection.h>
+#include <lightmetrica/surfacegeometry.h>
+#include <lightmetrica/spectrum.h>
+#include <lightmetrica/detail/arena.h>
+#include <boost/optional.hpp>
+
+LM_NAMESPACE_BEGIN
+
+struct Path;
+
+struct MISWeight : public Component
+{
+    LM_INTERFACE_CLASS(MISWeight, Component, 1);
+    LM_INTERFACE_F(0, Evaluate, Float(const Path& path, const Scene3* scene, int s, bool direct));
+};
+
+// --------------------------------------------------------------------------------
+
+#pragma region Path structures
+
+struct PathVertex
+{
+    int type;
+    SurfaceGeometry geom;
+    const Primitive* primitive = nullptr;
+};
+
+struct SubpathVertex
+{
+    boost::optional<PathVertex> sv;
+    boost::optional<PathVertex> direct;
+
+    // Cached PDFs of `sv` in area measure, used to evaluate MIS weights.
+    // `pdfFwd` is the PDF of sampling `sv` along the subpath (positional PDF for the first vertex),
+    // and `pdfRev` is the PDF of sampling `sv` from the next vertex in the opposite direction.
+    // `pdfFwd` of the first vertex and `pdfRev` are available only when the next two vertices exist.
+    Float pdfFwd = 0_f;
+    Float pdfRev = 0_f;
+};
+
+struct Subpath
+{
+
+    ArenaVector<SubpathVertex> vertices;
+
+public:
+
+    auto Sample(const Scene3* scene, Random* rng, TransportDirection transDir, int maxPathVertices) -> void
+    {
+        vertices.clear();
+
+        // --------------------------------------------------------------------------------
+
+        Vec3 initWo;
+        for (int step = 0; maxPathVertices == -1 || step < maxPathVertices; step++)
+        {
+            if (step == 0)
+            {
+                #pragma region Sample initial vertex
+
+                PathVertex sv;
+
+                // Sample an emitter
+                sv.type = transDir == TransportDirection::LE ? SurfaceInteractionType::L : SurfaceInteractionType::E;
+                sv.primitive = scene->SampleEmitter(sv.type, rng->Next());
+
+                // Sample a position on the emitter and initial ray direction
+                sv.primitive->SamplePositionAndDirection(rng->Next2D(), rng->Next2D(), sv.geom, initWo);
+
+                // Add a vertex
+                SubpathVertex v;
+                v.sv = sv;
+                vertices.push_back(v);
+
+                #pragma endregion
+            }
+            else
+            {
+                #pragma region Sample a vertex with PDF with BSDF
+
+                const auto sv = [&]() -> boost::optional<PathVertex>
+                {
+                    // Previous & two before vertex
+                    const auto* pv = &vertices.back().sv.get();
+                    const auto* ppv = vertices.size() > 1 ? &vertices[vertices.size() - 2].sv.get() : nullptr;
+
+                    // Sample a next direction
+                    Vec3 wo;
+                    const auto wi = ppv ? Math::Normalize(ppv->geom.p - pv->geom.p) : Vec3();
+                    if (step == 1)
+                    {
+                        wo = initWo;
+                    }
+                    else
+                    {
+                        pv->primitive->SampleDirection(rng->Next2D(), rng->Next(), pv->type, pv->geom, wi, wo);
+                    }
+                    const auto f = pv->primitive->EvaluateDirection(pv->geom, pv->type, wi, wo, transDir, false);
+                    if (f.Black())
+                    {
+                        return boost::none;
+                    }
+
+                    // Intersection query
+                    Ray ray = { pv->geom.p, wo };
+                    Intersection isect;
+                    if (!scene->Intersect(ray, isect))
+                    {
+                        return boost::none;
+                    }
+
+                    // Create vertex
+                    PathVertex v;
+                    v.geom = isect.geom;
+                    v.primitive = isect.primitive;
+                    v.type = isect.primitive->Type() & ~SurfaceInteractionType::Emitter;
+
+                    return v;
+                }();
+
+                #pragma endregion
+
+                // --------------------------------------------------------------------------------
+
+                #pragma region Sample a vertex with direct emitter sampling
+
+                const auto direct = [&]() -> boost::optional<PathVertex>
+                {
+                    PathVertex v;
+                    const auto& pv = vertices.back().sv;
+
+                    // Sample a emitter
+                    v.type = transDir == TransportDirection::LE ? SurfaceInteractionType::E : SurfaceInteractionType::L;
+                    v.primitive = scene->SampleEmitterGivenPosition(v.type, pv->geom, rng->Next());
+                    if (!v.primitive)
+                    {
+                        return boost::none;
+                    }
+
+                    // Sample a position on the emitter
+                    v.primitive->SamplePositionGivenPreviousPosition(rng->Next2D(), pv->geom, v.geom);
+
+                    // Check visibility
+                    if (!scene->Visible(pv->geom.p, v.geom.p))
+                    {
+                        return boost::none;
+                    }
+
+                    return v;
+                }();
+
+                #pragma endregion
+
+                // --------------------------------------------------------------------------------
+
+                #pragma region Add a vertex
+
+                if (sv || direct)
+                {
+                    SubpathVertex v;
+                    v.sv = sv;
+                    v.direct = direct;
+                    if (sv)
+                    {
+                        // Cache PDFs for MIS weights
+                        const int k = (int)(vertices.size());
+                        const auto* pv = &vertices[k - 1].sv.get();
+                        const auto* ppv = k > 1 ? &vertices[k - 2].sv.get() : nullptr;
+                        const auto toV = Math::Normalize(sv->geom.p - pv->geom.p);
+                        v.pdfFwd = pv->primitive->EvaluateDirectionPDF(pv->geom, pv->type, ppv ? Math::Normalize(ppv->geom.p - pv->geom.p) : Vec3(), toV, false).ConvertToArea(pv->geom, sv->geom).v;
+                        if (k == 1)
+                        {
+                            vertices[0].pdfFwd = pv->primitive->EvaluatePositionGivenDirectionPDF(pv->geom, toV, false).v * scene->EvaluateEmitterPDF(pv->primitive).v;
+                        }
+                        if (ppv)
+                        {
+                            vertices[k - 2].pdfRev = pv->primitive->EvaluateDirectionPDF(pv->geom, pv->type, toV, Math::Normalize(ppv->geom.p - pv->geom.p), false).ConvertToArea(pv->geom, ppv->geom).v;
+                        }
+                    }
+                    vertices.push_back(v);
+                }
+
+                #pragma endregion
+
+                // --------------------------------------------------------------------------------
+
+                #pragma region Path termination
+
+                if (!sv)
+                {
+                    break;
+                }
+
+                if (sv->geom.infinite)
+                {
+                    break;
+                }
+
+                // TODO: replace it with efficient one
+                const Float rrProb = 0.5_f;
+                if (rng->Next() > rrProb)
+                {
+                    break;
+                }
+
+                #pragma endregion
+            }
+        }
+    }
+
+};
+
+struct Path
+{
+
+    ArenaVector<PathVertex> vertices;
+    ArenaVector<Float> pdfL;        // PDF of sampling the vertex from the light side in area measure (positional PDF for the first vertex)
+    ArenaVector<Float> pdfE;        // PDF of sampling the vertex from the eye side in area measure (positional PDF for the last vertex)
+
+public:
+
+    #pragma region BDPT path initialization
+
+    auto Connect(const Scene3* scene, int s, int t, bool direct, const Subpath& subpathL, const Subpath& subpathE) -> bool
+    {
+        assert(s > 0 || t > 0);
+        vertices.clear();
+        int nL = 0;     // Number of vertices taken from the light subpath
+        int nE = 0;     // Number of vertices taken from the eye subpath
+        if (s == 0 && t > 0)
+        {
+            if (!direct)
+            {
+                if (!subpathE.vertices[t - 1].sv)
+                {
+                    return false;
+                }
+                if ((subpathE.vertices[t - 1].sv->primitive->Type() & SurfaceInteractionType::L) == 0)
+                {
+                    return false;
+                }
+                for (int i = t - 1; i >= 0; i--)
+                {
+                    assert(subpathE.vertices[i].sv);
+                    vertices.push_back(*subpathE.vertices[i].sv);
+                }
+                nE = t;
+            }
+            else
+            {
+                if (!subpathE.vertices[t - 1].direct)
+                {
+                    return false;
+                }
+                vertices.push_back(*subpathE.vertices[t - 1].direct);
+                for (int i = t - 2; i >= 0; i--)
+                {
+                    assert(subpathE.vertices[i].sv);
+                    vertices.push_back(*subpathE.vertices[i].sv);
+                }
+                nE = t - 1;
+            }
+
+            vertices.front().type = SurfaceInteractionType::L;
+        }
+        else if (s > 0 && t == 0)
+        {
+            if (!direct)
+            {
+                if (!subpathL.vertices[s - 1].sv)
+                {
+                    return false;
+                }
+                if ((subpathL.vertices[s - 1].sv->primitive->Type() & SurfaceInteractionType::E) == 0)
+                {
+                    return false;
+                }
+                for (int i = 0; i < s; i++)
+                {
+                    assert(subpathL.vertices[i].sv);
+                    vertices.push_back(*subpathL.vertices[i].sv);
+                }
+                nL = s;
+            }
+            else
+            {
+                if (!subpathL.vertices[s - 1].direct)
+                {
+                    return false;
+                }
+                for (int i = 0; i < s - 1; i++)
+                {
+                    assert(subpathL.vertices[i].sv);
+                    vertices.push_back(*subpathL.vertices[i].sv);
+                }
+                vertices.push_back(*subpathL.vertices[s - 1].direct);
+                nL = s - 1;
+            }
+
+            vertices.back().type = SurfaceInteractionType::E;
+        }
+        else
+        {
+            assert(s > 0 && t > 0);
+            assert(!direct);
+            if (!subpathL.vertices[s - 1].sv || !subpathE.vertices[t - 1].sv)
+            {
+                return false;
+            }
+            if (subpathL.vertices[s - 1].sv->geom.infinite || subpathE.vertices[t - 1].sv->geom.infinite)
+            {
+                return false;
+            }
+            if (!scene->Visible(subpathL.vertices[s - 1].sv->geom.p, subpathE.vertices[t - 1].sv->geom.p))
+            {
+                return false;
+            }
+            for (int i = 0; i < s; i++)
+            {
+                assert(subpathL.vertices[i].sv);
+                vertices.push_back(*subpathL.vertices[i].sv);
+            }
+            for (int i = t - 1; i >= 0; i--)
+            {
+                assert(subpathE.vertices[i].sv);
+                vertices.push_back(*subpathE.vertices[i].sv);
+            }
+            nL = s;
+            nE = t;
+        }
+
+        UpdatePDFs(scene, nL, nE, subpathL, subpathE);
+        return true;
+    }
+
+    /*!
+        Update the PDFs of the vertices.
+        Uses the PDFs cached in the subpaths, and evaluates only the PDFs
+        depending on the vertices around the connection or the directly sampled vertices.
+        The first `nL` vertices are the light subpath vertices in order,
+        and the last `nE` vertices are the eye subpath vertices in reverse order.
+    */
+    auto UpdatePDFs(const Scene3* scene, int nL, int nE, const Subpath& subpathL, const Subpath& subpathE) -> void
+    {
+        const int n = (int)(vertices.size());
+        const int offE = n - nE;
+        pdfL.resize(n);
+        pdfE.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            if (i < nL && (i > 0 || nL >= 2))
+            {
+                pdfL[i] = subpathL.vertices[i].pdfFwd;
+            }
+            else if (i - 2 >= offE)
+            {
+                pdfL[i] = subpathE.vertices[n - 1 - i].pdfRev;
+            }
+            else
+            {
+                pdfL[i] = EvaluatePDFL(scene, i);
+            }
+
+            if (i >= offE && (i < n - 1 || nE >= 2))
+            {
+                pdfE[i] = subpathE.vertices[n - 1 - i].pdfFwd;
+            }
+            else if (i + 2 < nL)
+            {
+                pdfE[i] = subpathL.vertices[i].pdfRev;
+            }
+            else
+            {
+                pdfE[i] = EvaluatePDFE(scene, i);
+            }
+        }
+    }
+
+    #pragma endregion
+
+public:
+
+    #pragma region BDPT path evaluation
+
+    auto EvaluateContribution(const MISWeight* mis, const Scene3* scene, int s, bool direct) const -> SPD
+    {
+        const auto Cstar = EvaluateUnweightContribution(scene, s, direct);
+        //const auto Cstar = EvaluateF(s, direct) / EvaluatePDF(scene, s, direct);
+        return Cstar.Black() ? SPD() : Cstar * mis->Evaluate(*this, scene, s, direct);
+    }
+
+    auto SelectionPDF(int s, bool direct) const -> Float
+    {
+        const Float rrProb = 0.5_f;
+        const int n = (int)(vertices.size());
+        const int t = n - s;
+        Float selectionProb = 1;
+
+        // Light subpath
+        for (int i = 1; i < s - 1; i++)
+        {
+            selectionProb *= rrProb;    
+        }
+        
+        // Eye subpath
+        for (int i = 1; i < t - 1; i++)
+        {
+            selectionProb *= rrProb;
+        }
+
+        return selectionProb;
+    }
+
+    auto RasterPosition() const -> Vec2
+    {
+        const auto& v = vertices[vertices.size() - 1];
+        const auto& vPrev = vertices[vertices.size() - 2];
+        Vec2 rasterPos;
+        v.primitive->RasterPosition(Math::Normalize(vPrev.geom.p - v.geom.p), v.geom, rasterPos);
+        return rasterPos;
+    }
+
+    auto EvaluateCst(int s) const -> SPD
+    {
+        const int n = (int)(vertices.size());
+        const int t = n - s;
+        SPD cst;
+
+        if (s == 0 && t > 0)
+        {
+            const auto& v = vertices[0];
+            const auto& vNext = vertices[1];
+            cst = v.primitive->EvaluatePosition(v.geom, true) * v.primitive->EvaluateDirection(v.geom, v.type, Vec3(), Math::Normalize(vNext.geom.p - v.geom.p), TransportDirection::EL, false);
+        }
+        else if (s > 0 && t == 0)
+        {
+            const auto& v = vertices[n - 1];
+            const auto& vPrev = vertices[n - 2];
+            cst = v.primitive->EvaluatePosition(v.geom, true) * v.primitive->EvaluateDirection(v.geom, v.type, Vec3(), Math::Normalize(vPrev.geom.p - v.geom.p), TransportDirection::LE, false);
+        }
+        else if (s > 0 && t > 0)
+        {
+            const auto* vL = &vertices[s - 1];
+            const auto* vE = &vertices[s];
+            const auto* vLPrev = s - 2 >= 0 ? &vertices[s - 2] : nullptr;
+            const auto* vENext = s + 1 < n ? &vertices[s + 1] : nullptr;
+            const auto fsL = vL->primitive->EvaluateDirection(vL->geom, vL->type, vLPrev ? Math::Normalize(vLPrev->geom.p - vL->geom.p) : Vec3(), Math::Normalize(vE->geom.p - vL->geom.p), TransportDirection::LE, true);
+            const auto fsE = vE->primitive->EvaluateDirection(vE->geom, vE->type, vENext ? Math::Normalize(vENext->geom.p - vE->geom.p) : Vec3(), Math::Normalize(vL->geom.p - vE->geom.p), TransportDirection::EL, true);
+            const Float G = RenderUtils::GeometryTerm(vL->geom, vE->geom);
+            cst = fsL * G * fsE;
+        }
+
+        return cst;
+    }
+
+    auto EvaluateF(int s, bool direct) const -> SPD
+    {
+        const int n = (int)(vertices.size());
+        const int t = n - s;
+        assert(n >= 2);
+
+        // --------------------------------------------------------------------------------
+
+        SPD fL;
+        if (s == 0)
+        {
+            fL = SPD(1_f);
+        }
+        else
+        {
+            {
+                const auto* vL  = &vertices[0];
+                fL = vL->primitive->EvaluatePosition(vL->geom, false);
+            }
+            for (int i = 0; i < s - 1; i++)
+            {
+                const auto* v     = &vertices[i];
+                const auto* vPrev = i >= 1 ? &vertices[i - 1] : nullptr;
+                const auto* vNext = &vertices[i + 1];
+                const auto wi = vPrev ? Math::Normalize(vPrev->geom.p - v->geom.p) : Vec3();
+                const auto wo = Math::Normalize(vNext->geom.p - v->geom.p);
+                fL *= v->primitive->EvaluateDirection(v->geom, v->type, wi, wo, TransportDirection::LE, t == 0 && i == s - 2 && direct);
+                fL *= RenderUtils::GeometryTerm(v->geom, vNext->geom);
+            }
+        }
+        if (fL.Black())
+        {
+            return SPD();
+        }
+        
+        // --------------------------------------------------------------------------------
+
+        SPD fE;
+        if (t == 0)
+        {
+            fE = SPD(1_f);
+        }
+        else
+        {
+            {
+                const auto* vE = &vertices[n - 1];
+                fE = vE->primitive->EvaluatePosition(vE->geom, false);
+            }
+            for (int i = n - 1; i > s; i--)
+            {
+                const auto* v     = &vertices[i];
+                const auto* vPrev = &vertices[i - 1];
+                const auto* vNext = i < n - 1 ? &vertices[i + 1] : nullptr;
+                const auto wi = vNext ? Math::Normalize(vNext->geom.p - v->geom.p) : Vec3();
+                const auto wo = Math::Normalize(vPrev->geom.p - v->geom.p);
+                fE *= v->primitive->EvaluateDirection(v->geom, v->type, wi, wo, TransportDirection::EL, s == 0 && i == 1 && direct);
+                fE *= RenderUtils::GeometryTerm(v->geom, vPrev->geom);
+            }
+        }
+        if (fE.Black())
+        {
+            return SPD();
+        }
+
+        // --------------------------------------------------------------------------------
+
+        const auto cst = EvaluateCst(s);
+        if (cst.Black())
+        {
+            return SPD();
+        }
+
+        // --------------------------------------------------------------------------------
+
+        return fL * cst * fE;
+    }
+
+    auto EvaluateUnweightContribution(const Scene3* scene, int s, bool direct) const -> SPD
+    {
+        const int n = (int)(vertices.size());
+        const int t = n - s;
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Compute alphaL
+
+        SPD alphaL;
+        if (s == 0)
+        {
+            alphaL = SPD(1_f);
+        }
+        else
+        {
+            {
+                const auto* v = &vertices[0];
+                const auto* vNext = &vertices[1];
+                alphaL =
+                    v->primitive->EvaluatePosition(v->geom, false) /
+                    v->primitive->EvaluatePositionGivenDirectionPDF(v->geom, Math::Normalize(vNext->geom.p - v->geom.p), false) / scene->EvaluateEmitterPDF(v->primitive).v;
+            }
+            for (int i = 0; i < s - 1; i++)
+            {
+                const auto* v     = &vertices[i];
+                const auto* vPrev = i >= 1 ? &vertices[i - 1] : nullptr;
+                const auto* vNext = &vertices[i + 1];
+                const auto wi = vPrev ? Math::Normalize(vPrev->geom.p - v->geom.p) : Vec3();
+                const auto wo = Math::Normalize(vNext->geom.p - v->geom.p);
+                const auto fs = v->primitive->EvaluateDirection(v->geom, v->type, wi, wo, TransportDirection::LE, t == 0 && i == s - 2 && direct);
+                if (fs.Black()) return SPD();
+                alphaL *= 
+                    fs /
+                    (t == 0 && i == s - 2 && direct
+                        ? vNext->primitive->EvaluatePositionGivenPreviousPositionPDF(vNext->geom, v->geom, false).ConvertToProjSA(vNext->geom, v->geom) * scene->EvaluateEmitterGivenPositionPDF(vNext->primitive, v->geom).v
+                        : v->primitive->EvaluateDirectionPDF(v->geom, v->type, wi, wo, false));
+            }
+        }
+        if (alphaL.Black())
+        {
+            return SPD();
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Compute alphaE
+
+        SPD alphaE;
+        if (t == 0)
+        {
+            alphaE = SPD(1_f);
+        }
+        else
+        {
+            {
+                const auto* v = &vertices[n - 1];
+                const auto* vPrev = &vertices[n - 2];
+                alphaE =
+                    v->primitive->EvaluatePosition(v->geom, false) /
+                    v->primitive->EvaluatePositionGivenDirectionPDF(v->geom, Math::Normalize(vPrev->geom.p - v->geom.p), false) / scene->EvaluateEmitterPDF(v->primitive).v;
+            }
+            for (int i = n - 1; i > s; i--)
+            {
+                const auto* v = &vertices[i];
+                const auto* vPrev = &vertices[i - 1];
+                const auto* vNext = i < n - 1 ? &vertices[i + 1] : nullptr;
+                const auto wi = vNext ? Math::Normalize(vNext->geom.p - v->geom.p) : Vec3();
+                const auto wo = Math::Normalize(vPrev->geom.p - v->geom.p);
+                const auto fs = v->primitive->EvaluateDirection(v->geom, v->type, wi, wo, TransportDirection::EL, s == 0 && i == 1 && direct);
+                if (fs.Black()) return SPD();
+                alphaE *= 
+                    fs /
+                    (s == 0 && i == 1 && direct
+                        ? vPrev->primitive->EvaluatePositionGivenPreviousPositionPDF(vPrev->geom, v->geom, false).ConvertToProjSA(vPrev->geom, v->geom) * scene->EvaluateEmitterGivenPositionPDF(vPrev->primitive, v->geom).v
+                        : v->primitive->EvaluateDirectionPDF(v->geom, v->type, wi, wo, false));
+            }
+        }
+        if (alphaE.Black())
+        {
+            return SPD();
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Compute Cst
+
+        const auto cst = EvaluateCst(s);
+        if (cst.Black())
+        {
+            return SPD();
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        return alphaL * cst * alphaE;
+    }
+
+    auto Samplable(int s, bool direct) const -> bool
+    {
+        // There is no connection with some cases
+        const int n = (int)(vertices.size());
+        const int t = n - s;
+        if (s > 0 && t > 0 && direct)
+        {
+            return false;
+        }
+
+        // Delta connection with direct light sampling
+        if (t == 0 && s > 0 && direct)
+        {
+            if (vertices[n - 2].primitive->IsDeltaDirection(vertices[n - 2].type))
+            {
+                return false;
+            }
+        }
+        if (s == 0 && t > 0 && direct)
+        {
+            if (vertices[1].primitive->IsDeltaDirection(vertices[1].type))
+            {
+                return false;
+            }
+        }
+
+        // Delta connection of endpoints
+        if (s == 0 && t > 0)
+        {
+            const auto& v = vertices[0];
+            if (v.primitive->IsDeltaPosition(v.type))
+            {
+                return false;
+            }
+        }
+        else if (s > 0 && t == 0)
+        {
+            const auto& v = vertices[n - 1];
+            if (v.primitive->IsDeltaPosition(v.type))
+            {
+                return false;
+            }
+        }
+        else if (s > 0 && t > 0)
+        {
+            const auto* vL = &vertices[s - 1];
+            const auto* vE = &vertices[s];
+            if (vL->primitive->IsDeltaDirection(vL->type) || vE->primitive->IsDeltaDirection(vE->type))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    //! PDF of sampling the i-th vertex from the light side.
+    auto EvaluatePDFL(const Scene3* scene, int i) const -> Float
+    {
+        const auto* v = &vertices[i];
+        if (i == 0)
+        {
+            return v->primitive->EvaluatePositionGivenDirectionPDF(v->geom, Math::Normalize(vertices[1].geom.p - v->geom.p), false).v * scene->EvaluateEmitterPDF(v->primitive).v;
+        }
+        const auto* vp = &vertices[i - 1];
+        const auto* vpp = i - 2 >= 0 ? &vertices[i - 2] : nullptr;
+        return vp->primitive->EvaluateDirectionPDF(vp->geom, vp->type, vpp ? Math::Normalize(vpp->geom.p - vp->geom.p) : Vec3(), Math::Normalize(v->geom.p - vp->geom.p), false).ConvertToArea(vp->geom, v->geom).v;
+    }
+
+    //! PDF of sampling the i-th vertex from the eye side.
+    auto EvaluatePDFE(const Scene3* scene, int i) const -> Float
+    {
+        const int n = (int)(vertices.size());
+        const auto* v = &vertices[i];
+        if (i == n - 1)
+        {
+            return v->primitive->EvaluatePositionGivenDirectionPDF(v->geom, Math::Normalize(vertices[n - 2].geom.p - v->geom.p), false).v * scene->EvaluateEmitterPDF(v->primitive).v;
+        }
+        const auto* vn = &vertices[i + 1];
+        const auto* vnn = i + 2 < n ? &vertices[i + 2] : nullptr;
+        return vn->primitive->EvaluateDirectionPDF(vn->geom, vn->type, vnn ? Math::Normalize(vnn->geom.p - vn->geom.p) : Vec3(), Math::Normalize(v->geom.p - vn->geom.p), false).ConvertToArea(vn->geom, v->geom).v;
+    }
+
+    //! PDF of sampling the endpoint with direct emitter sampling from the neighboring vertex.
+    auto EvaluateDirectPDF(const Scene3* scene, int i, int neighbor) const -> Float
+    {
+        const auto* v = &vertices[i];
+        const auto* vn = &vertices[neighbor];
+        return v->primitive->EvaluatePositionGivenPreviousPositionPDF(v->geom, vn->geom, false).v * scene->EvaluateEmitterGivenPositionPDF(v->primitive, vn->geom).v;
+    }
+
+    auto EvaluatePDF(const Scene3* scene, int s, bool direct) const -> PDFVal
+    {
+        if (!Samplable(s, direct))
+        {
+            return PDFVal(PDFMeasure::ProdArea, 0_f);
+        }
+
+        // Otherwise the path can be generated with the given strategy (s,t)
+        // so p_{s,t} can be safely evaluated.
+        const int n = (int)(vertices.size());
+        const int t = n - s;
+        Float pdf = 1_f;
+        for (int i = 0; i < s; i++)
+        {
+            pdf *= t == 0 && i == n - 1 && direct ? EvaluateDirectPDF(scene, n - 1, n - 2) : pdfL[i];
+        }
+        for (int i = s; i < n; i++)
+        {
+            pdf *= s == 0 && i == 0 && direct ? EvaluateDirectPDF(scene, 0, 1) : pdfE[i];
+        }
+
+        return PDFVal(PDFMeasure::ProdArea, pdf);
+    }
+
+    /*!
+        Evaluate PDFs of all strategies in linear time.
+        The PDF of the strategy (s, direct) is stored in `pdfs[2 * s + direct]`.
+    */
+    auto EvaluatePDFs(const Scene3* scene, ArenaVector<Float>& pdfs) const -> void
+    {
+        const int n = (int)(vertices.size());
+        pdfs.assign(2 * (n + 1), 0_f);
+
+        // Products of the PDFs from the eye side
+        Float pE = 1_f;
+        for (int s = n; s >= 0; s--)
+        {
+            pdfs[2 * s] = pE;
+            if (s > 0)
+            {
+                pE *= pdfE[s - 1];
+            }
+        }
+
+        // Strategy with direct emitter sampling for the light vertex (s = 0)
+        pdfs[1] = pdfs[2] * EvaluateDirectPDF(scene, 0, 1);
+
+        // Multiply products of the PDFs from the light side
+        Float pL = 1_f;
+        for (int s = 0; s <= n; s++)
+        {
+            pdfs[2 * s] *= pL;
+            if (s == n - 1)
+            {
+                // Strategy with direct emitter sampling for the eye vertex (t = 0)
+                pdfs[2 * n + 1] = pL * EvaluateDirectPDF(scene, n - 1, n - 2);
+            }
+            if (s < n)
+            {
+                pL *= pdfL[s];
+            }
+        }
+
+        for (int s = 0; s <= n; s++)
+        {
+            for (int d = 0; d < 2; d++)
+            {
+                if (!Samplable(s, d == 1))
+                {
+                    pdfs[2 * s + d] = 0_f;
+                }
+            }
+        }
+    }
+
+    #pragma endregion
+
+};
+
+#pragma endregion
+
+LM_NAMESPACE_END
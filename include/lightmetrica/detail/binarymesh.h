@@ -0,0 +1,83 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <lightmetrica/macros.h>
+#include <string>
+#include <cstdint>
+
+LM_NAMESPACE_BEGIN
+
+class TriangleMesh;
+
+/*!
+    Header of the binary mesh file.
+    The header is followed by the data blocks of positions, normals, texture coordinates, and faces.
+    Each block begins at the offset aligned to 64 bytes
+    so that the data can be directly used from the memory-mapped file.
+    The positions block is followed by at least one element of padding.
+    The data is stored in the native byte order.
+*/
+struct BinaryMeshHeader
+{
+    char magic[8];                  // Magic number ("LMBMESH\0")
+    std::uint32_t version;          // Format version
+    std::uint32_t floatSize;        // Size of the floating point elements of the vertex blocks (4 or 8)
+    std::uint64_t numVertices;      // Number of vertices
+    std::uint64_t numFaces;         // Number of faces
+    std::uint64_t positionsOffset;  // Offset to the positions block (3 elements per vertex)
+    std::uint64_t normalsOffset;    // Offset to the normals block (3 elements per vertex), or 0 if absent
+    std::uint64_t texcoordsOffset;  // Offset to the texture coordinates block (2 elements per vertex), or 0 if absent
+    std::uint64_t facesOffset;      // Offset to the faces block (3 unsigned 32-bit integers per face)
+    std::uint8_t reserved[64];
+};
+
+static_assert(sizeof(BinaryMeshHeader) == 128, "Invalid size of BinaryMeshHeader");
+
+/*!
+    Utility functions for the binary mesh format
+    loaded by `trianglemesh::binary` asset.
+*/
+class BinaryMesh
+{
+public:
+
+    LM_DISABLE_CONSTRUCT(BinaryMesh);
+
+public:
+
+    /*!
+        Save the triangle mesh in the binary mesh format.
+        The vertex blocks are stored with the precision of GeomFloat.
+        \param path Output path.
+        \param mesh Triangle mesh.
+        \retval true Succeeded to save.
+        \retval false Failed to save.
+    */
+    LM_PUBLIC_API static auto Save(const std::string& path, const TriangleMesh* mesh) -> bool;
+
+};
+
+LM_NAMESPACE_END
@@ -0,0 +1,110 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <lightmetrica/macros.h>
+#include <lightmetrica/bound.h>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <array>
+#include <vector>
+#include <limits>
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    Hashed uniform grid for the range query of points.
+
+    Points are bucketed by the hash of the grid cell containing them
+    and sorted by bucket with a parallel counting sort,
+    so that the points of a bucket are contiguous in memory.
+    The grid does not keep the points themselves; the user moves its data
+    into the sorted order in `Build` and the queries report the sorted indices.
+    The positions are stored in single precision in SoA layout for SIMD distance tests,
+    which takes 12 bytes per point regardless of the precision of `Float`.
+    The bucket tables take another 8 to 16 bytes per point.
+    The buffers are reused when the grid is rebuilt.
+*/
+class HashGrid
+{
+public:
+
+    /*!
+        Build the grid.
+        The points are indexed with `int`, so the grid fails to build
+        with more than `MaxNumPoints` points and is left empty.
+        \param numPoints Number of points.
+        \param cellSize  Size of the cell. With twice the maximum query radius a query visits at most 2x2x2 cells.
+                         If zero or negative, the size is determined from the density of the points.
+        \param pointFunc Returns the position of the i-th point, or false if the point is excluded from the grid.
+                         Called multiple times per point and in parallel.
+        \param moveFunc  Moves the i-th point to the index in the sorted order. Called in parallel.
+        \retval true  Succeeded to build.
+        \retval false Too many points.
+    */
+    LM_PUBLIC_API auto Build(size_t numPoints, Float cellSize, const std::function<bool(int i, Vec3& p)>& pointFunc, const std::function<void(int i, int sortedIndex)>& moveFunc) -> bool;
+
+    /*!
+        Find the points within the radius.
+        The radius can be larger than the one assumed in the build;
+        if the query overlaps with more cells than the buckets, all points are scanned instead.
+        \param queryFunc Called with the sorted index of each point found.
+    */
+    LM_PUBLIC_API auto RangeQuery(const Vec3& p, Float radius, const std::function<void(int sortedIndex)>& queryFunc) const -> void;
+
+    //! Number of points in the grid.
+    auto NumPoints() const -> int { return numPoints_; }
+
+    //! Position of the point at the sorted index.
+    auto Position(int sortedIndex) const -> Vec3 { return Vec3(Float(xs_[sortedIndex]), Float(ys_[sortedIndex]), Float(zs_[sortedIndex])); }
+
+    //! Maximum number of points.
+    static constexpr size_t MaxNumPoints = (size_t)(std::numeric_limits<int>::max());
+
+private:
+
+    using CellIdx = std::array<int, 3>;
+
+    auto CellIndex(const Vec3& p) const -> CellIdx;
+    auto Bucket(const CellIdx& c) const -> unsigned int;
+    auto QueryInRange(int begin, int end, const Vec3& p, Float radius2, const std::function<void(int)>& queryFunc) const -> void;
+
+private:
+
+    Bound bound_;
+    Float invCellSize_;
+    CellIdx gridRes_;                           // Number of cells along each axis
+    size_t numBuckets_ = 1;                     // Power of two
+    std::vector<int> cellStart_;                // Start index of the points for each bucket (with sentinel)
+    int numPoints_ = 0;
+    std::vector<float> xs_, ys_, zs_;           // Positions of the points sorted by bucket
+    std::unique_ptr<std::atomic<int>[]> counts_;
+    size_t countsCapacity_ = 0;
+
+};
+
+LM_NAMESPACE_END
@@ -0,0 +1,116 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <lightmetrica/macros.h>
+#include <lightmetrica/bound.h>
+#include <vector>
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    Bounds of the emission of a light or a set of lights.
+    The orientation is bounded by the cone of the normals (axis and cosThetaO)
+    and the emission angle around the normals (cosThetaE) [Conty Estevez & Kulla 2018].
+*/
+struct LightBounds
+{
+    Bound bound;                // Spatial bound
+    Vec3 axis;                  // Axis of the cone bounding the normals
+    Float cosThetaO = 1_f;      // Cosine of the spread angle of the normals around the axis
+    Float cosThetaE = 0_f;      // Cosine of the maximum emission angle from the normal
+    Float power = 0_f;          // Emitted power (luminance)
+};
+
+/*!
+    Node of the light BVH.
+    The nodes are stored in pre-order and the root node is located at index 0.
+*/
+struct LightBVHNode
+{
+    bool isleaf;
+    int parent;                 // Index of the parent node (-1 for the root)
+    LightBounds bounds;
+    union
+    {
+        struct
+        {
+            int light;          // Index of the light
+        } leaf;
+        struct
+        {
+            int child1;
+            int child2;
+        } internal;
+    };
+};
+
+/*!
+    Light BVH.
+    Hierarchy of the lights used to sample a light in proportion to
+    the estimated contribution to a shading point.
+    Each leaf contains a single light. The lights are selected by traversing the tree
+    from the root, choosing one of the children according to their importances.
+*/
+class LightBVH
+{
+public:
+
+    /*!
+        Build the light BVH.
+        Lights with zero power are excluded and never sampled.
+        \param lights Bounds of the lights.
+    */
+    LM_PUBLIC_API auto Build(const std::vector<LightBounds>& lights) -> void;
+
+    /*!
+        Sample a light.
+        \param p   Shading point.
+        \param n   Normal at the shading point or zero vector if not available.
+        \param u   Random number.
+        \param pdf Selection probability of the sampled light.
+        \return Index of the light, or -1 if no light can contribute to the shading point.
+    */
+    LM_PUBLIC_API auto Sample(const Vec3& p, const Vec3& n, Float u, Float& pdf) const -> int;
+
+    //! Evaluate the selection probability of the light given the shading point.
+    LM_PUBLIC_API auto EvaluatePDF(int light, const Vec3& p, const Vec3& n) const -> Float;
+
+    //! Estimate the contribution of the lights bounded by `b` to the shading point.
+    LM_PUBLIC_API static auto Importance(const LightBounds& b, const Vec3& p, const Vec3& n) -> Float;
+
+    //! Check if the tree contains no light.
+    auto Empty() const -> bool { return nodes_.empty(); }
+
+    auto Nodes() const -> const std::vector<LightBVHNode>& { return nodes_; }
+
+private:
+
+    std::vector<LightBVHNode> nodes_;
+    std::vector<int> leafIndices_;      // Mapping from light index to leaf node index
+
+};
+
+LM_NAMESPACE_END
@@ -0,0 +1,153 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <lightmetrica/macros.h>
+#include <lightmetrica/logger.h>
+#include <string>
+#if LM_PLATFORM_WINDOWS
+#include <Windows.h>
+#elif LM_PLATFORM_LINUX || LM_PLATFORM_APPLE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    Read-only memory-mapped file.
+    The pages are shared with the other processes mapping the same file.
+    An empty file cannot be mapped, so it results in Data() == nullptr and Size() == 0.
+*/
+class MappedFile
+{
+public:
+
+    MappedFile() = default;
+    ~MappedFile() { Unmap(); }
+    LM_DISABLE_COPY_AND_MOVE(MappedFile);
+
+public:
+
+    auto Map(const std::string& path) -> bool
+    {
+        Unmap();
+
+        #if LM_PLATFORM_WINDOWS
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+        {
+            LM_LOG_ERROR("Failed to open file: " + path);
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size))
+        {
+            LM_LOG_ERROR("Failed to get file size: " + path);
+            return false;
+        }
+        size_ = (size_t)(size.QuadPart);
+        if (size_ == 0)
+        {
+            Unmap();
+            return true;
+        }
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_)
+        {
+            LM_LOG_ERROR("Failed to create file mapping: " + path);
+            return false;
+        }
+        data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if (!data_)
+        {
+            LM_LOG_ERROR("Failed to map file: " + path);
+            return false;
+        }
+        #elif LM_PLATFORM_LINUX || LM_PLATFORM_APPLE
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            LM_LOG_ERROR("Failed to open file: " + path);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            LM_LOG_ERROR("Failed to get file size: " + path);
+            close(fd);
+            return false;
+        }
+        size_ = (size_t)(st.st_size);
+        if (size_ == 0)
+        {
+            close(fd);
+            return true;
+        }
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            LM_LOG_ERROR("Failed to map file: " + path);
+            return false;
+        }
+        data_ = data;
+        #endif
+
+        return true;
+    }
+
+    auto Unmap() -> void
+    {
+        #if LM_PLATFORM_WINDOWS
+        if (data_) { UnmapViewOfFile(data_); }
+        if (mapping_) { CloseHandle(mapping_); }
+        if (file_ != INVALID_HANDLE_VALUE) { CloseHandle(file_); }
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+        #elif LM_PLATFORM_LINUX || LM_PLATFORM_APPLE
+        if (data_) { munmap(data_, size_); }
+        #endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    auto Data() const -> const unsigned char* { return static_cast<const unsigned char*>(data_); }
+    auto Size() const -> size_t { return size_; }
+
+private:
+
+    void* data_ = nullptr;
+    size_t size_ = 0;
+    #if LM_PLATFORM_WINDOWS
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+    #endif
+
+};
+
+LM_NAMESPACE_END
@@ -27,6 +27,7 @@
 #include <lightmetrica/component.h>
 #include <lightmetrica/spectrum.h>
 #include <functional>
+#include <cstdint>
 
 LM_NAMESPACE_BEGIN
 
@@ -44,6 +45,113 @@ struct Photon : public SIMDAlignedType
     int numVertices;    //!< Number of path vertices of the light path that the photon is generated
 };
 
+/*!
+    \brief Compact photon.
+
+    Quantized photon attributes except the position (8 bytes).
+    The position is stored separately by the photon map.
+    The quantization affects the density estimation as follows.
+      - `throughput` is stored in the shared-exponent RGBE format (8-bit mantissas).
+        The relative error of the largest component is at most 2^-8 (~0.4%),
+        and the other components have the absolute error at most 2^-8 of the largest component,
+        thus the components smaller than that can be flushed to zero.
+        The error is deterministic so it biases the estimate by at most ~0.4% per photon.
+      - `wi` is stored in the octahedral encoding with 8 bits for each coordinate.
+        The angular error is at most ~2 degrees, which only affects the estimate with glossy BSDFs.
+      - `numVertices` is clamped to 65535.
+*/
+struct CompactPhoton
+{
+    std::uint32_t throughput;       //!< Throughput in RGBE
+    std::uint16_t wi;               //!< Incident ray direction in octahedral encoding
+    std::uint16_t numVertices;      //!< Number of path vertices
+
+    static auto Encode(const Photon& photon) -> CompactPhoton
+    {
+        CompactPhoton cp;
+        cp.throughput = EncodeRGBE(photon.throughput.ToRGB());
+        cp.wi = EncodeOctahedral(photon.wi);
+        cp.numVertices = (std::uint16_t)(std::min(std::max(photon.numVertices, 0), 65535));
+        return cp;
+    }
+
+    auto Decode(const Vec3& p) const -> Photon
+    {
+        Photon photon;
+        photon.p = p;
+        photon.throughput = SPD::FromRGB(DecodeRGBE(throughput));
+        photon.wi = DecodeOctahedral(wi);
+        photon.numVertices = numVertices;
+        return photon;
+    }
+
+private:
+
+    static auto EncodeRGBE(const Vec3& c) -> std::uint32_t
+    {
+        const Float m = std::max(c.x, std::max(c.y, c.z));
+        if (!(m > 1e-32_f))
+        {
+            return 0;
+        }
+        int e;
+        std::frexp(m, &e);
+        if ((int)(std::round(std::ldexp(m, 8 - e))) > 255)
+        {
+            // Rounding up the largest component overflows the mantissa
+            e++;
+        }
+        const auto Mantissa = [&](Float v) -> std::uint32_t { return (std::uint32_t)(Math::Clamp((int)(std::round(std::ldexp(std::max(v, 0_f), 8 - e))), 0, 255)); };
+        return Mantissa(c.x) | (Mantissa(c.y) << 8) | (Mantissa(c.z) << 16) | ((std::uint32_t)(Math::Clamp(e + 128, 0, 255)) << 24);
+    }
+
+    static auto DecodeRGBE(std::uint32_t v) -> Vec3
+    {
+        if (v == 0)
+        {
+            return Vec3();
+        }
+        const Float scale = std::ldexp(1_f, (int)(v >> 24) - 136);
+        return Vec3((Float)(v & 0xff), (Float)((v >> 8) & 0xff), (Float)((v >> 16) & 0xff)) * scale;
+    }
+
+    static auto EncodeOctahedral(const Vec3& d) -> std::uint16_t
+    {
+        const Float l1 = Math::Abs(d.x) + Math::Abs(d.y) + Math::Abs(d.z);
+        if (l1 == 0_f)
+        {
+            return 0;
+        }
+        Float x = d.x / l1;
+        Float y = d.y / l1;
+        if (d.z < 0_f)
+        {
+            const Float x2 = (1_f - Math::Abs(y)) * (x >= 0_f ? 1_f : -1_f);
+            const Float y2 = (1_f - Math::Abs(x)) * (y >= 0_f ? 1_f : -1_f);
+            x = x2;
+            y = y2;
+        }
+        const auto Quantize = [](Float v) -> std::uint16_t { return (std::uint16_t)(Math::Clamp((int)(std::round((v * 0.5_f + 0.5_f) * 255_f)), 0, 255)); };
+        return Quantize(x) | (Quantize(y) << 8);
+    }
+
+    static auto DecodeOctahedral(std::uint16_t v) -> Vec3
+    {
+        Float x = (Float)(v & 0xff) / 255_f * 2_f - 1_f;
+        Float y = (Float)(v >> 8) / 255_f * 2_f - 1_f;
+        const Float z = 1_f - Math::Abs(x) - Math::Abs(y);
+        if (z < 0_f)
+        {
+            const Float x2 = (1_f - Math::Abs(y)) * (x >= 0_f ? 1_f : -1_f);
+            const Float y2 = (1_f - Math::Abs(x)) * (y >= 0_f ? 1_f : -1_f);
+            x = x2;
+            y = y2;
+        }
+        return Math::Normalize(Vec3(x, y, z));
+    }
+
+};
+
 ///! Base class of photon map
 struct PhotonMap : public Component
 {
@@ -58,6 +166,15 @@ struct PhotonMap : public Component
     */
     virtual auto Build(std::vector<Photon>&& photons) -> void = 0;
 
+    /*!
+        \brief Set the maximum gather radius
+
+        Hints the maximum `radius` used in the subsequent calls of `CollectPhotons`.
+        Implementations may use it to configure the data structure in `Build`.
+        The queries with larger radii must still be supported.
+    */
+    virtual auto SetMaxRadius(Float radius) -> void {}
+
     /*!
         \brief Collect photons
 
@@ -0,0 +1,137 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <lightmetrica/macros.h>
+#include <lightmetrica/spectrum.h>
+#include <functional>
+#include <vector>
+
+LM_NAMESPACE_BEGIN
+
+class PropertyNode;
+class Scene3;
+class Film;
+class Random;
+
+/*!
+    Path termination and splitting policy.
+
+    Decides whether a path is terminated, continued, or split at a vertex.
+    The `fixed` mode is the Russian roulette with the constant survival probability.
+    The `adaptive` mode uses the weight window of adjoint-driven Russian roulette
+    and splitting [Vorba & Krivanek 2016]: paths with the throughput below the window
+    are terminated keeping the expected weight, and paths above the window are split.
+    As no radiance cache is available, the center of the window is the ratio of the pixel
+    estimate to the average pixel estimate, obtained from a short prepass.
+
+    References:
+      - [Vorba & Krivanek 2016] Adjoint-driven Russian roulette and splitting in light transport simulation
+*/
+class RussianRoulette
+{
+public:
+
+    enum class Mode
+    {
+        Fixed,
+        Adaptive,
+    };
+
+public:
+
+    /*!
+        Load parameters.
+        Reads `rr` (`fixed` or `adaptive`), `rr_prob`, `rr_window_size`,
+        `rr_max_split`, `rr_max_survival_prob`, `rr_prepass_spp`, and `rr_prepass_photons`.
+    */
+    LM_PUBLIC_API auto Load(const PropertyNode* prop) -> bool;
+
+    /*!
+        Estimate the pixel values used in the adaptive mode.
+        Processes `rr_prepass_spp` samples per pixel with `processSampleFunc`
+        and keeps the resulting image as the pixel estimate.
+        The prepass is rendered into a cleared clone of the film,
+        so the film is left unchanged. Does nothing in the fixed mode.
+    */
+    LM_PUBLIC_API auto EstimatePixels(const Scene3* scene, Film* film, Random* initRng, const std::function<void(Film*, Random*)>& processSampleFunc) -> void;
+
+    /*!
+        Number of samples of the prepass for the film (0 if no prepass is needed).
+        Used by the renderers which run the prepass by themselves
+        and set the result with `SetPixelEstimate`.
+    */
+    LM_PUBLIC_API auto NumPrepassSamples(const Film* film) const -> long long;
+
+    //! Set the pixel estimate from the image in the film.
+    LM_PUBLIC_API auto SetPixelEstimate(const Film* film) -> void;
+
+    //! Center of the weight window for the paths through the raster position (1 if no estimate is available).
+    LM_PUBLIC_API auto PixelReference(const Vec2& rasterPos) const -> Float;
+
+    /*!
+        Estimate the center of the weight window for the light subpaths used in the adaptive mode.
+        The center is the mean flux per photon, i.e., the mean luminance of the throughput
+        of the light subpaths at their first hit, estimated with `rr_prepass_photons` subpaths.
+        Does nothing in the fixed mode.
+    */
+    LM_PUBLIC_API auto EstimateLightReference(const Scene3* scene, Random* initRng) -> void;
+
+    //! Center of the weight window for the light subpaths (1 if no estimate is available).
+    auto LightReference() const -> Float { return lightReference_; }
+
+    /*!
+        Evaluate the policy at a path vertex.
+        \param reference  Center of the weight window in the unit of the luminance of the throughput.
+        \param throughput Throughput of the path, rescaled according to the decision.
+        \param u          Uniform random number.
+        \param maxSplit   Maximum number of paths the caller can continue with.
+        \return Number of paths to continue with (0 if the path is terminated).
+    */
+    LM_PUBLIC_API auto Evaluate(Float reference, SPD& throughput, Float u, int maxSplit) const -> int;
+
+    //! Evaluate the policy without splitting. Returns true if the path is terminated.
+    auto Terminate(Float reference, SPD& throughput, Float u) const -> bool { return Evaluate(reference, throughput, u, 1) == 0; }
+
+    auto GetMode() const -> Mode { return mode_; }
+
+private:
+
+    Mode mode_ = Mode::Fixed;
+    Float prob_ = 0.5_f;                // Survival probability for the fixed mode
+    Float windowSize_ = 5_f;            // Ratio of the upper and lower bounds of the weight window
+    Float maxSurvivalProb_ = 0.95_f;    // Survival probability inside the window, ensuring termination
+    int maxSplit_ = 4;
+    int prepassSpp_ = 4;
+    long long prepassPhotons_ = 10000;
+    int width_ = 0;
+    int height_ = 0;
+    std::vector<Float> reference_;      // Per-pixel center of the weight window
+    Float lightReference_ = 1_f;        // Center of the weight window for the light subpaths
+
+};
+
+LM_NAMESPACE_END
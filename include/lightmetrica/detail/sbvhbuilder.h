@@ -0,0 +1,95 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <lightmetrica/macros.h>
+#include <lightmetrica/bound.h>
+#include <vector>
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    Node of the binary BVH created by SBVHBuilder.
+    The nodes are stored in pre-order and the root node is located at index 0.
+*/
+struct SBVHNode
+{
+    bool isleaf;
+    GeomBound bound;
+    union
+    {
+        struct
+        {
+            int begin;      // Begin index of the references
+            int end;        // End index of the references
+        } leaf;
+        struct
+        {
+            int child1;
+            int child2;
+        } internal;
+    };
+};
+
+/*!
+    Builder of the spatial split BVH (SBVH).
+    Implements the split BVH construction [Stich et al. 2009]
+    which chooses either a binned object split or a spatial split per node.
+    Triangles straddling the spatial split plane are referenced by both children
+    with the clipped bounds, so that the output can contain duplicated references.
+*/
+class SBVHBuilder
+{
+public:
+
+    LM_DISABLE_CONSTRUCT(SBVHBuilder);
+
+public:
+
+    struct Params
+    {
+        int numBins = 32;               // Number of bins for both object and spatial splits
+        int leafNumNodes = 10;          // Nodes with fewer references than this number always become leaves
+        int maxLeafSize = 16;           // Maximum number of references in a leaf
+        Float alpha = 1e-5_f;           // Spatial splits are attempted if the overlap of the object split over the root area exceeds this value
+        Float maxDuplication = 0.5_f;   // Maximum ratio of the duplicated references to the number of triangles
+    };
+
+public:
+
+    /*!
+        Build SBVH.
+        
+        \param ps      Positions of the triangles in world space (three per triangle).
+        \param params  Build parameters.
+        \param nodes   Created nodes.
+        \param indices Triangle indices referenced from the leaf nodes.
+    */
+    LM_PUBLIC_API static auto Build(const std::vector<Vec3>& ps, const Params& params, std::vector<SBVHNode>& nodes, std::vector<int>& indices) -> void;
+
+};
+
+LM_NAMESPACE_END
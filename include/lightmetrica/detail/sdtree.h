@@ -0,0 +1,339 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <lightmetrica/math.h>
+#include <lightmetrica/bound.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <atomic>
+#include <vector>
+
+LM_NAMESPACE_BEGIN
+
+//! Float accumulator updated with lock-free CAS loops.
+struct GuidingAtomicFloat
+{
+    std::atomic<Float> v;
+
+    GuidingAtomicFloat() : v(0_f) {}
+    GuidingAtomicFloat(const GuidingAtomicFloat& o) : v(o.Load()) {}
+    auto operator=(const GuidingAtomicFloat& o) -> GuidingAtomicFloat& { Store(o.Load()); return *this; }
+
+    auto Load() const -> Float { return v.load(std::memory_order_relaxed); }
+    auto Store(Float x) -> void { v.store(x, std::memory_order_relaxed); }
+    auto Add(Float x) -> void
+    {
+        auto cur = v.load(std::memory_order_relaxed);
+        while (!v.compare_exchange_weak(cur, cur + x, std::memory_order_relaxed));
+    }
+};
+
+// --------------------------------------------------------------------------------
+
+/*!
+    \brief Directional quadtree.
+
+    Piecewise constant distribution of the incident radiance over the
+    cylindrical coordinates (cos(theta), phi) of the unit sphere, mapped to [0,1]^2.
+    The mapping is area-preserving, so the solid angle density is the density in [0,1]^2 divided by 4pi.
+    Each node stores the sum of the recorded values for its four quadrants.
+*/
+struct GuidingDTree
+{
+    struct Node
+    {
+        GuidingAtomicFloat sum[4];
+        int child[4] = { 0, 0, 0, 0 };      // Index of the child node (0 if the quadrant is a leaf)
+        auto Total() const -> Float { return sum[0].Load() + sum[1].Load() + sum[2].Load() + sum[3].Load(); }
+    };
+
+    std::vector<Node> nodes = std::vector<Node>(1);
+    GuidingAtomicFloat weight;              // Statistical weight (number of records)
+
+    //! Select the quadrant containing `p` and rescale `p` into the quadrant.
+    static auto Quadrant(Vec2& p) -> int
+    {
+        const int qx = p.x >= 0.5_f ? 1 : 0;
+        const int qy = p.y >= 0.5_f ? 1 : 0;
+        p.x = p.x * 2_f - qx;
+        p.y = p.y * 2_f - qy;
+        return qx + 2 * qy;
+    }
+
+    auto Total() const -> Float
+    {
+        return nodes[0].Total();
+    }
+
+    //! Record a value along the path from the root to the leaf containing `p`.
+    auto Record(Vec2 p, Float value) -> void
+    {
+        weight.Add(1_f);
+        if (!std::isfinite(value) || value <= 0_f)
+        {
+            return;
+        }
+        int i = 0;
+        while (true)
+        {
+            const int q = Quadrant(p);
+            nodes[i].sum[q].Add(value);
+            if (nodes[i].child[q] == 0) break;
+            i = nodes[i].child[q];
+        }
+    }
+
+    //! Solid angle density of the direction corresponding to `p`.
+    auto EvaluatePDF(Vec2 p) const -> Float
+    {
+        const Float InvFourPi = 0.25_f * Math::InvPi();
+        if (Total() <= 0_f)
+        {
+            return InvFourPi;
+        }
+
+        Float pdf = InvFourPi;
+        int i = 0;
+        while (true)
+        {
+            const auto total = nodes[i].Total();
+            const int q = Quadrant(p);
+            const auto s = nodes[i].sum[q].Load();
+            if (total <= 0_f || s <= 0_f)
+            {
+                return 0_f;
+            }
+            pdf *= 4_f * s / total;
+            if (nodes[i].child[q] == 0) break;
+            i = nodes[i].child[q];
+        }
+
+        return pdf;
+    }
+
+    //! Sample a point in [0,1]^2 proportional to the recorded values.
+    auto Sample(Vec2 u) const -> Vec2
+    {
+        if (Total() <= 0_f)
+        {
+            return u;
+        }
+
+        Vec2 origin(0_f);
+        Float size = 1_f;
+        int i = 0;
+        while (true)
+        {
+            const auto& node = nodes[i];
+            Float s[4];
+            for (int q = 0; q < 4; q++) s[q] = node.sum[q].Load();
+
+            // Select column, then row in the selected column
+            const auto pL = (s[0] + s[2]) / (s[0] + s[1] + s[2] + s[3]);
+            int qx;
+            if (u.x < pL) { qx = 0; u.x = u.x / pL; }
+            else          { qx = 1; u.x = (u.x - pL) / (1_f - pL); }
+            const auto pB = s[qx] / (s[qx] + s[qx + 2]);
+            int qy;
+            if (u.y < pB) { qy = 0; u.y = u.y / pB; }
+            else          { qy = 1; u.y = (u.y - pB) / (1_f - pB); }
+            u.x = Math::Clamp(u.x, 0_f, 1_f);
+            u.y = Math::Clamp(u.y, 0_f, 1_f);
+
+            size *= 0.5_f;
+            origin = origin + Vec2((Float)qx, (Float)qy) * size;
+
+            const int q = qx + 2 * qy;
+            if (node.child[q] == 0)
+            {
+                return origin + u * size;
+            }
+            i = node.child[q];
+        }
+    }
+
+    /*!
+        Rebuild the structure from the recorded values and reset them.
+        Quadrants having more than `threshold` of the total energy are subdivided,
+        and the others are collapsed.
+    */
+    auto Refine(Float threshold, int maxDepth) -> void
+    {
+        const auto total = Total();
+
+        struct Entry
+        {
+            int newIndex;
+            int oldIndex;       // -1 if the node does not exist in the old tree
+            Float energy;       // Energy of the node, used if the node is not in the old tree
+            int depth;
+        };
+
+        std::vector<Node> newNodes(1);
+        std::vector<Entry> stack{ { 0, 0, total, 1 } };
+        while (!stack.empty())
+        {
+            const auto e = stack.back();
+            stack.pop_back();
+            for (int q = 0; q < 4; q++)
+            {
+                const auto energy = e.oldIndex >= 0 ? nodes[e.oldIndex].sum[q].Load() : e.energy * 0.25_f;
+                if (e.depth >= maxDepth || total <= 0_f || energy <= total * threshold)
+                {
+                    continue;
+                }
+                const int c = (int)(newNodes.size());
+                newNodes.emplace_back();
+                newNodes[e.newIndex].child[q] = c;
+                const int oldChild = e.oldIndex >= 0 && nodes[e.oldIndex].child[q] > 0 ? nodes[e.oldIndex].child[q] : -1;
+                stack.push_back({ c, oldChild, energy, e.depth + 1 });
+            }
+        }
+
+        nodes = std::move(newNodes);
+        weight.Store(0_f);
+    }
+
+    static auto DirToCanonical(const Vec3& d) -> Vec2
+    {
+        const auto cosTheta = Math::Clamp(d.z, -1_f, 1_f);
+        auto phi = std::atan2(d.y, d.x);
+        if (phi < 0_f) phi += 2_f * Math::Pi();
+        return Vec2(
+            Math::Clamp((cosTheta + 1_f) * 0.5_f, 0_f, 1_f),
+            Math::Clamp(phi * 0.5_f * Math::InvPi(), 0_f, 1_f));
+    }
+
+    static auto CanonicalToDir(const Vec2& p) -> Vec3
+    {
+        const auto cosTheta = 2_f * p.x - 1_f;
+        const auto sinTheta = Math::Sqrt(Math::Max(0_f, 1_f - cosTheta * cosTheta));
+        const auto phi = 2_f * Math::Pi() * p.y;
+        return Vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+    }
+};
+
+// --------------------------------------------------------------------------------
+
+/*!
+    \brief Spatial binary tree of directional quadtrees (SD-tree).
+
+    The scene bound is split at the midpoints of the axes in turn.
+    Each leaf holds two directional quadtrees: `sampling` is the distribution learned
+    in the previous passes and is read-only during a pass,
+    `building` receives the records of the current pass.
+*/
+struct GuidingSTree
+{
+    struct Node
+    {
+        int axis = 0;
+        int child[2] = { 0, 0 };            // Index of the child nodes (0 if the node is a leaf)
+        GuidingDTree sampling;
+        GuidingDTree building;
+    };
+
+    Bound bound;
+    std::vector<Node> nodes;
+
+    auto Initialize(const Bound& sceneBound) -> void
+    {
+        // Use cubic bound so that the cells get roughly isotropic
+        const auto center = (sceneBound.min + sceneBound.max) * 0.5_f;
+        const auto d = sceneBound.max - sceneBound.min;
+        const auto extent = Math::Max(d.x, Math::Max(d.y, d.z)) * 0.5_f * 1.001_f + Math::Eps();
+        bound.min = center - Vec3(extent);
+        bound.max = center + Vec3(extent);
+        nodes.assign(1, Node());
+    }
+
+    //! Find the leaf containing `p`.
+    auto Lookup(const Vec3& p) -> Node&
+    {
+        auto t = (p - bound.min) / (bound.max - bound.min);
+        int i = 0;
+        while (nodes[i].child[0] != 0)
+        {
+            const int axis = nodes[i].axis;
+            if (t[axis] < 0.5_f) { t[axis] = t[axis] * 2_f;        i = nodes[i].child[0]; }
+            else                 { t[axis] = t[axis] * 2_f - 1_f;  i = nodes[i].child[1]; }
+        }
+        return nodes[i];
+    }
+
+    /*!
+        Finish a pass.
+        The records of the pass become the sampling distribution,
+        leaves having more than `spatialThreshold` records are split,
+        and the building quadtrees are refined for the next pass.
+    */
+    auto EndPass(Float spatialThreshold, Float directionalThreshold, int maxDepth) -> void
+    {
+        for (auto& node : nodes)
+        {
+            if (node.child[0] == 0)
+            {
+                node.sampling = node.building;
+            }
+        }
+
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].child[0] != 0 || nodes[i].building.weight.Load() <= spatialThreshold)
+            {
+                continue;
+            }
+
+            // Children inherit the distributions with the half of the statistical weight
+            const int c = (int)(nodes.size());
+            Node child;
+            child.axis = (nodes[i].axis + 1) % 3;
+            child.sampling = nodes[i].sampling;
+            child.building = nodes[i].building;
+            child.building.weight.Store(nodes[i].building.weight.Load() * 0.5_f);
+            nodes.push_back(child);
+            nodes.push_back(child);
+            nodes[i].child[0] = c;
+            nodes[i].child[1] = c + 1;
+            nodes[i].sampling = GuidingDTree();
+            nodes[i].building = GuidingDTree();
+        }
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, nodes.size()), [&](const tbb::blocked_range<size_t>& range) -> void
+        {
+            for (size_t i = range.begin(); i != range.end(); i++)
+            {
+                if (nodes[i].child[0] == 0)
+                {
+                    nodes[i].building.Refine(directionalThreshold, maxDepth);
+                }
+            }
+        });
+    }
+};
+
+LM_NAMESPACE_END
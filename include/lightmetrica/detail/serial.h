@@ -56,6 +56,7 @@ template <typename Archive> auto serialize(Archive& ar, SPD& s) { ar(s.v); }
 
 // Distribution 1D
 template <typename Archive> auto serialize(Archive& ar, Distribution1D& d) { ar(d.cdf); }
+template <typename Archive> auto serialize(Archive& ar, AliasTable& d) { ar(d.pdf, d.prob, d.alias, d.aliasedBegin, d.aliased); }
 
 #pragma endregion
 
@@ -35,6 +35,7 @@ LM_NAMESPACE_BEGIN
 
 class Scene3;
 class Random;
+class RussianRoulette;
 struct Primitive;
 
 ///! Utility class for sampling subpaths.
@@ -101,6 +102,22 @@ public:
     */
     LM_PUBLIC_API static auto TraceSubpath(const Scene3* scene, Random* rng, int maxNumVertices, TransportDirection transDir, const ProcessPathVertexFunc& processPathVertexFunc) -> void;
 
+    /*!
+        Function to trace subpath terminated by the Russian roulette.
+
+        The policy is evaluated for the throughput after the callback of each vertex except the initial vertex,
+        centered at the pixel reference for the eye subpaths and at the light reference for the light subpaths.
+        The subpaths are not split.
+
+        \param scene                 Scene.
+        \param rng                   Random number generator.
+        \param maxNumVertices        Maximum number of vertices in the subpath.
+        \param transDir              Transport direction of the subpath.
+        \param rr                    Path termination policy.
+        \param processPathVertexFunc Callback function to process vertices.
+    */
+    LM_PUBLIC_API static auto TraceSubpath(const Scene3* scene, Random* rng, int maxNumVertices, TransportDirection transDir, const RussianRoulette& rr, const ProcessPathVertexFunc& processPathVertexFunc) -> void;
+
     /*!
         Function to trace eye subpath with fixed raster position.
 
@@ -0,0 +1,98 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <lightmetrica/macros.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+LM_NAMESPACE_BEGIN
+
+//! Tile of a texture stored in the texture cache.
+struct TextureTile
+{
+    std::vector<float> data;    // Texel data (layout is defined by the texture)
+};
+
+//! Statistics of the texture cache.
+struct TextureCacheStats
+{
+    long long lookups;          // Number of tile lookups
+    long long hits;             // Number of lookups found in the cache
+    long long evictions;        // Number of evicted tiles
+    size_t memory;              // Current memory usage of the tiles in bytes
+    size_t peakMemory;          // Peak memory usage of the tiles in bytes
+    size_t capacity;            // Capacity of the cache in bytes
+};
+
+/*!
+    Texture cache.
+    
+    A cache of texture tiles shared among all textures and threads.
+    The textures register a loader function which reads a tile on a cache miss.
+    The memory used by the tiles is bounded by the capacity
+    and the least recently used tiles are evicted first.
+    The cache is split into shards guarded by separate locks
+    to reduce the contention among the threads.
+*/
+class TextureCache
+{
+public:
+
+    LM_DISABLE_CONSTRUCT(TextureCache);
+
+public:
+
+    using TileLoadFunc = std::function<bool(int level, int tileX, int tileY, TextureTile& tile)>;
+    using TilePtr = std::shared_ptr<const TextureTile>;
+
+public:
+
+    //! Set the capacity of the cache in bytes.
+    LM_PUBLIC_API static auto SetCapacity(size_t capacity) -> void;
+
+    //! Register a texture and get its ID.
+    LM_PUBLIC_API static auto Register(const TileLoadFunc& loadFunc) -> int;
+
+    //! Unregister a texture and release its tiles.
+    LM_PUBLIC_API static auto Unregister(int textureID) -> void;
+
+    /*!
+        Get a tile of the texture, loading it on a cache miss.
+        The returned tile is kept alive while referenced, even if evicted.
+        \retval nullptr Failed to load the tile.
+    */
+    LM_PUBLIC_API static auto Tile(int textureID, int level, int tileX, int tileY) -> TilePtr;
+
+    //! Get the statistics.
+    LM_PUBLIC_API static auto Stats() -> TextureCacheStats;
+
+    //! Reset the statistics.
+    LM_PUBLIC_API static auto ResetStats() -> void;
+
+};
+
+LM_NAMESPACE_END
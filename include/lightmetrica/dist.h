@@ -110,4 +110,199 @@ public:
 
 };
 
+/*!
+    \brief Discrete 1D distribution with the alias method.
+
+    Samples the distribution in O(1) with the table of
+    the probabilities and the aliases constructed by Vose's method.
+    The interface is compatible with `Distribution1D` except for the CDF.
+
+    \ingroup math
+*/
+class AliasTable
+{
+public:
+
+    AliasTable() { Clear(); }
+
+public:
+
+    //! Add an value
+    auto Add(Float v) -> void
+    {
+        pdf.push_back(v);
+    }
+
+    /*!
+        Normalize the histogram and build the table.
+        Falls back to the uniform distribution if the values sum to zero (or not finite).
+    */
+    auto Normalize() -> void
+    {
+        const int n = static_cast<int>(pdf.size());
+        Float sum = 0_f;
+        for (const auto& v : pdf) { sum += v; }
+        if (sum > 0_f && std::isfinite(sum))
+        {
+            const Float invSum = 1_f / sum;
+            for (auto& v : pdf) { v *= invSum; }
+        }
+        else
+        {
+            std::fill(pdf.begin(), pdf.end(), 1_f / Float(std::max(n, 1)));
+        }
+
+        // Partition the entries into the ones smaller and larger than the average
+        prob.assign(n, 1_f);
+        alias.resize(n);
+        std::vector<int> small, large;
+        std::vector<Float> scaled(n);
+        for (int i = 0; i < n; i++)
+        {
+            scaled[i] = pdf[i] * Float(n);
+            alias[i] = i;
+            (scaled[i] < 1_f ? small : large).push_back(i);
+        }
+
+        // Fill the probabilities of the small entries with the large entries
+        while (!small.empty() && !large.empty())
+        {
+            const int s = small.back(); small.pop_back();
+            const int l = large.back(); large.pop_back();
+            prob[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1_f;
+            (scaled[l] < 1_f ? small : large).push_back(l);
+        }
+
+        BuildAliased();
+    }
+
+    //! Sample from the distribution
+    auto Sample(Float u) const -> int
+    {
+        const int n = static_cast<int>(prob.size());
+        const Float scaled = u * Float(n);
+        const int i = Math::Clamp<int>(static_cast<int>(scaled), 0, n - 1);
+        return scaled - Float(i) < prob[i] ? i : alias[i];
+    }
+
+    //! Sample from the distribution reusing a random variable
+    auto SampleReuse(Float u, Float& u2) const -> int
+    {
+        const int n = static_cast<int>(prob.size());
+        const Float scaled = u * Float(n);
+        const int i = Math::Clamp<int>(static_cast<int>(scaled), 0, n - 1);
+        const Float f = Math::Clamp(scaled - Float(i), 0_f, 1_f);
+        if (f < prob[i])
+        {
+            u2 = f / prob[i];
+            return i;
+        }
+        u2 = std::min((f - prob[i]) / (1_f - prob[i]), 1_f - Math::Eps());
+        return alias[i];
+    }
+
+    /*!
+        Inverse of `SampleReuse`.
+        Computes the random number which `SampleReuse` maps to the entry `i`
+        and the reused random number `u2`. The entry can be reached
+        from its own slot and from the slots aliased to it, so one of them is
+        chosen with `uSel` proportional to the probability of the slot.
+        The function takes time linear in the number of the slots aliased to the entry.
+    */
+    auto SampleReuse_Inverse(int i, Float u2, Float uSel) const -> Float
+    {
+        const int n = static_cast<int>(prob.size());
+        const auto ToU = [&](int slot, Float f) -> Float
+        {
+            return Math::Clamp((Float(slot) + f) / Float(n), 0_f, 1_f);
+        };
+
+        // Select a slot proportional to the probabilities summing to pdf[i] * n
+        Float t = uSel * pdf[i] * Float(n);
+        if (t < prob[i] || pdf[i] == 0_f || aliasedBegin[i] == aliasedBegin[i + 1])
+        {
+            return ToU(i, u2 * prob[i]);
+        }
+        t -= prob[i];
+        int last = -1;
+        for (int j = aliasedBegin[i]; j < aliasedBegin[i + 1]; j++)
+        {
+            last = aliased[j];
+            const Float w = 1_f - prob[last];
+            if (t < w)
+            {
+                break;
+            }
+            t -= w;
+        }
+        return ToU(last, prob[last] + u2 * (1_f - prob[last]));
+    }
+
+    //! Inverse of `Sample`. `u2` is the position in the selected slot and `uSel` selects the slot.
+    auto Sample_Inverse(int i, Float u2, Float uSel) const -> Float
+    {
+        return SampleReuse_Inverse(i, u2, uSel);
+    }
+
+    //! Evaluate distribution
+    auto EvaluatePDF(int i) const -> Float
+    {
+        return (i < 0 || i >= static_cast<int>(pdf.size())) ? 0 : pdf[i];
+    }
+
+    //! Clear distribution
+    auto Clear() -> void
+    {
+        pdf.clear();
+        prob.clear();
+        alias.clear();
+        aliasedBegin.assign(1, 0);
+        aliased.clear();
+    }
+
+    //! Check if the distribution is empty
+    auto Empty() const -> bool
+    {
+        return pdf.empty();
+    }
+
+    //! Build the lists of the slots aliased to each entry from the table
+    auto BuildAliased() -> void
+    {
+        const int n = static_cast<int>(prob.size());
+        aliasedBegin.assign(n + 1, 0);
+        for (int k = 0; k < n; k++)
+        {
+            if (alias[k] != k && prob[k] < 1_f)
+            {
+                aliasedBegin[alias[k] + 1]++;
+            }
+        }
+        for (int i = 0; i < n; i++)
+        {
+            aliasedBegin[i + 1] += aliasedBegin[i];
+        }
+        aliased.resize(aliasedBegin[n]);
+        std::vector<int> next(aliasedBegin.begin(), aliasedBegin.end() - 1);
+        for (int k = 0; k < n; k++)
+        {
+            if (alias[k] != k && prob[k] < 1_f)
+            {
+                aliased[next[alias[k]]++] = k;
+            }
+        }
+    }
+
+public:
+
+    std::vector<Float> pdf;         // Normalized probabilities
+    std::vector<Float> prob;        // Probability to choose the entry itself rather than the alias
+    std::vector<int> alias;         // Aliases
+    std::vector<int> aliasedBegin;  // Offsets to `aliased` for each entry (used by the inverse)
+    std::vector<int> aliased;       // Slots aliased to the entries, grouped by the entry
+
+};
+
 LM_NAMESPACE_END
@@ -47,7 +47,7 @@ class Film : public Asset
 {
 public:
 
-    LM_INTERFACE_CLASS(Film, Asset, 9);
+    LM_INTERFACE_CLASS(Film, Asset, 10);
 
 public:
 
@@ -117,6 +117,9 @@ public:
     ///! Computes pixel index from the raster position.
     LM_INTERFACE_F(8, PixelIndex, int(const Vec2& rasterPos));
 
+    ///! Get the value of the pixel at the screen coordinates (x,y).
+    LM_INTERFACE_F(9, GetPixel, SPD(int x, int y));
+
 };
 
 LM_NAMESPACE_END
@@ -113,6 +113,11 @@ public:
             Vec2 uv2(tc[2 * v2], tc[2 * v2 + 1]);
             Vec2 uv3(tc[2 * v3], tc[2 * v3 + 1]);
             isect.geom.uv = uv1 * (1_f - b[0] - b[1]) + uv2 * b[0] + uv3 * b[1];
+
+            // Ratio of the lengths in the texture space and in the world space
+            const Float area = Math::Length(Math::Cross(p2 - p1, p3 - p1));
+            const Float uvArea = Math::Abs((uv2.x - uv1.x) * (uv3.y - uv1.y) - (uv3.x - uv1.x) * (uv2.y - uv1.y));
+            isect.geom.uvScale = area > 0_f ? Math::Sqrt(uvArea / area) : 0_f;
         }
 
         // Scene surface is not degenerated
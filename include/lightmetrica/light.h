@@ -35,6 +35,7 @@ LM_NAMESPACE_BEGIN
 */
 
 class Distribution1D;
+class AliasTable;
 
 /*!
     \brief An interface for Light
@@ -44,7 +45,7 @@ class Light : public Emitter
 {
 public:
 
-    LM_INTERFACE_CLASS(Light, Emitter, 2);
+    LM_INTERFACE_CLASS(Light, Emitter, 3);
 
 public:
 
@@ -59,6 +60,9 @@ public:
     ///! Get distribution for triangle selection if available.
     LM_INTERFACE_F(1, TriAreaDist, Distribution1D*());
 
+    ///! Get alias table for triangle selection if available.
+    LM_INTERFACE_F(2, TriAreaAliasTable, AliasTable*());
+
 };
 
 LM_NAMESPACE_END
@@ -48,6 +48,10 @@
     Options:
       - `-D LM_USE_DOUBLE_PRECISION` specifies to use double precision floating-point type.
       - `-D LM_USE_SINGLE_PRECISION` specifies to use single precision floating-point type.
+      - `-D LM_USE_SINGLE_PRECISION_GEOMETRY` specifies to store the geometry data
+        (e.g., vertex attributes of the meshes or data of the acceleration structures) in
+        single precision while the other computations use double precision (mixed precision mode).
+        Only valid with `LM_USE_DOUBLE_PRECISION`.
 
     ### SIMD optimization
     We can use SIMD-optimized functions for various operations.
@@ -88,6 +92,11 @@
 #if LM_SINGLE_PRECISION + LM_DOUBLE_PRECISION != 1
 	#error "Invalid precision mode"
 #endif
+#if LM_SINGLE_PRECISION || defined(LM_USE_SINGLE_PRECISION_GEOMETRY)
+	#define LM_SINGLE_PRECISION_GEOMETRY 1
+#else
+	#define LM_SINGLE_PRECISION_GEOMETRY 0
+#endif
 //! \endcond
 
 #pragma endregion
@@ -137,6 +146,13 @@ using Float = float;
 using Float = double;
 #endif
 
+// Floating point type for storing geometry data
+#if LM_SINGLE_PRECISION_GEOMETRY
+using GeomFloat = float;
+#else
+using GeomFloat = Float;
+#endif
+
 // Convert to default floating point type
 namespace
 {
@@ -209,6 +209,18 @@ inline auto PropertyNode::As<std::vector<Float>>() const -> std::vector<Float>
     return v;
 }
 
+#if LM_DOUBLE_PRECISION
+template <>
+inline auto PropertyNode::As<std::vector<float>>() const -> std::vector<float>
+{
+    std::vector<float> v;
+    std::stringstream ss(RawScalar());
+    double t;
+    while (ss >> t) { v.push_back(float(t)); }
+    return v;
+}
+#endif
+
 template <>
 inline auto PropertyNode::As<std::vector<unsigned int>>() const -> std::vector<unsigned int>
 {
@@ -35,6 +35,7 @@ LM_NAMESPACE_BEGIN
 struct Primitive;
 struct Ray;
 struct Intersection;
+struct SurfaceGeometry;
 
 /*!
     \brief A base class of the 3-dimensional scene.
@@ -44,7 +45,7 @@ class Scene3 : public Scene
 {
 public:
 
-    LM_INTERFACE_CLASS(Scene3, Scene, 11);
+    LM_INTERFACE_CLASS(Scene3, Scene, 18);
 
 public:
 
@@ -102,6 +103,85 @@ public:
     //! Get a number of light primitives.
     LM_INTERFACE_F(10, NumLightPrimitives, int());
 
+    /*!
+        \brief Update transforms of the primitives.
+
+        Updates the transforms of the primitives from the scene node of the next frame
+        in the sequence rendering. The scene node must have the same topology as
+        the one given to `Initialize`; only `transform` nodes are allowed to change.
+        The acceleration structure is refitted (or rebuilt if refitting is not supported).
+
+        \param sceneNode Scene node of the next frame.
+        \retval true  Succeeded to update.
+        \retval false Failed to update.
+    */
+    LM_INTERFACE_F(11, UpdateTransforms, bool(const PropertyNode* sceneNode));
+
+    /*!
+        \brief Occlusion query.
+
+        Checks if `ray` is occluded by the triangles within the range of the distance.
+        Cheaper than `IntersectWithRange` if the accel supports occlusion queries.
+
+        \param ray   Ray.
+        \param minT  Minimum range of the distance.
+        \param maxT  Maximum range of the distance.
+        \retval true  The ray is occluded.
+        \retval false The ray is not occluded.
+    */
+    LM_INTERFACE_F(12, Occluded, bool(const Ray& ray, Float minT, Float maxT));
+
+    /*!
+        \brief Intersection query with a stream of rays.
+        
+        Stream version of `IntersectWithRange`.
+        As with `Intersect`, the rays missing the geometries are
+        also tested against the emitter shapes (e.g., environment lights).
+        See `Accel3::IntersectStream` for the details.
+    */
+    LM_INTERFACE_F(13, IntersectStream, void(int numRays, const Ray* rays, const Float* minT, const Float* maxT, Intersection* isects, bool* hits));
+
+    /*!
+        \brief Occlusion query with a stream of rays.
+
+        Stream version of `Occluded`.
+        See `Accel3::OccludedStream` for the details.
+    */
+    LM_INTERFACE_F(14, OccludedStream, void(int numRays, const Ray* rays, const Float* minT, const Float* maxT, bool* occluded));
+
+    /*!
+        \brief Sample an emitter given a shading point.
+
+        Samples an emitter according to the estimated contribution to the shading point
+        when the scene is configured with `light_selection: bvh`.
+        Otherwise same as `SampleEmitter`. The function might return `nullptr`
+        if no emitter can contribute to the shading point.
+
+        \param type Type of the emitter.
+        \param geom Surface geometry of the shading point.
+        \param u    Random number.
+        \return Sampled emitter primitive.
+    */
+    LM_INTERFACE_F(15, SampleEmitterGivenPosition, const Primitive*(int type, const SurfaceGeometry& geom, Float u));
+
+    //! Evaluate the selection PDF of `SampleEmitterGivenPosition`.
+    LM_INTERFACE_F(16, EvaluateEmitterGivenPositionPDF, PDFVal(const Primitive* primitive, const SurfaceGeometry& geom));
+
+    /*!
+        \brief Inverse of `SampleEmitter`.
+
+        Computes a random number which `SampleEmitter` maps to the given emitter
+        for any light selection strategy. Several intervals of the random number
+        might be mapped to the emitter, so `u2` specifies the position in the interval
+        and `uSel` selects one of the intervals.
+
+        \param primitive Emitter primitive.
+        \param u2        Random number for the position in the interval.
+        \param uSel      Random number to select the interval.
+        \return Random number for `SampleEmitter`.
+    */
+    LM_INTERFACE_F(17, SampleEmitter_Inverse, Float(const Primitive* primitive, Float u2, Float uSel));
+
 public:
 
     auto Visible(const Vec3& p1, const Vec3& p2) const -> bool
@@ -111,8 +191,7 @@ public:
         const auto p1p2L = Math::Length(p1p2);
         shadowRay.d = p1p2 / p1p2L;
         shadowRay.o = p1;
-        Intersection _;
-        return !IntersectWithRange(shadowRay, _, Math::EpsIsect(), p1p2L * (1_f - Math::EpsIsect()));
+        return !Occluded(shadowRay, Math::EpsIsect(), p1p2L * (1_f - Math::EpsIsect()));
     }
 
 };
@@ -49,6 +49,8 @@ struct SurfaceGeometry
     Vec3 dpdu, dpdv;         //!< Tangent vectors
     Vec3 dndu, dndv;         //!< Partial derivatives of shading normal
     Vec2 uv;                 //!< Texture coordinates
+    Float uvScale = 0_f;     //!< Change of the texture coordinates per unit length on the surface (0 if not available)
+    Float footprint = 0_f;   //!< Width of the footprint of the incident ray on the surface (0 if not available)
     Mat3 ToLocal;            //!< Conversion matrix from world coordinates to shading coordinates 
     Mat3 ToWorld;            //!< Conversion matrix from shading coordinates to world coordinates 
 
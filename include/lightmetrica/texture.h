@@ -26,6 +26,7 @@
 
 #include <lightmetrica/asset.h>
 #include <lightmetrica/math.h>
+#include <lightmetrica/surfacegeometry.h>
 
 LM_NAMESPACE_BEGIN
 
@@ -43,7 +44,7 @@ class Texture : public Asset
 {
 public:
 
-    LM_INTERFACE_CLASS(Texture, Asset, 1);
+    LM_INTERFACE_CLASS(Texture, Asset, 2);
 
 public:
 
@@ -59,6 +60,34 @@ public:
     */
     LM_INTERFACE_F(0, Evaluate, Vec3(const Vec2& uv));
 
+    /*!
+        \brief Evaluate the texture value filtered over the footprint.
+        The function is optional; use Evaluate if not implemented.
+        \param uv Texture coordinates.
+        \param footprint Width of the filter footprint in the texture coordinates.
+        \return Texture color.
+    */
+    LM_INTERFACE_F(1, EvaluateFiltered, Vec3(const Vec2& uv, Float footprint));
+
+public:
+
+    /*!
+        \brief Evaluate the texture value on the surface.
+        The texture is filtered over the footprint of the incident ray
+        if EvaluateFiltered is implemented and the footprint is available.
+        \param geom Surface geometry.
+        \return Texture color.
+    */
+    auto EvaluateOnSurface(const SurfaceGeometry& geom) const -> Vec3
+    {
+        const Float footprint = geom.footprint * geom.uvScale;
+        if (footprint > 0_f && EvaluateFiltered.Implemented())
+        {
+            return EvaluateFiltered(geom.uv, footprint);
+        }
+        return Evaluate(geom.uv);
+    }
+
 };
 
 LM_NAMESPACE_END
@@ -29,21 +29,25 @@
 
 LM_NAMESPACE_BEGIN
 
+/*!
+    Precomputed triangle data for ray-triangle intersection [Wald 2004].
+    The data is stored with GeomFloat while the intersection is computed with Float.
+*/
 struct TriAccelTriangle
 {
 
     uint32_t k;
-    Float n_u;
-    Float n_v;
-    Float n_d;
+    GeomFloat n_u;
+    GeomFloat n_v;
+    GeomFloat n_d;
 
-    Float a_u;
-    Float a_v;
-    Float b_nu;
-    Float b_nv;
+    GeomFloat a_u;
+    GeomFloat a_v;
+    GeomFloat b_nu;
+    GeomFloat b_nv;
 
-    Float c_nu;
-    Float c_nv;
+    GeomFloat c_nu;
+    GeomFloat c_nv;
     uint32_t faceIndex;
     uint32_t primIndex;
 
@@ -77,15 +81,15 @@ struct TriAccelTriangle
         }
 
         // Pre-compute intersection calculation constants
-        n_u = N[u] / n_k;
-        n_v = N[v] / n_k;
-        n_d = Math::Dot(Vec3(A), N) / n_k;
-        b_nu = b[u] / denom;
-        b_nv = -b[v] / denom;
-        a_u = A[u];
-        a_v = A[v];
-        c_nu = c[v] / denom;
-        c_nv = -c[u] / denom;
+        n_u = (GeomFloat)(N[u] / n_k);
+        n_v = (GeomFloat)(N[v] / n_k);
+        n_d = (GeomFloat)(Math::Dot(Vec3(A), N) / n_k);
+        b_nu = (GeomFloat)(b[u] / denom);
+        b_nv = (GeomFloat)(-b[v] / denom);
+        a_u = (GeomFloat)(A[u]);
+        a_v = (GeomFloat)(A[v]);
+        c_nu = (GeomFloat)(c[v] / denom);
+        c_nv = (GeomFloat)(-c[u] / denom);
 
         return 0;
     }
@@ -67,21 +67,23 @@ public:
 
     /*!
         Get the position array.
+        The array is followed by at least one element of padding
+        so that the last position can be read with a 16-byte load (e.g., by Embree).
         \return The position array.
     */
-    LM_INTERFACE_F(2, Positions, const Float*());
+    LM_INTERFACE_F(2, Positions, const GeomFloat*());
 
     /*!
         Get the normal array.
         \return The normal array.
     */
-    LM_INTERFACE_F(3, Normals, const Float*());
+    LM_INTERFACE_F(3, Normals, const GeomFloat*());
 
     /*!
         Get the texture coordinates array.
         \return The texture coordinates array.
     */
-    LM_INTERFACE_F(4, Texcoords, const Float*());
+    LM_INTERFACE_F(4, Texcoords, const GeomFloat*());
 
     /*!
         Get the face array.
@@ -43,8 +43,9 @@ public:
 
 public:
 
-    //! Create discrete distribution for sampling area light or raw sensor
-    static auto CreateTriangleAreaDist(const Primitive* primitive, Distribution1D& dist, Float& invArea) -> void
+    //! Create discrete distribution for sampling area light or raw sensor (`Distribution1D` or `AliasTable`)
+    template <typename DistT>
+    static auto CreateTriangleAreaDist(const Primitive* primitive, DistT& dist, Float& invArea) -> void
     {
         assert(primitive->mesh);
         Float sumArea = 0;
@@ -68,7 +69,8 @@ public:
     }
 
     //! Sample a position on the triangle mesh
-    static auto SampleTriangleMesh(const Vec2& u, const TriangleMesh* mesh, const Mat4& transform, const Distribution1D& dist, SurfaceGeometry& geom)
+    template <typename DistT>
+    static auto SampleTriangleMesh(const Vec2& u, const TriangleMesh* mesh, const Mat4& transform, const DistT& dist, SurfaceGeometry& geom) -> void
     {
         #pragma region Sample a triangle & a position on triangle
 
@@ -22,6 +22,7 @@
     THE SOFTWARE.
 */
 
+
 #include <lightmetrica/accel3.h>
 #include <lightmetrica/scene3.h>
 #include <lightmetrica/property.h>
@@ -33,10 +34,16 @@
 #include <lightmetrica/fp.h>
 
 #include <unordered_map>
+#include <tbb/tbb.h>
 
 #include <embree2/rtcore.h>
 #include <embree2/rtcore_ray.h>
 
+// rtcIntersect1M and RTCIntersectContext are available since Embree 2.14
+#if defined(RTCORE_VERSION) && RTCORE_VERSION < 21400
+#error "accel_embree requires Embree 2.14 or later"
+#endif
+
 LM_NAMESPACE_BEGIN
 
 namespace
@@ -55,8 +62,34 @@ namespace
         }
         LM_LOG_ERROR("Embree error : " + error);
     }
+
+    auto CreateRTCRay(const Ray& ray, Float minT, Float maxT) -> RTCRay
+    {
+        RTCRay rtcRay;
+        rtcRay.org[0] = (float)(ray.o[0]);
+        rtcRay.org[1] = (float)(ray.o[1]);
+        rtcRay.org[2] = (float)(ray.o[2]);
+        rtcRay.dir[0] = (float)(ray.d[0]);
+        rtcRay.dir[1] = (float)(ray.d[1]);
+        rtcRay.dir[2] = (float)(ray.d[2]);
+        rtcRay.tnear  = (float)(minT);
+        rtcRay.tfar   = (float)(maxT);
+        rtcRay.geomID = RTC_INVALID_GEOMETRY_ID;
+        rtcRay.primID = RTC_INVALID_GEOMETRY_ID;
+        rtcRay.instID = RTC_INVALID_GEOMETRY_ID;
+        rtcRay.mask = 0xFFFFFFFF;
+        rtcRay.time = 0;
+        return rtcRay;
+    }
 }
 
+/*!
+    Acceleration structure with Embree.
+    Each mesh is registered once as a scene sharing the vertex and index buffers of the mesh
+    (the vertices are copied if the geometry is in double precision),
+    and the primitives are added to the top-level scene as instances of the mesh scenes.
+    Refit only updates the transforms of the instances and rebuilds the top-level scene.
+*/
 class Accel_Embree final : public Accel3
 {
 public:
@@ -73,78 +106,156 @@ public:
 
     ~Accel_Embree()
     {
-        if (RtcScene) rtcDeleteScene(RtcScene);
+        ReleaseScenes();
         rtcDeleteDevice(device);
     }
 
 public:
 
-    LM_IMPL_F(Initialize) = [this](const PropertyNode*) -> bool
+    LM_IMPL_F(Initialize) = [this](const PropertyNode* prop) -> bool
     {
-        // Do nothing
+        if (!prop)
+        {
+            return true;
+        }
+
+        // Number of build threads (0: use all threads)
+        const int numThreads = prop->ChildAs<int>("num_threads", 0);
+        if (numThreads > 0)
+        {
+            rtcDeleteDevice(device);
+            device = rtcNewDevice(boost::str(boost::format("threads=%d") % numThreads).c_str());
+            rtcDeviceSetErrorFunction(device, EmbreeErrorHandler);
+        }
+
+        // Build quality
+        const auto quality = prop->ChildAs<std::string>("quality", "medium");
+        if (quality == "high")
+        {
+            sceneFlags_ = RTC_SCENE_HIGH_QUALITY;
+        }
+        else if (quality == "low")
+        {
+            sceneFlags_ = RTC_SCENE_COMPACT;
+        }
+        else if (quality != "medium")
+        {
+            LM_LOG_ERROR("Invalid quality: " + quality);
+            return false;
+        }
+
+        if (prop->ChildAs<int>("robust", 0))
+        {
+            sceneFlags_ = (RTCSceneFlags)(sceneFlags_ | RTC_SCENE_ROBUST);
+        }
+
         return true;
     };
 
     LM_IMPL_F(Build) = [this](const Scene* scene_) -> bool
     {
         const auto* scene = static_cast<const Scene3*>(scene_);
+        ReleaseScenes();
+
+        // --------------------------------------------------------------------------------
 
-        // Create scene
-        RtcScene = rtcDeviceNewScene(device, RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT, RTC_INTERSECT1);
+        #pragma region Collect meshes
 
-        // Add meshes to the scene
+        // Meshes shared by multiple primitives are registered only once
+        std::vector<const TriangleMesh*> meshes;
+        std::unordered_map<const TriangleMesh*, size_t> meshIndexMap;
         int np = scene->NumPrimitives();
         for (int i = 0; i < np; i++)
         {
-            const auto* prim = scene->PrimitiveAt(i);
-            const auto* mesh = prim->mesh;
-            if (!mesh)
+            const auto* mesh = scene->PrimitiveAt(i)->mesh;
+            if (mesh && meshIndexMap.find(mesh) == meshIndexMap.end())
             {
-                continue;
+                meshIndexMap[mesh] = meshes.size();
+                meshes.push_back(mesh);
             }
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Create mesh scenes
 
-            // Create a triangle mesh
-            unsigned int geomID = rtcNewTriangleMesh(RtcScene, RTC_GEOMETRY_STATIC, mesh->NumFaces(), mesh->NumFaces() * 3);
-            RtcGeomIDToPrimitiveIndexMap[geomID] = i;
+        // Mesh scenes are built in parallel. Each commit also uses the threaded builder of Embree.
+        const auto algorithmFlags = (RTCAlgorithmFlags)(RTC_INTERSECT1 | RTC_INTERSECT_STREAM);
+        meshScenes_.assign(meshes.size(), nullptr);
+        positions_.assign(LM_SINGLE_PRECISION_GEOMETRY ? 0 : meshes.size(), std::vector<float>());
+        tbb::parallel_for(0, (int)(meshes.size()), [&](int i) -> void
+        {
+            const auto* mesh = meshes[i];
+            auto meshScene = rtcDeviceNewScene(device, (RTCSceneFlags)(RTC_SCENE_STATIC | RTC_SCENE_INCOHERENT | sceneFlags_), algorithmFlags);
+            unsigned int geomID = rtcNewTriangleMesh(meshScene, RTC_GEOMETRY_STATIC, mesh->NumFaces(), mesh->NumVertices());
+
+            // Share the index buffer
+            rtcSetBuffer(meshScene, geomID, RTC_INDEX_BUFFER, mesh->Faces(), 0, 3 * sizeof(unsigned int));
+
+            // Embree reads the last vertex with a 16-byte load, which is covered by
+            // the padding after the positions of the mesh (see TriangleMesh::Positions).
+            // Double precision positions are copied into a padded float buffer.
+            #if LM_SINGLE_PRECISION_GEOMETRY
+            rtcSetBuffer(meshScene, geomID, RTC_VERTEX_BUFFER, mesh->Positions(), 0, 3 * sizeof(float));
+            #else
+            auto& buffer = positions_[i];
+            buffer.assign(3 * mesh->NumVertices() + 1, 0.0f);
+            std::transform(mesh->Positions(), mesh->Positions() + 3 * mesh->NumVertices(), buffer.begin(), [](GeomFloat v) -> float { return (float)(v); });
+            rtcSetBuffer(meshScene, geomID, RTC_VERTEX_BUFFER, buffer.data(), 0, 3 * sizeof(float));
+            #endif
+
+            rtcCommit(meshScene);
+            meshScenes_[i] = meshScene;
+        });
+
+        #pragma endregion
 
-            // Copy vertices & faces
-            auto* mappedPositions = reinterpret_cast<float*>(rtcMapBuffer(RtcScene, geomID, RTC_VERTEX_BUFFER));
-            auto* mappedFaces = reinterpret_cast<int*>(rtcMapBuffer(RtcScene, geomID, RTC_INDEX_BUFFER));
+        // --------------------------------------------------------------------------------
 
-            const auto* ps = mesh->Positions();
-            const auto* faces = mesh->Faces();
-            for (int j = 0; j < mesh->NumFaces(); j++)
+        #pragma region Create top-level scene
+
+        // Dynamic scene for updating the transforms of the instances in Refit
+        RtcScene = rtcDeviceNewScene(device, (RTCSceneFlags)(RTC_SCENE_DYNAMIC | RTC_SCENE_INCOHERENT | sceneFlags_), algorithmFlags);
+        for (int i = 0; i < np; i++)
+        {
+            const auto* prim = scene->PrimitiveAt(i);
+            if (!prim->mesh)
             {
-                // Positions
-                unsigned int i1 = faces[3 * j];
-                unsigned int i2 = faces[3 * j + 1];
-                unsigned int i3 = faces[3 * j + 2];
-                Vec3 p1(prim->transform * Vec4(ps[3 * i1], ps[3 * i1 + 1], ps[3 * i1 + 2], 1_f));
-                Vec3 p2(prim->transform * Vec4(ps[3 * i2], ps[3 * i2 + 1], ps[3 * i2 + 2], 1_f));
-                Vec3 p3(prim->transform * Vec4(ps[3 * i3], ps[3 * i3 + 1], ps[3 * i3 + 2], 1_f));
-
-                // Store into mapped buffers
-                int mi1 = 3 * (int)(j);
-                int mi2 = 3 * (int)(j)+1;
-                int mi3 = 3 * (int)(j)+2;
-                mappedFaces[mi1] = mi1;
-                mappedFaces[mi2] = mi2;
-                mappedFaces[mi3] = mi3;
-                for (int k = 0; k < 3; k++)
-                {
-                    mappedPositions[4 * mi1 + k] = (float)(p1[k]);
-                    mappedPositions[4 * mi2 + k] = (float)(p2[k]);
-                    mappedPositions[4 * mi3 + k] = (float)(p3[k]);
-                }
+                continue;
             }
 
-            rtcUnmapBuffer(RtcScene, geomID, RTC_VERTEX_BUFFER);
-            rtcUnmapBuffer(RtcScene, geomID, RTC_INDEX_BUFFER);
+            unsigned int instID = rtcNewInstance2(RtcScene, meshScenes_[meshIndexMap.at(prim->mesh)], 1);
+            SetInstanceTransform(instID, prim->transform);
+            RtcGeomIDToPrimitiveIndexMap[instID] = i;
         }
 
         rtcCommit(RtcScene);
 
-        return true;
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        return rtcDeviceGetError(device) == RTC_NO_ERROR;
+    };
+
+    LM_IMPL_F(Refit) = [this](const Scene* scene_) -> bool
+    {
+        if (!RtcScene)
+        {
+            return Build(scene_);
+        }
+
+        const auto* scene = static_cast<const Scene3*>(scene_);
+        for (const auto& kv : RtcGeomIDToPrimitiveIndexMap)
+        {
+            SetInstanceTransform(kv.first, scene->PrimitiveAt((int)(kv.second))->transform);
+            rtcUpdate(RtcScene, kv.first);
+        }
+
+        rtcCommit(RtcScene);
+        return rtcDeviceGetError(device) == RTC_NO_ERROR;
     };
 
     LM_IMPL_F(Intersect) = [this](const Scene* scene_, const Ray& ray, Intersection& isect, Float minT, Float maxT) -> bool
@@ -154,47 +265,141 @@ public:
             return false;
         }
 
-        // Create RTCRay
-        RTCRay rtcRay;
-        rtcRay.org[0] = (float)(ray.o[0]);
-        rtcRay.org[1] = (float)(ray.o[1]);
-        rtcRay.org[2] = (float)(ray.o[2]);
-        rtcRay.dir[0] = (float)(ray.d[0]);
-        rtcRay.dir[1] = (float)(ray.d[1]);
-        rtcRay.dir[2] = (float)(ray.d[2]);
-        rtcRay.tnear  = (float)(minT);
-        rtcRay.tfar   = (float)(maxT);
-        rtcRay.geomID = RTC_INVALID_GEOMETRY_ID;
-        rtcRay.primID = RTC_INVALID_GEOMETRY_ID;
-        rtcRay.instID = RTC_INVALID_GEOMETRY_ID;
-        rtcRay.mask = 0xFFFFFFFF;
-        rtcRay.time = 0;
-
         // Intersection query
+        auto rtcRay = CreateRTCRay(ray, minT, maxT);
         FPUtils::PushFPControl();
         FPUtils::DisableFPControl();
         rtcIntersect(RtcScene, rtcRay);
         FPUtils::PopFPControl();
+
+        return CreateIntersection(scene_, ray, rtcRay, isect);
+    };
+
+    LM_IMPL_F(Occluded) = [this](const Scene* scene_, const Ray& ray, Float minT, Float maxT) -> bool
+    {
+        if (minT > maxT)
+        {
+            return false;
+        }
+
+        // Occlusion query. geomID is set to 0 if the ray is occluded.
+        auto rtcRay = CreateRTCRay(ray, minT, maxT);
+        FPUtils::PushFPControl();
+        FPUtils::DisableFPControl();
+        rtcOccluded(RtcScene, rtcRay);
+        FPUtils::PopFPControl();
+
+        return (unsigned int)(rtcRay.geomID) != RTC_INVALID_GEOMETRY_ID;
+    };
+
+    LM_IMPL_F(IntersectStream) = [this](const Scene* scene_, int numRays, const Ray* rays, const Float* minT, const Float* maxT, Intersection* isects, bool* hits) -> void
+    {
+        // Rays with tnear > tfar are ignored by Embree
+        auto& rtcRays = RTCRayBuffer(numRays);
+        for (int i = 0; i < numRays; i++)
+        {
+            rtcRays[i] = CreateRTCRay(rays[i], minT[i], maxT[i]);
+        }
+
+        // Stream query
+        RTCIntersectContext context;
+        context.flags = RTC_INTERSECT_INCOHERENT;
+        context.userRayExt = nullptr;
+        FPUtils::PushFPControl();
+        FPUtils::DisableFPControl();
+        rtcIntersect1M(RtcScene, &context, rtcRays.data(), numRays, sizeof(RTCRay));
+        FPUtils::PopFPControl();
+
+        for (int i = 0; i < numRays; i++)
+        {
+            hits[i] = minT[i] <= maxT[i] && CreateIntersection(scene_, rays[i], rtcRays[i], isects[i]);
+        }
+    };
+
+    LM_IMPL_F(OccludedStream) = [this](const Scene* scene_, int numRays, const Ray* rays, const Float* minT, const Float* maxT, bool* occluded) -> void
+    {
+        auto& rtcRays = RTCRayBuffer(numRays);
+        for (int i = 0; i < numRays; i++)
+        {
+            rtcRays[i] = CreateRTCRay(rays[i], minT[i], maxT[i]);
+        }
+
+        RTCIntersectContext context;
+        context.flags = RTC_INTERSECT_INCOHERENT;
+        context.userRayExt = nullptr;
+        FPUtils::PushFPControl();
+        FPUtils::DisableFPControl();
+        rtcOccluded1M(RtcScene, &context, rtcRays.data(), numRays, sizeof(RTCRay));
+        FPUtils::PopFPControl();
+
+        for (int i = 0; i < numRays; i++)
+        {
+            occluded[i] = minT[i] <= maxT[i] && (unsigned int)(rtcRays[i].geomID) != RTC_INVALID_GEOMETRY_ID;
+        }
+    };
+
+private:
+
+    auto ReleaseScenes() -> void
+    {
+        if (RtcScene) rtcDeleteScene(RtcScene);
+        for (auto meshScene : meshScenes_) rtcDeleteScene(meshScene);
+        RtcScene = nullptr;
+        meshScenes_.clear();
+        RtcGeomIDToPrimitiveIndexMap.clear();
+    }
+
+    auto SetInstanceTransform(unsigned int instID, const Mat4& transform) -> void
+    {
+        // Column major 4x4 matrix
+        LM_ALIGN_16 float xfm[16];
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                xfm[4 * i + j] = (float)(transform[i][j]);
+            }
+        }
+        rtcSetTransform2(RtcScene, instID, RTC_MATRIX_COLUMN_MAJOR_ALIGNED16, xfm, 0);
+    }
+
+    auto CreateIntersection(const Scene* scene_, const Ray& ray, const RTCRay& rtcRay, Intersection& isect) const -> bool
+    {
         if ((unsigned int)(rtcRay.geomID) == RTC_INVALID_GEOMETRY_ID)
         {
             return false;
         }
 
-        // Fill in the intersection structure
+        // Fill in the intersection structure.
+        // The primitive is identified by the instance ID.
         const auto* scene = static_cast<const Scene3*>(scene_);
         isect = IntersectionUtils::CreateTriangleIntersection(
-            scene->PrimitiveAt((int)(RtcGeomIDToPrimitiveIndexMap.at(rtcRay.geomID))),
+            scene->PrimitiveAt((int)(RtcGeomIDToPrimitiveIndexMap.at(rtcRay.instID))),
             ray.o + ray.d * (Float)(rtcRay.tfar),
             Vec2(rtcRay.u, rtcRay.v),
             rtcRay.primID);
 
         return true;
-    };
+    }
+
+    // Per-thread buffer for the ray streams
+    static auto RTCRayBuffer(int numRays) -> std::vector<RTCRay>&
+    {
+        static thread_local std::vector<RTCRay> buffer;
+        if ((int)(buffer.size()) < numRays)
+        {
+            buffer.resize(numRays);
+        }
+        return buffer;
+    }
 
 private:
 
     RTCDevice device = nullptr;
     RTCScene RtcScene = nullptr;
+    RTCSceneFlags sceneFlags_ = (RTCSceneFlags)(0);
+    std::vector<RTCScene> meshScenes_;
+    std::vector<std::vector<float>> positions_;     // Padded float copies of the positions of the meshes (double precision geometry only)
     std::unordered_map<unsigned int, size_t> RtcGeomIDToPrimitiveIndexMap;
 
 };
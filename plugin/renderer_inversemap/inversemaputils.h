@@ -27,6 +27,7 @@
 #include <lightmetrica/lightmetrica.h>
 #include <lightmetrica/detail/parallel.h>
 #include <lightmetrica/detail/subpathsampler.h>
+#include <lightmetrica/detail/arena.h>
 #include <fstream>
 #include <boost/format.hpp>
 #include <boost/optional.hpp>
@@ -42,7 +43,7 @@ LM_NAMESPACE_BEGIN
 
 struct Subpath
 {
-    std::vector<SubpathSampler::PathVertex> vertices;
+    ArenaVector<SubpathSampler::PathVertex> vertices;
 
     auto SampleSubpathFromEndpoint(const Scene3* scene, Random* rng, TransportDirection transDir, int maxNumVertices) -> int
     {
@@ -105,7 +106,7 @@ struct Subpath
 
 struct Path
 {
-    std::vector<SubpathSampler::PathVertex> vertices;
+    ArenaVector<SubpathSampler::PathVertex> vertices;
 
     auto PathType() const -> std::string
     {
@@ -986,6 +987,26 @@ public:
     }
 
     static auto SampleTriangleMesh_Inverse(const Primitive* primitive, const Distribution1D& dist, const SurfaceGeometry& geom) -> Vec2
+    {
+        auto u = UniformSampleTriangle_Inverse(primitive, geom);
+
+        // Inverse of 'SampleReuse'
+        const int i = geom.faceindex;
+        u[0] = Math::Clamp(dist.EvaluateCDF(i) + dist.EvaluatePDF(i) * u[0], 0_f, 1_f);
+
+        return u;
+    }
+
+    ///! Inverse of 'SampleTriangleMesh' with the alias table. `uSel` selects one of the slots mapped to the triangle.
+    static auto SampleTriangleMesh_Inverse(const Primitive* primitive, const AliasTable& dist, const SurfaceGeometry& geom, Float uSel) -> Vec2
+    {
+        auto u = UniformSampleTriangle_Inverse(primitive, geom);
+        u[0] = dist.SampleReuse_Inverse(geom.faceindex, u[0], uSel);
+        return u;
+    }
+
+    ///! Inverse of 'UniformSampleTriangle' for the position on the triangle of the mesh.
+    static auto UniformSampleTriangle_Inverse(const Primitive* primitive, const SurfaceGeometry& geom) -> Vec2
     {
         const int i = geom.faceindex;
         const auto* mesh = primitive->mesh;
@@ -1020,9 +1041,6 @@ public:
         u[0] = Math::Clamp((1_f - b.x) * (1_f - b.x), 0_f, 1_f);
         u[1] = Math::Clamp(b.y / (1_f - b.x), 0_f, 1_f);
 
-        // Inverse of 'SampleReuse'
-        u[0] = Math::Clamp(dist.EvaluateCDF(i) + dist.EvaluatePDF(i) * u[0], 0_f, 1_f);
-
         return u;
     }
 
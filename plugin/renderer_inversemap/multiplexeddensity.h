@@ -253,12 +253,14 @@ public:
                     // Area light
                     assert(std::strcmp(v->primitive->emitter->implName, "Light_Area") == 0);
                     const auto* triAreaDist = v->primitive->light->TriAreaDist();
-                    const auto u = InversemapUtils::SampleTriangleMesh_Inverse(v->primitive, *triAreaDist, v->geom);
+                    const auto u = triAreaDist
+                        ? InversemapUtils::SampleTriangleMesh_Inverse(v->primitive, *triAreaDist, v->geom)
+                        : InversemapUtils::SampleTriangleMesh_Inverse(v->primitive, *v->primitive->light->TriAreaAliasTable(), v->geom, rng->Next());
                     us.push_back(u[0]);
                     us.push_back(u[1]);
 
                     // Light selection prob
-                    const auto uC = Math::Clamp((rng->Next() + (Float)v->primitive->lightIndex) / scene->NumLightPrimitives(), 0_f, 1_f);
+                    const auto uC = scene->SampleEmitter_Inverse(v->primitive, rng->Next(), rng->Next());
                     us.push_back(uC);
                 }
             }
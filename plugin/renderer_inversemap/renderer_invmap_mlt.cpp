@@ -146,6 +146,7 @@ public:
                 Random rng;
                 Film::UniquePtr film{ nullptr, nullptr };
                 Path currP;
+                MemoryArena arena;      // Reset per mutation
                 #if INVERSEMAP_MLT_DEBUG_OUTPUT_AVE_ACC
                 long long acceptCount = 0;
                 std::vector<long long> acceptCountPerTech;
@@ -208,6 +209,7 @@ public:
             const auto processed = Parallel::For({ renderTime_ < 0 ? ParallelMode::Samples : ParallelMode::Time, numMutations_, renderTime_ }, [&](long long index, int threadid, bool init) -> void
             {
                 auto& ctx = contexts[threadid];
+                MemoryArena::Scope arenaScope(ctx.arena);
 
                 // --------------------------------------------------------------------------------
                 
@@ -309,6 +311,14 @@ public:
                 }
                 #pragma endregion
             });
+
+            // --------------------------------------------------------------------------------
+
+            {
+                long long numHeapAllocations = 0;
+                for (const auto& ctx : contexts) { numHeapAllocations += ctx.arena.NumHeapAllocations(); }
+                LM_LOG_INFO(boost::str(boost::format("Heap allocations for proposed paths: %d (%.3e per mutation)") % numHeapAllocations % ((double)(numHeapAllocations) / processed)));
+            }
             
             // --------------------------------------------------------------------------------
 
@@ -235,6 +235,7 @@ public:
                 Random rng;
                 Film::UniquePtr film{ nullptr, nullptr };
                 Path currP;
+                MemoryArena arena;      // Reset per mutation
             };
             std::vector<Context> contexts(Parallel::GetNumThreads());
             for (auto& ctx : contexts)
@@ -335,6 +336,7 @@ public:
             Parallel::For(numMutations_, [&](long long index, int threadid, bool init) -> void
             {
                 auto& ctx = contexts[threadid];
+                MemoryArena::Scope arenaScope(ctx.arena);
 
                 // --------------------------------------------------------------------------------
                 
@@ -484,6 +486,14 @@ public:
                 #endif
             });
 
+            // --------------------------------------------------------------------------------
+
+            {
+                long long numHeapAllocations = 0;
+                for (const auto& ctx : contexts) { numHeapAllocations += ctx.arena.NumHeapAllocations(); }
+                LM_LOG_INFO(boost::str(boost::format("Heap allocations for proposed paths: %d (%.3e per mutation)") % numHeapAllocations % ((double)(numHeapAllocations) / numMutations_)));
+            }
+
             
             // --------------------------------------------------------------------------------
 
@@ -158,14 +158,17 @@ public:
             {
                 auto& p = aimesh->mVertices[i];
                 auto& n = aimesh->mNormals[i];
-                ps_.push_back(Float(p.x));
-                ps_.push_back(Float(p.y));
-                ps_.push_back(Float(p.z));
-                ns_.push_back(Float(n.x));
-                ns_.push_back(Float(n.y));
-                ns_.push_back(Float(n.z));
+                ps_.push_back(GeomFloat(p.x));
+                ps_.push_back(GeomFloat(p.y));
+                ps_.push_back(GeomFloat(p.z));
+                ns_.push_back(GeomFloat(n.x));
+                ns_.push_back(GeomFloat(n.y));
+                ns_.push_back(GeomFloat(n.z));
             }
 
+            // Padding after the last position (see TriangleMesh::Positions)
+            ps_.push_back(0);
+
             #pragma endregion
 
             // --------------------------------------------------------------------------------
@@ -177,8 +180,8 @@ public:
                 for (unsigned int i = 0; i < aimesh->mNumVertices; i++)
                 {
                     auto& uv = aimesh->mTextureCoords[0][i];
-                    ts_.push_back(Float(uv.x));
-                    ts_.push_back(Float(uv.y));
+                    ts_.push_back(GeomFloat(uv.x));
+                    ts_.push_back(GeomFloat(uv.y));
                 }
             }
 
@@ -211,16 +214,16 @@ public:
 
     LM_IMPL_F(NumVertices) = [this]() -> int { return (int)(ps_.size()) / 3; };
     LM_IMPL_F(NumFaces)    = [this]() -> int { return (int)(fs_.size()) / 3; };
-    LM_IMPL_F(Positions)   = [this]() -> const Float* { return ps_.data(); };
-    LM_IMPL_F(Normals)     = [this]() -> const Float* { return ns_.data(); };
-    LM_IMPL_F(Texcoords)   = [this]() -> const Float* { return ts_.data(); };
+    LM_IMPL_F(Positions)   = [this]() -> const GeomFloat* { return ps_.data(); };
+    LM_IMPL_F(Normals)     = [this]() -> const GeomFloat* { return ns_.data(); };
+    LM_IMPL_F(Texcoords)   = [this]() -> const GeomFloat* { return ts_.data(); };
     LM_IMPL_F(Faces)       = [this]() -> const unsigned int* { return fs_.data(); };
 
 protected:
 
-    std::vector<Float> ps_;
-    std::vector<Float> ns_;
-    std::vector<Float> ts_;
+    std::vector<GeomFloat> ps_;
+    std::vector<GeomFloat> ns_;
+    std::vector<GeomFloat> ts_;
     std::vector<unsigned int> fs_;
 
 };
@@ -36,7 +36,7 @@ LM_NAMESPACE_BEGIN
 struct BVHNode
 {
     bool isleaf;
-    Bound bound;
+    GeomBound bound;
 
     union
     {
@@ -123,10 +123,12 @@ public:
             nodes_.emplace_back(new BVHNode);
             auto* node = nodes_[idx].get();
 
+            Bound bound;
             for (int i = begin; i < end; i++)
             {
-                node->bound = Math::Union(node->bound, bounds_[i]);
+                bound = Math::Union(bound, bounds_[i]);
             }
+            node->bound = GeomBound(bound);
 
             // Leaf node
             const int LeafNumNodes = 10;
@@ -30,13 +30,15 @@
 #include <lightmetrica/primitive.h>
 #include <lightmetrica/bound.h>
 #include <lightmetrica/intersectionutils.h>
+#include <lightmetrica/property.h>
+#include <tbb/tbb.h>
 
 LM_NAMESPACE_BEGIN
 
 struct BVHNode
 {
     bool isleaf;
-    Bound bound;
+    GeomBound bound;
 
     union
     {
@@ -62,8 +64,12 @@ public:
 
 public:
 
-    LM_IMPL_F(Initialize) = [this](const PropertyNode*) -> bool
+    LM_IMPL_F(Initialize) = [this](const PropertyNode* prop) -> bool
     {
+        if (prop)
+        {
+            rebuildThreshold_ = prop->ChildAs<Float>("refit_rebuild_threshold", 2_f);
+        }
         return true;
     };
 
@@ -76,6 +82,7 @@ public:
 
         #pragma region Create triaccels
 
+        triangles_.clear();
         int np = scene->NumPrimitives();
         for (int i = 0; i < np; i++)
         {
@@ -84,29 +91,13 @@ public:
             if (mesh)
             {
                 // Enumerate all triangles and create triaccels
-                const auto* ps = mesh->Positions();
-                const auto* faces = mesh->Faces();
                 for (int j = 0; j < mesh->NumFaces(); j++)
                 {
                     // Create a triaccel
                     triangles_.push_back(TriAccelTriangle());
                     triangles_.back().faceIndex = j;
                     triangles_.back().primIndex = i;
-                    unsigned int i1 = faces[3 * j];
-                    unsigned int i2 = faces[3 * j + 1];
-                    unsigned int i3 = faces[3 * j + 2];
-                    Vec3 p1(prim->transform * Vec4(ps[3 * i1], ps[3 * i1 + 1], ps[3 * i1 + 2], 1_f));
-                    Vec3 p2(prim->transform * Vec4(ps[3 * i2], ps[3 * i2 + 1], ps[3 * i2 + 2], 1_f));
-                    Vec3 p3(prim->transform * Vec4(ps[3 * i3], ps[3 * i3 + 1], ps[3 * i3 + 2], 1_f));
-                    triangles_.back().Load(p1, p2, p3);
-
-                    Bound bound;
-                    bound = Math::Union(bound, p1);
-                    bound = Math::Union(bound, p2);
-                    bound = Math::Union(bound, p3);
-                    bound.min -= Vec3(Math::Eps());
-                    bound.max += Vec3(Math::Eps());
-                    bounds_.push_back(bound);
+                    bounds_.push_back(LoadTriangle(scene, triangles_.back()));
                 }
             }
         }
@@ -124,14 +115,15 @@ public:
             auto* node = nodes_[idx].get();
 
             // Current bound & centroid bound
-            node->bound = Bound();
+            Bound bound;
             Bound centroldBound;
             for (int i = begin; i < end; i++)
             {
-                const auto bound = bounds_[indices_[i]];
-                node->bound = Math::Union(node->bound, bound);
-                centroldBound = Math::Union(centroldBound, bound.Centroid());
+                const auto& b = bounds_[indices_[i]];
+                bound = Math::Union(bound, b);
+                centroldBound = Math::Union(centroldBound, b.Centroid());
             }
+            node->bound = GeomBound(bound);
 
             // Leaf node
             const int LeafNumNodes = 10;
@@ -144,7 +136,7 @@ public:
             }
 
             // Select longest axis
-            int axis = node->bound.LongestAxis();
+            int axis = bound.LongestAxis();
 
             // Sort along the longest axis with bin sort
             // In order to guarantee the existence of a split position we utilizes centroid bounds
@@ -187,7 +179,7 @@ public:
                 const Float Cb = 0.125_f;
                 const Float C1 = n1 > 0 ? bound1.SurfaceArea() * n1 : 0_f;
                 const Float C2 = n2 > 0 ? bound2.SurfaceArea() * n2 : 0_f;
-                costs[split] = Cb + (C1 + C2) / node->bound.SurfaceArea();
+                costs[split] = Cb + (C1 + C2) / bound.SurfaceArea();
             }
 
             // Find minimum partition with minimum local cost
@@ -228,6 +220,89 @@ public:
 
         // --------------------------------------------------------------------------------
 
+        buildSAHCost_ = EvaluateSAHCost();
+
+        // --------------------------------------------------------------------------------
+
+        return true;
+    };
+
+    LM_IMPL_F(Refit) = [this](const Scene* scene_) -> bool
+    {
+        const auto* scene = static_cast<const Scene3*>(scene_);
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Update triaccels
+
+        std::vector<Bound> bounds_(triangles_.size());
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, triangles_.size()), [&](const tbb::blocked_range<size_t>& range) -> void
+        {
+            for (size_t i = range.begin(); i != range.end(); i++)
+            {
+                bounds_[i] = LoadTriangle(scene, triangles_[i]);
+            }
+        });
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Refit node bounds
+
+        // Bottom-up update of the node bounds.
+        // Subtrees near the root are processed in parallel.
+        const int ParallelDepth = 8;
+        const std::function<void(int, int)> Refit_ = [&](int idx, int depth) -> void
+        {
+            auto* node = nodes_[idx].get();
+            if (node->isleaf)
+            {
+                Bound bound;
+                for (int i = node->leaf.begin; i < node->leaf.end; i++)
+                {
+                    bound = Math::Union(bound, bounds_[indices_[i]]);
+                }
+                node->bound = GeomBound(bound);
+                return;
+            }
+
+            if (depth < ParallelDepth)
+            {
+                tbb::parallel_invoke(
+                    [&]() { Refit_(node->internal.child1, depth + 1); },
+                    [&]() { Refit_(node->internal.child2, depth + 1); });
+            }
+            else
+            {
+                Refit_(node->internal.child1, depth + 1);
+                Refit_(node->internal.child2, depth + 1);
+            }
+
+            node->bound = GeomBound(Math::Union(nodes_[node->internal.child1]->bound.ToBound(), nodes_[node->internal.child2]->bound.ToBound()));
+        };
+
+        Refit_(0, 0);
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Rebuild if the quality is degraded
+
+        const auto cost = EvaluateSAHCost();
+        LM_LOG_INFO(boost::str(boost::format("SAH cost: %.3f (build: %.3f)") % cost % buildSAHCost_));
+        if (rebuildThreshold_ > 0_f && cost > buildSAHCost_ * rebuildThreshold_)
+        {
+            LM_LOG_INFO("SAH cost exceeds the threshold. Rebuilding");
+            LM_LOG_INDENTER();
+            return Build(scene_);
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
         return true;
     };
 
@@ -287,11 +362,55 @@ public:
         return true;
     };
 
+private:
+
+    // Loads the triaccel with the current transform of the primitive and returns its bound
+    static auto LoadTriangle(const Scene3* scene, TriAccelTriangle& tri) -> Bound
+    {
+        const auto* prim = scene->PrimitiveAt(tri.primIndex);
+        const auto* ps = prim->mesh->Positions();
+        const auto* faces = prim->mesh->Faces();
+        unsigned int i1 = faces[3 * tri.faceIndex];
+        unsigned int i2 = faces[3 * tri.faceIndex + 1];
+        unsigned int i3 = faces[3 * tri.faceIndex + 2];
+        Vec3 p1(prim->transform * Vec4(ps[3 * i1], ps[3 * i1 + 1], ps[3 * i1 + 2], 1_f));
+        Vec3 p2(prim->transform * Vec4(ps[3 * i2], ps[3 * i2 + 1], ps[3 * i2 + 2], 1_f));
+        Vec3 p3(prim->transform * Vec4(ps[3 * i3], ps[3 * i3 + 1], ps[3 * i3 + 2], 1_f));
+        tri.Load(p1, p2, p3);
+
+        Bound bound;
+        bound = Math::Union(bound, p1);
+        bound = Math::Union(bound, p2);
+        bound = Math::Union(bound, p3);
+        bound.min -= Vec3(Math::Eps());
+        bound.max += Vec3(Math::Eps());
+        return bound;
+    }
+
+    // SAH cost of the tree normalized by the surface area of the root node
+    auto EvaluateSAHCost() const -> Float
+    {
+        const Float Cb = 0.125_f;
+        const std::function<Float(int)> Cost_ = [&](int idx) -> Float
+        {
+            const auto* node = nodes_[idx].get();
+            if (node->isleaf)
+            {
+                return node->leaf.end > node->leaf.begin ? node->bound.ToBound().SurfaceArea() * (Float)(node->leaf.end - node->leaf.begin) : 0_f;
+            }
+            return Cb * node->bound.ToBound().SurfaceArea() + Cost_(node->internal.child1) + Cost_(node->internal.child2);
+        };
+        const Float rootArea = nodes_[0]->bound.ToBound().SurfaceArea();
+        return rootArea > 0_f ? Cost_(0) / rootArea : 0_f;
+    }
+
 private:
 
     std::vector<TriAccelTriangle> triangles_;
     std::vector<std::unique_ptr<BVHNode>> nodes_;
     std::vector<int> indices_;                      // Triangle indices
+    Float buildSAHCost_ = 0_f;                      // SAH cost of the tree after the last build
+    Float rebuildThreshold_ = 2_f;                  // Rebuild in Refit if the SAH cost exceeds this ratio to buildSAHCost_ (<= 0 to disable)
 
 };
 
@@ -36,7 +36,7 @@ LM_NAMESPACE_BEGIN
 struct BVHNode
 {
     bool isleaf;
-    Bound bound;
+    GeomBound bound;
 
     union
     {
@@ -124,11 +124,12 @@ public:
             auto* node = nodes_[idx].get();
 
             // Current bound
-            node->bound = Bound();
+            Bound bound;
             for (int i = begin; i < end; i++)
             {
-                node->bound = Math::Union(node->bound, bounds_[indices_[i]]);
+                bound = Math::Union(bound, bounds_[indices_[i]]);
             }
+            node->bound = GeomBound(bound);
 
             // Leaf node
             const int LeafNumNodes = 10;
@@ -144,7 +145,7 @@ public:
             int mid = 0;
             {
                 // Select longest axis
-                int axis = node->bound.LongestAxis();
+                int axis = bound.LongestAxis();
 
                 // Sort along the longest axis
                 std::sort(indices_.begin() + begin, indices_.begin() + end, [&](int v1, int v2) -> bool
@@ -195,7 +196,7 @@ public:
                     const Float Cb = 0.125_f;
                     const int n1 = split + 1;
                     const int n2 = end - begin - split - 1;
-                    costs[split] = Cb + (bound1.SurfaceArea() * n1 + bound2.SurfaceArea() * n2) / node->bound.SurfaceArea();
+                    costs[split] = Cb + (bound1.SurfaceArea() * n1 + bound2.SurfaceArea() * n2) / bound.SurfaceArea();
                 }
 
                 // Select split position with minimum local cost
@@ -30,8 +30,12 @@
 #include <lightmetrica/primitive.h>
 #include <lightmetrica/bound.h>
 #include <lightmetrica/intersectionutils.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/logger.h>
+#include <lightmetrica/detail/sbvhbuilder.h>
+#include <tbb/tbb.h>
 
-#if LM_SSE && LM_SINGLE_PRECISION
+#if LM_SSE && LM_SINGLE_PRECISION_GEOMETRY
 
 LM_NAMESPACE_BEGIN
 
@@ -42,12 +46,12 @@ struct Ray4
 
     Ray4(const Ray& ray)
     {
-        ox = _mm_set1_ps(ray.o.x);
-        oy = _mm_set1_ps(ray.o.y);
-        oz = _mm_set1_ps(ray.o.z);
-        dx = _mm_set1_ps(ray.d.x);
-        dy = _mm_set1_ps(ray.d.y);
-        dz = _mm_set1_ps(ray.d.z);
+        ox = _mm_set1_ps((float)(ray.o.x));
+        oy = _mm_set1_ps((float)(ray.o.y));
+        oz = _mm_set1_ps((float)(ray.o.z));
+        dx = _mm_set1_ps((float)(ray.d.x));
+        dy = _mm_set1_ps((float)(ray.d.y));
+        dz = _mm_set1_ps((float)(ray.d.z));
     }
 };
 
@@ -88,13 +92,26 @@ public:
 
     auto SetBound(int childIndex, const Bound& bound) -> void
     {
+        // Rounded outward if the bound is computed in double precision
+        const GeomBound b(bound);
         for (int axis = 0; axis < 3; axis++)
         {
-            reinterpret_cast<float*>(&(bounds[0][axis]))[childIndex] = bound.min[axis];
-            reinterpret_cast<float*>(&(bounds[1][axis]))[childIndex] = bound.max[axis];
+            reinterpret_cast<float*>(&(bounds[0][axis]))[childIndex] = b.min[axis];
+            reinterpret_cast<float*>(&(bounds[1][axis]))[childIndex] = b.max[axis];
         }
     }
 
+    auto GetBound(int childIndex) const -> Bound
+    {
+        Bound bound;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            bound.min[axis] = reinterpret_cast<const float*>(&(bounds[0][axis]))[childIndex];
+            bound.max[axis] = reinterpret_cast<const float*>(&(bounds[1][axis]))[childIndex];
+        }
+        return bound;
+    }
+
     auto CreateLeaf(int childIndex, unsigned int size, unsigned int offset) -> void
     {
         if (size == 0)
@@ -144,20 +161,34 @@ public:
 
 public:
 
-    LM_IMPL_F(Initialize) = [this](const PropertyNode*) -> bool
+    LM_IMPL_F(Initialize) = [this](const PropertyNode* prop) -> bool
     {
+        if (prop)
+        {
+            rebuildThreshold_ = prop->ChildAs<Float>("refit_rebuild_threshold", 2_f);
+            builder_ = prop->ChildAs<std::string>("builder", "sah_bin");
+            if (builder_ != "sah_bin" && builder_ != "sbvh")
+            {
+                LM_LOG_ERROR("Invalid builder: " + builder_);
+                return false;
+            }
+            sbvhParams_.alpha = prop->ChildAs<Float>("alpha", 1e-5_f);
+            sbvhParams_.maxDuplication = prop->ChildAs<Float>("max_duplication", 0.5_f);
+        }
         return true;
     };
 
     LM_IMPL_F(Build) = [this](const Scene* scene_) -> bool
     {
         std::vector<Bound> bounds_;
+        std::vector<Vec3> ps;
         const auto* scene = static_cast<const Scene3*>(scene_);
 
         // --------------------------------------------------------------------------------
 
         #pragma region Create triaccels
 
+        triangles_.clear();
         int np = scene->NumPrimitives();
         for (int i = 0; i < np; i++)
         {
@@ -166,29 +197,15 @@ public:
             if (mesh)
             {
                 // Enumerate all triangles and create triaccels
-                const auto* ps = mesh->Positions();
-                const auto* faces = mesh->Faces();
                 for (int j = 0; j < mesh->NumFaces(); j++)
                 {
                     // Create a triaccel
                     triangles_.push_back(TriAccelTriangle());
                     triangles_.back().faceIndex = j;
                     triangles_.back().primIndex = i;
-                    unsigned int i1 = faces[3 * j];
-                    unsigned int i2 = faces[3 * j + 1];
-                    unsigned int i3 = faces[3 * j + 2];
-                    Vec3 p1(prim->transform * Vec4(ps[3 * i1], ps[3 * i1 + 1], ps[3 * i1 + 2], 1_f));
-                    Vec3 p2(prim->transform * Vec4(ps[3 * i2], ps[3 * i2 + 1], ps[3 * i2 + 2], 1_f));
-                    Vec3 p3(prim->transform * Vec4(ps[3 * i3], ps[3 * i3 + 1], ps[3 * i3 + 2], 1_f));
-                    triangles_.back().Load(p1, p2, p3);
-
-                    Bound bound;
-                    bound = Math::Union(bound, p1);
-                    bound = Math::Union(bound, p2);
-                    bound = Math::Union(bound, p3);
-                    bound.min -= Vec3(Math::Eps());
-                    bound.max += Vec3(Math::Eps());
-                    bounds_.push_back(bound);
+                    Vec3 p[3];
+                    bounds_.push_back(LoadTriangle(scene, triangles_.back(), p));
+                    ps.insert(ps.end(), p, p + 3);
                 }
             }
         }
@@ -382,11 +399,185 @@ public:
             #pragma endregion
         };
 
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Collapse SBVH
+
+        // Converts the binary SBVH into QBVH with the same scheme as Build_,
+        // i.e., creating new intermediate nodes in every two levels.
+        // The builder limits the number of references in a leaf to 16.
+        std::vector<SBVHNode> sbvhNodes;
+        const std::function<void(int, int, int, int)> Collapse_ = [&](int idx, int parent, int child, int depth) -> void
+        {
+            const auto& sbvhNode = sbvhNodes[idx];
+
+            #pragma region Create leaf node
+
+            if (sbvhNode.isleaf)
+            {
+                const auto& node = nodes_[parent];
+                node->SetBound(child, sbvhNode.bound.ToBound());
+                node->CreateLeaf(child, sbvhNode.leaf.end - sbvhNode.leaf.begin, sbvhNode.leaf.begin);
+                return;
+            }
+
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Current & child node indices
+
+            int current;
+            int child1;
+            int child2;
+
+            if (depth % 2 == 1)
+            {
+                current = parent;
+                child1 = child;
+                child2 = child + 1;
+            }
+            else
+            {
+                current = (int)(nodes_.size());
+                nodes_.emplace_back(new QBVHNode, [](QBVHNode* p){ delete p; });
+                nodes_[parent]->CreateIntermediateNode(child, current);
+                nodes_[parent]->SetBound(child, sbvhNode.bound.ToBound());
+                child1 = 0;
+                child2 = 2;
+            }
+
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            Collapse_(sbvhNode.internal.child1, current, child1, depth + 1);
+            Collapse_(sbvhNode.internal.child2, current, child2, depth + 1);
+        };
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
         nodes_.clear();
-        indices_.assign(triangles_.size(), 0);
-        std::iota(indices_.begin(), indices_.end(), 0);
         nodes_.emplace_back(new QBVHNode, [](QBVHNode* p) { delete p; });
-        Build_(0, (int)(triangles_.size()), 0, 0, 0);
+        if (builder_ == "sbvh")
+        {
+            auto params = sbvhParams_;
+            params.maxLeafSize = 16;
+            SBVHBuilder::Build(ps, params, sbvhNodes, indices_);
+            Collapse_(0, 0, 0, 0);
+        }
+        else
+        {
+            indices_.assign(triangles_.size(), 0);
+            std::iota(indices_.begin(), indices_.end(), 0);
+            Build_(0, (int)(triangles_.size()), 0, 0, 0);
+        }
+
+        // --------------------------------------------------------------------------------
+
+        buildSAHCost_ = EvaluateSAHCost();
+
+        // --------------------------------------------------------------------------------
+
+        return true;
+    };
+
+    LM_IMPL_F(Refit) = [this](const Scene* scene_) -> bool
+    {
+        const auto* scene = static_cast<const Scene3*>(scene_);
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Update triaccels
+
+        std::vector<Bound> bounds_(triangles_.size());
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, triangles_.size()), [&](const tbb::blocked_range<size_t>& range) -> void
+        {
+            for (size_t i = range.begin(); i != range.end(); i++)
+            {
+                bounds_[i] = LoadTriangle(scene, triangles_[i]);
+            }
+        });
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Refit node bounds
+
+        // Bottom-up update of the bounds of the child nodes.
+        // Returns the bound of the node. Subtrees near the root are processed in parallel.
+        const int ParallelDepth = 4;
+        const std::function<Bound(int, int)> Refit_ = [&](int idx, int depth) -> Bound
+        {
+            const auto& node = nodes_[idx];
+            Bound childBounds[4];
+            const auto RefitChild = [&](int child) -> void
+            {
+                const int data = node->children[child];
+                if (data == QBVHNode::EmptyLeafNode)
+                {
+                    return;
+                }
+                if (data < 0)
+                {
+                    unsigned int size, offset;
+                    QBVHNode::ExtractLeafData(data, size, offset);
+                    for (unsigned int i = offset; i < offset + size; i++)
+                    {
+                        childBounds[child] = Math::Union(childBounds[child], bounds_[indices_[i]]);
+                    }
+                }
+                else
+                {
+                    childBounds[child] = Refit_(data, depth + 1);
+                }
+            };
+
+            if (depth < ParallelDepth)
+            {
+                tbb::parallel_for(0, 4, RefitChild);
+            }
+            else
+            {
+                for (int child = 0; child < 4; child++)
+                {
+                    RefitChild(child);
+                }
+            }
+
+            Bound bound;
+            for (int child = 0; child < 4; child++)
+            {
+                if (node->children[child] != QBVHNode::EmptyLeafNode)
+                {
+                    node->SetBound(child, childBounds[child]);
+                    bound = Math::Union(bound, childBounds[child]);
+                }
+            }
+            return bound;
+        };
+
+        Refit_(0, 0);
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Rebuild if the quality is degraded
+
+        const auto cost = EvaluateSAHCost();
+        LM_LOG_INFO(boost::str(boost::format("SAH cost: %.3f (build: %.3f)") % cost % buildSAHCost_));
+        if (rebuildThreshold_ > 0_f && cost > buildSAHCost_ * rebuildThreshold_)
+        {
+            LM_LOG_INFO("SAH cost exceeds the threshold. Rebuilding");
+            LM_LOG_INDENTER();
+            return Build(scene_);
+        }
 
         #pragma endregion
 
@@ -496,11 +687,83 @@ public:
         return hit;
     };
 
+private:
+
+    // Loads the triaccel with the current transform of the primitive and returns its bound.
+    // The transformed positions are stored to ps if specified.
+    static auto LoadTriangle(const Scene3* scene, TriAccelTriangle& tri, Vec3* ps_ = nullptr) -> Bound
+    {
+        const auto* prim = scene->PrimitiveAt(tri.primIndex);
+        const auto* ps = prim->mesh->Positions();
+        const auto* faces = prim->mesh->Faces();
+        unsigned int i1 = faces[3 * tri.faceIndex];
+        unsigned int i2 = faces[3 * tri.faceIndex + 1];
+        unsigned int i3 = faces[3 * tri.faceIndex + 2];
+        Vec3 p1(prim->transform * Vec4(ps[3 * i1], ps[3 * i1 + 1], ps[3 * i1 + 2], 1_f));
+        Vec3 p2(prim->transform * Vec4(ps[3 * i2], ps[3 * i2 + 1], ps[3 * i2 + 2], 1_f));
+        Vec3 p3(prim->transform * Vec4(ps[3 * i3], ps[3 * i3 + 1], ps[3 * i3 + 2], 1_f));
+        tri.Load(p1, p2, p3);
+        if (ps_)
+        {
+            ps_[0] = p1;
+            ps_[1] = p2;
+            ps_[2] = p3;
+        }
+
+        Bound bound;
+        bound = Math::Union(bound, p1);
+        bound = Math::Union(bound, p2);
+        bound = Math::Union(bound, p3);
+        bound.min -= Vec3(Math::Eps());
+        bound.max += Vec3(Math::Eps());
+        return bound;
+    }
+
+    // SAH cost of the tree normalized by the surface area of the scene
+    auto EvaluateSAHCost() const -> Float
+    {
+        const Float Cb = 0.125_f;
+        Bound rootBound;
+        const std::function<Float(int)> Cost_ = [&](int idx) -> Float
+        {
+            const auto& node = nodes_[idx];
+            Float cost = 0_f;
+            for (int child = 0; child < 4; child++)
+            {
+                const int data = node->children[child];
+                if (data == QBVHNode::EmptyLeafNode)
+                {
+                    continue;
+                }
+                const auto bound = node->GetBound(child);
+                if (idx == 0) { rootBound = Math::Union(rootBound, bound); }
+                if (data < 0)
+                {
+                    unsigned int size, offset;
+                    QBVHNode::ExtractLeafData(data, size, offset);
+                    cost += bound.SurfaceArea() * (Float)(size);
+                }
+                else
+                {
+                    cost += Cb * bound.SurfaceArea() + Cost_(data);
+                }
+            }
+            return cost;
+        };
+        const Float cost = Cost_(0);
+        const Float rootArea = rootBound.SurfaceArea();
+        return rootArea > 0_f ? cost / rootArea : 0_f;
+    }
+
 private:
 
     std::vector<TriAccelTriangle> triangles_;
     std::vector<std::unique_ptr<QBVHNode, std::function<void(QBVHNode*)>>> nodes_;
     std::vector<int> indices_;
+    Float buildSAHCost_ = 0_f;          // SAH cost of the tree after the last build
+    Float rebuildThreshold_ = 2_f;      // Rebuild in Refit if the SAH cost exceeds this ratio to buildSAHCost_ (<= 0 to disable)
+    std::string builder_ = "sah_bin";   // Builder type (sah_bin or sbvh)
+    SBVHBuilder::Params sbvhParams_;
 
 };
 
@@ -0,0 +1,188 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch.h>
+#include <lightmetrica/accel3.h>
+#include <lightmetrica/scene3.h>
+#include <lightmetrica/trianglemesh.h>
+#include <lightmetrica/triaccel.h>
+#include <lightmetrica/primitive.h>
+#include <lightmetrica/bound.h>
+#include <lightmetrica/intersectionutils.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/detail/sbvhbuilder.h>
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    Spatial split BVH.
+    Binary BVH constructed with SBVHBuilder.
+    Refit is not implemented because the clipped bounds of the split references
+    cannot be updated without the original split planes; the scene rebuilds instead.
+*/
+class Accel_SBVH final : public Accel3
+{
+public:
+
+    LM_IMPL_CLASS(Accel_SBVH, Accel3);
+
+public:
+
+    LM_IMPL_F(Initialize) = [this](const PropertyNode* prop) -> bool
+    {
+        if (prop)
+        {
+            params_.numBins = prop->ChildAs<int>("num_bins", 32);
+            params_.alpha = prop->ChildAs<Float>("alpha", 1e-5_f);
+            params_.maxDuplication = prop->ChildAs<Float>("max_duplication", 0.5_f);
+        }
+        return true;
+    };
+
+    LM_IMPL_F(Build) = [this](const Scene* scene_) -> bool
+    {
+        std::vector<Vec3> ps;
+        const auto* scene = static_cast<const Scene3*>(scene_);
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Create triaccels
+
+        triangles_.clear();
+        int np = scene->NumPrimitives();
+        for (int i = 0; i < np; i++)
+        {
+            const auto* prim = scene->PrimitiveAt(i);
+            const auto* mesh = prim->mesh;
+            if (mesh)
+            {
+                const auto* positions = mesh->Positions();
+                const auto* faces = mesh->Faces();
+                for (int j = 0; j < mesh->NumFaces(); j++)
+                {
+                    unsigned int i1 = faces[3 * j];
+                    unsigned int i2 = faces[3 * j + 1];
+                    unsigned int i3 = faces[3 * j + 2];
+                    Vec3 p1(prim->transform * Vec4(positions[3 * i1], positions[3 * i1 + 1], positions[3 * i1 + 2], 1_f));
+                    Vec3 p2(prim->transform * Vec4(positions[3 * i2], positions[3 * i2 + 1], positions[3 * i2 + 2], 1_f));
+                    Vec3 p3(prim->transform * Vec4(positions[3 * i3], positions[3 * i3 + 1], positions[3 * i3 + 2], 1_f));
+                    ps.push_back(p1);
+                    ps.push_back(p2);
+                    ps.push_back(p3);
+
+                    // Create a triaccel
+                    triangles_.push_back(TriAccelTriangle());
+                    triangles_.back().faceIndex = j;
+                    triangles_.back().primIndex = i;
+                    triangles_.back().Load(p1, p2, p3);
+                }
+            }
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Build BVH
+
+        SBVHBuilder::Build(ps, params_, nodes_, indices_);
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        return true;
+    };
+
+    LM_IMPL_F(Intersect) = [this](const Scene* scene_, const Ray& ray, Intersection& isect, Float minT, Float maxT) -> bool
+    {
+        int minIndex;
+        Vec2 minB;
+
+        const std::function<bool(int)> Intersect_ = [&](int idx) -> bool
+        {
+            const auto& node = nodes_.at(idx);
+
+            // Check intersection with bound
+            if (!node.bound.Intersect(ray, minT, maxT))
+            {
+                return false;
+            }
+
+            // Check intersection with objects in the leaf
+            // The same triangle can be tested more than once due to the duplicated references,
+            // which is harmless because maxT is updated on every hit.
+            if (node.isleaf)
+            {
+                bool hit = false;
+                for (int i = node.leaf.begin; i < node.leaf.end; i++)
+                {
+                    Float t;
+                    Vec2 b;
+                    if (triangles_[indices_[i]].Intersect(ray, minT, maxT, b[0], b[1], t))
+                    {
+                        hit = true;
+                        maxT = t;
+                        minIndex = indices_[i];
+                        minB = b;
+                    }
+                }
+                return hit;
+            }
+
+            // Check intersection with child nodes
+            bool hit = false;
+            hit |= Intersect_(node.internal.child1);
+            hit |= Intersect_(node.internal.child2);
+            return hit;
+        };
+
+        if (!Intersect_(0))
+        {
+            return false;
+        }
+
+        const auto* scene = static_cast<const Scene3*>(scene_);
+        isect = IntersectionUtils::CreateTriangleIntersection(
+            scene->PrimitiveAt(triangles_[minIndex].primIndex),
+            ray.o + ray.d * maxT,
+            minB,
+            triangles_[minIndex].faceIndex);
+
+        return true;
+    };
+
+private:
+
+    SBVHBuilder::Params params_;
+    std::vector<TriAccelTriangle> triangles_;
+    std::vector<SBVHNode> nodes_;
+    std::vector<int> indices_;                      // Triangle indices (can contain duplicates)
+
+};
+
+LM_COMPONENT_REGISTER_IMPL(Accel_SBVH, "accel::sbvh");
+
+LM_NAMESPACE_END
@@ -0,0 +1,478 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch.h>
+#include <lightmetrica/detail/sbvhbuilder.h>
+#include <lightmetrica/logger.h>
+
+LM_NAMESPACE_BEGIN
+
+namespace
+{
+    // Reference to a triangle with the (possibly clipped) bound
+    struct Reference
+    {
+        int index;
+        Bound bound;
+    };
+
+    // Split candidate
+    struct Split
+    {
+        Float cost = Math::Inf();
+        int axis = -1;
+        int bin = -1;           // Split after this bin
+        bool spatial = false;
+        Bound bound1;           // Bound of the left child
+        Bound bound2;           // Bound of the right child
+        int n1 = 0;             // Number of references in the left child
+        int n2 = 0;             // Number of references in the right child
+    };
+
+    auto IntersectBound(const Bound& a, const Bound& b) -> Bound
+    {
+        Bound r;
+        r.min = Math::Max(a.min, b.min);
+        r.max = Math::Min(a.max, b.max);
+        return r;
+    }
+
+    auto IsValid(const Bound& b) -> bool
+    {
+        return b.min.x <= b.max.x && b.min.y <= b.max.y && b.min.z <= b.max.z;
+    }
+
+    auto SurfaceArea(const Bound& b) -> Float
+    {
+        return IsValid(b) ? b.SurfaceArea() : 0_f;
+    }
+
+    // Bound of the part of the triangle inside the slab [lo, hi] along the axis
+    auto ClipTriangle(const Vec3* p, int axis, Float lo, Float hi) -> Bound
+    {
+        Bound b;
+        for (int i = 0; i < 3; i++)
+        {
+            const auto& v1 = p[i];
+            const auto& v2 = p[(i + 1) % 3];
+            const Float p1 = v1[axis];
+            const Float p2 = v2[axis];
+            if (lo <= p1 && p1 <= hi)
+            {
+                b = Math::Union(b, v1);
+            }
+            for (const Float plane : { lo, hi })
+            {
+                if ((p1 < plane && plane < p2) || (p2 < plane && plane < p1))
+                {
+                    const Float t = (plane - p1) / (p2 - p1);
+                    auto v = v1 + (v2 - v1) * t;
+                    v[axis] = plane;
+                    b = Math::Union(b, v);
+                }
+            }
+        }
+        if (IsValid(b))
+        {
+            b.min -= Vec3(Math::Eps());
+            b.max += Vec3(Math::Eps());
+        }
+        return b;
+    }
+}
+
+auto SBVHBuilder::Build(const std::vector<Vec3>& ps, const Params& params, std::vector<SBVHNode>& nodes, std::vector<int>& indices) -> void
+{
+    nodes.clear();
+    indices.clear();
+
+    // --------------------------------------------------------------------------------
+
+    #pragma region Initial references
+
+    const int numTriangles = (int)(ps.size() / 3);
+    std::vector<Reference> rootRefs(numTriangles);
+    Bound rootBound;
+    for (int i = 0; i < numTriangles; i++)
+    {
+        auto& ref = rootRefs[i];
+        ref.index = i;
+        ref.bound = Math::Union(ref.bound, ps[3 * i]);
+        ref.bound = Math::Union(ref.bound, ps[3 * i + 1]);
+        ref.bound = Math::Union(ref.bound, ps[3 * i + 2]);
+        ref.bound.min -= Vec3(Math::Eps());
+        ref.bound.max += Vec3(Math::Eps());
+        rootBound = Math::Union(rootBound, ref.bound);
+    }
+
+    #pragma endregion
+
+    // --------------------------------------------------------------------------------
+
+    #pragma region Build
+
+    const Float Cb = 0.125_f;
+    const int NumBins = std::max(2, params.numBins);
+    const Float rootArea = SurfaceArea(rootBound);
+    const long long maxNumRefs = (long long)(numTriangles * (1_f + std::max(0_f, params.maxDuplication)));
+    long long numRefs = numTriangles;
+
+    const auto BinIndex = [&](Float v, Float min, Float max) -> int
+    {
+        return std::max(0, std::min((int)((v - min) / (max - min) * NumBins), NumBins - 1));
+    };
+
+    const std::function<int(std::vector<Reference>&, int)> Build_ = [&](std::vector<Reference>& refs, int depth) -> int
+    {
+        const int idx = (int)(nodes.size());
+        nodes.emplace_back();
+
+        #pragma region Compute current bound
+
+        Bound bound;
+        Bound centroidBound;
+        for (const auto& ref : refs)
+        {
+            bound = Math::Union(bound, ref.bound);
+            centroidBound = Math::Union(centroidBound, ref.bound.Centroid());
+        }
+        nodes[idx].bound = GeomBound(bound);
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Create leaf node
+
+        const auto CreateLeaf = [&]() -> int
+        {
+            auto& node = nodes[idx];
+            node.isleaf = true;
+            node.leaf.begin = (int)(indices.size());
+            for (const auto& ref : refs)
+            {
+                indices.push_back(ref.index);
+            }
+            node.leaf.end = (int)(indices.size());
+            return idx;
+        };
+
+        const int n = (int)(refs.size());
+        if (n < params.leafNumNodes)
+        {
+            return CreateLeaf();
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Find best object split
+
+        const Float area = SurfaceArea(bound);
+        Split best;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const Float min = centroidBound.min[axis];
+            const Float max = centroidBound.max[axis];
+            if (max <= min)
+            {
+                continue;
+            }
+
+            std::vector<Bound> bounds(NumBins);
+            std::vector<int> counts(NumBins, 0);
+            for (const auto& ref : refs)
+            {
+                const int i = BinIndex(ref.bound.Centroid()[axis], min, max);
+                bounds[i] = Math::Union(bounds[i], ref.bound);
+                counts[i]++;
+            }
+
+            // Sweep from right to left
+            std::vector<Bound> rightBounds(NumBins);
+            std::vector<int> rightCounts(NumBins, 0);
+            for (int i = NumBins - 1; i > 0; i--)
+            {
+                rightBounds[i - 1] = Math::Union(i < NumBins - 1 ? rightBounds[i] : Bound(), bounds[i]);
+                rightCounts[i - 1] = (i < NumBins - 1 ? rightCounts[i] : 0) + counts[i];
+            }
+
+            // Sweep from left to right
+            Bound leftBound;
+            int leftCount = 0;
+            for (int i = 0; i < NumBins - 1; i++)
+            {
+                leftBound = Math::Union(leftBound, bounds[i]);
+                leftCount += counts[i];
+                if (leftCount == 0 || rightCounts[i] == 0)
+                {
+                    continue;
+                }
+                const Float cost = Cb + (SurfaceArea(leftBound) * leftCount + SurfaceArea(rightBounds[i]) * rightCounts[i]) / area;
+                if (cost < best.cost)
+                {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.bin = i;
+                    best.spatial = false;
+                    best.bound1 = leftBound;
+                    best.bound2 = rightBounds[i];
+                    best.n1 = leftCount;
+                    best.n2 = rightCounts[i];
+                }
+            }
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Find best spatial split
+
+        // Spatial splits are only considered if the children of the object split overlap significantly
+        const bool trySpatial =
+            numRefs < maxNumRefs && rootArea > 0_f &&
+            (best.axis < 0 || SurfaceArea(IntersectBound(best.bound1, best.bound2)) / rootArea > params.alpha);
+
+        if (trySpatial)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                const Float min = bound.min[axis];
+                const Float max = bound.max[axis];
+                if (max <= min)
+                {
+                    continue;
+                }
+
+                const Float w = (max - min) / NumBins;
+                std::vector<Bound> bounds(NumBins);
+                std::vector<int> entries(NumBins, 0);
+                std::vector<int> exits(NumBins, 0);
+                for (const auto& ref : refs)
+                {
+                    const int b1 = BinIndex(ref.bound.min[axis], min, max);
+                    const int b2 = BinIndex(ref.bound.max[axis], min, max);
+                    if (b1 == b2)
+                    {
+                        bounds[b1] = Math::Union(bounds[b1], ref.bound);
+                    }
+                    else
+                    {
+                        for (int i = b1; i <= b2; i++)
+                        {
+                            const Float lo = min + w * i;
+                            const Float hi = i == NumBins - 1 ? max : lo + w;
+                            const auto clipped = IntersectBound(ClipTriangle(&ps[3 * ref.index], axis, lo, hi), ref.bound);
+                            if (IsValid(clipped))
+                            {
+                                bounds[i] = Math::Union(bounds[i], clipped);
+                            }
+                        }
+                    }
+                    entries[b1]++;
+                    exits[b2]++;
+                }
+
+                // Sweep from right to left
+                std::vector<Bound> rightBounds(NumBins);
+                std::vector<int> rightCounts(NumBins, 0);
+                for (int i = NumBins - 1; i > 0; i--)
+                {
+                    rightBounds[i - 1] = Math::Union(i < NumBins - 1 ? rightBounds[i] : Bound(), bounds[i]);
+                    rightCounts[i - 1] = (i < NumBins - 1 ? rightCounts[i] : 0) + exits[i];
+                }
+
+                // Sweep from left to right
+                Bound leftBound;
+                int leftCount = 0;
+                for (int i = 0; i < NumBins - 1; i++)
+                {
+                    leftBound = Math::Union(leftBound, bounds[i]);
+                    leftCount += entries[i];
+                    if (leftCount == 0 || rightCounts[i] == 0)
+                    {
+                        continue;
+                    }
+                    const Float cost = Cb + (SurfaceArea(leftBound) * leftCount + SurfaceArea(rightBounds[i]) * rightCounts[i]) / area;
+                    if (cost < best.cost)
+                    {
+                        best.cost = cost;
+                        best.axis = axis;
+                        best.bin = i;
+                        best.spatial = true;
+                        best.bound1 = leftBound;
+                        best.bound2 = rightBounds[i];
+                        best.n1 = leftCount;
+                        best.n2 = rightCounts[i];
+                    }
+                }
+            }
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Create leaf node if splitting is not beneficial
+
+        if (n <= params.maxLeafSize && (best.axis < 0 || best.cost > (Float)(n)))
+        {
+            return CreateLeaf();
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Partition
+
+        std::vector<Reference> refs1;
+        std::vector<Reference> refs2;
+
+        if (best.axis >= 0 && !best.spatial)
+        {
+            #pragma region Object split
+
+            const Float min = centroidBound.min[best.axis];
+            const Float max = centroidBound.max[best.axis];
+            for (const auto& ref : refs)
+            {
+                (BinIndex(ref.bound.Centroid()[best.axis], min, max) <= best.bin ? refs1 : refs2).push_back(ref);
+            }
+
+            #pragma endregion
+        }
+        else if (best.axis >= 0 && best.spatial)
+        {
+            #pragma region Spatial split
+
+            const int axis = best.axis;
+            const Float min = bound.min[axis];
+            const Float max = bound.max[axis];
+            const Float pos = min + (max - min) / NumBins * (best.bin + 1);
+
+            // Bounds and counts of the children updated with the reference unsplitting
+            auto bound1 = best.bound1;
+            auto bound2 = best.bound2;
+            int n1 = best.n1;
+            int n2 = best.n2;
+
+            for (const auto& ref : refs)
+            {
+                const int b1 = BinIndex(ref.bound.min[axis], min, max);
+                const int b2 = BinIndex(ref.bound.max[axis], min, max);
+                if (b2 <= best.bin)
+                {
+                    refs1.push_back(ref);
+                    continue;
+                }
+                if (b1 > best.bin)
+                {
+                    refs2.push_back(ref);
+                    continue;
+                }
+
+                // Straddling reference. Compare the costs of unsplitting the reference
+                const Float Csplit = SurfaceArea(bound1) * n1 + SurfaceArea(bound2) * n2;
+                const Float C1 = SurfaceArea(Math::Union(bound1, ref.bound)) * n1 + SurfaceArea(bound2) * (n2 - 1);
+                const Float C2 = SurfaceArea(bound1) * (n1 - 1) + SurfaceArea(Math::Union(bound2, ref.bound)) * n2;
+                const auto clipped1 = IntersectBound(ClipTriangle(&ps[3 * ref.index], axis, -Math::Inf(), pos), ref.bound);
+                const auto clipped2 = IntersectBound(ClipTriangle(&ps[3 * ref.index], axis, pos, Math::Inf()), ref.bound);
+                const bool canSplit = numRefs < maxNumRefs && IsValid(clipped1) && IsValid(clipped2);
+                if ((C1 < Csplit && C1 <= C2) || (!canSplit && C1 <= C2))
+                {
+                    bound1 = Math::Union(bound1, ref.bound);
+                    n2--;
+                    refs1.push_back(ref);
+                }
+                else if (C2 < Csplit || !canSplit)
+                {
+                    bound2 = Math::Union(bound2, ref.bound);
+                    n1--;
+                    refs2.push_back(ref);
+                }
+                else
+                {
+                    numRefs++;
+                    refs1.push_back({ ref.index, clipped1 });
+                    refs2.push_back({ ref.index, clipped2 });
+                }
+            }
+
+            #pragma endregion
+        }
+
+        if (refs1.empty() || refs2.empty())
+        {
+            #pragma region Fallback to median split
+
+            refs1.clear();
+            refs2.clear();
+            const int axis = centroidBound.LongestAxis();
+            const auto mid = refs.begin() + n / 2;
+            std::nth_element(refs.begin(), mid, refs.end(), [&](const Reference& r1, const Reference& r2) -> bool
+            {
+                return r1.bound.Centroid()[axis] < r2.bound.Centroid()[axis];
+            });
+            refs1.assign(refs.begin(), mid);
+            refs2.assign(mid, refs.end());
+
+            #pragma endregion
+        }
+
+        // Release the memory of the current node before recursion
+        std::vector<Reference>().swap(refs);
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Process child nodes recursively
+
+        const int child1 = Build_(refs1, depth + 1);
+        const int child2 = Build_(refs2, depth + 1);
+        auto& node = nodes[idx];
+        node.isleaf = false;
+        node.internal.child1 = child1;
+        node.internal.child2 = child2;
+
+        #pragma endregion
+
+        return idx;
+    };
+
+    Build_(rootRefs, 0);
+
+    #pragma endregion
+
+    // --------------------------------------------------------------------------------
+
+    LM_LOG_INFO(boost::str(boost::format("SBVH: %d nodes, %d references (%d triangles)") % nodes.size() % indices.size() % numTriangles));
+}
+
+LM_NAMESPACE_END
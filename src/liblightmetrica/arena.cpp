@@ -0,0 +1,114 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch.h>
+#include <lightmetrica/detail/arena.h>
+
+LM_NAMESPACE_BEGIN
+
+namespace
+{
+    thread_local MemoryArena* CurrentArena = nullptr;
+}
+
+MemoryArena::Scope::Scope(MemoryArena& arena)
+    : prev_(CurrentArena)
+{
+    // Nested scope of the active arena keeps the allocations of the outer scope
+    if (CurrentArena != &arena)
+    {
+        arena.Reset();
+    }
+    CurrentArena = &arena;
+}
+
+MemoryArena::Scope::~Scope()
+{
+    CurrentArena = prev_;
+}
+
+// --------------------------------------------------------------------------------
+
+MemoryArena::MemoryArena(size_t blockSize)
+    : blockSize_(blockSize)
+{}
+
+MemoryArena::~MemoryArena()
+{}
+
+auto MemoryArena::Allocate(size_t size, size_t align) -> void*
+{
+    // Find a block with enough space
+    while (true)
+    {
+        if (currBlock_ < blocks_.size())
+        {
+            const auto& block = blocks_[currBlock_];
+            const auto base = reinterpret_cast<std::uintptr_t>(block.data.get());
+            const auto offset = ((base + currOffset_ + align - 1) & ~(std::uintptr_t)(align - 1)) - base;
+            if (offset + size <= block.size)
+            {
+                currOffset_ = offset + size;
+                return block.data.get() + offset;
+            }
+            currBlock_++;
+            currOffset_ = 0;
+            continue;
+        }
+        AllocateBlock(std::max(blockSize_, size + align));
+    }
+}
+
+auto MemoryArena::Reset() -> void
+{
+    // Merge the blocks if the last use overflowed the first block
+    if (currBlock_ > 0 && blocks_.size() > 1)
+    {
+        size_t total = 0;
+        for (const auto& block : blocks_) { total += block.size; }
+        blocks_.clear();
+        blockSize_ = total;
+        AllocateBlock(total);
+    }
+
+    currBlock_ = 0;
+    currOffset_ = 0;
+    numResets_++;
+    numResetsSinceHeapAllocation_++;
+}
+
+auto MemoryArena::Current() -> MemoryArena*
+{
+    return CurrentArena;
+}
+
+auto MemoryArena::AllocateBlock(size_t size) -> void
+{
+    blocks_.push_back(Block{ std::unique_ptr<unsigned char[]>(new unsigned char[size]), size });
+    numHeapAllocations_++;
+    numResetsSinceHeapAllocation_ = 0;
+}
+
+LM_NAMESPACE_END
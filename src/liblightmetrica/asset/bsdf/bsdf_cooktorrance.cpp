@@ -115,7 +115,7 @@ public:
         const Float D = EvaluateNormalDist(H);
         const Float G = EvalauteShadowMaskingFunc(localWi, localWo, H);
         const auto  F = EvaluateFrConductor(Math::Dot(localWi, H));
-        const auto  R = texR_ ? SPD::FromRGB(texR_->Evaluate(geom.uv)) : R_;
+        const auto  R = texR_ ? SPD::FromRGB(texR_->EvaluateOnSurface(geom)) : R_;
         return R * D * G * F / (4_f * Math::LocalCos(localWi)) / Math::LocalCos(localWo) * BSDFUtils::ShadingNormalCorrection(geom, wi, wo, transDir);
     };
 
@@ -160,7 +160,7 @@ public:
     };
 
     LM_IMPL_F(Reflectance) = [this]() -> SPD { return R_; };
-    LM_IMPL_F(Reflectance2) = [this](const SurfaceGeometry& geom) -> SPD { return texR_ ? SPD::FromRGB(texR_->Evaluate(geom.uv)) : R_; };
+    LM_IMPL_F(Reflectance2) = [this](const SurfaceGeometry& geom) -> SPD { return texR_ ? SPD::FromRGB(texR_->EvaluateOnSurface(geom)) : R_; };
 
 private:
 
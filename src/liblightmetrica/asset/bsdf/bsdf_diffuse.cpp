@@ -99,7 +99,7 @@ public:
             return SPD();
         }
 
-        const auto R = texR_ ? SPD::FromRGB(texR_->Evaluate(geom.uv)) : R_;
+        const auto R = texR_ ? SPD::FromRGB(texR_->EvaluateOnSurface(geom)) : R_;
         return R * Math::InvPi() * BSDFUtils::ShadingNormalCorrection(geom, wi, wo, transDir);
     };
 
@@ -114,7 +114,7 @@ public:
     };
 
     LM_IMPL_F(Reflectance) = [this]() -> SPD { return R_; };
-    LM_IMPL_F(Reflectance2) = [this](const SurfaceGeometry& geom) -> SPD { return texR_ ? SPD::FromRGB(texR_->Evaluate(geom.uv)) : R_; };
+    LM_IMPL_F(Reflectance2) = [this](const SurfaceGeometry& geom) -> SPD { return texR_ ? SPD::FromRGB(texR_->EvaluateOnSurface(geom)) : R_; };
 
     LM_IMPL_F(Serialize) = [this](std::ostream& stream) -> bool
     {
@@ -304,6 +304,11 @@ public:
         return pY * width_ + pX;
     };
 
+    LM_IMPL_F(GetPixel) = [this](int x, int y) -> SPD
+    {
+        return SPD::FromRGB(data_[y * width_ + x]);
+    };
+
     LM_IMPL_F(Serialize) = [this](std::ostream& stream) -> bool
     {
         {
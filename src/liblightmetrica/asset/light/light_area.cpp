@@ -48,11 +48,26 @@ public:
     {
         // Load parameters
         Le_ = SPD::FromRGB(prop->ChildAs<Vec3>("Le", Vec3()));
+        const auto triangleDist = prop->ChildAs<std::string>("triangle_dist", "cdf");
+        if (triangleDist != "cdf" && triangleDist != "alias")
+        {
+            LM_LOG_ERROR("Invalid triangle distribution: " + triangleDist);
+            return false;
+        }
+        useAlias_ = triangleDist == "alias";
 
         // Create distribution according to triangle area
+        // The alias table samples a triangle in O(1) at the cost of the larger memory
         mesh_ = primitive->mesh;
         transform_ = primitive->transform;
-        TriangleUtils::CreateTriangleAreaDist(primitive, dist_, invArea_);
+        if (useAlias_)
+        {
+            TriangleUtils::CreateTriangleAreaDist(primitive, aliasDist_, invArea_);
+        }
+        else
+        {
+            TriangleUtils::CreateTriangleAreaDist(primitive, dist_, invArea_);
+        }
 
         return true;
     };
@@ -66,13 +81,13 @@ public:
 
     LM_IMPL_F(SamplePositionGivenPreviousPosition) = [this](const Vec2& u, const SurfaceGeometry& geomPrev, SurfaceGeometry& geom) -> void
     {
-        TriangleUtils::SampleTriangleMesh(u, mesh_, transform_, dist_, geom);
+        SampleTriangleMesh(u, geom);
     };
 
     LM_IMPL_F(SamplePositionAndDirection) = [this](const Vec2& u, const Vec2& u2, SurfaceGeometry& geom, Vec3& wo) -> void
     {
         // Position
-        TriangleUtils::SampleTriangleMesh(u, mesh_, transform_, dist_, geom);
+        SampleTriangleMesh(u, geom);
 
         // Direction
         const auto localWo = Sampler::CosineSampleHemisphere(u);
@@ -131,7 +146,7 @@ public:
         {
             cereal::PortableBinaryOutputArchive oa(stream);
             int meshID = mesh_ ? mesh_->Index() : -1;
-            oa(Le_, dist_, invArea_, meshID, transform_);
+            oa(Le_, useAlias_, dist_, aliasDist_, invArea_, meshID, transform_);
         }
         return true;
     };
@@ -141,7 +156,7 @@ public:
         int meshID;
         {
             cereal::PortableBinaryInputArchive ia(stream);
-            ia(Le_, dist_, invArea_, meshID, transform_);
+            ia(Le_, useAlias_, dist_, aliasDist_, invArea_, meshID, transform_);
         }
         if (meshID >= 0)
         {
@@ -151,12 +166,29 @@ public:
         return true;
     };
 
-    LM_IMPL_F(TriAreaDist) = [this]() -> Distribution1D* { return &dist_; };
+    LM_IMPL_F(TriAreaDist) = [this]() -> Distribution1D* { return useAlias_ ? nullptr : &dist_; };
+    LM_IMPL_F(TriAreaAliasTable) = [this]() -> AliasTable* { return useAlias_ ? &aliasDist_ : nullptr; };
+
+private:
+
+    auto SampleTriangleMesh(const Vec2& u, SurfaceGeometry& geom) const -> void
+    {
+        if (useAlias_)
+        {
+            TriangleUtils::SampleTriangleMesh(u, mesh_, transform_, aliasDist_, geom);
+        }
+        else
+        {
+            TriangleUtils::SampleTriangleMesh(u, mesh_, transform_, dist_, geom);
+        }
+    }
 
 private:
 
     SPD Le_;
+    bool useAlias_;
     Distribution1D dist_;
+    AliasTable aliasDist_;
     Float invArea_;
     const TriangleMesh* mesh_ = nullptr;
     Mat4 transform_;
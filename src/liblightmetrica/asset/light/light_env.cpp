@@ -36,6 +36,7 @@
 #include <lightmetrica/texture.h>
 #include <lightmetrica/assets.h>
 #include <lightmetrica/detail/serial.h>
+#include <tbb/tbb.h>
 
 LM_NAMESPACE_BEGIN
 
@@ -47,8 +48,9 @@ public:
 
 public:
 
-    EmitterShape_EnvLight(const SphereBound& bound)
+    EmitterShape_EnvLight(const SphereBound& bound, const Primitive* primitive)
         : bound_(bound)
+        , primitive_(primitive)
     {}
 
 public:
@@ -76,7 +78,7 @@ public:
         isect.geom.p = c + isect.geom.dpdu * Math::Dot(isect.geom.dpdu, p - c) + isect.geom.dpdv * Math::Dot(isect.geom.dpdv, p - c);
 
         // Primitive
-        //isect.primitive = primitive_;
+        isect.primitive = primitive_;
 
         return true;
     };
@@ -89,7 +91,7 @@ public:
 public:
 
     SphereBound bound_;
-    //const Primitive* primitive_;
+    const Primitive* primitive_;
 
 };
 
@@ -108,7 +110,7 @@ public:
             std::string id;
             prop->ChildAs("envmap", id);
             envmap_ = static_cast<const Texture*>(assets->AssetByIDAndType(id, "texture", primitive));
-            if (envmap_) return false;
+            if (!envmap_) return false;
         }
         else
         {
@@ -116,6 +118,12 @@ public:
         }
 
         rotate_ = prop->ChildAs<Float>("rotate", 0_f);
+        distRes_ = prop->ChildAs<int>("dist_res", 512);
+        if (distRes_ < 2)
+        {
+            LM_LOG_ERROR("Invalid resolution of the distribution: " + std::to_string(distRes_));
+            return false;
+        }
 
         return true;
     };
@@ -125,7 +133,26 @@ public:
         const auto* scene = static_cast<const Scene3*>(scene_);
         bound_ = scene->GetSphereBound();
         invArea_ = 1_f / (Math::Pi() * bound_.radius * bound_.radius);
-        emitterShape_.reset(new EmitterShape_EnvLight(bound_));
+
+        // Find the primitive associated with the light, which is also necessary after deserialization
+        const Primitive* primitive = nullptr;
+        for (int i = 0; i < scene->NumPrimitives(); i++)
+        {
+            if (scene->PrimitiveAt(i)->light == this)
+            {
+                primitive = scene->PrimitiveAt(i);
+                break;
+            }
+        }
+        emitterShape_.reset(new EmitterShape_EnvLight(bound_, primitive));
+
+        // Build the distribution for the importance sampling
+        // The distribution is rebuilt on deserialization because PostLoad is called again
+        rotation_ = Mat3(Math::Rotate(Math::Radians(rotate_), Vec3(0_f, 1_f, 0_f)));
+        if (envmap_)
+        {
+            BuildDist();
+        }
         return true;
     };
 
@@ -140,7 +167,7 @@ public:
     LM_IMPL_F(SamplePositionGivenPreviousPosition) = [this](const Vec2& u, const SurfaceGeometry& geomPrev, SurfaceGeometry& geom) -> void
     {
         // First sample a direction from p_\omega(wo)
-        const auto d = Sampler::UniformSampleSphere(u);
+        const auto d = SampleDirectionToEnv(u);
 
         // Calculate intersection point on virtual disk
         Ray ray = { geomPrev.p, d };
@@ -159,7 +186,7 @@ public:
     LM_IMPL_F(SamplePositionAndDirection) = [this](const Vec2& u, const Vec2& u2, SurfaceGeometry& geom, Vec3& wo) -> void
     {
         // Sample a direction from p_\omega(wo)
-        const auto d = Sampler::UniformSampleSphere(u);
+        const auto d = SampleDirectionToEnv(u);
 
         // Sample a point on the virtual disk
         const auto p = Sampler::UniformConcentricDiskSample(u2) * bound_.radius;
@@ -180,7 +207,7 @@ public:
     LM_IMPL_F(EvaluateDirectionPDF) = [this](const SurfaceGeometry& geom, int queryType, const Vec3& wi, const Vec3& wo, bool evalDelta) -> PDFVal
     {
         // |cos(geom.sn, wo)| is always 1
-        return PDFVal(PDFMeasure::ProjectedSolidAngle, Sampler::UniformSampleSpherePDFSA().v);
+        return PDFVal(PDFMeasure::ProjectedSolidAngle, DirectionToEnvPDF(-wo));
     };
 
     // Evaluate p_A(x | \omega_o)
@@ -192,8 +219,9 @@ public:
     // Evaluate p_A(x | x_prev)
     LM_IMPL_F(EvaluatePositionGivenPreviousPositionPDF) = [this](const SurfaceGeometry& geom, const SurfaceGeometry& geomPrev, bool evalDelta) -> PDFVal
     {
-        if (evalDelta) { return PDFVal(PDFMeasure::Area, 0_f); }
-        return Sampler::UniformSampleSpherePDFSA().ConvertToArea(geomPrev, geom);
+        // The position is not sampled from a delta distribution,
+        // so the PDF is also evaluated with evalDelta for MIS with the direction sampling
+        return PDFVal(PDFMeasure::SolidAngle, DirectionToEnvPDF(Math::Normalize(geom.p - geomPrev.p))).ConvertToArea(geomPrev, geom);
     };
 
     LM_IMPL_F(EvaluateDirection) = [this](const SurfaceGeometry& geom, int types, const Vec3& wi, const Vec3& wo, TransportDirection transDir, bool evalDelta) -> SPD
@@ -205,12 +233,7 @@ public:
 
         if (envmap_)
         {
-            // Convert ray direction to the uv coordinates of light probe
-            // See http://www.pauldebevec.com/Probes/ for details
-            const auto d = -Vec3(Math::Rotate(Math::Radians(rotate_), Vec3(0_f, 1_f, 0_f)) * Vec4(wo.x, wo.y, wo.z, 0_f));
-            const auto r = (1_f / Math::Pi()) * Math::Acos(Math::Clamp(d.z, -1_f, 1_f)) / Math::Sqrt(d.x*d.x + d.y*d.y);
-            const auto uv = (Vec2(d.x, -d.y) * r + Vec2(1_f)) * .5_f;
-            return SPD::FromRGB(envmap_->Evaluate(uv));
+            return SPD::FromRGB(EvaluateEnvmap(rotation_ * -wo));
         }
 
         return Le_;
@@ -241,7 +264,7 @@ public:
         {
             cereal::PortableBinaryOutputArchive oa(stream);
             int envmapID = envmap_ ? envmap_->Index() : -1;
-            oa(bound_, invArea_, Le_, envmapID, rotate_);
+            oa(bound_, invArea_, Le_, envmapID, rotate_, distRes_);
         }
         return true;
     };
@@ -251,7 +274,7 @@ public:
         int envmapID;
         {
             cereal::PortableBinaryInputArchive ia(stream);
-            ia(bound_, invArea_, Le_, envmapID, rotate_);
+            ia(bound_, invArea_, Le_, envmapID, rotate_, distRes_);
         }
         if (envmapID >= 0)
         {
@@ -261,6 +284,114 @@ public:
         return true;
     };
 
+private:
+
+    // Evaluate the envmap with the direction in the local coordinates of the light probe
+    auto EvaluateEnvmap(const Vec3& d) const -> Vec3
+    {
+        // Convert the direction to the uv coordinates of light probe
+        // See http://www.pauldebevec.com/Probes/ for details
+        const auto l = Math::Sqrt(d.x*d.x + d.y*d.y);
+        const auto r = l > 0_f ? (1_f / Math::Pi()) * Math::Acos(Math::Clamp(d.z, -1_f, 1_f)) / l : 0_f;
+        const auto uv = (Vec2(d.x, -d.y) * r + Vec2(1_f)) * .5_f;
+        return envmap_->Evaluate(uv);
+    }
+
+    // Build the piecewise constant distribution over the spherical coordinates (theta, phi)
+    // of the local directions, proportional to the luminance weighted by sin(theta).
+    // Each cell is supersampled so that small bright regions (e.g., the sun) are not missed.
+    auto BuildDist() -> void
+    {
+        const int W = distRes_;
+        const int H = distRes_ / 2;
+        const int SS = 4;
+        std::vector<Float> weights(W * H);
+        tbb::parallel_for(0, H, [&](int y) -> void
+        {
+            for (int x = 0; x < W; x++)
+            {
+                Float sum = 0_f;
+                for (int sy = 0; sy < SS; sy++)
+                {
+                    for (int sx = 0; sx < SS; sx++)
+                    {
+                        const auto theta = Math::Pi() * (Float(y) + (Float(sy) + .5_f) / SS) / Float(H);
+                        const auto phi = 2_f * Math::Pi() * (Float(x) + (Float(sx) + .5_f) / SS) / Float(W);
+                        const Vec3 d(Math::Sin(theta) * Math::Cos(phi), Math::Sin(theta) * Math::Sin(phi), Math::Cos(theta));
+                        sum += SPD::FromRGB(EvaluateEnvmap(d)).Luminance() * Math::Sin(theta);
+                    }
+                }
+                weights[y * W + x] = sum / Float(SS * SS);
+            }
+        });
+
+        // Add a small floor so that every direction has non-zero probability
+        Float avg = 0_f;
+        for (const auto& w : weights) { avg += w; }
+        avg /= Float(W * H);
+        const auto floor = avg > 0_f ? avg * 1e-3_f : 1_f;
+
+        conditionals_.assign(H, AliasTable());
+        marginal_.Clear();
+        for (int y = 0; y < H; y++)
+        {
+            const auto sinTheta = Math::Sin(Math::Pi() * (Float(y) + .5_f) / Float(H));
+            Float rowSum = 0_f;
+            for (int x = 0; x < W; x++)
+            {
+                const auto w = std::max(weights[y * W + x], floor * sinTheta);
+                conditionals_[y].Add(w);
+                rowSum += w;
+            }
+            conditionals_[y].Normalize();
+            marginal_.Add(rowSum);
+        }
+        marginal_.Normalize();
+    }
+
+    // Sample a direction toward the environment
+    auto SampleDirectionToEnv(const Vec2& u) const -> Vec3
+    {
+        if (!envmap_)
+        {
+            return Sampler::UniformSampleSphere(u);
+        }
+
+        const int W = distRes_;
+        const int H = distRes_ / 2;
+        Float fy, fx;
+        const int y = marginal_.SampleReuse(u.y, fy);
+        const int x = conditionals_[y].SampleReuse(u.x, fx);
+        const auto theta = Math::Pi() * (Float(y) + fy) / Float(H);
+        const auto phi = 2_f * Math::Pi() * (Float(x) + fx) / Float(W);
+        const Vec3 d(Math::Sin(theta) * Math::Cos(phi), Math::Sin(theta) * Math::Sin(phi), Math::Cos(theta));
+        return Math::Transpose(rotation_) * d;
+    }
+
+    // Evaluate the PDF of SampleDirectionToEnv in the solid angle measure
+    auto DirectionToEnvPDF(const Vec3& w) const -> Float
+    {
+        if (!envmap_)
+        {
+            return Sampler::UniformSampleSpherePDFSA().v;
+        }
+
+        const int W = distRes_;
+        const int H = distRes_ / 2;
+        const auto d = rotation_ * w;
+        const auto theta = Math::Acos(Math::Clamp(d.z, -1_f, 1_f));
+        const auto sinTheta = Math::Sin(theta);
+        if (sinTheta <= 0_f)
+        {
+            return 0_f;
+        }
+        auto phi = std::atan2(d.y, d.x);
+        if (phi < 0_f) phi += 2_f * Math::Pi();
+        const int y = Math::Clamp((int)(theta / Math::Pi() * Float(H)), 0, H - 1);
+        const int x = Math::Clamp((int)(phi / (2_f * Math::Pi()) * Float(W)), 0, W - 1);
+        return marginal_.EvaluatePDF(y) * conditionals_[y].EvaluatePDF(x) * Float(W * H) / (2_f * Math::Pi() * Math::Pi() * sinTheta);
+    }
+
 public:
 
     SphereBound bound_;
@@ -270,6 +401,11 @@ public:
     SPD Le_;
     const Texture* envmap_ = nullptr;
     Float rotate_;
+    Mat3 rotation_;                         // Rotation from world to the local coordinates of the light probe
+
+    int distRes_;                           // Number of the cells of the distribution for phi (half for theta)
+    AliasTable marginal_;                   // Marginal distribution for theta
+    std::vector<AliasTable> conditionals_;  // Conditional distributions for phi
 
 };
 
@@ -114,6 +114,8 @@ public:
         return true;
     };
 
+    LM_IMPL_F(Emittance) = [this]() -> SPD { return Le_; };
+
     LM_IMPL_F(Serialize) = [this](std::ostream& stream) -> bool
     {
         {
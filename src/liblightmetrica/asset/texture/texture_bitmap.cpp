@@ -25,6 +25,7 @@
 #include <pch.h>
 #include <lightmetrica/texture.h>
 #include <lightmetrica/property.h>
+#include <lightmetrica/detail/propertyutils.h>
 #include <lightmetrica/detail/serial.h>
 #include <FreeImage.h>
 
@@ -32,6 +33,145 @@
 
 LM_NAMESPACE_BEGIN
 
+#pragma region Texel formats
+
+namespace
+{
+    /*
+        Texel formats.
+        The texels are stored in the compact formats and decoded on lookup.
+        The texels with three channels are padded to four channels
+        so that a texel can be loaded with a single SIMD load.
+    */
+    enum class TexelFormat : int
+    {
+        U8,         // 8-bit unsigned integer decoded with the lookup table (linear or sRGB)
+        Half,       // 16-bit half precision floating point
+        Float,      // 32-bit single precision floating point (three channels are not padded)
+    };
+
+    const char* TexelFormatNames[] = { "u8", "half", "float" };
+
+    // Converts a float into half with rounding to the nearest
+    auto FloatToHalf(float v) -> std::uint16_t
+    {
+        std::uint32_t x;
+        std::memcpy(&x, &v, sizeof(float));
+        const std::uint32_t sign = (x >> 16) & 0x8000;
+        const std::uint32_t mant = x & 0x7fffff;
+        const int e = (int)((x >> 23) & 0xff);
+        if (e == 0xff)
+        {
+            // Inf or NaN
+            return (std::uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0));
+        }
+        const int exp = e - 127 + 15;
+        if (exp >= 31)
+        {
+            // Overflow
+            return (std::uint16_t)(sign | 0x7c00);
+        }
+        if (exp <= 0)
+        {
+            // Denormalized or zero
+            if (exp < -10)
+            {
+                return (std::uint16_t)(sign);
+            }
+            const std::uint32_t m = mant | 0x800000;
+            const int shift = 14 - exp;
+            std::uint32_t h = m >> shift;
+            if ((m >> (shift - 1)) & 1) h++;
+            return (std::uint16_t)(sign | h);
+        }
+        std::uint32_t h = sign | ((std::uint32_t)(exp) << 10) | (mant >> 13);
+        if (mant & 0x1000) h++;
+        return (std::uint16_t)(h);
+    }
+
+    auto HalfToFloat(std::uint16_t h) -> float
+    {
+        const std::uint32_t sign = (std::uint32_t)(h & 0x8000) << 16;
+        const std::uint32_t exp = (h >> 10) & 0x1f;
+        const std::uint32_t mant = h & 0x3ff;
+        std::uint32_t x;
+        if (exp == 0)
+        {
+            // Denormalized or zero
+            const float v = (float)(mant) * (1.0f / (1 << 24));
+            return sign ? -v : v;
+        }
+        else if (exp == 31)
+        {
+            x = sign | 0x7f800000 | (mant << 13);
+        }
+        else
+        {
+            x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+        }
+        float v;
+        std::memcpy(&v, &x, sizeof(float));
+        return v;
+    }
+
+    #if LM_SSE || LM_AVX
+    // Converts four halves into floats [Giesen 2016]
+    LM_INLINE auto HalfToFloat4(const std::uint16_t* h) -> __m128
+    {
+        const __m128i maskNoSign = _mm_set1_epi32(0x7fff);
+        const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+        const __m128i wasInfNaN = _mm_set1_epi32(0x7bff);
+        const __m128 expInfNaN = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+        const __m128i v = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(h)));
+        const __m128i expmant = _mm_and_si128(maskNoSign, v);
+        const __m128i justsign = _mm_xor_si128(v, expmant);
+        const __m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expmant, 13)), magic);
+        const __m128 infnanexp = _mm_and_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(expmant, wasInfNaN)), expInfNaN);
+        const __m128 signinf = _mm_or_ps(_mm_castsi128_ps(_mm_slli_epi32(justsign, 16)), infnanexp);
+        return _mm_or_ps(scaled, signinf);
+    }
+    #endif
+
+    // Lookup tables for 8-bit texels
+    struct U8LUT
+    {
+        float linear[256];
+        float srgb[256];
+        U8LUT()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                const float v = (float)(i) / 255.0f;
+                linear[i] = v;
+                srgb[i] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+            }
+        }
+    };
+
+    const U8LUT& LUT()
+    {
+        static const U8LUT lut;
+        return lut;
+    }
+
+    // Total memory of the loaded textures, reported on load
+    std::atomic<size_t> TotalMemory(0);
+    std::atomic<size_t> TotalFloatMemory(0);
+}
+
+#pragma endregion
+
+// --------------------------------------------------------------------------------
+
+#pragma region Bitmap texture
+
+/*!
+    Bitmap texture.
+    The texels are kept in the compact format of the image:
+    8-bit images as 8-bit integers decoded with the lookup table (optionally as sRGB),
+    and floating point images as halves if the values fit in the range.
+    Single channel images are stored with a single channel.
+*/
 class Texture_Bitmap final : public Texture
 {
 public:
@@ -49,6 +189,26 @@ public:
         const auto basepath = boost::filesystem::path(prop->Tree()->BasePath());
         const auto path = (basepath / localpath).string();
 
+        scale_ = (float)(prop->ChildAs<Float>("scale", 1_f));
+        srgb_ = prop->ChildAs<int>("srgb", 0) != 0;
+
+        const auto filter = prop->ChildAs<std::string>("filter", "bilinear");
+        if (filter != "bilinear" && filter != "nearest")
+        {
+            LM_LOG_ERROR("Invalid filter: " + filter);
+            PropertyUtils::PrintPrettyError(prop->Child("filter"));
+            return false;
+        }
+        bilinear_ = filter == "bilinear";
+
+        const auto format = prop->ChildAs<std::string>("format", "auto");
+        if (format != "auto" && format != "float")
+        {
+            LM_LOG_ERROR("Invalid format: " + format);
+            PropertyUtils::PrintPrettyError(prop->Child("format"));
+            return false;
+        }
+
         #pragma endregion
 
         // --------------------------------------------------------------------------------
@@ -57,12 +217,12 @@ public:
 
         {
             // Try to deduce the file format by the file signature
-            auto format = FreeImage_GetFileType(path.c_str(), 0);
-            if (format == FIF_UNKNOWN)
+            auto fif = FreeImage_GetFileType(path.c_str(), 0);
+            if (fif == FIF_UNKNOWN)
             {
                 // Try to deduce the file format by the extension
-                format = FreeImage_GetFIFFromFilename(path.c_str());
-                if (format == FIF_UNKNOWN)
+                fif = FreeImage_GetFIFFromFilename(path.c_str());
+                if (fif == FIF_UNKNOWN)
                 {
                     // Unknown image
                     LM_LOG_ERROR("Unknown image format");
@@ -71,14 +231,14 @@ public:
             }
 
             // Check the plugin capability
-            if (!FreeImage_FIFSupportsReading(format))
+            if (!FreeImage_FIFSupportsReading(fif))
             {
                 LM_LOG_ERROR("Unsupported format");
                 return false;
             }
 
             // Load image
-            auto* fibitmap = FreeImage_Load(format, path.c_str(), 0);
+            auto* fibitmap = FreeImage_Load(fif, path.c_str(), 0);
             if (!fibitmap)
             {
                 LM_LOG_ERROR("Failed to load an image " + path);
@@ -92,7 +252,8 @@ public:
             // Image type and bits per pixel (BPP)
             const auto type = FreeImage_GetImageType(fibitmap);
             const auto bpp = FreeImage_GetBPP(fibitmap);
-            if (!(type == FIT_RGBF || type == FIT_RGBAF || (type == FIT_BITMAP && (bpp == 24 || bpp == 32))))
+            const bool grey = type == FIT_BITMAP && bpp == 8 && FreeImage_GetColorType(fibitmap) == FIC_MINISBLACK;
+            if (!(type == FIT_RGBF || type == FIT_RGBAF || type == FIT_FLOAT || (type == FIT_BITMAP && (bpp == 24 || bpp == 32)) || grey))
             {
                 FreeImage_Unload(fibitmap);
                 LM_LOG_ERROR("Unsupportted format");
@@ -107,56 +268,116 @@ public:
             #endif
 
             // Read image data
-            data_.clear();
-            for (int y = 0; y < height_; y++)
+            channels_ = (type == FIT_FLOAT || grey) ? 1 : 3;
+            const size_t numTexels = (size_t)(width_) * height_;
+            if (type == FIT_BITMAP)
             {
-                if (type == FIT_RGBF)
+                // 8-bit texels are stored as they are
+                texelFormat_ = TexelFormat::U8;
+                stride_ = channels_ == 1 ? 1 : 4;
+                data_.assign(numTexels * stride_, 0);
+                for (int y = 0; y < height_; y++)
                 {
-                    auto* bits = (FIRGBF*)FreeImage_GetScanLine(fibitmap, y);
+                    const BYTE* bits = (BYTE*)FreeImage_GetScanLine(fibitmap, y);
+                    auto* out = &data_[(size_t)(y) * width_ * stride_];
                     for (int x = 0; x < width_; x++)
                     {
-                        data_.emplace_back(bits[x].red);
-                        data_.emplace_back(bits[x].green);
-                        data_.emplace_back(bits[x].blue);
+                        if (channels_ == 1)
+                        {
+                            out[x] = bits[x];
+                        }
+                        else
+                        {
+                            out[4 * x]     = bits[FI_RGBA_RED];
+                            out[4 * x + 1] = bits[FI_RGBA_GREEN];
+                            out[4 * x + 2] = bits[FI_RGBA_BLUE];
+                            bits += bpp / 8;
+                        }
                     }
                 }
-                else if (type == FIT_RGBAF)
+            }
+            else
+            {
+                // Read floating point texels
+                std::vector<float> texels(numTexels * channels_);
+                for (int y = 0; y < height_; y++)
                 {
-                    auto* bits = (FIRGBAF*)FreeImage_GetScanLine(fibitmap, y);
-                    for (int x = 0; x < width_; x++)
+                    auto* out = &texels[(size_t)(y) * width_ * channels_];
+                    if (type == FIT_FLOAT)
+                    {
+                        const auto* bits = (float*)FreeImage_GetScanLine(fibitmap, y);
+                        std::copy_n(bits, width_, out);
+                    }
+                    else if (type == FIT_RGBF)
                     {
-                        data_.emplace_back(bits[x].red);
-                        data_.emplace_back(bits[x].green);
-                        data_.emplace_back(bits[x].blue);
+                        const auto* bits = (FIRGBF*)FreeImage_GetScanLine(fibitmap, y);
+                        for (int x = 0; x < width_; x++)
+                        {
+                            out[3 * x]     = bits[x].red;
+                            out[3 * x + 1] = bits[x].green;
+                            out[3 * x + 2] = bits[x].blue;
+                        }
+                    }
+                    else if (type == FIT_RGBAF)
+                    {
+                        const auto* bits = (FIRGBAF*)FreeImage_GetScanLine(fibitmap, y);
+                        for (int x = 0; x < width_; x++)
+                        {
+                            out[3 * x]     = bits[x].red;
+                            out[3 * x + 1] = bits[x].green;
+                            out[3 * x + 2] = bits[x].blue;
+                        }
                     }
                 }
-                else if (type == FIT_BITMAP)
+
+                // Use half if the values are representable
+                const bool fitsHalf = std::all_of(texels.begin(), texels.end(), [](float v) { return std::abs(v) <= 65504.0f; });
+                if (format == "auto" && !fitsHalf)
                 {
-                    BYTE* bits = (BYTE*)FreeImage_GetScanLine(fibitmap, y);
-                    for (int x = 0; x < width_; x++)
+                    LM_LOG_WARN("Texel values exceed the range of half. Using float.");
+                }
+                if (format == "auto" && fitsHalf)
+                {
+                    texelFormat_ = TexelFormat::Half;
+                    stride_ = channels_ == 1 ? 1 : 4;
+                    data_.assign(numTexels * stride_ * sizeof(std::uint16_t), 0);
+                    auto* out = reinterpret_cast<std::uint16_t*>(data_.data());
+                    for (size_t i = 0; i < numTexels; i++)
                     {
-                        data_.push_back((float)(bits[FI_RGBA_RED]) / 255.0f);
-                        data_.push_back((float)(bits[FI_RGBA_GREEN]) / 255.0f);
-                        data_.push_back((float)(bits[FI_RGBA_BLUE]) / 255.0f);
-                        bits += bpp / 8;
+                        for (int c = 0; c < channels_; c++)
+                        {
+                            out[i * stride_ + c] = FloatToHalf(texels[i * channels_ + c]);
+                        }
                     }
                 }
+                else
+                {
+                    // A padding element is added so that the last texel can be loaded with SIMD load
+                    texelFormat_ = TexelFormat::Float;
+                    stride_ = channels_;
+                    data_.assign((numTexels * stride_ + 1) * sizeof(float), 0);
+                    std::memcpy(data_.data(), texels.data(), texels.size() * sizeof(float));
+                }
             }
 
             FreeImage_Unload(fibitmap);
+        }
 
-            // --------------------------------------------------------------------------------
+        #pragma endregion
 
-            // Scale
-            const auto scale = (float)(prop->ChildAs<Float>("scale", 1_f));
-            for (auto& v : data_)
-            {
-                v *= scale;
-            }
+        // --------------------------------------------------------------------------------
 
-            // --------------------------------------------------------------------------------
+        #pragma region Report memory usage
 
-            return true;
+        {
+            const size_t floatMemory = (size_t)(width_) * height_ * 3 * sizeof(float);
+            TotalMemory += data_.size();
+            TotalFloatMemory += floatMemory;
+            LM_LOG_INFO(boost::str(boost::format("Texels: %dx%d, %d channel(s), %s%s, %.2f MB (%.1fx smaller than float RGB)")
+                % width_ % height_ % channels_ % TexelFormatNames[(int)(texelFormat_)] % (texelFormat_ == TexelFormat::U8 && srgb_ ? " (sRGB)" : "")
+                % ((double)(data_.size()) / (1 << 20)) % ((double)(floatMemory) / data_.size())));
+            LM_LOG_INFO(boost::str(boost::format("Total texture memory: %.2f MB (%.2f MB saved)")
+                % ((double)(TotalMemory) / (1 << 20)) % ((double)(TotalFloatMemory - TotalMemory) / (1 << 20))));
         }
 
         #pragma endregion
@@ -171,39 +392,143 @@ public:
 
     LM_IMPL_F(Evaluate) = [this](const Vec2& uv) -> Vec3
     {
-        const int x = Math::Clamp<int>((int)(Math::Fract(uv.x) * width_), 0, width_ - 1);
-        const int y = Math::Clamp<int>((int)(Math::Fract(uv.y) * height_), 0, height_ - 1);
-        const int i = width_ * y + x;
-        return Vec3(Float(data_[3 * i]), Float(data_[3 * i + 1]), Float(data_[3 * i + 2]));
+        if (!bilinear_)
+        {
+            const int x = Math::Clamp<int>((int)(Math::Fract(uv.x) * width_), 0, width_ - 1);
+            const int y = Math::Clamp<int>((int)(Math::Fract(uv.y) * height_), 0, height_ - 1);
+            float v[4];
+            Texel(x, y, v);
+            return channels_ == 1 ? Vec3(Float(v[0] * scale_)) : Vec3(Float(v[0] * scale_), Float(v[1] * scale_), Float(v[2] * scale_));
+        }
+
+        // Bilinear interpolation with repeat wrapping
+        const float x = (float)(Math::Fract(uv.x)) * width_ - 0.5f;
+        const float y = (float)(Math::Fract(uv.y)) * height_ - 0.5f;
+        const int x0 = (int)(std::floor(x));
+        const int y0 = (int)(std::floor(y));
+        const float fx = x - (float)(x0);
+        const float fy = y - (float)(y0);
+        const int xs[] = { (x0 + width_) % width_, (x0 + 1) % width_ };
+        const int ys[] = { (y0 + height_) % height_, (y0 + 1) % height_ };
+        const float ws[] = { (1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy };
+
+        float v[4];
+        #if LM_SSE || LM_AVX
+        if (channels_ != 1)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int i = 0; i < 4; i++)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(Texel4(xs[i & 1], ys[i >> 1]), _mm_set1_ps(ws[i])));
+            }
+            _mm_storeu_ps(v, _mm_mul_ps(sum, _mm_set1_ps(scale_)));
+            return Vec3(Float(v[0]), Float(v[1]), Float(v[2]));
+        }
+        #endif
+
+        float sum[3] = { 0, 0, 0 };
+        for (int i = 0; i < 4; i++)
+        {
+            Texel(xs[i & 1], ys[i >> 1], v);
+            for (int c = 0; c < channels_; c++)
+            {
+                sum[c] += v[c] * ws[i];
+            }
+        }
+        return channels_ == 1 ? Vec3(Float(sum[0] * scale_)) : Vec3(Float(sum[0] * scale_), Float(sum[1] * scale_), Float(sum[2] * scale_));
     };
 
     LM_IMPL_F(Serialize) = [this](std::ostream& stream) -> bool
     {
         {
             cereal::PortableBinaryOutputArchive oa(stream);
-            oa(width_, height_, data_);
+            oa(width_, height_, channels_, stride_, (int)(texelFormat_), srgb_, bilinear_, scale_, data_);
         }
         return true;
     };
 
     LM_IMPL_F(Deserialize) = [this](std::istream& stream, const std::unordered_map<std::string, void*>& userdata) -> bool
     {
+        int texelFormat;
         {
             cereal::PortableBinaryInputArchive ia(stream);
-            ia(width_, height_, data_);
+            ia(width_, height_, channels_, stride_, texelFormat, srgb_, bilinear_, scale_, data_);
         }
+        texelFormat_ = (TexelFormat)(texelFormat);
         return true;
     };
 
+private:
+
+    // Decodes the texel into linear values
+    auto Texel(int x, int y, float* v) const -> void
+    {
+        const size_t i = ((size_t)(y) * width_ + x) * stride_;
+        switch (texelFormat_)
+        {
+            case TexelFormat::U8:
+            {
+                const auto* lut = srgb_ ? LUT().srgb : LUT().linear;
+                for (int c = 0; c < channels_; c++) { v[c] = lut[data_[i + c]]; }
+                break;
+            }
+            case TexelFormat::Half:
+            {
+                const auto* data = reinterpret_cast<const std::uint16_t*>(data_.data());
+                for (int c = 0; c < channels_; c++) { v[c] = HalfToFloat(data[i + c]); }
+                break;
+            }
+            case TexelFormat::Float:
+            {
+                const auto* data = reinterpret_cast<const float*>(data_.data());
+                for (int c = 0; c < channels_; c++) { v[c] = data[i + c]; }
+                break;
+            }
+        }
+    }
+
+    #if LM_SSE || LM_AVX
+    // Decodes the texel with three channels into a SIMD register (the fourth element is undefined)
+    auto Texel4(int x, int y) const -> __m128
+    {
+        const size_t i = ((size_t)(y) * width_ + x) * stride_;
+        switch (texelFormat_)
+        {
+            case TexelFormat::U8:
+            {
+                const auto* lut = srgb_ ? LUT().srgb : LUT().linear;
+                const auto* p = &data_[i];
+                return _mm_set_ps(0.0f, lut[p[2]], lut[p[1]], lut[p[0]]);
+            }
+            case TexelFormat::Half:
+            {
+                return HalfToFloat4(reinterpret_cast<const std::uint16_t*>(data_.data()) + i);
+            }
+            case TexelFormat::Float:
+            {
+                return _mm_loadu_ps(reinterpret_cast<const float*>(data_.data()) + i);
+            }
+        }
+        return _mm_setzero_ps();
+    }
+    #endif
+
 private:
 
     int width_;
     int height_;
-    std::vector<float> data_;
+    int channels_;                      // Number of channels (1 or 3)
+    int stride_;                        // Number of elements per texel
+    TexelFormat texelFormat_;
+    bool srgb_;                         // Decode 8-bit texels as sRGB
+    bool bilinear_;                     // Bilinear or nearest neighbor filtering
+    float scale_;
+    std::vector<unsigned char> data_;   // Texel data in the texel format
 
 };
 
 LM_COMPONENT_REGISTER_IMPL(Texture_Bitmap, "texture::bitmap");
 
-LM_NAMESPACE_END
+#pragma endregion
 
+LM_NAMESPACE_END
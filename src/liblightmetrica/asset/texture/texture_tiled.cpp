@@ -0,0 +1,534 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <pch.h>
+#include <lightmetrica/texture.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/logger.h>
+#include <lightmetrica/detail/texturecache.h>
+#include <lightmetrica/detail/mappedfile.h>
+#include <lightmetrica/detail/serial.h>
+#include <FreeImage.h>
+#include <tbb/tbb.h>
+
+LM_NAMESPACE_BEGIN
+
+#pragma region Tiled texture file
+
+namespace
+{
+    /*
+        Tiled texture file.
+        The file consists of the header, the level table, and the tiles of the mip levels.
+        The tiles of a level are stored in row-major order
+        and each tile contains `tileSize * tileSize` RGB texels in float.
+        The texels of the boundary tiles outside of the level are filled with zero.
+    */
+    struct TiledTextureHeader
+    {
+        char magic[8];                  // Magic number ("LMTILES\0")
+        std::uint32_t version;          // Format version
+        std::uint32_t tileSize;         // Width and height of a tile
+        std::uint32_t width;            // Width of the finest level
+        std::uint32_t height;           // Height of the finest level
+        std::uint32_t numLevels;        // Number of mip levels
+        std::uint32_t reserved;
+        std::uint64_t sourceSize;       // Size of the source image used to detect the update
+        std::int64_t sourceTime;        // Last write time of the source image
+    };
+
+    struct TiledTextureLevel
+    {
+        std::uint32_t width;
+        std::uint32_t height;
+        std::uint32_t tilesX;           // Number of tiles in x direction
+        std::uint32_t tilesY;           // Number of tiles in y direction
+        std::uint64_t offset;           // Offset to the first tile of the level
+    };
+
+    const char TiledTextureMagic[8] = { 'L', 'M', 'T', 'I', 'L', 'E', 'S', '\0' };
+    const std::uint32_t TiledTextureVersion = 3;
+
+    // The level is stored in 4 bits of the key of the texture cache
+    const std::uint32_t MaxNumLevels = 16;
+
+    // Decodes the image into RGB float texels
+    auto DecodeImage(const std::string& path, int& width, int& height, std::vector<float>& data) -> bool
+    {
+        auto format = FreeImage_GetFileType(path.c_str(), 0);
+        if (format == FIF_UNKNOWN)
+        {
+            format = FreeImage_GetFIFFromFilename(path.c_str());
+            if (format == FIF_UNKNOWN)
+            {
+                LM_LOG_ERROR("Unknown image format");
+                return false;
+            }
+        }
+        if (!FreeImage_FIFSupportsReading(format))
+        {
+            LM_LOG_ERROR("Unsupported format");
+            return false;
+        }
+
+        auto* fibitmap = FreeImage_Load(format, path.c_str(), 0);
+        if (!fibitmap)
+        {
+            LM_LOG_ERROR("Failed to load an image " + path);
+            return false;
+        }
+        auto* rgbf = FreeImage_ConvertToRGBF(fibitmap);
+        FreeImage_Unload(fibitmap);
+        if (!rgbf)
+        {
+            LM_LOG_ERROR("Unsupported format");
+            return false;
+        }
+
+        width = (int)(FreeImage_GetWidth(rgbf));
+        height = (int)(FreeImage_GetHeight(rgbf));
+        data.resize((size_t)(width) * height * 3);
+        for (int y = 0; y < height; y++)
+        {
+            const auto* bits = (FIRGBF*)FreeImage_GetScanLine(rgbf, y);
+            for (int x = 0; x < width; x++)
+            {
+                const size_t i = (size_t)(y) * width + x;
+                data[3 * i]     = bits[x].red;
+                data[3 * i + 1] = bits[x].green;
+                data[3 * i + 2] = bits[x].blue;
+            }
+        }
+        FreeImage_Unload(rgbf);
+
+        return true;
+    }
+
+    // Creates the tiled texture file from the image
+    auto CreateTiledTexture(const std::string& sourcePath, const std::string& path, int tileSize) -> bool
+    {
+        LM_LOG_INFO("Creating tiled texture '" + path + "'");
+        LM_LOG_INDENTER();
+
+        #pragma region Create mip levels
+        std::vector<std::vector<float>> levels(1);
+        std::vector<TiledTextureLevel> levelInfos(1);
+        {
+            int width, height;
+            if (!DecodeImage(sourcePath, width, height, levels[0]))
+            {
+                return false;
+            }
+            levelInfos[0].width = width;
+            levelInfos[0].height = height;
+        }
+
+        // Downsample with 2x2 box filter until the level becomes a single texel
+        while ((levelInfos.back().width > 1 || levelInfos.back().height > 1) && levels.size() < MaxNumLevels)
+        {
+            const auto& src = levels.back();
+            const int sw = levelInfos.back().width;
+            const int sh = levelInfos.back().height;
+            const int w = std::max(1, sw / 2);
+            const int h = std::max(1, sh / 2);
+            std::vector<float> dst((size_t)(w) * h * 3);
+            tbb::parallel_for(0, h, [&](int y)
+            {
+                for (int x = 0; x < w; x++)
+                {
+                    for (int c = 0; c < 3; c++)
+                    {
+                        float sum = 0;
+                        for (int dy = 0; dy < 2; dy++)
+                        {
+                            for (int dx = 0; dx < 2; dx++)
+                            {
+                                const int sx = std::min(2 * x + dx, sw - 1);
+                                const int sy = std::min(2 * y + dy, sh - 1);
+                                sum += src[3 * ((size_t)(sy) * sw + sx) + c];
+                            }
+                        }
+                        dst[3 * ((size_t)(y) * w + x) + c] = sum * 0.25f;
+                    }
+                }
+            });
+
+            TiledTextureLevel info;
+            info.width = w;
+            info.height = h;
+            levels.push_back(std::move(dst));
+            levelInfos.push_back(info);
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Compute layout
+        TiledTextureHeader header = {};
+        std::memcpy(header.magic, TiledTextureMagic, sizeof(TiledTextureMagic));
+        header.version = TiledTextureVersion;
+        header.tileSize = tileSize;
+        header.width = levelInfos[0].width;
+        header.height = levelInfos[0].height;
+        header.numLevels = (std::uint32_t)(levels.size());
+        header.sourceSize = boost::filesystem::file_size(sourcePath);
+        header.sourceTime = boost::filesystem::last_write_time(sourcePath);
+
+        const size_t tileBytes = (size_t)(tileSize) * tileSize * 3 * sizeof(float);
+        std::uint64_t offset = sizeof(TiledTextureHeader) + sizeof(TiledTextureLevel) * levels.size();
+        for (auto& info : levelInfos)
+        {
+            info.tilesX = (info.width + tileSize - 1) / tileSize;
+            info.tilesY = (info.height + tileSize - 1) / tileSize;
+            info.offset = offset;
+            offset += tileBytes * info.tilesX * info.tilesY;
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Write file
+        std::ofstream out(path, std::ios::out | std::ios::binary);
+        if (!out)
+        {
+            LM_LOG_ERROR("Failed to open file: " + path);
+            return false;
+        }
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(TiledTextureHeader));
+        out.write(reinterpret_cast<const char*>(levelInfos.data()), sizeof(TiledTextureLevel) * levelInfos.size());
+
+        std::vector<float> tile((size_t)(tileSize) * tileSize * 3);
+        for (size_t l = 0; l < levels.size(); l++)
+        {
+            const auto& info = levelInfos[l];
+            for (std::uint32_t ty = 0; ty < info.tilesY; ty++)
+            {
+                for (std::uint32_t tx = 0; tx < info.tilesX; tx++)
+                {
+                    std::fill(tile.begin(), tile.end(), 0.0f);
+                    for (int y = 0; y < tileSize; y++)
+                    {
+                        const std::uint32_t ly = ty * tileSize + y;
+                        if (ly >= info.height) break;
+                        const std::uint32_t lx = tx * tileSize;
+                        const std::uint32_t n = std::min<std::uint32_t>(tileSize, info.width - lx);
+                        std::copy_n(&levels[l][3 * ((size_t)(ly) * info.width + lx)], 3 * n, &tile[3 * (size_t)(y) * tileSize]);
+                    }
+                    out.write(reinterpret_cast<const char*>(tile.data()), tileBytes);
+                }
+            }
+        }
+
+        if (!out)
+        {
+            LM_LOG_ERROR("Failed to write file: " + path);
+            return false;
+        }
+        #pragma endregion
+
+        LM_LOG_INFO(boost::str(boost::format("Created %d levels, %.1f MB") % levels.size() % ((double)(offset) / (1 << 20))));
+        return true;
+    }
+}
+
+#pragma endregion
+
+// --------------------------------------------------------------------------------
+
+#pragma region Tiled texture
+
+/*!
+    Tiled texture.
+    The texture is converted into the tiled mip pyramid stored on disk,
+    and the tiles are paged into the texture cache on demand.
+    The tiled texture file is created beside the image (or in the temporary directory
+    if not writable) and recreated when the image is updated.
+*/
+class Texture_Tiled final : public Texture
+{
+public:
+
+    LM_IMPL_CLASS(Texture_Tiled, Texture);
+
+public:
+
+    ~Texture_Tiled()
+    {
+        if (textureID_ >= 0)
+        {
+            TextureCache::Unregister(textureID_);
+        }
+    }
+
+public:
+
+    LM_IMPL_F(Load) = [this](const PropertyNode* prop, Assets* assets, const Primitive* primitive) -> bool
+    {
+        std::string localpath;
+        if (!prop->ChildAs("path", localpath)) return false;
+        const auto basepath = boost::filesystem::path(prop->Tree()->BasePath());
+        path_      = (basepath / localpath).string();
+        cachePath_ = prop->Child("cache_path") ? (basepath / prop->ChildAs<std::string>("cache_path", "")).string() : "";
+        tileSize_  = prop->ChildAs<int>("tile_size", 64);
+        scale_     = prop->ChildAs<Float>("scale", 1_f);
+        if (tileSize_ <= 0)
+        {
+            LM_LOG_ERROR("Invalid tile size: " + std::to_string(tileSize_));
+            return false;
+        }
+        return Initialize();
+    };
+
+    LM_IMPL_F(Evaluate) = [this](const Vec2& uv) -> Vec3
+    {
+        return Bilinear(0, uv) * scale_;
+    };
+
+    LM_IMPL_F(EvaluateFiltered) = [this](const Vec2& uv, Float footprint) -> Vec3
+    {
+        // Select the mip level from the footprint and interpolate between the levels
+        const Float texels = footprint * (Float)(std::max(levels_[0].width, levels_[0].height));
+        const Float level = Math::Clamp(texels > 1_f ? Float(std::log2(texels)) : 0_f, 0_f, Float(levels_.size() - 1));
+        const int l0 = (int)(level);
+        const int l1 = std::min(l0 + 1, (int)(levels_.size()) - 1);
+        const Float t = level - Float(l0);
+        if (l0 == l1 || t == 0_f)
+        {
+            return Bilinear(l0, uv) * scale_;
+        }
+        return (Bilinear(l0, uv) * (1_f - t) + Bilinear(l1, uv) * t) * scale_;
+    };
+
+    LM_IMPL_F(Serialize) = [this](std::ostream& stream) -> bool
+    {
+        {
+            cereal::PortableBinaryOutputArchive oa(stream);
+            oa(path_, cachePath_, tileSize_, scale_);
+        }
+        return true;
+    };
+
+    LM_IMPL_F(Deserialize) = [this](std::istream& stream, const std::unordered_map<std::string, void*>& userdata) -> bool
+    {
+        {
+            cereal::PortableBinaryInputArchive ia(stream);
+            ia(path_, cachePath_, tileSize_, scale_);
+        }
+        if (tileSize_ <= 0)
+        {
+            LM_LOG_ERROR("Invalid tile size: " + std::to_string(tileSize_));
+            return false;
+        }
+        return Initialize();
+    };
+
+private:
+
+    auto Initialize() -> bool
+    {
+        namespace fs = boost::filesystem;
+
+        // Release the previous registration on re-initialization (e.g., Deserialize after Load),
+        // because its loader refers to the previously mapped file
+        if (textureID_ >= 0)
+        {
+            TextureCache::Unregister(textureID_);
+            textureID_ = -1;
+        }
+        file_.Unmap();
+        levels_.clear();
+
+        #pragma region Find or create the tiled texture file
+        if (!fs::exists(path_))
+        {
+            LM_LOG_ERROR("Missing file: " + path_);
+            return false;
+        }
+
+        const auto Valid = [&](const std::string& path) -> bool
+        {
+            std::ifstream in(path, std::ios::binary);
+            TiledTextureHeader header;
+            if (!in || !in.read(reinterpret_cast<char*>(&header), sizeof(TiledTextureHeader)))
+            {
+                return false;
+            }
+            return std::memcmp(header.magic, TiledTextureMagic, sizeof(TiledTextureMagic)) == 0
+                && header.version == TiledTextureVersion
+                && header.tileSize == (std::uint32_t)(tileSize_)
+                && header.sourceSize == fs::file_size(path_)
+                && header.sourceTime == (std::int64_t)(fs::last_write_time(path_));
+        };
+
+        std::vector<std::string> candidates;
+        if (!cachePath_.empty())
+        {
+            candidates.push_back(cachePath_);
+        }
+        else
+        {
+            candidates.push_back(path_ + ".lmtx");
+            candidates.push_back((fs::temp_directory_path() / (fs::path(path_).filename().string() + "." + std::to_string(std::hash<std::string>()(fs::absolute(path_).string())) + ".lmtx")).string());
+        }
+
+        std::string tiledPath;
+        for (const auto& candidate : candidates)
+        {
+            if (Valid(candidate) || CreateTiledTexture(path_, candidate, tileSize_))
+            {
+                tiledPath = candidate;
+                break;
+            }
+        }
+        if (tiledPath.empty())
+        {
+            LM_LOG_ERROR("Failed to create tiled texture: " + path_);
+            return false;
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Map the tiled texture file
+        if (!file_.Map(tiledPath))
+        {
+            return false;
+        }
+
+        TiledTextureHeader header;
+        if (file_.Size() < sizeof(TiledTextureHeader))
+        {
+            LM_LOG_ERROR("Invalid tiled texture file: " + tiledPath);
+            return false;
+        }
+        std::memcpy(&header, file_.Data(), sizeof(TiledTextureHeader));
+        if (header.numLevels == 0 || header.numLevels > MaxNumLevels ||
+            file_.Size() < sizeof(TiledTextureHeader) + sizeof(TiledTextureLevel) * header.numLevels)
+        {
+            LM_LOG_ERROR("Invalid tiled texture file: " + tiledPath);
+            return false;
+        }
+        std::vector<TiledTextureLevel> levels(header.numLevels);
+        std::memcpy(levels.data(), file_.Data() + sizeof(TiledTextureHeader), sizeof(TiledTextureLevel) * header.numLevels);
+
+        // Check the consistency of the level table
+        const size_t tileBytes = (size_t)(tileSize_) * tileSize_ * 3 * sizeof(float);
+        for (std::uint32_t l = 0; l < header.numLevels; l++)
+        {
+            const auto& info = levels[l];
+            const bool valid =
+                info.width > 0 && info.height > 0 &&
+                info.width  == (l == 0 ? header.width  : std::max(1u, levels[l - 1].width / 2)) &&
+                info.height == (l == 0 ? header.height : std::max(1u, levels[l - 1].height / 2)) &&
+                info.tilesX == (info.width  + tileSize_ - 1) / tileSize_ &&
+                info.tilesY == (info.height + tileSize_ - 1) / tileSize_ &&
+                info.offset <= file_.Size() &&
+                tileBytes * info.tilesX * info.tilesY <= file_.Size() - info.offset;
+            if (!valid)
+            {
+                LM_LOG_ERROR("Invalid tiled texture file: " + tiledPath);
+                return false;
+            }
+        }
+        levels_ = std::move(levels);
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Register to the texture cache
+        textureID_ = TextureCache::Register([this, tileBytes](int level, int tileX, int tileY, TextureTile& tile) -> bool
+        {
+            const auto& info = levels_[level];
+            const auto* data = file_.Data() + info.offset + tileBytes * ((size_t)(tileY) * info.tilesX + tileX);
+            tile.data.resize(tileBytes / sizeof(float));
+            std::memcpy(tile.data.data(), data, tileBytes);
+            return true;
+        });
+        #pragma endregion
+
+        LM_LOG_INFO(boost::str(boost::format("Tiled texture: %dx%d, %d levels") % header.width % header.height % header.numLevels));
+        return true;
+    }
+
+    // Bilinear interpolation with repeat wrapping
+    auto Bilinear(int level, const Vec2& uv) const -> Vec3
+    {
+        const auto& info = levels_[level];
+        const int w = (int)(info.width);
+        const int h = (int)(info.height);
+        const Float x = Math::Fract(uv.x) * w - 0.5_f;
+        const Float y = Math::Fract(uv.y) * h - 0.5_f;
+        const int x0 = (int)(std::floor(x));
+        const int y0 = (int)(std::floor(y));
+        const Float fx = x - Float(x0);
+        const Float fy = y - Float(y0);
+
+        // Fetch texels reusing the tile of the previous texel
+        TextureCache::TilePtr tile;
+        int currTileX = -1, currTileY = -1;
+        const auto Texel = [&](int tx, int ty) -> Vec3
+        {
+            tx = (tx % w + w) % w;
+            ty = (ty % h + h) % h;
+            const int tileX = tx / tileSize_;
+            const int tileY = ty / tileSize_;
+            if (tileX != currTileX || tileY != currTileY)
+            {
+                tile = TextureCache::Tile(textureID_, level, tileX, tileY);
+                currTileX = tileX;
+                currTileY = tileY;
+            }
+            if (!tile)
+            {
+                return Vec3();
+            }
+            const size_t i = 3 * ((size_t)(ty % tileSize_) * tileSize_ + (tx % tileSize_));
+            return Vec3(Float(tile->data[i]), Float(tile->data[i + 1]), Float(tile->data[i + 2]));
+        };
+
+        return Texel(x0,     y0)     * (1_f - fx) * (1_f - fy)
+             + Texel(x0 + 1, y0)     * fx         * (1_f - fy)
+             + Texel(x0,     y0 + 1) * (1_f - fx) * fy
+             + Texel(x0 + 1, y0 + 1) * fx         * fy;
+    }
+
+private:
+
+    std::string path_;
+    std::string cachePath_;
+    int tileSize_;
+    Float scale_;
+
+    MappedFile file_;
+    std::vector<TiledTextureLevel> levels_;
+    int textureID_ = -1;
+
+};
+
+LM_COMPONENT_REGISTER_IMPL(Texture_Tiled, "texture::tiled");
+
+#pragma endregion
+
+LM_NAMESPACE_END
@@ -0,0 +1,263 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <pch.h>
+#include <lightmetrica/detail/texturecache.h>
+#include <list>
+#include <tbb/enumerable_thread_specific.h>
+
+LM_NAMESPACE_BEGIN
+
+namespace
+{
+    class TextureCacheImpl
+    {
+    public:
+
+        static auto Instance() -> TextureCacheImpl&
+        {
+            static TextureCacheImpl instance;
+            return instance;
+        }
+
+    private:
+
+        // Key of a tile: texture ID (20 bits), level (4 bits), tile indices (20 bits each)
+        using Key = unsigned long long;
+        static auto MakeKey(int textureID, int level, int tileX, int tileY) -> Key
+        {
+            return ((Key)(textureID) << 44) | ((Key)(level) << 40) | ((Key)(tileY) << 20) | (Key)(tileX);
+        }
+        static auto TextureIDOf(Key key) -> int { return (int)(key >> 44); }
+
+        static constexpr int NumShards = 64;
+
+        struct Shard
+        {
+            std::mutex mutex;
+            std::list<std::pair<Key, TextureCache::TilePtr>> lru;     // Most recently used tile is at front
+            std::unordered_map<Key, std::list<std::pair<Key, TextureCache::TilePtr>>::iterator> map;
+            size_t memory = 0;
+        };
+
+        /*
+            Lookup counters of a thread.
+            The counters are updated only by the owning thread without the read-modify-write,
+            so that the lookups in the different threads do not contend on a cache line.
+            The counters are read by Stats and reset by ResetStats from the other threads.
+        */
+        struct Counters
+        {
+            std::atomic<long long> lookups{ 0 };
+            std::atomic<long long> hits{ 0 };
+        };
+
+        static auto Increment(std::atomic<long long>& counter) -> void
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+    public:
+
+        auto SetCapacity(size_t capacity) -> void
+        {
+            capacity_ = capacity;
+        }
+
+        auto Register(const TextureCache::TileLoadFunc& loadFunc) -> int
+        {
+            std::unique_lock<std::mutex> lock(registryMutex_);
+            const int id = nextID_++;
+            loaders_[id] = loadFunc;
+            return id;
+        }
+
+        auto Unregister(int textureID) -> void
+        {
+            {
+                std::unique_lock<std::mutex> lock(registryMutex_);
+                loaders_.erase(textureID);
+            }
+            for (auto& shard : shards_)
+            {
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                for (auto it = shard.lru.begin(); it != shard.lru.end();)
+                {
+                    if (TextureIDOf(it->first) != textureID)
+                    {
+                        ++it;
+                        continue;
+                    }
+                    Release(shard, it->second);
+                    shard.map.erase(it->first);
+                    it = shard.lru.erase(it);
+                }
+            }
+        }
+
+        auto Tile(int textureID, int level, int tileX, int tileY) -> TextureCache::TilePtr
+        {
+            const auto key = MakeKey(textureID, level, tileX, tileY);
+            auto& shard = shards_[std::hash<Key>()(key) % NumShards];
+            auto& counters = counters_.local();
+            Increment(counters.lookups);
+
+            #pragma region Find the tile in the cache
+            {
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                const auto it = shard.map.find(key);
+                if (it != shard.map.end())
+                {
+                    Increment(counters.hits);
+                    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                    return it->second->second;
+                }
+            }
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Load the tile
+            // The tile is loaded without holding the lock.
+            // Other threads might load the same tile concurrently, in which case the first one is used.
+            TextureCache::TileLoadFunc loadFunc;
+            {
+                std::unique_lock<std::mutex> lock(registryMutex_);
+                const auto it = loaders_.find(textureID);
+                if (it == loaders_.end())
+                {
+                    return nullptr;
+                }
+                loadFunc = it->second;
+            }
+
+            auto tile = std::make_shared<TextureTile>();
+            if (!loadFunc(level, tileX, tileY, *tile))
+            {
+                return nullptr;
+            }
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Insert the tile and evict the least recently used tiles
+            {
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                const auto it = shard.map.find(key);
+                if (it != shard.map.end())
+                {
+                    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                    return it->second->second;
+                }
+
+                shard.lru.emplace_front(key, tile);
+                shard.map[key] = shard.lru.begin();
+                Acquire(shard, tile);
+
+                const size_t shardCapacity = capacity_ / NumShards;
+                while (shard.memory > shardCapacity && shard.lru.size() > 1)
+                {
+                    const auto& back = shard.lru.back();
+                    Release(shard, back.second);
+                    shard.map.erase(back.first);
+                    shard.lru.pop_back();
+                    evictions_++;
+                }
+            }
+            #pragma endregion
+
+            return tile;
+        }
+
+        auto Stats() const -> TextureCacheStats
+        {
+            TextureCacheStats stats;
+            stats.lookups = 0;
+            stats.hits = 0;
+            for (const auto& counters : counters_)
+            {
+                stats.lookups += counters.lookups.load(std::memory_order_relaxed);
+                stats.hits += counters.hits.load(std::memory_order_relaxed);
+            }
+            stats.evictions = evictions_;
+            stats.memory = memory_;
+            stats.peakMemory = peakMemory_;
+            stats.capacity = capacity_;
+            return stats;
+        }
+
+        auto ResetStats() -> void
+        {
+            for (auto& counters : counters_)
+            {
+                counters.lookups = 0;
+                counters.hits = 0;
+            }
+            evictions_ = 0;
+            peakMemory_ = memory_.load();
+        }
+
+    private:
+
+        auto Acquire(Shard& shard, const TextureCache::TilePtr& tile) -> void
+        {
+            const size_t size = tile->data.size() * sizeof(float);
+            shard.memory += size;
+            const size_t memory = memory_ += size;
+            size_t peak = peakMemory_;
+            while (memory > peak && !peakMemory_.compare_exchange_weak(peak, memory));
+        }
+
+        auto Release(Shard& shard, const TextureCache::TilePtr& tile) -> void
+        {
+            const size_t size = tile->data.size() * sizeof(float);
+            shard.memory -= size;
+            memory_ -= size;
+        }
+
+    private:
+
+        std::atomic<size_t> capacity_{ (size_t)(1) << 30 };
+        Shard shards_[NumShards];
+
+        std::mutex registryMutex_;
+        int nextID_ = 0;
+        std::unordered_map<int, TextureCache::TileLoadFunc> loaders_;
+
+        tbb::enumerable_thread_specific<Counters> counters_;         // Padded to the cache line per thread
+        std::atomic<long long> evictions_{ 0 };
+        std::atomic<size_t> memory_{ 0 };
+        std::atomic<size_t> peakMemory_{ 0 };
+
+    };
+}
+
+auto TextureCache::SetCapacity(size_t capacity) -> void { TextureCacheImpl::Instance().SetCapacity(capacity); }
+auto TextureCache::Register(const TileLoadFunc& loadFunc) -> int { return TextureCacheImpl::Instance().Register(loadFunc); }
+auto TextureCache::Unregister(int textureID) -> void { TextureCacheImpl::Instance().Unregister(textureID); }
+auto TextureCache::Tile(int textureID, int level, int tileX, int tileY) -> TilePtr { return TextureCacheImpl::Instance().Tile(textureID, level, tileX, tileY); }
+auto TextureCache::Stats() -> TextureCacheStats { return TextureCacheImpl::Instance().Stats(); }
+auto TextureCache::ResetStats() -> void { TextureCacheImpl::Instance().ResetStats(); }
+
+LM_NAMESPACE_END
@@ -0,0 +1,361 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <pch.h>
+#include <lightmetrica/trianglemesh.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/logger.h>
+#include <lightmetrica/detail/binarymesh.h>
+#include <lightmetrica/detail/mappedfile.h>
+#include <lightmetrica/detail/serial.h>
+#include <tbb/tbb.h>
+
+LM_NAMESPACE_BEGIN
+
+namespace
+{
+    const char BinaryMeshMagic[8] = { 'L', 'M', 'B', 'M', 'E', 'S', 'H', '\0' };
+    const std::uint32_t BinaryMeshVersion = 1;
+    const std::uint64_t BinaryMeshAlignment = 64;
+
+    auto AlignOffset(std::uint64_t offset) -> std::uint64_t
+    {
+        return (offset + BinaryMeshAlignment - 1) / BinaryMeshAlignment * BinaryMeshAlignment;
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+#pragma region Binary mesh
+
+/*!
+    Triangle mesh loaded from the binary mesh file.
+    The file is memory-mapped and the data blocks are directly used as the mesh data.
+    If the precision of the file differs from GeomFloat,
+    the vertex blocks are converted into the copies.
+*/
+class TriangleMesh_Binary final : public TriangleMesh
+{
+public:
+
+    LM_IMPL_CLASS(TriangleMesh_Binary, TriangleMesh);
+
+public:
+
+    LM_IMPL_F(Load) = [this](const PropertyNode* prop, Assets* assets, const Primitive* primitive) -> bool
+    {
+        std::string localpath;
+        if (!prop->ChildAs("path", localpath)) return false;
+        const auto basepath = boost::filesystem::path(prop->Tree()->BasePath());
+        return LoadFile((basepath / localpath).string());
+    };
+
+public:
+
+    LM_IMPL_F(NumVertices) = [this]() -> int { return numVertices_; };
+    LM_IMPL_F(NumFaces)    = [this]() -> int { return numFaces_; };
+    LM_IMPL_F(Positions)   = [this]() -> const GeomFloat* { return ps_; };
+    LM_IMPL_F(Normals)     = [this]() -> const GeomFloat* { return ns_; };
+    LM_IMPL_F(Texcoords)   = [this]() -> const GeomFloat* { return ts_; };
+    LM_IMPL_F(Faces)       = [this]() -> const unsigned int* { return fs_; };
+
+public:
+
+    // The mesh is serialized as the path to the binary mesh file
+    LM_IMPL_F(Serialize) = [this](std::ostream& stream) -> bool
+    {
+        {
+            cereal::PortableBinaryOutputArchive oa(stream);
+            oa(path_);
+        }
+        return true;
+    };
+
+    LM_IMPL_F(Deserialize) = [this](std::istream& stream, const std::unordered_map<std::string, void*>& userdata) -> bool
+    {
+        std::string path;
+        {
+            cereal::PortableBinaryInputArchive ia(stream);
+            ia(path);
+        }
+        return LoadFile(path);
+    };
+
+private:
+
+    auto LoadFile(const std::string& path) -> bool
+    {
+        path_ = boost::filesystem::absolute(path).string();
+        if (!file_.Map(path_))
+        {
+            return false;
+        }
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Check header
+        if (file_.Size() < sizeof(BinaryMeshHeader))
+        {
+            LM_LOG_ERROR("Invalid binary mesh file: " + path_);
+            return false;
+        }
+
+        BinaryMeshHeader header;
+        std::memcpy(&header, file_.Data(), sizeof(BinaryMeshHeader));
+        if (std::memcmp(header.magic, BinaryMeshMagic, sizeof(BinaryMeshMagic)) != 0)
+        {
+            LM_LOG_ERROR("Invalid binary mesh file: " + path_);
+            return false;
+        }
+        if (header.version != BinaryMeshVersion)
+        {
+            LM_LOG_ERROR(boost::str(boost::format("Unsupported binary mesh version %d (expected %d)") % header.version % BinaryMeshVersion));
+            return false;
+        }
+        if (header.floatSize != sizeof(float) && header.floatSize != sizeof(double))
+        {
+            LM_LOG_ERROR(boost::str(boost::format("Invalid floating point size %d") % header.floatSize));
+            return false;
+        }
+        if (header.numVertices > (std::uint64_t)(std::numeric_limits<int>::max()) || header.numFaces > (std::uint64_t)(std::numeric_limits<int>::max()))
+        {
+            LM_LOG_ERROR("Too many vertices or faces");
+            return false;
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Get data blocks
+        const auto Block = [&](std::uint64_t offset, std::uint64_t size, const char* name) -> const unsigned char*
+        {
+            if (offset == 0)
+            {
+                return nullptr;
+            }
+            if (offset % BinaryMeshAlignment != 0 || offset + size > file_.Size())
+            {
+                LM_LOG_ERROR("Invalid '" + std::string(name) + "' block: " + path_);
+                return nullptr;
+            }
+            return file_.Data() + offset;
+        };
+
+        const auto nv = header.numVertices;
+        const auto fsize = header.floatSize;
+        const auto* ps = Block(header.positionsOffset, nv * 3 * fsize, "positions");
+        const auto* ns = Block(header.normalsOffset,   nv * 3 * fsize, "normals");
+        const auto* ts = Block(header.texcoordsOffset, nv * 2 * fsize, "texcoords");
+        const auto* fs = Block(header.facesOffset,     header.numFaces * 3 * sizeof(std::uint32_t), "faces");
+        if (!ps || !fs || (header.normalsOffset && !ns) || (header.texcoordsOffset && !ts))
+        {
+            return false;
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Check face indices
+        {
+            const auto* indices = reinterpret_cast<const std::uint32_t*>(fs);
+            const auto maxIndex = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, (size_t)(header.numFaces * 3), 1 << 16), (std::uint32_t)(0), [&](const tbb::blocked_range<size_t>& range, std::uint32_t m) -> std::uint32_t
+            {
+                for (size_t i = range.begin(); i != range.end(); i++)
+                {
+                    m = std::max(m, indices[i]);
+                }
+                return m;
+            }, [](std::uint32_t m1, std::uint32_t m2) -> std::uint32_t
+            {
+                return std::max(m1, m2);
+            });
+            if (header.numFaces > 0 && maxIndex >= nv)
+            {
+                LM_LOG_ERROR(boost::str(boost::format("Invalid face index %d (number of vertices: %d): %s") % maxIndex % nv % path_));
+                return false;
+            }
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Set mesh data
+        numVertices_ = (int)(header.numVertices);
+        numFaces_ = (int)(header.numFaces);
+        fs_ = reinterpret_cast<const unsigned int*>(fs);
+
+        // The positions can be used directly only if the file contains the padding after the positions
+        // (see TriangleMesh::Positions), which is always the case for the files written by BinaryMesh::Save.
+        const bool paddedPositions = header.positionsOffset + (nv * 3 + 1) * fsize <= file_.Size();
+        const auto Convert = [&](const unsigned char* data, size_t n, size_t padding, std::vector<GeomFloat>& out) -> const GeomFloat*
+        {
+            if (!data)
+            {
+                return nullptr;
+            }
+            out.assign(n + padding, 0);
+            for (size_t i = 0; i < n; i++)
+            {
+                if (fsize == sizeof(float))
+                {
+                    float v;
+                    std::memcpy(&v, data + i * sizeof(float), sizeof(float));
+                    out[i] = (GeomFloat)(v);
+                }
+                else
+                {
+                    double v;
+                    std::memcpy(&v, data + i * sizeof(double), sizeof(double));
+                    out[i] = (GeomFloat)(v);
+                }
+            }
+            return out.data();
+        };
+
+        if (fsize == sizeof(GeomFloat))
+        {
+            // Zero-copy (except for the positions without padding)
+            ps_ = paddedPositions ? reinterpret_cast<const GeomFloat*>(ps) : Convert(ps, nv * 3, 1, convertedPs_);
+            ns_ = reinterpret_cast<const GeomFloat*>(ns);
+            ts_ = reinterpret_cast<const GeomFloat*>(ts);
+        }
+        else
+        {
+            LM_LOG_WARN("Precision of the binary mesh differs from the geometry precision. Converting vertex data.");
+            ps_ = Convert(ps, nv * 3, 1, convertedPs_);
+            ns_ = Convert(ns, nv * 3, 0, convertedNs_);
+            ts_ = Convert(ts, nv * 2, 0, convertedTs_);
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        LM_LOG_INFO(boost::str(boost::format("Mapped %d vertices, %d faces") % numVertices_ % numFaces_));
+        return true;
+    }
+
+private:
+
+    std::string path_;
+    MappedFile file_;
+    int numVertices_ = 0;
+    int numFaces_ = 0;
+    const GeomFloat* ps_ = nullptr;
+    const GeomFloat* ns_ = nullptr;
+    const GeomFloat* ts_ = nullptr;
+    const unsigned int* fs_ = nullptr;
+
+    // Used only if the precision of the file differs from GeomFloat or the positions are not padded
+    std::vector<GeomFloat> convertedPs_;
+    std::vector<GeomFloat> convertedNs_;
+    std::vector<GeomFloat> convertedTs_;
+
+};
+
+LM_COMPONENT_REGISTER_IMPL(TriangleMesh_Binary, "trianglemesh::binary");
+
+#pragma endregion
+
+// --------------------------------------------------------------------------------
+
+#pragma region Writer
+
+auto BinaryMesh::Save(const std::string& path, const TriangleMesh* mesh) -> bool
+{
+    const auto nv = (std::uint64_t)(mesh->NumVertices());
+    const auto nf = (std::uint64_t)(mesh->NumFaces());
+
+    // Compute the layout of the blocks
+    BinaryMeshHeader header = {};
+    std::memcpy(header.magic, BinaryMeshMagic, sizeof(BinaryMeshMagic));
+    header.version = BinaryMeshVersion;
+    header.floatSize = sizeof(GeomFloat);
+    header.numVertices = nv;
+    header.numFaces = nf;
+
+    // The positions and faces blocks are always allocated (possibly empty),
+    // because the data of an empty std::vector can be nullptr.
+    if ((nv > 0 && !mesh->Positions()) || (nf > 0 && !mesh->Faces()))
+    {
+        LM_LOG_ERROR("Mesh must contain positions and faces");
+        return false;
+    }
+
+    std::uint64_t offset = AlignOffset(sizeof(BinaryMeshHeader));
+    const auto AddBlock = [&](const void* data, std::uint64_t size, bool required) -> std::uint64_t
+    {
+        if (!data && !required)
+        {
+            return 0;
+        }
+        const auto blockOffset = offset;
+        offset = AlignOffset(offset + size);
+        return blockOffset;
+    };
+    // The positions block is followed by the padding of one element (see TriangleMesh::Positions).
+    // The padding is filled with zeros when the next block is written.
+    header.positionsOffset = AddBlock(mesh->Positions(), (nv * 3 + 1) * sizeof(GeomFloat), true);
+    header.normalsOffset   = AddBlock(mesh->Normals(),   nv * 3 * sizeof(GeomFloat), false);
+    header.texcoordsOffset = AddBlock(mesh->Texcoords(), nv * 2 * sizeof(GeomFloat), false);
+    header.facesOffset     = AddBlock(mesh->Faces(),     nf * 3 * sizeof(std::uint32_t), true);
+
+    // Write
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    if (!out)
+    {
+        LM_LOG_ERROR("Failed to open file: " + path);
+        return false;
+    }
+
+    const auto WriteBlock = [&](std::uint64_t blockOffset, const void* data, std::uint64_t size) -> void
+    {
+        if (blockOffset == 0)
+        {
+            return;
+        }
+        const std::vector<char> padding((size_t)(blockOffset - (std::uint64_t)(out.tellp())), 0);
+        out.write(padding.data(), padding.size());
+        if (size > 0)
+        {
+            out.write(static_cast<const char*>(data), size);
+        }
+    };
+    out.write(reinterpret_cast<const char*>(&header), sizeof(BinaryMeshHeader));
+    WriteBlock(header.positionsOffset, mesh->Positions(), nv * 3 * sizeof(GeomFloat));
+    WriteBlock(header.normalsOffset,   mesh->Normals(),   nv * 3 * sizeof(GeomFloat));
+    WriteBlock(header.texcoordsOffset, mesh->Texcoords(), nv * 2 * sizeof(GeomFloat));
+    WriteBlock(header.facesOffset,     mesh->Faces(),     nf * 3 * sizeof(std::uint32_t));
+
+    if (!out)
+    {
+        LM_LOG_ERROR("Failed to write file: " + path);
+        return false;
+    }
+
+    return true;
+}
+
+#pragma endregion
+
+LM_NAMESPACE_END
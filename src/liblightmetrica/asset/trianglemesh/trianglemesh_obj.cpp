@@ -25,7 +25,10 @@
 #include <pch.h>
 #include <lightmetrica/trianglemesh.h>
 #include <lightmetrica/property.h>
+#include <lightmetrica/detail/propertyutils.h>
 #include <lightmetrica/detail/serial.h>
+#include <lightmetrica/detail/mappedfile.h>
+#include <tbb/tbb.h>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #pragma warning(push)
@@ -35,6 +38,476 @@
 
 LM_NAMESPACE_BEGIN
 
+#pragma region Parallel OBJ parser
+
+namespace
+{
+    /*
+        Parallel OBJ parser.
+        The memory-mapped file is split into chunks at line boundaries.
+        The first pass counts the vertex attributes in each chunk in parallel,
+        which determines the global offsets of the attributes defined in the chunks.
+        The second pass parses the chunks in parallel, writing the attributes
+        directly into the final arrays and resolving the face indices.
+        Only the geometry (v, vt, vn, f) is considered; other statements are ignored.
+    */
+    class ObjParser
+    {
+    public:
+
+        // Indices of a face vertex (0-based, -1 if not specified)
+        struct FaceVertex
+        {
+            int v;
+            int vt;
+            int vn;
+        };
+
+        struct Chunk
+        {
+            const char* begin;
+            const char* end;
+            long long numPositions = 0;         // Number of each attribute in the chunk
+            long long numTexcoords = 0;
+            long long numNormals = 0;
+            long long positionsOffset = 0;      // Global offset of the attributes in the chunk
+            long long texcoordsOffset = 0;
+            long long normalsOffset = 0;
+            std::vector<FaceVertex> faces;      // Triangulated faces
+            std::string error;
+        };
+
+    public:
+
+        auto Parse(const char* data, size_t size) -> bool
+        {
+            #pragma region Split into chunks
+            const size_t ChunkSize = 1 << 22;
+            for (const char* p = data; p < data + size;)
+            {
+                const char* e = std::min(p + ChunkSize, data + size);
+                while (e < data + size && *(e - 1) != '\n') e++;
+                Chunk chunk;
+                chunk.begin = p;
+                chunk.end = e;
+                chunks_.push_back(std::move(chunk));
+                p = e;
+            }
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Count vertex attributes
+            tbb::parallel_for(0, (int)(chunks_.size()), [&](int i)
+            {
+                auto& chunk = chunks_[i];
+                ForEachLine(chunk.begin, chunk.end, [&](const char* p, const char* e)
+                {
+                    if (e - p < 2 || p[0] != 'v') return;
+                    if (IsSpace(p[1]))   chunk.numPositions++;
+                    else if (p[1] == 't') chunk.numTexcoords++;
+                    else if (p[1] == 'n') chunk.numNormals++;
+                });
+            });
+
+            for (size_t i = 1; i < chunks_.size(); i++)
+            {
+                chunks_[i].positionsOffset = chunks_[i-1].positionsOffset + chunks_[i-1].numPositions;
+                chunks_[i].texcoordsOffset = chunks_[i-1].texcoordsOffset + chunks_[i-1].numTexcoords;
+                chunks_[i].normalsOffset   = chunks_[i-1].normalsOffset   + chunks_[i-1].numNormals;
+            }
+
+            numPositions_ = chunks_.empty() ? 0 : chunks_.back().positionsOffset + chunks_.back().numPositions;
+            numTexcoords_ = chunks_.empty() ? 0 : chunks_.back().texcoordsOffset + chunks_.back().numTexcoords;
+            numNormals_   = chunks_.empty() ? 0 : chunks_.back().normalsOffset + chunks_.back().numNormals;
+            if (numPositions_ > std::numeric_limits<int>::max() || numTexcoords_ > std::numeric_limits<int>::max() || numNormals_ > std::numeric_limits<int>::max())
+            {
+                LM_LOG_ERROR("Too many vertices");
+                return false;
+            }
+
+            ps_.resize(numPositions_ * 3);
+            ts_.resize(numTexcoords_ * 2);
+            ns_.resize(numNormals_ * 3);
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Parse chunks
+            tbb::parallel_for(0, (int)(chunks_.size()), [&](int i)
+            {
+                ParseChunk(chunks_[i]);
+            });
+
+            for (const auto& chunk : chunks_)
+            {
+                if (!chunk.error.empty())
+                {
+                    LM_LOG_ERROR(chunk.error);
+                    return false;
+                }
+            }
+            #pragma endregion
+
+            return true;
+        }
+
+        // Builds the mesh by merging the parsed chunks
+        auto Build(std::vector<GeomFloat>& ps, std::vector<GeomFloat>& ns, std::vector<GeomFloat>& ts, std::vector<unsigned int>& fs) -> bool
+        {
+            #pragma region Check consistency of the attributes
+            // Same as tinyobjloader, normals and texture coordinates must be specified for all or none of the faces
+            struct State
+            {
+                long long numFaceVertices = 0;
+                long long numTexcoords = 0;
+                long long numNormals = 0;
+                bool aligned = true;        // True if the indices of the attributes are same
+            };
+            std::vector<State> states(chunks_.size());
+            tbb::parallel_for(0, (int)(chunks_.size()), [&](int i)
+            {
+                auto& state = states[i];
+                for (const auto& fv : chunks_[i].faces)
+                {
+                    state.numTexcoords += fv.vt >= 0 ? 1 : 0;
+                    state.numNormals   += fv.vn >= 0 ? 1 : 0;
+                    state.aligned = state.aligned && (fv.vt < 0 || fv.vt == fv.v) && (fv.vn < 0 || fv.vn == fv.v);
+                }
+                state.numFaceVertices = (long long)(chunks_[i].faces.size());
+            });
+
+            State total;
+            for (const auto& state : states)
+            {
+                total.numFaceVertices += state.numFaceVertices;
+                total.numTexcoords += state.numTexcoords;
+                total.numNormals += state.numNormals;
+                total.aligned = total.aligned && state.aligned;
+            }
+
+            if ((total.numTexcoords != 0 && total.numTexcoords != total.numFaceVertices) || (total.numNormals != 0 && total.numNormals != total.numFaceVertices))
+            {
+                LM_LOG_ERROR("Inconsistency of normal or texcoords");
+                return false;
+            }
+            if (total.numFaceVertices > std::numeric_limits<int>::max())
+            {
+                LM_LOG_ERROR("Too many faces");
+                return false;
+            }
+
+            const bool hasTexcoords = total.numTexcoords > 0;
+            const bool hasNormals = total.numNormals > 0;
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Offsets of the faces of the chunks
+            std::vector<long long> faceOffsets(chunks_.size() + 1, 0);
+            for (size_t i = 0; i < chunks_.size(); i++)
+            {
+                faceOffsets[i + 1] = faceOffsets[i] + (long long)(chunks_[i].faces.size());
+            }
+            fs.resize(faceOffsets.back());
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Build vertices
+            if (total.aligned && (!hasTexcoords || numTexcoords_ == numPositions_) && (!hasNormals || numNormals_ == numPositions_))
+            {
+                // The attributes share the indices, so they can be directly used as vertices
+                tbb::parallel_for(0, (int)(chunks_.size()), [&](int i)
+                {
+                    auto* out = &fs[faceOffsets[i]];
+                    for (const auto& fv : chunks_[i].faces)
+                    {
+                        *out++ = (unsigned int)(fv.v);
+                    }
+                });
+
+                ps.swap(ps_);
+                ns.clear();
+                ts.clear();
+                if (hasNormals)   ns.swap(ns_);
+                if (hasTexcoords) ts.swap(ts_);
+            }
+            else
+            {
+                // Create a vertex for each unique combination of the indices
+                const auto Hash = [](const FaceVertex& fv) -> size_t
+                {
+                    return ((size_t)(fv.v) * 73856093) ^ ((size_t)(fv.vt) * 19349663) ^ ((size_t)(fv.vn) * 83492791);
+                };
+                const auto Equal = [](const FaceVertex& a, const FaceVertex& b) -> bool
+                {
+                    return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+                };
+                std::unordered_map<FaceVertex, unsigned int, decltype(Hash), decltype(Equal)> vertexMap(numPositions_, Hash, Equal);
+
+                ps.clear();
+                ns.clear();
+                ts.clear();
+                size_t fi = 0;
+                for (const auto& chunk : chunks_)
+                {
+                    for (const auto& fv : chunk.faces)
+                    {
+                        const auto it = vertexMap.find(fv);
+                        if (it != vertexMap.end())
+                        {
+                            fs[fi++] = it->second;
+                            continue;
+                        }
+
+                        const auto index = (unsigned int)(ps.size() / 3);
+                        vertexMap.emplace(fv, index);
+                        fs[fi++] = index;
+                        ps.insert(ps.end(), &ps_[3 * (size_t)(fv.v)], &ps_[3 * (size_t)(fv.v)] + 3);
+                        if (hasNormals)   ns.insert(ns.end(), &ns_[3 * (size_t)(fv.vn)], &ns_[3 * (size_t)(fv.vn)] + 3);
+                        if (hasTexcoords) ts.insert(ts.end(), &ts_[2 * (size_t)(fv.vt)], &ts_[2 * (size_t)(fv.vt)] + 2);
+                    }
+                }
+            }
+            #pragma endregion
+
+            return true;
+        }
+
+    private:
+
+        static auto IsSpace(char c) -> bool { return c == ' ' || c == '\t'; }
+        static auto IsEOL(char c) -> bool { return c == '\n' || c == '\r'; }
+
+        // Calls the function with the range of each line without leading spaces
+        template <typename Func>
+        static auto ForEachLine(const char* p, const char* end, const Func& func) -> void
+        {
+            while (p < end)
+            {
+                while (p < end && IsSpace(*p)) p++;
+                const char* e = p;
+                while (e < end && *e != '\n') e++;
+                func(p, e);
+                p = e + 1;
+            }
+        }
+
+        static auto ParseInt(const char*& p, const char* end, long long& v) -> bool
+        {
+            bool neg = false;
+            if (p < end && (*p == '-' || *p == '+')) { neg = *p == '-'; p++; }
+            if (p == end || !std::isdigit((unsigned char)(*p))) return false;
+            v = 0;
+            while (p < end && std::isdigit((unsigned char)(*p)))
+            {
+                v = v * 10 + (*p - '0');
+                p++;
+            }
+            if (neg) v = -v;
+            return true;
+        }
+
+        // Parses a floating point number without requiring null termination
+        static auto ParseFloat(const char*& p, const char* end, double& v) -> bool
+        {
+            while (p < end && IsSpace(*p)) p++;
+
+            bool neg = false;
+            if (p < end && (*p == '-' || *p == '+')) { neg = *p == '-'; p++; }
+
+            // Mantissa (up to 19 significant digits)
+            unsigned long long mantissa = 0;
+            int exponent = 0;
+            int numDigits = 0;
+            int numSignificantDigits = 0;
+            const auto AddDigit = [&](char c, bool fraction) -> void
+            {
+                numDigits++;
+                if (numSignificantDigits < 19)
+                {
+                    mantissa = mantissa * 10 + (c - '0');
+                    numSignificantDigits += mantissa > 0 ? 1 : 0;
+                    exponent -= fraction ? 1 : 0;
+                }
+                else
+                {
+                    exponent += fraction ? 0 : 1;
+                }
+            };
+            while (p < end && std::isdigit((unsigned char)(*p))) { AddDigit(*p++, false); }
+            if (p < end && *p == '.')
+            {
+                p++;
+                while (p < end && std::isdigit((unsigned char)(*p))) { AddDigit(*p++, true); }
+            }
+            if (numDigits == 0)
+            {
+                return false;
+            }
+
+            // Exponent
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                p++;
+                long long e;
+                if (!ParseInt(p, end, e)) return false;
+                exponent += (int)(std::max(-1000LL, std::min(1000LL, e)));
+            }
+
+            // Powers of ten up to 22 are exactly representable in double
+            static const double Pow10[] =
+            {
+                1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+            v = (double)(mantissa);
+            if (exponent < 0)
+            {
+                v = -exponent <= 22 ? v / Pow10[-exponent] : v * std::pow(10.0, exponent);
+            }
+            else if (exponent > 0)
+            {
+                v = exponent <= 22 ? v * Pow10[exponent] : v * std::pow(10.0, exponent);
+            }
+            if (neg) v = -v;
+
+            return true;
+        }
+
+        auto ParseChunk(Chunk& chunk) -> void
+        {
+            long long pi = chunk.positionsOffset;
+            long long ti = chunk.texcoordsOffset;
+            long long ni = chunk.normalsOffset;
+
+            // Converts an OBJ index (1-based or negative relative) to 0-based index
+            const auto ResolveIndex = [](long long index, long long count) -> long long
+            {
+                return index > 0 ? index - 1 : count + index;
+            };
+
+            std::vector<FaceVertex> polygon;
+            ForEachLine(chunk.begin, chunk.end, [&](const char* p, const char* e)
+            {
+                if (!chunk.error.empty() || p == e)
+                {
+                    return;
+                }
+
+                const auto Error = [&](const std::string& message) -> void
+                {
+                    const char* le = p;
+                    while (le < e && !IsEOL(*le)) le++;
+                    chunk.error = message + ": '" + std::string(p, le) + "'";
+                };
+
+                #pragma region Vertex attributes
+                if (p[0] == 'v' && e - p >= 2)
+                {
+                    const auto ParseFloats = [&](const char* q, GeomFloat* out, int n) -> bool
+                    {
+                        for (int i = 0; i < n; i++)
+                        {
+                            double v;
+                            if (!ParseFloat(q, e, v)) return false;
+                            out[i] = (GeomFloat)(v);
+                        }
+                        return true;
+                    };
+
+                    bool succeeded = true;
+                    if (IsSpace(p[1]))   succeeded = ParseFloats(p + 1, &ps_[3 * pi++], 3);
+                    else if (p[1] == 't') succeeded = ParseFloats(p + 2, &ts_[2 * ti++], 2);
+                    else if (p[1] == 'n') succeeded = ParseFloats(p + 2, &ns_[3 * ni++], 3);
+                    if (!succeeded)
+                    {
+                        Error("Invalid vertex attribute");
+                    }
+                    return;
+                }
+                #pragma endregion
+
+                // --------------------------------------------------------------------------------
+
+                #pragma region Faces
+                if (p[0] == 'f' && e - p >= 2 && IsSpace(p[1]))
+                {
+                    polygon.clear();
+                    const char* q = p + 1;
+                    while (true)
+                    {
+                        while (q < e && IsSpace(*q)) q++;
+                        if (q == e || IsEOL(*q)) break;
+
+                        // Parse v, v/vt, v//vn, or v/vt/vn
+                        long long v, vt = 0, vn = 0;
+                        if (!ParseInt(q, e, v)) { Error("Invalid face"); return; }
+                        if (q < e && *q == '/')
+                        {
+                            q++;
+                            if (q < e && *q != '/')
+                            {
+                                if (!ParseInt(q, e, vt)) { Error("Invalid face"); return; }
+                            }
+                            if (q < e && *q == '/')
+                            {
+                                q++;
+                                if (!ParseInt(q, e, vn)) { Error("Invalid face"); return; }
+                            }
+                        }
+
+                        FaceVertex fv;
+                        const auto rv  = ResolveIndex(v, pi);
+                        const auto rvt = vt != 0 ? ResolveIndex(vt, ti) : -1;
+                        const auto rvn = vn != 0 ? ResolveIndex(vn, ni) : -1;
+                        if (v == 0 || rv < 0 || rv >= numPositions_ || (vt != 0 && (rvt < 0 || rvt >= numTexcoords_)) || (vn != 0 && (rvn < 0 || rvn >= numNormals_)))
+                        {
+                            Error("Invalid index");
+                            return;
+                        }
+                        fv.v  = (int)(rv);
+                        fv.vt = (int)(rvt);
+                        fv.vn = (int)(rvn);
+                        polygon.push_back(fv);
+                    }
+
+                    // Triangulate the polygon as a fan
+                    for (size_t i = 2; i < polygon.size(); i++)
+                    {
+                        chunk.faces.push_back(polygon[0]);
+                        chunk.faces.push_back(polygon[i - 1]);
+                        chunk.faces.push_back(polygon[i]);
+                    }
+                    return;
+                }
+                #pragma endregion
+            });
+        }
+
+    private:
+
+        std::vector<Chunk> chunks_;
+        long long numPositions_ = 0;
+        long long numTexcoords_ = 0;
+        long long numNormals_ = 0;
+        std::vector<GeomFloat> ps_;
+        std::vector<GeomFloat> ts_;
+        std::vector<GeomFloat> ns_;
+
+    };
+}
+
+#pragma endregion
+
+// --------------------------------------------------------------------------------
+
+/*!
+    Triangle mesh loaded from OBJ file.
+    The mesh is loaded by the parallel OBJ parser by default.
+    The parser can be switched to tinyobjloader with `parser: tinyobj`.
+*/
 class TriangleMesh_Obj final : public TriangleMesh
 {
 public:
@@ -48,25 +521,67 @@ public:
         std::string localpath;
         if (!prop->ChildAs("path", localpath)) return false;
         const auto basepath = boost::filesystem::path(prop->Tree()->BasePath());
-        const auto path = basepath / localpath;
+        const auto path = (basepath / localpath).string();
+
+        const auto parser = prop->ChildAs<std::string>("parser", "parallel");
+        if (parser == "parallel")
+        {
+            return Load_Parallel(path);
+        }
+        else if (parser == "tinyobj")
+        {
+            return Load_TinyObj(path);
+        }
+
+        LM_LOG_ERROR("Invalid parser: " + parser);
+        PropertyUtils::PrintPrettyError(prop->Child("parser"));
+        return false;
+    };
+
+private:
+
+    auto Load_Parallel(const std::string& path) -> bool
+    {
+        MappedFile file;
+        if (!file.Map(path))
+        {
+            return false;
+        }
+
+        ObjParser parser;
+        if (!parser.Parse(reinterpret_cast<const char*>(file.Data()), file.Size()))
+        {
+            return false;
+        }
+
+        if (!parser.Build(ps_, ns_, ts_, fs_))
+        {
+            return false;
+        }
+
+        // Padding after the last position (see TriangleMesh::Positions)
+        ps_.push_back(0);
 
+        return true;
+    }
+
+    auto Load_TinyObj(const std::string& path) -> bool
+    {
         std::vector<tinyobj::shape_t> shapes;
         std::vector<tinyobj::material_t> materials;
 
         std::string err;
-        bool ret = tinyobj::LoadObj(shapes, materials, err, path.string().c_str(), nullptr);
+        bool ret = tinyobj::LoadObj(shapes, materials, err, path.c_str(), nullptr);
         if (!ret)
         {
             LM_LOG_ERROR(err);
             return false;
         }
 
-        // Obj model must contain at least one shape
-        assert(!shapes.empty());
-
-        // There must not be the shape with normals and the shape with no normals in the same model
-        bool nonormal   = shapes[0].mesh.normals.empty();
-        bool notexcoord = shapes[0].mesh.texcoords.empty();
+        // There must not be the shape with normals and the shape with no normals in the same model.
+        // An empty model (e.g., an empty file) results in an empty mesh.
+        bool nonormal   = shapes.empty() || shapes[0].mesh.normals.empty();
+        bool notexcoord = shapes.empty() || shapes[0].mesh.texcoords.empty();
         for (size_t i = 1; i < shapes.size(); i++)
         {
             if (nonormal != shapes[i].mesh.normals.empty() || notexcoord != shapes[i].mesh.texcoords.empty())
@@ -77,29 +592,42 @@ public:
         }
 
         // Copy
+        size_t numPositions = 0, numIndices = 0;
+        for (const auto& shape : shapes)
+        {
+            numPositions += shape.mesh.positions.size();
+            numIndices += shape.mesh.indices.size();
+        }
+        ps_.reserve(numPositions);
+        ns_.reserve(nonormal ? 0 : numPositions);
+        ts_.reserve(notexcoord ? 0 : numPositions / 3 * 2);
+        fs_.reserve(numIndices);
         for (const auto& shape : shapes)
         {
             const auto& mesh = shape.mesh;
             const size_t psN = ps_.size() / 3;
-            ps_.insert(ps_.begin(), mesh.positions.begin(), mesh.positions.end());
-            ns_.insert(ns_.begin(), mesh.normals.begin(), mesh.normals.end());
-            ts_.insert(ts_.begin(), mesh.texcoords.begin(), mesh.texcoords.end());
+            ps_.insert(ps_.end(), mesh.positions.begin(), mesh.positions.end());
+            ns_.insert(ns_.end(), mesh.normals.begin(), mesh.normals.end());
+            ts_.insert(ts_.end(), mesh.texcoords.begin(), mesh.texcoords.end());
             std::transform(mesh.indices.begin(), mesh.indices.end(), std::back_inserter(fs_), [&](unsigned int i)
             {
                 return i + (unsigned int)(psN);
             });
         }
 
+        // Padding after the last position (see TriangleMesh::Positions)
+        ps_.push_back(0);
+
         return true;
-    };
+    }
 
 public:
 
     LM_IMPL_F(NumVertices) = [this]() -> int { return (int)(ps_.size()) / 3; };
     LM_IMPL_F(NumFaces)    = [this]() -> int { return (int)(fs_.size()) / 3; };
-    LM_IMPL_F(Positions)   = [this]() -> const Float* { return ps_.data(); };
-    LM_IMPL_F(Normals)     = [this]() -> const Float* { return ns_.data(); };
-    LM_IMPL_F(Texcoords)   = [this]() -> const Float* { return ts_.data(); };
+    LM_IMPL_F(Positions)   = [this]() -> const GeomFloat* { return ps_.data(); };
+    LM_IMPL_F(Normals)     = [this]() -> const GeomFloat* { return ns_.data(); };
+    LM_IMPL_F(Texcoords)   = [this]() -> const GeomFloat* { return ts_.data(); };
     LM_IMPL_F(Faces)       = [this]() -> const unsigned int* { return fs_.data(); };
 
 public:
@@ -124,9 +652,9 @@ public:
 
 protected:
 
-    std::vector<Float> ps_;
-    std::vector<Float> ns_;
-    std::vector<Float> ts_;
+    std::vector<GeomFloat> ps_;
+    std::vector<GeomFloat> ns_;
+    std::vector<GeomFloat> ts_;
     std::vector<unsigned int> fs_;
 
 };
@@ -78,6 +78,9 @@ public:
             return false;
         }
 
+        // Padding after the last position (see TriangleMesh::Positions)
+        ps_.push_back(0);
+
         return true;
     };
 
@@ -85,9 +88,9 @@ public:
 
     LM_IMPL_F(NumVertices) = [this]() -> int { return (int)(ps_.size()) / 3; };
     LM_IMPL_F(NumFaces)    = [this]() -> int { return (int)(fs_.size()) / 3; };
-    LM_IMPL_F(Positions)   = [this]() -> const Float* { return ps_.data(); };
-    LM_IMPL_F(Normals)     = [this]() -> const Float* { return ns_.data(); };
-    LM_IMPL_F(Texcoords)   = [this]() -> const Float* { return ts_.data(); };
+    LM_IMPL_F(Positions)   = [this]() -> const GeomFloat* { return ps_.data(); };
+    LM_IMPL_F(Normals)     = [this]() -> const GeomFloat* { return ns_.data(); };
+    LM_IMPL_F(Texcoords)   = [this]() -> const GeomFloat* { return ts_.data(); };
     LM_IMPL_F(Faces)       = [this]() -> const unsigned int* { return fs_.data(); };
 
 public:
@@ -112,9 +115,9 @@ public:
 
 protected:
 
-    std::vector<Float> ps_;
-    std::vector<Float> ns_;
-    std::vector<Float> ts_;
+    std::vector<GeomFloat> ps_;
+    std::vector<GeomFloat> ns_;
+    std::vector<GeomFloat> ts_;
     std::vector<unsigned int> fs_;
 
 };
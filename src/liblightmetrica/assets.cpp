@@ -29,16 +29,28 @@
 #include <lightmetrica/asset.h>
 #include <lightmetrica/detail/propertyutils.h>
 #include <lightmetrica/detail/serial.h>
+#include <tbb/tbb.h>
 
 LM_NAMESPACE_BEGIN
 
-// The assets are loaded when it queries.
+// The assets are loaded when it queries,
+// or in parallel by preloading.
 class Assets3 final : public Assets
 {
 public:
 
     LM_IMPL_CLASS(Assets3, Assets);
 
+private:
+
+    // Loading state of an asset.
+    // An asset failed to load is not retried.
+    struct Entry
+    {
+        std::once_flag flag;
+        Asset* asset = nullptr;
+    };
+
 public:
 
     LM_IMPL_F(Initialize) = [this](const PropertyNode* prop) -> bool
@@ -50,75 +62,86 @@ public:
     LM_IMPL_F(AssetByIDAndType) = [this](const std::string& id, const std::string& interfaceType, const Primitive* primitive) -> Asset*
     {
         #pragma region Find the registered asset by id
-        const auto it = assetIndexMap_.find(id);
-        if (it != assetIndexMap_.end())
+        Entry* entry;
         {
-            // TODO: Add type check
-            return assets_[it->second].get();
+            std::unique_lock<std::mutex> lock(mutex_);
+            const auto it = assetIndexMap_.find(id);
+            if (it != assetIndexMap_.end())
+            {
+                // TODO: Add type check
+                return assets_[it->second].get();
+            }
+
+            // The entry is shared by the threads requesting the same asset
+            auto& e = entries_[id];
+            if (!e) { e.reset(new Entry); }
+            entry = e.get();
         }
         #pragma endregion
 
         // --------------------------------------------------------------------------------
 
         #pragma region If not found, try to load asset
+        // Only one thread loads the asset, the others wait until the load finishes.
+        // Dependent assets are loaded recursively in the loading thread.
+        // The load is isolated so that the loading thread waiting in the nested parallel loops of the loader
+        // does not steal an outer task requesting the same asset, which would deadlock in call_once.
+        std::call_once(entry->flag, [&]()
         {
-            LM_LOG_INFO("Loading asset '" + id + "'");
-            LM_LOG_INDENTER();
-
-            // Find property node
-            const auto* assetNode = prop_->Child(id);
-            if (!assetNode)
+            tbb::this_task_arena::isolate([&]()
             {
-                LM_LOG_ERROR("Missing '" + id + "' node");
-                PropertyUtils::PrintPrettyError(prop_);
-                return nullptr;
-            }
+                auto asset = LoadAsset(id, interfaceType, primitive);
+                if (!asset)
+                {
+                    return;
+                }
+
+                // Register asset
+                std::unique_lock<std::mutex> lock(mutex_);
+                entry->asset = asset.get();
+                assets_.push_back(std::move(asset));
+                assetIndexMap_[id] = assets_.size() - 1;
+                assets_.back()->SetID(id);
+                assets_.back()->SetIndex((int)(assets_.size() - 1));
+            });
+        });
+        #pragma endregion
 
-            // Check interface type (case insensitive)
-            const auto* interfaceNode = assetNode->Child("interface");
-            if (!interfaceNode)
-            {
-                LM_LOG_ERROR("Missing 'interface' node");
-                PropertyUtils::PrintPrettyError(assetNode);
-                return nullptr;
-            }
-            if (!boost::iequals(interfaceType, interfaceNode->RawScalar()))
-            {
-                LM_LOG_ERROR(boost::str(boost::format("Invalid asset type '%s' expected '%s'") % interfaceNode->RawScalar() % interfaceType));
-                PropertyUtils::PrintPrettyError(assetNode);
-                return nullptr;
-            }
+        // --------------------------------------------------------------------------------
+
+        return entry->asset;
+    };
 
-            // Create asset instance
-            const auto* typeNode = assetNode->Child("type");
-            const std::string implType = typeNode->RawScalar();
-            auto asset = ComponentFactory::Create<Asset>(interfaceType + "::" + implType);   // This cannot be const (later we move it)
-            if (!asset)
+    LM_IMPL_F(Preload) = [this](const std::vector<std::string>& ids) -> bool
+    {
+        // Remove duplicated IDs
+        std::vector<std::string> uniqueIDs(ids);
+        std::sort(uniqueIDs.begin(), uniqueIDs.end());
+        uniqueIDs.erase(std::unique(uniqueIDs.begin(), uniqueIDs.end()), uniqueIDs.end());
+
+        LM_LOG_INFO(boost::str(boost::format("Preloading %d assets") % uniqueIDs.size()));
+        LM_LOG_INDENTER();
+
+        // Load independent assets in parallel
+        std::atomic<bool> succeeded(true);
+        tbb::parallel_for(0, (int)(uniqueIDs.size()), [&](int i)
+        {
+            const auto& id = uniqueIDs[i];
+            const auto* assetNode = prop_->Child(id);
+            const auto* interfaceNode = assetNode ? assetNode->Child("interface") : nullptr;
+            if (!interfaceNode)
             {
-                LM_LOG_ERROR("Failed to create instance: " + implType);
-                PropertyUtils::PrintPrettyError(assetNode);
-                return nullptr;
+                LM_LOG_ERROR("Missing asset or 'interface' node: '" + id + "'");
+                succeeded = false;
+                return;
             }
-
-            // Load asset
-            if (!asset->Load(assetNode->Child("params"), this, primitive))
+            if (!AssetByIDAndType(id, interfaceNode->RawScalar(), nullptr))
             {
-                LM_LOG_ERROR("Failed to load asset '" + id + "'");
-                PropertyUtils::PrintPrettyError(assetNode);
-                return nullptr;
+                succeeded = false;
             }
+        });
 
-            // Register asset
-            assets_.push_back(std::move(asset));
-            assetIndexMap_[id] = assets_.size() - 1;
-            assets_.back()->SetID(id);
-            assets_.back()->SetIndex((int)(assets_.size() - 1));
-        }
-        #pragma endregion
-
-        // --------------------------------------------------------------------------------
-
-        return assets_.back().get();
+        return succeeded;
     };
 
     LM_IMPL_F(PostLoad) = [this](const Scene* scene) -> bool
@@ -141,6 +164,7 @@ public:
 
     LM_IMPL_F(GetByIndex) = [this](int index) -> Asset*
     {
+        std::unique_lock<std::mutex> lock(mutex_);
         return assets_[index].get();
     };
 
@@ -191,14 +215,69 @@ public:
         return true;
     };
 
+private:
+
+    auto LoadAsset(const std::string& id, const std::string& interfaceType, const Primitive* primitive) -> Asset::UniquePtr
+    {
+        LM_LOG_INFO("Loading asset '" + id + "'");
+        LM_LOG_INDENTER();
+
+        // Find property node
+        const auto* assetNode = prop_->Child(id);
+        if (!assetNode)
+        {
+            LM_LOG_ERROR("Missing '" + id + "' node");
+            PropertyUtils::PrintPrettyError(prop_);
+            return Asset::UniquePtr(nullptr, nullptr);
+        }
+
+        // Check interface type (case insensitive)
+        const auto* interfaceNode = assetNode->Child("interface");
+        if (!interfaceNode)
+        {
+            LM_LOG_ERROR("Missing 'interface' node");
+            PropertyUtils::PrintPrettyError(assetNode);
+            return Asset::UniquePtr(nullptr, nullptr);
+        }
+        if (!boost::iequals(interfaceType, interfaceNode->RawScalar()))
+        {
+            LM_LOG_ERROR(boost::str(boost::format("Invalid asset type '%s' expected '%s'") % interfaceNode->RawScalar() % interfaceType));
+            PropertyUtils::PrintPrettyError(assetNode);
+            return Asset::UniquePtr(nullptr, nullptr);
+        }
+
+        // Create asset instance
+        const auto* typeNode = assetNode->Child("type");
+        const std::string implType = typeNode->RawScalar();
+        auto asset = ComponentFactory::Create<Asset>(interfaceType + "::" + implType);   // This cannot be const (later we move it)
+        if (!asset)
+        {
+            LM_LOG_ERROR("Failed to create instance: " + implType);
+            PropertyUtils::PrintPrettyError(assetNode);
+            return Asset::UniquePtr(nullptr, nullptr);
+        }
+
+        // Load asset
+        if (!asset->Load(assetNode->Child("params"), this, primitive))
+        {
+            LM_LOG_ERROR("Failed to load asset '" + id + "'");
+            PropertyUtils::PrintPrettyError(assetNode);
+            return Asset::UniquePtr(nullptr, nullptr);
+        }
+
+        return asset;
+    }
+
 private:
 
     const PropertyNode* prop_;
 
 private:
 
+    std::mutex mutex_;
     std::vector<Asset::UniquePtr> assets_;
     std::unordered_map<std::string, size_t> assetIndexMap_;
+    std::unordered_map<std::string, std::unique_ptr<Entry>> entries_;
 
 };
 
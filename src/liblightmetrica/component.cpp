@@ -98,6 +98,14 @@ public:
         return it == funcMap.end() ? nullptr : it->second.releaseFunc;
     }
 
+    auto EnumerateKeys(KeyFuncPointerType func, void* userData) -> void
+    {
+        for (const auto& kv : funcMap)
+        {
+            func(kv.first.c_str(), userData);
+        }
+    }
+
     auto LoadPlugin(const std::string& path) -> bool
     {
         LM_LOG_INFO("Loading '" + boost::filesystem::path(path).filename().string() + "'");
@@ -187,6 +195,7 @@ auto ComponentFactory_Register(const char* key, CreateFuncPointerType createFunc
 auto ComponentFactory_Unregister(const char* key) -> void { ComponentFactoryImpl::Instance().Unregister(key); }
 auto ComponentFactory_Create(const char* key) -> Component* { return ComponentFactoryImpl::Instance().Create(key); }
 auto ComponentFactory_ReleaseFunc(const char* key) -> ReleaseFuncPointerType { return ComponentFactoryImpl::Instance().ReleaseFunc(key); }
+auto ComponentFactory_EnumerateKeys(KeyFuncPointerType func, void* userData) -> void { ComponentFactoryImpl::Instance().EnumerateKeys(func, userData); }
 auto ComponentFactory_LoadPlugin(const char* path) -> bool { return ComponentFactoryImpl::Instance().LoadPlugin(path); }
 auto ComponentFactory_LoadPlugins(const char* directory) -> void { ComponentFactoryImpl::Instance().LoadPlugins(directory); }
 auto ComponentFactory_UnloadPlugins() -> void { ComponentFactoryImpl::Instance().UnloadPlugins(); }
@@ -0,0 +1,368 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <pch.h>
+#include <lightmetrica/detail/lightbvh.h>
+
+LM_NAMESPACE_BEGIN
+
+namespace
+{
+    // cos(max(0, a - b)) and sin(max(0, a - b)) given the sines and cosines of the angles
+    auto CosSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) -> Float
+    {
+        return cosA > cosB ? 1_f : cosA * cosB + sinA * sinB;
+    }
+
+    auto SinSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) -> Float
+    {
+        return cosA > cosB ? 0_f : sinA * cosB - cosA * sinB;
+    }
+
+    auto SafeSqrt(Float v) -> Float
+    {
+        return std::sqrt(std::max(0_f, v));
+    }
+
+    auto SafeAcos(Float v) -> Float
+    {
+        return Math::Acos(Math::Clamp(v, -1_f, 1_f));
+    }
+
+    // Smallest cone containing two cones
+    auto UnionCone(const Vec3& axisA, Float cosA, const Vec3& axisB, Float cosB, Vec3& axis, Float& cosTheta) -> void
+    {
+        const auto thetaA = SafeAcos(cosA);
+        const auto thetaB = SafeAcos(cosB);
+        const auto thetaD = SafeAcos(Math::Dot(axisA, axisB));
+        if (std::min(thetaD + thetaB, Math::Pi()) <= thetaA)
+        {
+            axis = axisA;
+            cosTheta = cosA;
+            return;
+        }
+        if (std::min(thetaD + thetaA, Math::Pi()) <= thetaB)
+        {
+            axis = axisB;
+            cosTheta = cosB;
+            return;
+        }
+
+        const auto thetaO = (thetaA + thetaD + thetaB) * .5_f;
+        const auto k = Math::Cross(axisA, axisB);
+        if (thetaO >= Math::Pi() || Math::Length2(k) == 0_f)
+        {
+            axis = axisA;
+            cosTheta = -1_f;
+            return;
+        }
+
+        // Rotate axisA toward axisB by thetaO - thetaA
+        const auto thetaR = thetaO - thetaA;
+        axis = Math::Normalize(axisA * std::cos(thetaR) + Math::Cross(Math::Normalize(k), axisA) * std::sin(thetaR));
+        cosTheta = std::cos(thetaO);
+    }
+
+    auto UnionBounds(const LightBounds& a, const LightBounds& b) -> LightBounds
+    {
+        LightBounds r;
+        r.bound = Math::Union(a.bound, b.bound);
+        UnionCone(a.axis, a.cosThetaO, b.axis, b.cosThetaO, r.axis, r.cosThetaO);
+        r.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+        r.power = a.power + b.power;
+        return r;
+    }
+
+    // Cost of the node used to find the split [Conty Estevez & Kulla 2018]
+    auto EvaluateCost(const LightBounds& b, const Bound& nodeBound, int axis) -> Float
+    {
+        const auto thetaO = SafeAcos(b.cosThetaO);
+        const auto thetaE = SafeAcos(b.cosThetaE);
+        const auto thetaW = std::min(thetaO + thetaE, Math::Pi());
+        const auto sinThetaO = SafeSqrt(1_f - b.cosThetaO * b.cosThetaO);
+        const auto mOmega =
+            2_f * Math::Pi() * (1_f - b.cosThetaO) +
+            Math::Pi() * .5_f * (2_f * thetaW * sinThetaO - std::cos(thetaO - 2_f * thetaW) - 2_f * thetaO * sinThetaO + b.cosThetaO);
+        const auto d = nodeBound.max - nodeBound.min;
+        const auto kr = std::max({ d.x, d.y, d.z }) / d[axis];
+        return b.power * mOmega * kr * b.bound.SurfaceArea();
+    }
+
+    struct Reference
+    {
+        int index;
+        LightBounds bounds;
+        Vec3 centroid;
+    };
+}
+
+auto LightBVH::Build(const std::vector<LightBounds>& lights) -> void
+{
+    nodes_.clear();
+    leafIndices_.assign(lights.size(), -1);
+
+    // --------------------------------------------------------------------------------
+
+    #pragma region Create references
+    std::vector<Reference> refs;
+    for (int i = 0; i < (int)(lights.size()); i++)
+    {
+        if (lights[i].power <= 0_f)
+        {
+            continue;
+        }
+        refs.push_back({ i, lights[i], lights[i].bound.Centroid() });
+    }
+    if (refs.empty())
+    {
+        return;
+    }
+    #pragma endregion
+
+    // --------------------------------------------------------------------------------
+
+    #pragma region Build recursively
+    const std::function<int(int, int, int)> Build_ = [&](int begin, int end, int parent) -> int
+    {
+        const int index = (int)(nodes_.size());
+        nodes_.emplace_back();
+        nodes_[index].parent = parent;
+
+        // Leaf node
+        if (end - begin == 1)
+        {
+            auto& node = nodes_[index];
+            node.isleaf = true;
+            node.bounds = refs[begin].bounds;
+            node.leaf.light = refs[begin].index;
+            leafIndices_[refs[begin].index] = index;
+            return index;
+        }
+
+        // Bound of the centroids
+        Bound nodeBound;
+        Bound centroidBound;
+        for (int i = begin; i < end; i++)
+        {
+            nodeBound = Math::Union(nodeBound, refs[i].bounds.bound);
+            centroidBound = Math::Union(centroidBound, refs[i].centroid);
+        }
+
+        // Find the split with the minimum cost with the binning
+        const int NumBins = 12;
+        Float minCost = Math::Inf();
+        int minAxis = -1;
+        int minBin = -1;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const auto extent = centroidBound.max[axis] - centroidBound.min[axis];
+            if (extent <= 0_f)
+            {
+                continue;
+            }
+
+            // Assign the references to the bins
+            LightBounds bins[NumBins];
+            for (int i = begin; i < end; i++)
+            {
+                const int b = Math::Clamp((int)(NumBins * (refs[i].centroid[axis] - centroidBound.min[axis]) / extent), 0, NumBins - 1);
+                bins[b] = bins[b].power == 0_f ? refs[i].bounds : UnionBounds(bins[b], refs[i].bounds);
+            }
+
+            // Evaluate the costs of the splits between the bins
+            for (int split = 0; split < NumBins - 1; split++)
+            {
+                LightBounds b1, b2;
+                for (int b = 0; b <= split; b++)
+                {
+                    if (bins[b].power > 0_f) b1 = b1.power == 0_f ? bins[b] : UnionBounds(b1, bins[b]);
+                }
+                for (int b = split + 1; b < NumBins; b++)
+                {
+                    if (bins[b].power > 0_f) b2 = b2.power == 0_f ? bins[b] : UnionBounds(b2, bins[b]);
+                }
+                if (b1.power == 0_f || b2.power == 0_f)
+                {
+                    continue;
+                }
+                const auto cost = EvaluateCost(b1, nodeBound, axis) + EvaluateCost(b2, nodeBound, axis);
+                if (cost < minCost)
+                {
+                    minCost = cost;
+                    minAxis = axis;
+                    minBin = split;
+                }
+            }
+        }
+
+        // Partition the references
+        int mid;
+        if (minAxis >= 0)
+        {
+            const auto extent = centroidBound.max[minAxis] - centroidBound.min[minAxis];
+            mid = (int)(std::partition(refs.begin() + begin, refs.begin() + end, [&](const Reference& r) -> bool
+            {
+                const int b = Math::Clamp((int)(NumBins * (r.centroid[minAxis] - centroidBound.min[minAxis]) / extent), 0, NumBins - 1);
+                return b <= minBin;
+            }) - refs.begin());
+        }
+        else
+        {
+            // All centroids are at the same position
+            mid = (begin + end) / 2;
+        }
+        if (mid == begin || mid == end)
+        {
+            mid = (begin + end) / 2;
+        }
+
+        // Internal node
+        const int child1 = Build_(begin, mid, index);
+        const int child2 = Build_(mid, end, index);
+        auto& node = nodes_[index];
+        node.isleaf = false;
+        node.internal.child1 = child1;
+        node.internal.child2 = child2;
+        node.bounds = UnionBounds(nodes_[child1].bounds, nodes_[child2].bounds);
+        return index;
+    };
+    Build_(0, (int)(refs.size()), -1);
+    #pragma endregion
+}
+
+auto LightBVH::Sample(const Vec3& p, const Vec3& n, Float u, Float& pdf) const -> int
+{
+    if (nodes_.empty())
+    {
+        return -1;
+    }
+
+    pdf = 1_f;
+    int index = 0;
+    while (!nodes_[index].isleaf)
+    {
+        // Choose a child according to the importances
+        const auto& node = nodes_[index];
+        const auto i1 = Importance(nodes_[node.internal.child1].bounds, p, n);
+        const auto i2 = Importance(nodes_[node.internal.child2].bounds, p, n);
+        if (i1 == 0_f && i2 == 0_f)
+        {
+            return -1;
+        }
+        const auto p1 = i1 / (i1 + i2);
+        if (u < p1)
+        {
+            index = node.internal.child1;
+            u = std::min(u / p1, 1_f - Math::Eps());
+            pdf *= p1;
+        }
+        else
+        {
+            index = node.internal.child2;
+            u = std::min((u - p1) / (1_f - p1), 1_f - Math::Eps());
+            pdf *= 1_f - p1;
+        }
+    }
+
+    return nodes_[index].leaf.light;
+}
+
+auto LightBVH::EvaluatePDF(int light, const Vec3& p, const Vec3& n) const -> Float
+{
+    if (light < 0 || light >= (int)(leafIndices_.size()) || leafIndices_[light] < 0)
+    {
+        return 0_f;
+    }
+
+    // Accumulate the probabilities of the choices from the leaf to the root
+    Float pdf = 1_f;
+    int index = leafIndices_[light];
+    while (nodes_[index].parent >= 0)
+    {
+        const auto& parent = nodes_[nodes_[index].parent];
+        const auto i1 = Importance(nodes_[parent.internal.child1].bounds, p, n);
+        const auto i2 = Importance(nodes_[parent.internal.child2].bounds, p, n);
+        if (i1 == 0_f && i2 == 0_f)
+        {
+            return 0_f;
+        }
+        pdf *= (index == parent.internal.child1 ? i1 : i2) / (i1 + i2);
+        index = nodes_[index].parent;
+    }
+
+    return pdf;
+}
+
+auto LightBVH::Importance(const LightBounds& b, const Vec3& p, const Vec3& n) -> Float
+{
+    if (b.power == 0_f)
+    {
+        return 0_f;
+    }
+
+    // Distance to the center of the bound, clamped to avoid the singularity inside the bound
+    const auto pc = b.bound.Centroid();
+    const auto dist2 = Math::Length2(p - pc);
+    const auto d2 = std::max(dist2, Math::Length(b.bound.max - b.bound.min) * .5_f);
+    if (dist2 == 0_f)
+    {
+        return b.power / d2;
+    }
+
+    // Angle between the axis and the direction to the shading point
+    const auto wi = (p - pc) / std::sqrt(dist2);
+    const auto cosThetaW = Math::Dot(b.axis, wi);
+    const auto sinThetaW = SafeSqrt(1_f - cosThetaW * cosThetaW);
+
+    // Angle subtended by the bounding sphere of the bound
+    const bool inside = p.x >= b.bound.min.x && p.x <= b.bound.max.x && p.y >= b.bound.min.y && p.y <= b.bound.max.y && p.z >= b.bound.min.z && p.z <= b.bound.max.z;
+    const auto r2 = Math::Length2(b.bound.max - b.bound.min) * .25_f;
+    const auto sin2ThetaB = r2 / dist2;
+    const auto cosThetaB = inside || sin2ThetaB >= 1_f ? -1_f : SafeSqrt(1_f - sin2ThetaB);
+    const auto sinThetaB = SafeSqrt(1_f - cosThetaB * cosThetaB);
+
+    // Minimum angle between the emission and the direction to the shading point
+    const auto sinThetaO = SafeSqrt(1_f - b.cosThetaO * b.cosThetaO);
+    const auto cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, b.cosThetaO);
+    const auto sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, b.cosThetaO);
+    const auto cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= b.cosThetaE)
+    {
+        return 0_f;
+    }
+
+    auto importance = b.power * cosThetaP / d2;
+
+    // Minimum incident angle at the shading point
+    if (Math::Length2(n) > 0_f)
+    {
+        const auto cosThetaI = std::abs(Math::Dot(wi, n));
+        const auto sinThetaI = SafeSqrt(1_f - cosThetaI * cosThetaI);
+        importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+    }
+
+    return std::max(importance, 0_f);
+}
+
+LM_NAMESPACE_END
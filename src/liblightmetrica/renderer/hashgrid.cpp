@@ -0,0 +1,272 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch.h>
+#include <lightmetrica/detail/hashgrid.h>
+#include <lightmetrica/logger.h>
+#include <tbb/tbb.h>
+
+LM_NAMESPACE_BEGIN
+
+constexpr size_t HashGrid::MaxNumPoints;
+
+auto HashGrid::Build(size_t numPoints, Float cellSize, const std::function<bool(int i, Vec3& p)>& pointFunc, const std::function<void(int i, int sortedIndex)>& moveFunc) -> bool
+{
+    numPoints_ = 0;
+    cellStart_.assign(2, 0);
+    numBuckets_ = 1;
+    if (numPoints == 0)
+    {
+        return true;
+    }
+    if (numPoints > MaxNumPoints)
+    {
+        LM_LOG_ERROR(boost::str(boost::format("Too many points for the hash grid (%d > %d)") % numPoints % MaxNumPoints));
+        return false;
+    }
+    const int n = (int)(numPoints);
+
+    // --------------------------------------------------------------------------------
+
+    #pragma region Grid parameters
+
+    bound_ = tbb::parallel_reduce(tbb::blocked_range<int>(0, n, 4096), Bound(), [&](const tbb::blocked_range<int>& range, Bound b) -> Bound
+    {
+        for (int i = range.begin(); i != range.end(); i++)
+        {
+            Vec3 p;
+            if (pointFunc(i, p)) { b = Math::Union(b, p); }
+        }
+        return b;
+    }, [](const Bound& b1, const Bound& b2) -> Bound
+    {
+        return Math::Union(b1, b2);
+    });
+
+    if (bound_.min.x > bound_.max.x)
+    {
+        // All points are excluded
+        return true;
+    }
+
+    if (cellSize <= 0_f)
+    {
+        // A few points per cell on average assuming the points are on surfaces
+        const auto d = bound_.max - bound_.min;
+        const auto area = 2_f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        cellSize = area > 0_f ? Math::Sqrt(area / n) * 2_f : 1_f;
+    }
+    invCellSize_ = 1_f / cellSize;
+    for (int i = 0; i < 3; i++)
+    {
+        gridRes_[i] = (int)(Math::Min((bound_.max[i] - bound_.min[i]) * invCellSize_, (Float)(1 << 30))) + 1;
+    }
+
+    while (numBuckets_ < numPoints) { numBuckets_ <<= 1; }
+
+    #pragma endregion
+
+    // --------------------------------------------------------------------------------
+
+    #pragma region Counting sort by bucket
+
+    // Count points per bucket
+    if (countsCapacity_ < numBuckets_)
+    {
+        counts_.reset(new std::atomic<int>[numBuckets_]);
+        countsCapacity_ = numBuckets_;
+    }
+    for (size_t i = 0; i < numBuckets_; i++) { counts_[i] = 0; }
+    tbb::parallel_for(tbb::blocked_range<int>(0, n, 4096), [&](const tbb::blocked_range<int>& range) -> void
+    {
+        for (int i = range.begin(); i != range.end(); i++)
+        {
+            Vec3 p;
+            if (pointFunc(i, p))
+            {
+                counts_[Bucket(CellIndex(p))].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    });
+
+    // Prefix sum
+    cellStart_.resize(numBuckets_ + 1);
+    cellStart_[0] = 0;
+    for (size_t i = 0; i < numBuckets_; i++)
+    {
+        cellStart_[i + 1] = cellStart_[i] + counts_[i].load(std::memory_order_relaxed);
+        counts_[i] = cellStart_[i];
+    }
+    numPoints_ = cellStart_[numBuckets_];
+
+    // Scatter points. The bucket is recomputed instead of being stored per point
+    xs_.resize(numPoints_);
+    ys_.resize(numPoints_);
+    zs_.resize(numPoints_);
+    tbb::parallel_for(tbb::blocked_range<int>(0, n, 4096), [&](const tbb::blocked_range<int>& range) -> void
+    {
+        for (int i = range.begin(); i != range.end(); i++)
+        {
+            Vec3 p;
+            if (!pointFunc(i, p))
+            {
+                continue;
+            }
+            const int j = counts_[Bucket(CellIndex(p))].fetch_add(1, std::memory_order_relaxed);
+            xs_[j] = (float)(p.x);
+            ys_[j] = (float)(p.y);
+            zs_[j] = (float)(p.z);
+            moveFunc(i, j);
+        }
+    });
+
+    #pragma endregion
+
+    return true;
+}
+
+auto HashGrid::RangeQuery(const Vec3& p, Float radius, const std::function<void(int sortedIndex)>& queryFunc) const -> void
+{
+    if (numPoints_ == 0)
+    {
+        return;
+    }
+
+    // Range of cells overlapping with the query sphere, clamped to the grid
+    auto minCell = CellIndex(p - Vec3(radius));
+    auto maxCell = CellIndex(p + Vec3(radius));
+    long long numCells = 1;
+    for (int i = 0; i < 3; i++)
+    {
+        minCell[i] = std::max(minCell[i], 0);
+        maxCell[i] = std::min(maxCell[i], gridRes_[i] - 1);
+        if (minCell[i] > maxCell[i])
+        {
+            return;
+        }
+        numCells = std::min(numCells * (maxCell[i] - minCell[i] + 1), (long long)(numBuckets_) + 1);
+    }
+
+    const Float radius2 = radius * radius;
+    if (numCells > (long long)(numBuckets_))
+    {
+        // Scanning all points is cheaper than visiting the cells
+        QueryInRange(0, numPoints_, p, radius2, queryFunc);
+        return;
+    }
+
+    // Buckets of the cells. Different cells can share a bucket so we remove duplicates.
+    // The local buffer covers 3x3x3 cells, which can happen with the radius assumed in the build
+    // due to the rounding error in the cell indices.
+    unsigned int localBuckets[27];
+    std::vector<unsigned int> heapBuckets;
+    unsigned int* buckets = localBuckets;
+    if (numCells > 27)
+    {
+        heapBuckets.resize((size_t)(numCells));
+        buckets = heapBuckets.data();
+    }
+    int numBuckets = 0;
+    for (int z = minCell[2]; z <= maxCell[2]; z++)
+    {
+        for (int y = minCell[1]; y <= maxCell[1]; y++)
+        {
+            for (int x = minCell[0]; x <= maxCell[0]; x++)
+            {
+                buckets[numBuckets++] = Bucket({ x, y, z });
+            }
+        }
+    }
+    std::sort(buckets, buckets + numBuckets);
+    numBuckets = (int)(std::unique(buckets, buckets + numBuckets) - buckets);
+
+    for (int i = 0; i < numBuckets; i++)
+    {
+        QueryInRange(cellStart_[buckets[i]], cellStart_[buckets[i] + 1], p, radius2, queryFunc);
+    }
+}
+
+auto HashGrid::CellIndex(const Vec3& p) const -> CellIdx
+{
+    // Clamped to avoid overflow for the points far outside of the grid
+    const auto q = (p - bound_.min) * invCellSize_;
+    const auto ToIndex = [](Float v) -> int { return (int)(std::floor(Math::Clamp(v, -1_f, (Float)(1 << 30)))); };
+    return { ToIndex(q.x), ToIndex(q.y), ToIndex(q.z) };
+}
+
+auto HashGrid::Bucket(const CellIdx& c) const -> unsigned int
+{
+    const auto h = ((unsigned int)(c[0]) * 73856093u) ^ ((unsigned int)(c[1]) * 19349663u) ^ ((unsigned int)(c[2]) * 83492791u);
+    return h & (unsigned int)(numBuckets_ - 1);
+}
+
+auto HashGrid::QueryInRange(int begin, int end, const Vec3& p, Float radius2, const std::function<void(int)>& queryFunc) const -> void
+{
+    // Distances are computed in the precision of the stored positions
+    const float qx = (float)(p.x);
+    const float qy = (float)(p.y);
+    const float qz = (float)(p.z);
+    const float qr2 = (float)(radius2);
+    int i = begin;
+
+    #if LM_SSE
+    const auto px = _mm_set1_ps(qx);
+    const auto py = _mm_set1_ps(qy);
+    const auto pz = _mm_set1_ps(qz);
+    const auto r2 = _mm_set1_ps(qr2);
+    for (; i + 4 <= end; i += 4)
+    {
+        const auto dx = _mm_sub_ps(_mm_loadu_ps(&xs_[i]), px);
+        const auto dy = _mm_sub_ps(_mm_loadu_ps(&ys_[i]), py);
+        const auto dz = _mm_sub_ps(_mm_loadu_ps(&zs_[i]), pz);
+        const auto d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        const int mask = _mm_movemask_ps(_mm_cmplt_ps(d2, r2));
+        if (mask == 0)
+        {
+            continue;
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            if (mask & (1 << j))
+            {
+                queryFunc(i + j);
+            }
+        }
+    }
+    #endif
+
+    for (; i < end; i++)
+    {
+        const auto dx = xs_[i] - qx;
+        const auto dy = ys_[i] - qy;
+        const auto dz = zs_[i] - qz;
+        if (dx * dx + dy * dy + dz * dz < qr2)
+        {
+            queryFunc(i);
+        }
+    }
+}
+
+LM_NAMESPACE_END
@@ -0,0 +1,172 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch.h>
+#include <lightmetrica/detail/photonmap.h>
+#include <lightmetrica/bound.h>
+#include <tbb/tbb.h>
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    \brief kd-tree photon map with flat layout.
+
+    Photons are reordered in place so that every range [begin, end) of the array
+    is a subtree whose splitting photon is placed at the median `(begin + end) / 2`.
+    The children are the ranges [begin, mid) and [mid + 1, end),
+    so the tree needs no pointers and the photons are traversed in memory order.
+    The split axis and value are stored in the node array indexed by the median.
+    Subtrees are built in parallel, and queries use an explicit stack.
+*/
+class PhotonMap_FlatKdTree : public PhotonMap
+{
+public:
+
+    LM_IMPL_CLASS(PhotonMap_FlatKdTree, PhotonMap);
+
+private:
+
+    struct Node
+    {
+        Float split;
+        int axis;
+    };
+
+    static constexpr int LeafSize = 8;                  // Ranges up to this size are scanned linearly
+    static constexpr int ParallelBuildSize = 1 << 14;   // Subtrees larger than this are built in parallel
+    static constexpr int MaxStackSize = 128;
+
+public:
+
+    virtual auto Build(std::vector<Photon>&& photons) -> void
+    {
+        photons_ = std::move(photons);
+        nodes_.resize(photons_.size());
+        BuildRange(0, (int)(photons_.size()));
+    }
+
+    virtual auto CollectPhotons(const Vec3& p, Float radius, const std::function<void(const Photon&)>& collectFunc) const -> void
+    {
+        const Float radius2 = radius * radius;
+
+        struct Range { int begin; int end; };
+        Range stack[MaxStackSize];
+        int top = 0;
+        stack[top++] = { 0, (int)(photons_.size()) };
+        
+        while (top > 0)
+        {
+            const auto range = stack[--top];
+
+            // Leaf, or the range is scanned linearly if the children do not fit in the stack.
+            // The stack depth is at most the tree depth plus one, so the latter does not happen for valid trees.
+            if (range.end - range.begin <= LeafSize || top + 2 > MaxStackSize)
+            {
+                for (int i = range.begin; i < range.end; i++)
+                {
+                    if (Math::Length2(photons_[i].p - p) < radius2)
+                    {
+                        collectFunc(photons_[i]);
+                    }
+                }
+                continue;
+            }
+
+            // Splitting photon
+            const int mid = range.begin + (range.end - range.begin) / 2;
+            const auto& node = nodes_[mid];
+            if (Math::Length2(photons_[mid].p - p) < radius2)
+            {
+                collectFunc(photons_[mid]);
+            }
+
+            // Visit the near side first
+            const Float d = p[node.axis] - node.split;
+            const Range left{ range.begin, mid };
+            const Range right{ mid + 1, range.end };
+            if (d < 0_f)
+            {
+                if (d * d < radius2) { stack[top++] = right; }
+                stack[top++] = left;
+            }
+            else
+            {
+                if (d * d < radius2) { stack[top++] = left; }
+                stack[top++] = right;
+            }
+        }
+    }
+
+private:
+
+    //! Builds the subtree of the range [begin, end).
+    auto BuildRange(int begin, int end) -> void
+    {
+        if (end - begin <= LeafSize)
+        {
+            return;
+        }
+
+        // Select longest axis as split axis
+        Bound bound;
+        for (int i = begin; i < end; i++)
+        {
+            bound = Math::Union(bound, photons_[i].p);
+        }
+        const int axis = bound.LongestAxis();
+
+        // Partition around the median
+        const int mid = begin + (end - begin) / 2;
+        std::nth_element(photons_.begin() + begin, photons_.begin() + mid, photons_.begin() + end, [&](const Photon& p1, const Photon& p2) -> bool
+        {
+            return p1.p[axis] < p2.p[axis];
+        });
+        nodes_[mid].split = photons_[mid].p[axis];
+        nodes_[mid].axis = axis;
+
+        // Build subtrees
+        if (end - begin > ParallelBuildSize)
+        {
+            tbb::parallel_invoke(
+                [&]() { BuildRange(begin, mid); },
+                [&]() { BuildRange(mid + 1, end); });
+        }
+        else
+        {
+            BuildRange(begin, mid);
+            BuildRange(mid + 1, end);
+        }
+    }
+
+private:
+
+    std::vector<Photon> photons_;
+    std::vector<Node> nodes_;       // Valid only for the medians of internal ranges
+
+};
+
+LM_COMPONENT_REGISTER_IMPL(PhotonMap_FlatKdTree, "photonmap::flatkdtree");
+
+LM_NAMESPACE_END
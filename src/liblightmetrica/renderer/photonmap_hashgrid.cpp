@@ -0,0 +1,140 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch.h>
+#include <lightmetrica/detail/photonmap.h>
+#include <lightmetrica/detail/hashgrid.h>
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    \brief Hashed uniform grid photon map.
+
+    Photons are stored in the order of the buckets of `HashGrid`,
+    so that the photons of a bucket are contiguous in memory.
+    With the cell size of twice the maximum gather radius (see `SetMaxRadius`),
+    a query visits at most 2x2x2 cells. Larger radii are handled by visiting more cells.
+*/
+class PhotonMap_HashGrid : public PhotonMap
+{
+public:
+
+    LM_IMPL_CLASS(PhotonMap_HashGrid, PhotonMap);
+
+public:
+
+    virtual auto SetMaxRadius(Float radius) -> void
+    {
+        maxRadius_ = radius;
+    }
+
+    virtual auto Build(std::vector<Photon>&& photons) -> void
+    {
+        const size_t n = photons.size();
+        photons_.clear();
+        compactPhotons_.clear();
+        if (compact_) { compactPhotons_.resize(n); } else { photons_.resize(n); }
+        const bool built = grid_.Build(n, 2_f * maxRadius_, [&](int i, Vec3& p) -> bool
+        {
+            p = photons[i].p;
+            return true;
+        }, [&](int i, int j) -> void
+        {
+            if (compact_)
+            {
+                compactPhotons_[j] = CompactPhoton::Encode(photons[i]);
+            }
+            else
+            {
+                photons_[j] = photons[i];
+            }
+        });
+
+        // Release the input buffer
+        std::vector<Photon>().swap(photons);
+        if (!built)
+        {
+            // The map is left empty
+            std::vector<Photon>().swap(photons_);
+            std::vector<CompactPhoton>().swap(compactPhotons_);
+        }
+    }
+
+    virtual auto CollectPhotons(const Vec3& p, Float radius, const std::function<void(const Photon&)>& collectFunc) const -> void
+    {
+        grid_.RangeQuery(p, radius, [&](int i) -> void
+        {
+            if (compact_)
+            {
+                collectFunc(compactPhotons_[i].Decode(grid_.Position(i)));
+            }
+            else
+            {
+                collectFunc(photons_[i]);
+            }
+        });
+    }
+
+protected:
+
+    bool compact_ = false;                  // Stores photons as CompactPhoton
+
+private:
+
+    Float maxRadius_ = 0_f;
+    HashGrid grid_;
+    std::vector<Photon> photons_;           // Photons sorted by bucket
+    std::vector<CompactPhoton> compactPhotons_;     // Photons sorted by bucket if compact_ is enabled
+
+};
+
+/*!
+    \brief Hashed uniform grid photon map with compact photons.
+
+    Same as `PhotonMap_HashGrid` but the photon attributes are quantized into `CompactPhoton`,
+    which reduces the photon storage from 64 to 8 bytes per photon (80 to 8 with double precision).
+    The grid adds 12 bytes per photon for the positions and 8 to 16 bytes for the bucket tables.
+    The photons are decoded on the fly when collected.
+    See `CompactPhoton` for the quantization error.
+*/
+class PhotonMap_HashGridCompact final : public PhotonMap_HashGrid
+{
+public:
+
+    LM_IMPL_CLASS(PhotonMap_HashGridCompact, PhotonMap_HashGrid);
+
+public:
+
+    PhotonMap_HashGridCompact()
+    {
+        compact_ = true;
+    }
+
+};
+
+LM_COMPONENT_REGISTER_IMPL(PhotonMap_HashGrid, "photonmap::hashgrid");
+LM_COMPONENT_REGISTER_IMPL(PhotonMap_HashGridCompact, "photonmap::hashgrid_compact");
+
+LM_NAMESPACE_END
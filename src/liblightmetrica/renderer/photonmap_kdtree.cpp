@@ -111,7 +111,7 @@ public:
             return idx;
         };
 
-        photons_ = photons;
+        photons_ = std::move(photons);
         nodes_.clear();
         indices_.assign(photons_.size(), 0);
         std::iota(indices_.begin(), indices_.end(), 0);
@@ -37,7 +37,7 @@ public:
 
     virtual auto Build(std::vector<Photon>&& photons) -> void
     {
-        photons_ = photons;
+        photons_ = std::move(photons);
     }
 
     virtual auto CollectPhotons(const Vec3& p, Float radius, const std::function<void(const Photon&)>& collectFunc) const -> void
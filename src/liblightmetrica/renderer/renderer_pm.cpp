@@ -37,7 +37,9 @@
 #include <lightmetrica/film.h>
 #include <lightmetrica/detail/photonmap.h>
 #include <lightmetrica/detail/subpathsampler.h>
+#include <lightmetrica/detail/russianroulette.h>
 #include <lightmetrica/detail/parallel.h>
+#include <tbb/tbb.h>
 
 LM_NAMESPACE_BEGIN
 
@@ -63,146 +65,226 @@ public:
         sched_->Load(prop);
         maxNumVertices_ = prop->ChildAs<int>("max_num_vertices", -1);
         numPhotonTraceSamples_ = prop->ChildAs<long long>("num_photon_trace_samples", 100000L);
+        photonBatchSize_ = prop->ChildAs<long long>("photon_batch_size", 0L);
         finalgather_ = prop->ChildAs<int>("finalgather", 1);
         radius_ = prop->ChildAs<Float>("radius", 0.01_f);
         pm_ = ComponentFactory::Create<PhotonMap>("photonmap::" + prop->ChildAs<std::string>("photonmap", "kdtree"));
+        if (!rr_.Load(prop))
+        {
+            return false;
+        }
         return true;
     };
 
     LM_IMPL_F(Render) = [this](const Scene* scene_, Random* initRng, const std::string& outputPath) -> void
     {
         const auto* scene = static_cast<const Scene3*>(scene_);
+        rr_.EstimateLightReference(scene, initRng);
+        auto* film_ = static_cast<const Sensor*>(scene->GetSensor()->emitter)->GetFilm();
 
         // --------------------------------------------------------------------------------
 
-        #pragma region Trace photons
-        std::vector<Photon> photons;
+        #pragma region Collect gather points
+
+        // The eye paths are traced once and the gather points are stored,
+        // so that the photon map of each batch is gathered against the same points.
+        struct GatherPoint
         {
-            LM_LOG_INFO("Tracing photons");
+            Vec2 rasterPos;                 // Raster position
+            Vec3 wi;                        // Direction to previous vertex
+            SPD throughputE;                // Throughput of importance
+            SubpathSampler::PathVertex v;   // Vertex to gather photons
+            int numVertices;                // Number of vertices needed to generate the gather point
+        };
+
+        std::vector<GatherPoint> gps;
+        long long numEyeSamples = 0;
+        {
+            LM_LOG_INFO("Collecting gather points");
             LM_LOG_INDENTER();
-                
-            struct Context
-            {
-                Random rng;
-                std::vector<Photon> photons;
-            };
-            std::vector<Context> contexts(Parallel::GetNumThreads());
-            for (auto& ctx : contexts)
-            {
-                ctx.rng.SetSeed(initRng->NextUInt());
-            }
 
-            Parallel::For(numPhotonTraceSamples_, [&](long long index, int threadid, bool init)
+            // The contributions of the light sources hit by the eye paths are recorded to the film here
+            tbb::enumerable_thread_specific<std::vector<GatherPoint>> threadGps;
+            numEyeSamples = sched_->Process(scene, film_, initRng, [&](Film* film, Random* rng)
             {
-                auto& ctx = contexts[threadid];
-                SubpathSampler::TraceSubpath(scene, &ctx.rng, maxNumVertices_, TransportDirection::LE, [&](int numVertices, const Vec2& /*rasterPos*/, const SubpathSampler::PathVertex& pv, const SubpathSampler::PathVertex& v, SPD& throughput) -> bool
+                auto& localGps = threadGps.local();
+                bool gatherNext = !finalgather_;
+                SubpathSampler::TraceSubpath(scene, rng, maxNumVertices_, TransportDirection::EL, [&](int numVertices, const Vec2& rasterPos, const SubpathSampler::PathVertex& pv, const SubpathSampler::PathVertex& v, SPD& throughput) -> bool
                 {
-                    // Record photon
-                    if ((v.type & SurfaceInteractionType::D) > 0 || (v.type & SurfaceInteractionType::G) > 0)
+                    // Skip initial vertex
+                    if (numVertices == 1)
                     {
-                        Photon photon;
-                        photon.p = v.geom.p;
-                        photon.throughput = throughput;
-                        photon.wi = Math::Normalize(pv.geom.p - v.geom.p);
-                        photon.numVertices = numVertices;
-                        ctx.photons.push_back(photon);
+                        return true;
                     }
 
-                    // Path termination
-                    const Float rrProb = 0.5_f;
-                    if (ctx.rng.Next() > rrProb)
+                    // Handle hit with light source
+                    if ((v.primitive->Type() & SurfaceInteractionType::L) > 0)
                     {
-                        return false;
+                        // Accumulate to film
+                        const auto C =
+                            throughput
+                            * v.primitive->EvaluateDirection(v.geom, SurfaceInteractionType::L, Vec3(), Math::Normalize(pv.geom.p - v.geom.p), TransportDirection::EL, false)
+                            * v.primitive->EvaluatePosition(v.geom, false);
+                        film->Splat(rasterPos, C);
                     }
-                    else
+
+                    // Record the gather point
+                    if ((v.type & SurfaceInteractionType::D) > 0 || (v.type & SurfaceInteractionType::G) > 0)
                     {
-                        throughput /= rrProb;
+                        if (gatherNext)
+                        {
+                            GatherPoint gp;
+                            gp.rasterPos = rasterPos;
+                            gp.wi = Math::Normalize(pv.geom.p - v.geom.p);
+                            gp.throughputE = throughput;
+                            gp.v = v;
+                            gp.numVertices = numVertices;
+                            localGps.push_back(gp);
+
+                            // TODO: support multi component materials
+                            return false;
+                        }
+
+                        gatherNext = true;
+                        return true;
                     }
 
                     return true;
                 });
             });
 
-            for (auto& ctx : contexts)
+            // Release the thread-local gather points as they are merged
+            gps.reserve(std::accumulate(threadGps.begin(), threadGps.end(), (size_t)(0), [](size_t n, const std::vector<GatherPoint>& v) { return n + v.size(); }));
+            for (auto& localGps : threadGps)
             {
-                photons.insert(photons.end(), ctx.photons.begin(), ctx.photons.end());
+                gps.insert(gps.end(), localGps.begin(), localGps.end());
+                std::vector<GatherPoint>().swap(localGps);
             }
         }
+
         #pragma endregion
 
         // --------------------------------------------------------------------------------
 
-        #pragma region Build photon map
+        // Photons are traced, stored, and gathered in batches of bounded size
+        // so that the peak memory is bounded by the batch size instead of the number of photons.
+        // The density estimates of the batches are summed per gather point.
+        const long long batchSize = photonBatchSize_ > 0 ? std::min(photonBatchSize_, numPhotonTraceSamples_) : numPhotonTraceSamples_;
+        const long long numBatches = batchSize > 0 ? (numPhotonTraceSamples_ + batchSize - 1) / batchSize : 0;
+        std::vector<SPD> contribs(gps.size());
+        for (long long batch = 0; batch < numBatches; batch++)
         {
-            LM_LOG_INFO("Building photon map");
-            LM_LOG_INDENTER();
-            pm_->Build(std::move(photons));
-        }
-        #pragma endregion
+            if (numBatches > 1)
+            {
+                LM_LOG_INFO("Batch " + std::to_string(batch) + " / " + std::to_string(numBatches));
+            }
+            const long long numBatchSamples = std::min(batchSize, numPhotonTraceSamples_ - batch * batchSize);
 
-        // --------------------------------------------------------------------------------
+            // --------------------------------------------------------------------------------
 
-        #pragma region Trace eye rays
-        auto* film_ = static_cast<const Sensor*>(scene->GetSensor()->emitter)->GetFilm();
-        sched_->Process(scene, film_, initRng, [&](Film* film, Random* rng)
-        {
-            bool gatherNext = !finalgather_;
-            SubpathSampler::TraceSubpath(scene, rng, maxNumVertices_, TransportDirection::EL, [&](int numVertices, const Vec2& rasterPos, const SubpathSampler::PathVertex& pv, const SubpathSampler::PathVertex& v, SPD& throughput) -> bool
+            #pragma region Trace photons
+            std::vector<Photon> photons;
             {
-                // Skip initial vertex
-                if (numVertices == 1)
+                LM_LOG_INFO("Tracing photons");
+                LM_LOG_INDENTER();
+                
+                struct Context
                 {
-                    return true;
+                    Random rng;
+                    std::vector<Photon> photons;
+                };
+                std::vector<Context> contexts(Parallel::GetNumThreads());
+                for (auto& ctx : contexts)
+                {
+                    ctx.rng.SetSeed(initRng->NextUInt());
                 }
 
-                // Handle hit with light source
-                if ((v.primitive->Type() & SurfaceInteractionType::L) > 0)
+                Parallel::For(numBatchSamples, [&](long long index, int threadid, bool init)
+                {
+                    auto& ctx = contexts[threadid];
+                    SubpathSampler::TraceSubpath(scene, &ctx.rng, maxNumVertices_, TransportDirection::LE, rr_, [&](int numVertices, const Vec2& /*rasterPos*/, const SubpathSampler::PathVertex& pv, const SubpathSampler::PathVertex& v, SPD& throughput) -> bool
+                    {
+                        // Record photon
+                        if ((v.type & SurfaceInteractionType::D) > 0 || (v.type & SurfaceInteractionType::G) > 0)
+                        {
+                            Photon photon;
+                            photon.p = v.geom.p;
+                            photon.throughput = throughput;
+                            photon.wi = Math::Normalize(pv.geom.p - v.geom.p);
+                            photon.numVertices = numVertices;
+                            ctx.photons.push_back(photon);
+                        }
+
+                        return true;
+                    });
+                });
+
+                // Release the thread-local photons as they are merged
+                photons.reserve(std::accumulate(contexts.begin(), contexts.end(), (size_t)(0), [](size_t n, const Context& ctx) { return n + ctx.photons.size(); }));
+                for (auto& ctx : contexts)
                 {
-                    // Accumulate to film
-                    const auto C =
-                        throughput
-                        * v.primitive->EvaluateDirection(v.geom, SurfaceInteractionType::L, Vec3(), Math::Normalize(pv.geom.p - v.geom.p), TransportDirection::EL, false)
-                        * v.primitive->EvaluatePosition(v.geom, false);
-                    film->Splat(rasterPos, C);
+                    photons.insert(photons.end(), ctx.photons.begin(), ctx.photons.end());
+                    std::vector<Photon>().swap(ctx.photons);
                 }
+            }
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
 
-                // Photon density estimation
-                if ((v.type & SurfaceInteractionType::D) > 0 || (v.type & SurfaceInteractionType::G) > 0)
+            #pragma region Build photon map
+            {
+                LM_LOG_INFO("Building photon map");
+                LM_LOG_INDENTER();
+                pm_->SetMaxRadius(radius_);
+                pm_->Build(std::move(photons));
+            }
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Gather photons
+            {
+                LM_LOG_INFO("Gathering photons");
+                LM_LOG_INDENTER();
+                const auto Kernel = [](const Vec3& p, const Photon& photon, Float radius)
+                {
+                    auto s = 1_f - Math::Length2(photon.p - p) / radius / radius;
+                    return 3_f * Math::InvPi() * s * s;
+                };
+                Parallel::For(gps.size(), [&](long long index, int threadid, bool init)
                 {
-                    if (gatherNext)
+                    const auto& gp = gps[index];
+                    pm_->CollectPhotons(gp.v.geom.p, radius_, [&](const Photon& photon) -> void
                     {
-                        // Density estimation
-                        const auto Kernel = [](const Vec3& p, const Photon& photon, Float radius)
-                        {
-                            auto s = 1_f - Math::Length2(photon.p - p) / radius / radius;
-                            return 3_f * Math::InvPi() * s * s;
-                        };
-                        pm_->CollectPhotons(v.geom.p, radius_, [&](const Photon& photon) -> void
+                        if (gp.numVertices + photon.numVertices - 1 > maxNumVertices_)
                         {
-                            if (numVertices + photon.numVertices - 1 > maxNumVertices_)
-                            {
-                                return;
-                            }
-                            auto k = Kernel(v.geom.p, photon, radius_);
-                            auto p = k / (radius_ * radius_ * numPhotonTraceSamples_);
-                            const auto f = v.primitive->EvaluateDirection(v.geom, SurfaceInteractionType::BSDF, Math::Normalize(pv.geom.p - v.geom.p), photon.wi, TransportDirection::EL, true);
-                            const auto C = throughput * p * f * photon.throughput;
-                            film->Splat(rasterPos, C);
-                        });
-
-                        #pragma endregion
-
-                        // TODO: support multi component materials
-                        return false;
-                    }
+                            return;
+                        }
+                        const auto k = Kernel(gp.v.geom.p, photon, radius_);
+                        const auto p = k / (radius_ * radius_ * numPhotonTraceSamples_);
+                        const auto f = gp.v.primitive->EvaluateDirection(gp.v.geom, SurfaceInteractionType::BSDF, gp.wi, photon.wi, TransportDirection::EL, true);
+                        contribs[index] += gp.throughputE * p * f * photon.throughput;
+                    });
+                });
+            }
+            #pragma endregion
+        }
 
-                    gatherNext = true;
-                    return true;
-                }
+        // Release the photon map of the last batch
+        pm_->Build(std::vector<Photon>());
 
-                return true;
-            });
-        });
+        // --------------------------------------------------------------------------------
+
+        #pragma region Record to film
+        {
+            // The film already holds the rescaled contributions of the light sources,
+            // so the density estimates are rescaled in the same way as the scheduler does
+            const Float scale = numEyeSamples > 0 ? (Float)(film_->Width() * film_->Height()) / numEyeSamples : 0_f;
+            for (size_t i = 0; i < gps.size(); i++)
+            {
+                film_->Splat(gps[i].rasterPos, contribs[i] * scale);
+            }
+        }
         #pragma endregion
 
         // --------------------------------------------------------------------------------
@@ -219,7 +301,9 @@ public:
 private:
 
     int maxNumVertices_;
+    RussianRoulette rr_;
     long long numPhotonTraceSamples_;
+    long long photonBatchSize_;
     int finalgather_;
     Float radius_;
     Scheduler::UniquePtr sched_ = ComponentFactory::Create<Scheduler>();
@@ -39,6 +39,7 @@
 #include <lightmetrica/renderutils.h>
 #include <lightmetrica/detail/photonmap.h>
 #include <lightmetrica/detail/subpathsampler.h>
+#include <lightmetrica/detail/russianroulette.h>
 #include <lightmetrica/detail/parallel.h>
 #include <tbb/tbb.h>
 
@@ -62,9 +63,11 @@ public:
 private:
 
     int maxNumVertices_;
+    RussianRoulette rr_;
     long long numSamples_;                                // Number of measurement points
     long long numIterationPass_;                          // Number of photon scattering passes
     long long numPhotonTraceSamples_;                     // Number of photon trace samples for each pass
+    long long photonBatchSize_;                           // Number of photon trace samples for each batch in a pass (0: single batch)
     Float initialRadius_;                                 // Initial photon gather radius
     Float alpha_;                                         // Fraction to control photons (see paper)
     PhotonMap::UniquePtr photonmap_{ nullptr, nullptr };  // Underlying photon map implementation
@@ -80,12 +83,17 @@ public:
         numSamples_            = prop->ChildAs<long long>("num_samples", 100000L);
         numIterationPass_         = prop->ChildAs<long long>("num_iteration_pass", 1000L);
         numPhotonTraceSamples_ = prop->ChildAs<long long>("num_photon_trace_samples", 100L);
+        photonBatchSize_       = prop->ChildAs<long long>("photon_batch_size", 0L);
         initialRadius_         = prop->ChildAs<Float>("initial_radius", 0.1_f);
         alpha_                 = prop->ChildAs<Float>("alpha", 0.7_f);
         photonmap_             = ComponentFactory::Create<PhotonMap>("photonmap::" + prop->ChildAs<std::string>("photonmap", "kdtree"));
         #if LM_PPM_DEBUG
         debugOutputPath_       = prop->ChildAs<std::string>("debug_output_path", "ppm_%05d");
         #endif
+        if (!rr_.Load(prop))
+        {
+            return false;
+        }
         return true;
     };
 
@@ -177,7 +185,10 @@ public:
         // --------------------------------------------------------------------------------
 
         #pragma region Photon scattering pass
+        rr_.EstimateLightReference(scene, initRng);
         long long totalPhotonTraceSamples = 0;
+        std::vector<SPD> deltaTaus(mps.size());   // Sum of throughput of luminance multiplies BSDF in the current pass
+        std::vector<Float> Ms(mps.size());        // Number of photons collected in the current pass
         for (long long pass = 0; pass < numIterationPass_; pass++)
         {
             LM_LOG_INFO("Pass " + std::to_string(pass));
@@ -185,79 +196,115 @@ public:
 
             // --------------------------------------------------------------------------------
 
-            #pragma region Trace photons
-            std::vector<Photon> photons;
+            // Photons are traced, stored, and gathered in batches of bounded size
+            // so that the peak memory is bounded by the batch size instead of the number of photons in the pass.
+            // The statistics of the batches are accumulated and the measurement points are updated once per pass.
+            const long long batchSize = photonBatchSize_ > 0 ? std::min(photonBatchSize_, numPhotonTraceSamples_) : numPhotonTraceSamples_;
+            const long long numBatches = batchSize > 0 ? (numPhotonTraceSamples_ + batchSize - 1) / batchSize : 0;
+            const auto maxRadius = std::accumulate(mps.begin(), mps.end(), 0_f, [](Float r, const MeasurementPoint& mp) { return std::max(r, mp.radius); });
+            std::fill(deltaTaus.begin(), deltaTaus.end(), SPD());
+            std::fill(Ms.begin(), Ms.end(), 0_f);
+            for (long long batch = 0; batch < numBatches; batch++)
             {
-                LM_LOG_INFO("Tracing photons");
-                LM_LOG_INDENTER();
-                
-                struct Context
+                if (numBatches > 1)
                 {
-                    Random rng;
-                    std::vector<Photon> photons;
-                };
-                std::vector<Context> contexts(Parallel::GetNumThreads());
-                for (auto& ctx : contexts)
-                {
-                    ctx.rng.SetSeed(initRng->NextUInt());
+                    LM_LOG_INFO("Batch " + std::to_string(batch) + " / " + std::to_string(numBatches));
                 }
 
-                Parallel::For(numPhotonTraceSamples_, [&](long long index, int threadid, bool init)
+                // --------------------------------------------------------------------------------
+
+                #pragma region Trace photons
+                std::vector<Photon> photons;
                 {
-                    auto& ctx = contexts[threadid];
-                    SubpathSampler::TraceSubpath(scene, &ctx.rng, maxNumVertices_, TransportDirection::LE, [&](int numVertices, const Vec2& /*rasterPos*/, const SubpathSampler::PathVertex& pv, const SubpathSampler::PathVertex& v, SPD& throughput) -> bool
-                    {
-                        // Skip initial vertex
-                        if (numVertices == 1)
-                        {
-                            return true;
-                        }
+                    LM_LOG_INFO("Tracing photons");
+                    LM_LOG_INDENTER();
 
-                        // Record photon
-                        if ((v.type & SurfaceInteractionType::D) > 0 || (v.type & SurfaceInteractionType::G) > 0)
-                        {
-                            Photon photon;
-                            photon.p = v.geom.p;
-                            photon.throughput = throughput;
-                            photon.wi = Math::Normalize(pv.geom.p - v.geom.p);
-                            photon.numVertices = numVertices;
-                            ctx.photons.push_back(photon);
-                        }
+                    struct Context
+                    {
+                        Random rng;
+                        std::vector<Photon> photons;
+                    };
+                    std::vector<Context> contexts(Parallel::GetNumThreads());
+                    for (auto& ctx : contexts)
+                    {
+                        ctx.rng.SetSeed(initRng->NextUInt());
+                    }
 
-                        // Path termination
-                        const Float rrProb = 0.5_f;
-                        if (ctx.rng.Next() > rrProb)
-                        {
-                            return false;
-                        }
-                        else
+                    Parallel::For(std::min(batchSize, numPhotonTraceSamples_ - batch * batchSize), [&](long long index, int threadid, bool init)
+                    {
+                        auto& ctx = contexts[threadid];
+                        SubpathSampler::TraceSubpath(scene, &ctx.rng, maxNumVertices_, TransportDirection::LE, rr_, [&](int numVertices, const Vec2& /*rasterPos*/, const SubpathSampler::PathVertex& pv, const SubpathSampler::PathVertex& v, SPD& throughput) -> bool
                         {
-                            throughput /= rrProb;
-                        }
+                            // Skip initial vertex
+                            if (numVertices == 1)
+                            {
+                                return true;
+                            }
+
+                            // Record photon
+                            if ((v.type & SurfaceInteractionType::D) > 0 || (v.type & SurfaceInteractionType::G) > 0)
+                            {
+                                Photon photon;
+                                photon.p = v.geom.p;
+                                photon.throughput = throughput;
+                                photon.wi = Math::Normalize(pv.geom.p - v.geom.p);
+                                photon.numVertices = numVertices;
+                                ctx.photons.push_back(photon);
+                            }
 
-                        return true;
+                            return true;
+                        });
                     });
-                });
 
-                for (auto& ctx : contexts)
+                    // Release the thread-local photons as they are merged
+                    photons.reserve(std::accumulate(contexts.begin(), contexts.end(), (size_t)(0), [](size_t n, const Context& ctx) { return n + ctx.photons.size(); }));
+                    for (auto& ctx : contexts)
+                    {
+                        photons.insert(photons.end(), ctx.photons.begin(), ctx.photons.end());
+                        std::vector<Photon>().swap(ctx.photons);
+                    }
+                }
+                #pragma endregion
+
+                // --------------------------------------------------------------------------------
+
+                #pragma region Build photon map
                 {
-                    photons.insert(photons.end(), ctx.photons.begin(), ctx.photons.end());
+                    LM_LOG_INFO("Building photon map");
+                    LM_LOG_INDENTER();
+                    photonmap_->SetMaxRadius(maxRadius);
+                    photonmap_->Build(std::move(photons));
                 }
+                #pragma endregion
+
+                // --------------------------------------------------------------------------------
 
-                totalPhotonTraceSamples += numPhotonTraceSamples_;
+                #pragma region Accumulate photon statistics
+                {
+                    LM_LOG_INFO("Gathering photons");
+                    LM_LOG_INDENTER();
+                    Parallel::For(mps.size(), [&](long long index, int threadid, bool init)
+                    {
+                        const auto& mp = mps[index];
+                        photonmap_->CollectPhotons(mp.v.geom.p, mp.radius, [&](const Photon& photon) -> void
+                        {
+                            if (mp.numVertices + photon.numVertices - 1 > maxNumVertices_)
+                            {
+                                return;
+                            }
+                            const auto f = mp.v.primitive->EvaluateDirection(mp.v.geom, SurfaceInteractionType::BSDF, mp.wi, photon.wi, TransportDirection::EL, true);
+                            deltaTaus[index] += f * photon.throughput;
+                            Ms[index] += 1_f;
+                        });
+                    });
+                }
+                #pragma endregion
             }
-            #pragma endregion
 
-            // --------------------------------------------------------------------------------
+            // Release the photon map of the last batch
+            photonmap_->Build(std::vector<Photon>());
+            totalPhotonTraceSamples += numPhotonTraceSamples_;
 
-            #pragma region Build photon map
-            {
-                LM_LOG_INFO("Building photon map");
-                LM_LOG_INDENTER();
-                photonmap_->Build(std::move(photons));
-            }
-            #pragma endregion
-            
             // --------------------------------------------------------------------------------
 
             #pragma region Progressive density estimation
@@ -270,20 +317,8 @@ public:
                 Parallel::For(mps.size(), [&](long long index, int threadid, bool init)
                 {
                     auto& mp = mps[index];
-
-                    // Accumulate tau 
-                    SPD deltaTau;
-                    Float M = 0_f;
-                    photonmap_->CollectPhotons(mp.v.geom.p, mp.radius, [&](const Photon& photon) -> void
-                    {
-                        if (mp.numVertices + photon.numVertices - 1 > maxNumVertices_)
-                        {
-                            return;
-                        }
-                        const auto f = mp.v.primitive->EvaluateDirection(mp.v.geom, SurfaceInteractionType::BSDF, mp.wi, photon.wi, TransportDirection::EL, true);
-                        deltaTau += f * photon.throughput;
-                        M += 1_f;
-                    });
+                    const auto& deltaTau = deltaTaus[index];
+                    const auto M = Ms[index];
 
                     // Update information in the measreument point
                     if (mp.N + M == 0_f)
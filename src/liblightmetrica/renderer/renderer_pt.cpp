@@ -36,6 +36,7 @@
 #include <lightmetrica/surfacegeometry.h>
 #include <lightmetrica/primitive.h>
 #include <lightmetrica/scheduler.h>
+#include <lightmetrica/detail/russianroulette.h>
 
 LM_NAMESPACE_BEGIN
 
@@ -50,6 +51,7 @@ private:
     int maxNumVertices_;
     int minNumVertices_;
     Scheduler::UniquePtr sched_ = ComponentFactory::Create<Scheduler>();
+    RussianRoulette rr_;
 
 public:
 
@@ -58,6 +60,10 @@ public:
         sched_->Load(prop);
         maxNumVertices_ = prop->ChildAs("max_num_vertices", -1);
         minNumVertices_ = prop->ChildAs("min_num_vertices", 0);
+        if (!rr_.Load(prop))
+        {
+            return false;
+        }
         return true;
     };
 
@@ -65,7 +71,7 @@ public:
     {
         const auto* scene = static_cast<const Scene3*>(scene_);
         auto* film_ = static_cast<const Sensor*>(scene->GetSensor()->emitter)->GetFilm();
-        sched_->Process(scene, film_, initRng, [&](Film* film, Random* rng)
+        const auto processSample = [&](Film* film, Random* rng) -> void
         {
             #pragma region Sample a sensor
 
@@ -111,124 +117,169 @@ public:
             Vec3 wi;
             int numVertices = 1;
 
+            // Paths split at the vertices, traced after the current path terminates
+            struct SplitPath
+            {
+                SPD throughput;
+                const Primitive* primitive;
+                int type;
+                SurfaceGeometry geom;
+                Vec3 wi;
+                int numVertices;
+            };
+            const int MaxNumSplitPaths = 8;
+            SplitPath splitPaths[MaxNumSplitPaths];
+            int numSplitPaths = 0;
+
             #pragma endregion
 
             // --------------------------------------------------------------------------------
 
             while (true)
             {
-                if (maxNumVertices_ != -1 && numVertices >= maxNumVertices_)
+                while (true)
                 {
-                    break;
-                }
+                    if (maxNumVertices_ != -1 && numVertices >= maxNumVertices_)
+                    {
+                        break;
+                    }
 
-                // --------------------------------------------------------------------------------
+                    // --------------------------------------------------------------------------------
 
-                #pragma region Sample direction
+                    #pragma region Sample direction
 
-                Vec3 wo;
-                if (type == SurfaceInteractionType::E)
-                {
-                    wo = initWo;
-                }
-                else
-                {
-                    primitive->SampleDirection(rng->Next2D(), rng->Next(), type, geom, wi, wo);
-                }
-                const auto pdfD = primitive->EvaluateDirectionPDF(geom, type, wi, wo, false);
+                    Vec3 wo;
+                    if (type == SurfaceInteractionType::E)
+                    {
+                        wo = initWo;
+                    }
+                    else
+                    {
+                        primitive->SampleDirection(rng->Next2D(), rng->Next(), type, geom, wi, wo);
+                    }
+                    const auto pdfD = primitive->EvaluateDirectionPDF(geom, type, wi, wo, false);
 
-                #pragma endregion
+                    #pragma endregion
 
-                // --------------------------------------------------------------------------------
+                    // --------------------------------------------------------------------------------
 
-                #pragma region Evaluate direction
+                    #pragma region Evaluate direction
 
-                const auto fs = primitive->EvaluateDirection(geom, type, wi, wo, TransportDirection::EL, false);
-                if (fs.Black())
-                {
-                    break;
-                }
+                    const auto fs = primitive->EvaluateDirection(geom, type, wi, wo, TransportDirection::EL, false);
+                    if (fs.Black())
+                    {
+                        break;
+                    }
 
-                #pragma endregion
+                    #pragma endregion
 
-                // --------------------------------------------------------------------------------
+                    // --------------------------------------------------------------------------------
 
-                #pragma region Update throughput
+                    #pragma region Update throughput
 
-                assert(pdfD > 0_f);
-                throughput *= fs / pdfD;
+                    assert(pdfD > 0_f);
+                    throughput *= fs / pdfD;
 
-                #pragma endregion
+                    #pragma endregion
 
-                // --------------------------------------------------------------------------------
+                    // --------------------------------------------------------------------------------
 
-                #pragma region Intersection
+                    #pragma region Intersection
 
-                // Setup next ray
-                Ray ray = { geom.p, wo };
+                    // Setup next ray
+                    Ray ray = { geom.p, wo };
 
-                // Intersection query
-                Intersection isect;
-                if (!scene->Intersect(ray, isect))
-                {
-                    break;
-                }
+                    // Intersection query
+                    Intersection isect;
+                    if (!scene->Intersect(ray, isect))
+                    {
+                        break;
+                    }
 
-                #pragma endregion
+                    #pragma endregion
 
-                // --------------------------------------------------------------------------------
+                    // --------------------------------------------------------------------------------
 
-                #pragma region Handle hit with light source
+                    #pragma region Handle hit with light source
 
-                if ((isect.primitive->Type() & SurfaceInteractionType::L) > 0)
-                {
-                    // Accumulate to film
-                    if (numVertices + 1 >= minNumVertices_)
+                    if ((isect.primitive->Type() & SurfaceInteractionType::L) > 0)
                     {
-                        const auto C =
-                            throughput
-                            * isect.primitive->EvaluateDirection(isect.geom, SurfaceInteractionType::L, Vec3(), -ray.d, TransportDirection::EL, false)
-                            * isect.primitive->EvaluatePosition(isect.geom, false);
-                        film->Splat(rasterPos, C);
+                        // Accumulate to film
+                        if (numVertices + 1 >= minNumVertices_)
+                        {
+                            const auto C =
+                                throughput
+                                * isect.primitive->EvaluateDirection(isect.geom, SurfaceInteractionType::L, Vec3(), -ray.d, TransportDirection::EL, false)
+                                * isect.primitive->EvaluatePosition(isect.geom, false);
+                            film->Splat(rasterPos, C);
+                        }
                     }
-                }
 
-                #pragma endregion
+                    #pragma endregion
 
-                // --------------------------------------------------------------------------------
+                    // --------------------------------------------------------------------------------
 
-                #pragma region Path termination
+                    #pragma region Path termination
 
-                if (isect.geom.infinite)
-                {
-                    break;
-                }
+                    if (isect.geom.infinite)
+                    {
+                        break;
+                    }
 
-                const Float rrProb = 0.5_f;
-                if (rng->Next() > rrProb)
-                {
-                    break;
-                }
-                else
-                {
-                    throughput /= rrProb;
-                }
+                    const int numPaths = rr_.Evaluate(rr_.PixelReference(rasterPos), throughput, rng->Next(), MaxNumSplitPaths - numSplitPaths + 1);
+                    if (numPaths == 0)
+                    {
+                        break;
+                    }
 
-                #pragma endregion
+                    #pragma endregion
+
+                    // --------------------------------------------------------------------------------
+
+                    #pragma region Update information
+
+                    geom = isect.geom;
+                    primitive = isect.primitive;
+                    type = isect.primitive->Type() & ~SurfaceInteractionType::Emitter;
+                    wi = -ray.d;
+                    numVertices++;
+
+                    #pragma endregion
+
+                    // --------------------------------------------------------------------------------
+
+                    #pragma region Split path
+
+                    for (int i = 1; i < numPaths; i++)
+                    {
+                        splitPaths[numSplitPaths++] = { throughput, primitive, type, geom, wi, numVertices };
+                    }
+
+                    #pragma endregion
+                }
 
                 // --------------------------------------------------------------------------------
 
-                #pragma region Update information
+                #pragma region Continue with split path
 
-                geom = isect.geom;
-                primitive = isect.primitive;
-                type = isect.primitive->Type() & ~SurfaceInteractionType::Emitter;
-                wi = -ray.d;
-                numVertices++;
+                if (numSplitPaths == 0)
+                {
+                    break;
+                }
+                const auto& path = splitPaths[--numSplitPaths];
+                throughput = path.throughput;
+                primitive = path.primitive;
+                type = path.type;
+                geom = path.geom;
+                wi = path.wi;
+                numVertices = path.numVertices;
 
                 #pragma endregion
             }
-        });
+        };
+
+        rr_.EstimatePixels(scene, film_, initRng, processSample);
+        sched_->Process(scene, film_, initRng, processSample);
 
         // --------------------------------------------------------------------------------
 
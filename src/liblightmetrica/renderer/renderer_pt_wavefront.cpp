@@ -0,0 +1,685 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch.h>
+#include <lightmetrica/renderer.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/random.h>
+#include <lightmetrica/scene3.h>
+#include <lightmetrica/film.h>
+#include <lightmetrica/bsdf.h>
+#include <lightmetrica/ray.h>
+#include <lightmetrica/intersection.h>
+#include <lightmetrica/emitter.h>
+#include <lightmetrica/sensor.h>
+#include <lightmetrica/surfacegeometry.h>
+#include <lightmetrica/primitive.h>
+#include <lightmetrica/renderutils.h>
+#include <lightmetrica/logger.h>
+#include <lightmetrica/detail/russianroulette.h>
+#include <lightmetrica/detail/parallel.h>
+#include <tbb/tbb.h>
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    \brief Wavefront path tracing.
+
+    Traces a large pool of paths at once in stages instead of one path at a time.
+    The path states are stored in SoA layout, and each stage is a parallel kernel
+    over the queue of the active paths:
+      1. Generate camera rays.
+      2. Shade: sample a light and the next direction (optionally grouped by the BSDF implementation).
+      3. Trace the shadow rays of the light samples with the stream occlusion query.
+      4. Intersect the next rays with the stream intersection query (optionally sorted by origin or direction).
+      5. Accumulate the emission at the hit points and apply Russian roulette.
+    The estimator is the same as `renderer::ptmis`.
+    Russian roulette follows the `rr` parameters without splitting, as the pool has the fixed size.
+*/
+class Renderer_PTWavefront final : public Renderer
+{
+public:
+
+    LM_IMPL_CLASS(Renderer_PTWavefront, Renderer);
+
+private:
+
+    enum class RaySort
+    {
+        None,
+        Origin,         // Morton order of the origins
+        Direction,      // Direction octants, then Morton order of the origins
+    };
+
+    //! Path states in SoA layout.
+    struct PathStates
+    {
+        std::vector<SPD> throughput;
+        std::vector<Vec2> rasterPos;
+        std::vector<const Primitive*> primitive;
+        std::vector<int> type;
+        std::vector<SurfaceGeometry> geom;      // Current vertex
+        std::vector<Vec3> wi;
+        std::vector<Vec3> wo;                   // Sampled direction from the current vertex
+        std::vector<Float> pdfD;                // PDF of the sampled direction (projected solid angle measure)
+        std::vector<int> numVertices;
+        std::vector<char> alive;
+
+        auto Resize(int n) -> void
+        {
+            throughput.resize(n);
+            rasterPos.resize(n);
+            primitive.resize(n);
+            type.resize(n);
+            geom.resize(n);
+            wi.resize(n);
+            wo.resize(n);
+            pdfD.resize(n);
+            numVertices.resize(n);
+            alive.resize(n);
+        }
+    };
+
+    //! Queue of the rays for the stream queries.
+    struct RayQueue
+    {
+        std::vector<Ray> rays;
+        std::vector<Float> minT;
+        std::vector<Float> maxT;
+        std::unique_ptr<bool[]> results;        // Hit or occlusion
+        std::vector<Intersection> isects;       // Only for the intersection queue
+        std::vector<SPD> C;                     // Only for the shadow ray queue
+        std::vector<Vec2> rasterPos;            // Only for the shadow ray queue
+        std::atomic<int> size;
+
+        auto Resize(int n, bool shadow) -> void
+        {
+            rays.resize(n);
+            minT.resize(n);
+            maxT.resize(n);
+            results.reset(new bool[n]);
+            if (shadow)
+            {
+                C.resize(n);
+                rasterPos.resize(n);
+            }
+            else
+            {
+                isects.resize(n);
+            }
+            size = 0;
+        }
+    };
+
+    //! Thread-specific data of the kernels.
+    struct Context
+    {
+        Random rng;
+        Film::UniquePtr film{ nullptr, nullptr };
+        bool initialized = false;
+    };
+
+private:
+
+    int maxNumVertices_;
+    int minNumVertices_;
+    long long numSamples_;
+    int wavefrontSize_;                 // Number of paths in the pool
+    RaySort raySort_;
+    bool groupByBSDF_;
+    RussianRoulette rr_;
+
+public:
+
+    LM_IMPL_F(Initialize) = [this](const PropertyNode* prop) -> bool
+    {
+        maxNumVertices_ = prop->ChildAs("max_num_vertices", -1);
+        minNumVertices_ = prop->ChildAs("min_num_vertices", 0);
+        numSamples_     = prop->ChildAs<long long>("num_samples", 10000000L);
+        wavefrontSize_  = prop->ChildAs("wavefront_size", 1 << 16);
+        groupByBSDF_    = prop->ChildAs("group_by_bsdf", 1) != 0;
+        if (wavefrontSize_ <= 0 || wavefrontSize_ > (1 << 24))
+        {
+            LM_LOG_ERROR("wavefront_size must be in (0, 2^24]");
+            return false;
+        }
+
+        const auto raySort = prop->ChildAs<std::string>("ray_sort", "direction");
+        if      (raySort == "none")      { raySort_ = RaySort::None; }
+        else if (raySort == "origin")    { raySort_ = RaySort::Origin; }
+        else if (raySort == "direction") { raySort_ = RaySort::Direction; }
+        else
+        {
+            LM_LOG_ERROR("Invalid ray sort mode: " + raySort);
+            return false;
+        }
+
+        if (!rr_.Load(prop))
+        {
+            return false;
+        }
+
+        return true;
+    };
+
+    LM_IMPL_F(Render) = [this](const Scene* scene_, Random* initRng, const std::string& outputPath) -> void
+    {
+        const auto* scene = static_cast<const Scene3*>(scene_);
+        auto* film_ = static_cast<const Sensor*>(scene->GetSensor()->emitter)->GetFilm();
+        tbb::task_scheduler_init init(Parallel::GetNumThreads());
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Shading keys
+
+        // Primitives are grouped by the implementation of the BSDF, then by the BSDF instance
+        std::vector<std::uint64_t> shadingKeys(scene->NumPrimitives(), 0);
+        {
+            std::unordered_map<std::string, int> implIDs;
+            std::unordered_map<const BSDF*, int> bsdfIDs;
+            for (int i = 0; i < scene->NumPrimitives(); i++)
+            {
+                const auto* primitive = scene->PrimitiveAt(i);
+                if (!primitive->bsdf)
+                {
+                    continue;
+                }
+                const auto implID = implIDs.emplace(primitive->bsdf->implName, (int)(implIDs.size()) + 1).first->second;
+                const auto bsdfID = bsdfIDs.emplace(primitive->bsdf, (int)(bsdfIDs.size()) + 1).first->second;
+                if (primitive->index >= (int)(shadingKeys.size()))
+                {
+                    shadingKeys.resize(primitive->index + 1, 0);
+                }
+                shadingKeys[primitive->index] = ((std::uint64_t)(implID) << 16) | (std::uint64_t)(bsdfID & 0xffff);
+            }
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Kernel utilities
+
+        tbb::enumerable_thread_specific<Context> contexts;
+        std::mutex contextInitMutex;
+        const auto LocalContext = [&]() -> Context&
+        {
+            auto& ctx = contexts.local();
+            if (!ctx.initialized)
+            {
+                std::unique_lock<std::mutex> lock(contextInitMutex);
+                ctx.rng.SetSeed(initRng->NextUInt());
+                ctx.film = ComponentFactory::Clone<Film>(film_);
+                ctx.film->Clear();
+                ctx.initialized = true;
+            }
+            return ctx;
+        };
+
+        // Runs `func` for each element in [0, n) in parallel
+        const auto Kernel = [&](int n, const std::function<void(int k, Context& ctx)>& func) -> void
+        {
+            tbb::parallel_for(tbb::blocked_range<int>(0, n, 256), [&](const tbb::blocked_range<int>& range) -> void
+            {
+                auto& ctx = LocalContext();
+                for (int k = range.begin(); k != range.end(); k++)
+                {
+                    func(k, ctx);
+                }
+            });
+        };
+
+        // Sorts the active paths by the keys (the lower 24 bits of the keys are used for the path indices)
+        std::vector<std::uint64_t> sortKeys;
+        const auto SortActive = [&](std::vector<int>& active, const std::function<std::uint64_t(int i)>& key) -> void
+        {
+            sortKeys.resize(active.size());
+            Kernel((int)(active.size()), [&](int k, Context&) { sortKeys[k] = (key(active[k]) << 24) | (std::uint64_t)(active[k]); });
+            tbb::parallel_sort(sortKeys.begin(), sortKeys.end());
+            for (size_t k = 0; k < active.size(); k++)
+            {
+                active[k] = (int)(sortKeys[k] & 0xffffff);
+            }
+        };
+
+        const auto bound = scene->GetBound();
+        const auto MortonKey = [&](const Vec3& p) -> std::uint64_t
+        {
+            const auto Spread = [](std::uint64_t v) -> std::uint64_t
+            {
+                v = (v | (v << 16)) & 0x030000FF;
+                v = (v | (v <<  8)) & 0x0300F00F;
+                v = (v | (v <<  4)) & 0x030C30C3;
+                v = (v | (v <<  2)) & 0x09249249;
+                return v;
+            };
+            const auto d = bound.max - bound.min;
+            const auto Quantize = [](Float v, Float min, Float extent) -> std::uint64_t
+            {
+                const auto t = extent > 0_f ? (v - min) / extent : 0_f;
+                return (std::uint64_t)(Math::Clamp(t, 0_f, 1_f) * 1023_f);
+            };
+            return (Spread(Quantize(p.x, bound.min.x, d.x)) << 2) | (Spread(Quantize(p.y, bound.min.y, d.y)) << 1) | Spread(Quantize(p.z, bound.min.z, d.z));
+        };
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Allocate queues
+
+        PathStates paths;
+        paths.Resize(wavefrontSize_);
+        RayQueue shadowQueue;
+        shadowQueue.Resize(wavefrontSize_, true);
+        RayQueue rayQueue;
+        rayQueue.Resize(wavefrontSize_, false);
+        std::vector<int> active;
+        active.reserve(wavefrontSize_);
+
+        const auto Compact = [&]() -> void
+        {
+            active.erase(std::remove_if(active.begin(), active.end(), [&](int i) { return !paths.alive[i]; }), active.end());
+        };
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Render pass
+
+        // Renders `numSamples` samples into the film
+        const auto RenderPass = [&](long long numSamples, Film* film) -> void
+        {
+            #pragma region Render loop
+
+            // Reuse the thread-local films of the previous pass
+            for (auto& ctx : contexts)
+            {
+                if (ctx.initialized)
+                {
+                    ctx.film->Clear();
+                }
+            }
+
+            long long processed = 0;
+            while (processed < numSamples)
+            {
+                const int n = (int)(std::min<long long>(wavefrontSize_, numSamples - processed));
+
+                // --------------------------------------------------------------------------------
+
+                #pragma region Generate camera rays
+
+                Kernel(n, [&](int i, Context& ctx) -> void
+                {
+                    auto* rng = &ctx.rng;
+                    paths.alive[i] = 0;
+
+                    const auto* E = scene->SampleEmitter(SurfaceInteractionType::E, rng->Next());
+                    const auto pdfE = scene->EvaluateEmitterPDF(E);
+                    assert(pdfE.v > 0);
+
+                    SurfaceGeometry geomE;
+                    Vec3 initWo;
+                    E->sensor->SamplePositionAndDirection(rng->Next2D(), rng->Next2D(), geomE, initWo);
+                    const auto pdfPE = E->sensor->EvaluatePositionGivenDirectionPDF(geomE, initWo, false);
+                    assert(pdfPE.v > 0);
+
+                    Vec2 rasterPos;
+                    if (!E->RasterPosition(initWo, geomE, rasterPos))
+                    {
+                        // This can happen due to numerical errors
+                        return;
+                    }
+
+                    paths.throughput[i] = E->sensor->EvaluatePosition(geomE, false) / pdfPE / pdfE;
+                    paths.rasterPos[i] = rasterPos;
+                    paths.primitive[i] = E;
+                    paths.type[i] = SurfaceInteractionType::E;
+                    paths.geom[i] = geomE;
+                    paths.wi[i] = Vec3();
+                    paths.wo[i] = initWo;
+                    paths.numVertices[i] = 1;
+                    paths.alive[i] = 1;
+                });
+
+                active.clear();
+                for (int i = 0; i < n; i++)
+                {
+                    if (paths.alive[i])
+                    {
+                        active.push_back(i);
+                    }
+                }
+
+                #pragma endregion
+
+                // --------------------------------------------------------------------------------
+
+                while (!active.empty())
+                {
+                    #pragma region Shade
+
+                    if (groupByBSDF_)
+                    {
+                        SortActive(active, [&](int i) -> std::uint64_t { return shadingKeys[paths.primitive[i]->index]; });
+                    }
+
+                    shadowQueue.size = 0;
+                    Kernel((int)(active.size()), [&](int k, Context& ctx) -> void
+                    {
+                        const int i = active[k];
+                        auto* rng = &ctx.rng;
+                        const auto& geom = paths.geom[i];
+                        const auto* primitive = paths.primitive[i];
+                        const int type = paths.type[i];
+                        const auto& wi = paths.wi[i];
+                        const int numVertices = paths.numVertices[i];
+                        auto& throughput = paths.throughput[i];
+
+                        if (maxNumVertices_ != -1 && numVertices >= maxNumVertices_)
+                        {
+                            paths.alive[i] = 0;
+                            return;
+                        }
+
+                        // --------------------------------------------------------------------------------
+
+                        #pragma region Direct light sampling
+
+                        const auto* L = numVertices + 1 >= minNumVertices_ ? scene->SampleEmitterGivenPosition(SurfaceInteractionType::L, geom, rng->Next()) : nullptr;
+                        if (L)
+                        {
+                            const auto pdfL = scene->EvaluateEmitterGivenPositionPDF(L, geom);
+                            assert(pdfL > 0_f);
+
+                            SurfaceGeometry geomL;
+                            L->SamplePositionGivenPreviousPosition(rng->Next2D(), geom, geomL);
+                            const auto pdfPL = L->EvaluatePositionGivenPreviousPositionPDF(geomL, geom, false);
+                            assert(pdfPL > 0_f);
+
+                            const auto ppL = Math::Normalize(geomL.p - geom.p);
+                            const auto fsE = primitive->EvaluateDirection(geom, type, wi, ppL, TransportDirection::EL, true);
+                            const auto fsL = L->EvaluateDirection(geomL, SurfaceInteractionType::L, Vec3(), -ppL, TransportDirection::LE, false);
+                            const auto G = RenderUtils::GeometryTerm(geom, geomL);
+                            const auto LeP = L->EvaluatePosition(geomL, false);
+                            const auto C = throughput * fsE * G * fsL * LeP / pdfL / pdfPL;
+                            if (!C.Black())
+                            {
+                                // MIS weight
+                                const auto pdfD_DirectLight = pdfPL.ConvertToProjSA(geom, geomL).v * pdfL.v;
+                                const auto pdfD_BSDF = primitive->EvaluateDirectionPDF(geom, type, wi, ppL, true).v;
+                                const auto w = pdfD_DirectLight / (pdfD_DirectLight + pdfD_BSDF);
+
+                                // Recompute pixel index if necessary
+                                auto rp = paths.rasterPos[i];
+                                if (type == SurfaceInteractionType::E)
+                                {
+                                    primitive->sensor->RasterPosition(ppL, geom, rp);
+                                }
+
+                                // Enqueue shadow ray with the same range as Scene3::Visible
+                                const int s = shadowQueue.size++;
+                                shadowQueue.rays[s] = { geom.p, ppL };
+                                shadowQueue.minT[s] = Math::EpsIsect();
+                                shadowQueue.maxT[s] = Math::Length(geomL.p - geom.p) * (1_f - Math::EpsIsect());
+                                shadowQueue.C[s] = w * C;
+                                shadowQueue.rasterPos[s] = rp;
+                            }
+                        }
+
+                        #pragma endregion
+
+                        // --------------------------------------------------------------------------------
+
+                        #pragma region Sample next direction
+
+                        Vec3 wo;
+                        if (type == SurfaceInteractionType::E)
+                        {
+                            wo = paths.wo[i];
+                        }
+                        else
+                        {
+                            primitive->SampleDirection(rng->Next2D(), rng->Next(), type, geom, wi, wo);
+                        }
+                        const auto pdfD = primitive->EvaluateDirectionPDF(geom, type, wi, wo, false);
+                        const auto fs = primitive->EvaluateDirection(geom, type, wi, wo, TransportDirection::EL, false);
+                        if (fs.Black())
+                        {
+                            paths.alive[i] = 0;
+                            return;
+                        }
+
+                        assert(pdfD > 0_f);
+                        throughput *= fs / pdfD;
+                        paths.wo[i] = wo;
+                        paths.pdfD[i] = pdfD.v;
+
+                        #pragma endregion
+                    });
+
+                    Compact();
+
+                    #pragma endregion
+
+                    // --------------------------------------------------------------------------------
+
+                    #pragma region Trace shadow rays
+
+                    const int numShadowRays = shadowQueue.size;
+                    tbb::parallel_for(tbb::blocked_range<int>(0, numShadowRays, 256), [&](const tbb::blocked_range<int>& range) -> void
+                    {
+                        auto& ctx = LocalContext();
+                        const int b = range.begin();
+                        scene->OccludedStream((int)(range.size()), &shadowQueue.rays[b], &shadowQueue.minT[b], &shadowQueue.maxT[b], &shadowQueue.results[b]);
+                        for (int s = range.begin(); s != range.end(); s++)
+                        {
+                            if (!shadowQueue.results[s])
+                            {
+                                ctx.film->Splat(shadowQueue.rasterPos[s], shadowQueue.C[s]);
+                            }
+                        }
+                    });
+
+                    #pragma endregion
+
+                    // --------------------------------------------------------------------------------
+
+                    #pragma region Intersect
+
+                    if (active.empty())
+                    {
+                        break;
+                    }
+
+                    if (raySort_ != RaySort::None)
+                    {
+                        SortActive(active, [&](int i) -> std::uint64_t
+                        {
+                            auto key = MortonKey(paths.geom[i].p);
+                            if (raySort_ == RaySort::Direction)
+                            {
+                                const auto& d = paths.wo[i];
+                                const std::uint64_t octant = (d.x < 0_f ? 1 : 0) | (d.y < 0_f ? 2 : 0) | (d.z < 0_f ? 4 : 0);
+                                key |= octant << 30;
+                            }
+                            return key;
+                        });
+                    }
+
+                    const int numRays = (int)(active.size());
+                    tbb::parallel_for(tbb::blocked_range<int>(0, numRays, 256), [&](const tbb::blocked_range<int>& range) -> void
+                    {
+                        for (int k = range.begin(); k != range.end(); k++)
+                        {
+                            const int i = active[k];
+                            rayQueue.rays[k] = { paths.geom[i].p, paths.wo[i] };
+                            rayQueue.minT[k] = Math::EpsIsect();
+                            rayQueue.maxT[k] = Math::Inf();
+                        }
+                        const int b = range.begin();
+                        scene->IntersectStream((int)(range.size()), &rayQueue.rays[b], &rayQueue.minT[b], &rayQueue.maxT[b], &rayQueue.isects[b], &rayQueue.results[b]);
+                    });
+
+                    #pragma endregion
+
+                    // --------------------------------------------------------------------------------
+
+                    #pragma region Handle hit points
+
+                    Kernel(numRays, [&](int k, Context& ctx) -> void
+                    {
+                        const int i = active[k];
+                        const auto& ray = rayQueue.rays[k];
+                        auto& isect = rayQueue.isects[k];
+                        if (!rayQueue.results[k])
+                        {
+                            paths.alive[i] = 0;
+                            return;
+                        }
+
+                        const auto& geom = paths.geom[i];
+                        const int type = paths.type[i];
+                        auto& throughput = paths.throughput[i];
+
+                        // --------------------------------------------------------------------------------
+
+                        #pragma region Hit with light source
+
+                        if ((isect.primitive->Type() & SurfaceInteractionType::L) > 0 && paths.numVertices[i] + 1 >= minNumVertices_)
+                        {
+                            const auto pdfD_BSDF = paths.pdfD[i];
+                            const auto pdfD_DirectLight =
+                                (type & SurfaceInteractionType::S) > 0
+                                    ? 0_f
+                                    : isect.primitive->EvaluatePositionGivenPreviousPositionPDF(isect.geom, geom, true).ConvertToProjSA(isect.geom, geom).v *
+                                      scene->EvaluateEmitterGivenPositionPDF(isect.primitive, geom).v;
+                            const auto w = pdfD_BSDF / (pdfD_BSDF + pdfD_DirectLight);
+                            const auto C =
+                                throughput
+                                * isect.primitive->EvaluateDirection(isect.geom, SurfaceInteractionType::L, Vec3(), -ray.d, TransportDirection::EL, false)
+                                * isect.primitive->EvaluatePosition(isect.geom, false);
+                            ctx.film->Splat(paths.rasterPos[i], w * C);
+                        }
+
+                        #pragma endregion
+
+                        // --------------------------------------------------------------------------------
+
+                        #pragma region Path termination
+
+                        if (isect.geom.infinite || rr_.Terminate(rr_.PixelReference(paths.rasterPos[i]), throughput, ctx.rng.Next()))
+                        {
+                            paths.alive[i] = 0;
+                            return;
+                        }
+
+                        #pragma endregion
+
+                        // --------------------------------------------------------------------------------
+
+                        #pragma region Update information
+
+                        paths.geom[i] = isect.geom;
+                        paths.primitive[i] = isect.primitive;
+                        paths.type[i] = isect.primitive->Type() & ~SurfaceInteractionType::Emitter;
+                        paths.wi[i] = -ray.d;
+                        paths.numVertices[i]++;
+
+                        #pragma endregion
+                    });
+
+                    Compact();
+
+                    #pragma endregion
+                }
+
+                // --------------------------------------------------------------------------------
+
+                processed += n;
+                LM_LOG_INPLACE(boost::str(boost::format("Progress: %.1f%%") % ((double)(processed) / numSamples * 100.0)));
+            }
+
+            LM_LOG_INFO("Progress: 100.0%");
+            LM_LOG_INFO(boost::str(boost::format("# of samples: %d") % processed));
+
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Gather film data
+
+            film->Clear();
+            contexts.combine_each([&](const Context& ctx)
+            {
+                if (ctx.initialized)
+                {
+                    film->Accumulate(ctx.film.get());
+                }
+            });
+            film->Rescale((Float)(film->Width() * film->Height()) / processed);
+
+            #pragma endregion
+        };
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Render
+
+        // Prepass for the adaptive Russian roulette rendered into a scratch film
+        const long long numPrepassSamples = rr_.NumPrepassSamples(film_);
+        if (numPrepassSamples > 0)
+        {
+            LM_LOG_INFO("Estimating pixels for adaptive Russian roulette");
+            LM_LOG_INDENTER();
+            const auto prepassFilm = ComponentFactory::Clone<Film>(film_);
+            RenderPass(numPrepassSamples, prepassFilm.get());
+            rr_.SetPixelEstimate(prepassFilm.get());
+        }
+
+        RenderPass(numSamples_, film_);
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Save image
+        {
+            LM_LOG_INFO("Saving image");
+            LM_LOG_INDENTER();
+            film_->Save(outputPath);
+        }
+        #pragma endregion
+    };
+
+};
+
+LM_COMPONENT_REGISTER_IMPL(Renderer_PTWavefront, "renderer::pt_wavefront");
+
+LM_NAMESPACE_END
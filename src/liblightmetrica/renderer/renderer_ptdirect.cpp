@@ -37,6 +37,9 @@
 #include <lightmetrica/surfacegeometry.h>
 #include <lightmetrica/primitive.h>
 #include <lightmetrica/scheduler.h>
+#include <lightmetrica/detail/russianroulette.h>
+#include <lightmetrica/logger.h>
+#include <tbb/tbb.h>
 #include <lightmetrica/renderutils.h>
 
 LM_NAMESPACE_BEGIN
@@ -51,7 +54,9 @@ private:
 
     int maxNumVertices_;
     int minNumVertices_;
+    int numLightSamples_;               // Number of light samples per vertex
     Scheduler::UniquePtr sched_;
+    RussianRoulette rr_;
 
 public:
 
@@ -59,6 +64,32 @@ public:
         : sched_(ComponentFactory::Create<Scheduler>())
     {}
 
+private:
+
+    //! Shadow rays of the light samples at a vertex, traced as a batch.
+    struct ShadowRayBatch
+    {
+        std::vector<Ray> rays;
+        std::vector<Float> minT;
+        std::vector<Float> maxT;
+        std::unique_ptr<bool[]> occluded;
+        std::vector<SPD> C;                 // Contribution if not occluded
+        std::vector<Vec2> rasterPos;
+        int capacity = 0;
+
+        auto Resize(int n) -> void
+        {
+            if (n <= capacity) return;
+            rays.resize(n);
+            minT.resize(n);
+            maxT.resize(n);
+            occluded.reset(new bool[n]);
+            C.resize(n);
+            rasterPos.resize(n);
+            capacity = n;
+        }
+    };
+
 public:
 
     LM_IMPL_F(Initialize) = [this](const PropertyNode* prop) -> bool
@@ -66,6 +97,16 @@ public:
         sched_->Load(prop);
         maxNumVertices_ = prop->ChildAs<int>("max_num_vertices", -1);
         minNumVertices_ = prop->ChildAs("min_num_vertices", 0);
+        numLightSamples_ = prop->ChildAs("num_light_samples", 1);
+        if (numLightSamples_ < 1)
+        {
+            LM_LOG_ERROR("num_light_samples must be positive");
+            return false;
+        }
+        if (!rr_.Load(prop))
+        {
+            return false;
+        }
         return true;
     };
 
@@ -73,7 +114,8 @@ public:
     {
         const auto* scene = static_cast<const Scene3*>(scene_);
         auto* film_ = static_cast<const Sensor*>(scene->GetSensor()->emitter)->GetFilm();
-        sched_->Process(scene, film_, initRng, [&](Film* film, Random* rng)
+        tbb::enumerable_thread_specific<ShadowRayBatch> shadowRayBatches;
+        const auto processSample = [&](Film* film, Random* rng) -> void
         {
             #pragma region Sample a sensor
 
@@ -107,179 +149,282 @@ public:
             Vec2 rasterPos;
             int numVertices = 1;
 
+            // Paths split at the vertices, traced after the current path terminates
+            struct SplitPath
+            {
+                SPD throughput;
+                const Primitive* primitive;
+                int type;
+                SurfaceGeometry geom;
+                Vec3 wi;
+                int numVertices;
+            };
+            const int MaxNumSplitPaths = 8;
+            SplitPath splitPaths[MaxNumSplitPaths];
+            int numSplitPaths = 0;
+
             #pragma endregion
 
             // --------------------------------------------------------------------------------
 
             while (true)
             {
-                if (maxNumVertices_ != -1 && numVertices >= maxNumVertices_)
+                while (true)
                 {
-                    break;
-                }
+                    if (maxNumVertices_ != -1 && numVertices >= maxNumVertices_)
+                    {
+                        break;
+                    }
 
-                // --------------------------------------------------------------------------------
+                    // --------------------------------------------------------------------------------
 
-                #pragma region Direct light sampling
+                    #pragma region Direct light sampling
 
-                {
-                    #pragma region Sample a light
+                    {
+                        auto& batch = shadowRayBatches.local();
+                        batch.Resize(numLightSamples_);
+                        int numShadowRays = 0;
 
-                    const auto* L = scene->SampleEmitter(SurfaceInteractionType::L, rng->Next());
-                    const auto pdfL = scene->EvaluateEmitterPDF(L);
-                    assert(pdfL > 0_f);
+                        // --------------------------------------------------------------------------------
 
-                    #pragma endregion
+                        #pragma region Sample lights
 
-                    // --------------------------------------------------------------------------------
+                        for (int i = 0; i < numLightSamples_; i++)
+                        {
+                            const auto* L = scene->SampleEmitterGivenPosition(SurfaceInteractionType::L, geom, rng->Next());
+                            if (!L)
+                            {
+                                continue;
+                            }
+
+                            // --------------------------------------------------------------------------------
+
+                            #pragma region Evaluate selection PDF of the light
+
+                            const auto pdfL = scene->EvaluateEmitterGivenPositionPDF(L, geom);
+                            assert(pdfL > 0_f);
+
+                            #pragma endregion
+
+                            // --------------------------------------------------------------------------------
 
-                    #pragma region Sample a position on the light
+                            #pragma region Sample a position on the light
 
-                    SurfaceGeometry geomL;
-                    L->SamplePositionGivenPreviousPosition(rng->Next2D(), geom, geomL);
-                    const auto pdfPL = L->EvaluatePositionGivenPreviousPositionPDF(geomL, geom, false);
-                    assert(pdfPL > 0_f);
+                            SurfaceGeometry geomL;
+                            L->SamplePositionGivenPreviousPosition(rng->Next2D(), geom, geomL);
+                            const auto pdfPL = L->EvaluatePositionGivenPreviousPositionPDF(geomL, geom, false);
+                            assert(pdfPL > 0_f);
+
+                            #pragma endregion
+
+                            // --------------------------------------------------------------------------------
+
+                            #pragma region Evaluate unoccluded contribution
+
+                            const auto ppL = Math::Normalize(geomL.p - geom.p);
+                            const auto fsE = primitive->EvaluateDirection(geom, type, wi, ppL, TransportDirection::EL, true);
+                            const auto fsL = L->EvaluateDirection(geomL, SurfaceInteractionType::L, Vec3(), -ppL, TransportDirection::LE, false);
+                            const auto G = RenderUtils::GeometryTerm(geom, geomL);
+                            const auto LeP = L->EvaluatePosition(geomL, false);
+                            const auto C = throughput * fsE * G * fsL * LeP / pdfL / pdfPL / (Float)(numLightSamples_);
+                            if (C.Black())
+                            {
+                                continue;
+                            }
+
+                            #pragma endregion
+
+                            // --------------------------------------------------------------------------------
+
+                            #pragma region Add shadow ray
+
+                            // Recompute pixel index if necessary
+                            auto rp = rasterPos;
+                            if (type == SurfaceInteractionType::E)
+                            {
+                                primitive->sensor->RasterPosition(ppL, geom, rp);
+                            }
+
+                            // Same range as Scene3::Visible
+                            const auto dist = Math::Length(geomL.p - geom.p);
+                            batch.rays[numShadowRays] = { geom.p, ppL };
+                            batch.minT[numShadowRays] = Math::EpsIsect();
+                            batch.maxT[numShadowRays] = dist * (1_f - Math::EpsIsect());
+                            batch.C[numShadowRays] = C;
+                            batch.rasterPos[numShadowRays] = rp;
+                            numShadowRays++;
+
+                            #pragma endregion
+                        }
+
+                        #pragma endregion
+
+                        // --------------------------------------------------------------------------------
+
+                        #pragma region Trace shadow rays and record to film
+
+                        if (numShadowRays > 0)
+                        {
+                            scene->OccludedStream(numShadowRays, batch.rays.data(), batch.minT.data(), batch.maxT.data(), batch.occluded.get());
+                            for (int i = 0; i < numShadowRays; i++)
+                            {
+                                if (!batch.occluded[i])
+                                {
+                                    film->Splat(batch.rasterPos[i], batch.C[i]);
+                                }
+                            }
+                        }
+
+                        #pragma endregion
+                    }
 
                     #pragma endregion
 
                     // --------------------------------------------------------------------------------
 
-                    #pragma region Evaluate contribution
+                    #pragma region Sample next direction
 
-                    const auto ppL = Math::Normalize(geomL.p - geom.p);
-                    const auto fsE = primitive->EvaluateDirection(geom, type, wi, ppL, TransportDirection::EL, true);
-                    const auto fsL = L->EvaluateDirection(geomL, SurfaceInteractionType::L, Vec3(), -ppL, TransportDirection::LE, false);
-                    const auto G = RenderUtils::GeometryTerm(geom, geomL);
-                    const auto V = scene->Visible(geom.p, geomL.p) ? 1_f : 0_f;
-                    const auto LeP = L->EvaluatePosition(geomL, false);
-                    const auto C = throughput * fsE * G * V * fsL * LeP / pdfL / pdfPL;
+                    Vec3 wo;
+                    if (type == SurfaceInteractionType::E)
+                    {
+                        wo = initWo;
+                    }
+                    else
+                    {
+                        primitive->SampleDirection(rng->Next2D(), rng->Next(), type, geom, wi, wo);
+                    }
+                    const auto pdfD = primitive->EvaluateDirectionPDF(geom, type, wi, wo, false);
 
                     #pragma endregion
 
                     // --------------------------------------------------------------------------------
 
-                    #pragma region Record to film
+                    #pragma region Calculate pixel index for initial vertex
 
-                    if (!C.Black())
+                    if (type == SurfaceInteractionType::E)
                     {
-                        // Recompute pixel index if necessary
-                        auto rp = rasterPos;
-                        if (type == SurfaceInteractionType::E)
+                        if (!primitive->sensor->RasterPosition(wo, geom, rasterPos))
                         {
-                            primitive->sensor->RasterPosition(ppL, geom, rp);
+                            break;
                         }
+                    }
+
+                    #pragma endregion
 
-                        // Accumulate to film
-                        film->Splat(rp, C);
+                    // --------------------------------------------------------------------------------
+
+                    #pragma region Evaluate direction
+
+                    const auto fs = primitive->EvaluateDirection(geom, type, wi, wo, TransportDirection::EL, false);
+                    if (fs.Black())
+                    {
+                        break;
                     }
 
                     #pragma endregion
-                }
 
-                #pragma endregion
+                    // --------------------------------------------------------------------------------
 
-                // --------------------------------------------------------------------------------
+                    #pragma region Update throughput
 
-                #pragma region Sample next direction
+                    assert(pdfD > 0_f);
+                    throughput *= fs / pdfD;
 
-                Vec3 wo;
-                if (type == SurfaceInteractionType::E)
-                {
-                    wo = initWo;
-                }
-                else
-                {
-                    primitive->SampleDirection(rng->Next2D(), rng->Next(), type, geom, wi, wo);
-                }
-                const auto pdfD = primitive->EvaluateDirectionPDF(geom, type, wi, wo, false);
+                    #pragma endregion
 
-                #pragma endregion
+                    // --------------------------------------------------------------------------------
 
-                // --------------------------------------------------------------------------------
+                    #pragma region Intersection
 
-                #pragma region Calculate pixel index for initial vertex
+                    // Setup next ray
+                    Ray ray = { geom.p, wo };
 
-                if (type == SurfaceInteractionType::E)
-                {
-                    if (!primitive->sensor->RasterPosition(wo, geom, rasterPos))
+                    // Intersection query
+                    Intersection isect;
+                    if (!scene->Intersect(ray, isect))
                     {
                         break;
                     }
-                }
 
-                #pragma endregion
+                    #pragma endregion
 
-                // --------------------------------------------------------------------------------
+                    // --------------------------------------------------------------------------------
 
-                #pragma region Evaluate direction
+                    #pragma region Path termination
 
-                const auto fs = primitive->EvaluateDirection(geom, type, wi, wo, TransportDirection::EL, false);
-                if (fs.Black())
-                {
-                    break;
-                }
+                    if (isect.geom.infinite)
+                    {
+                        break;
+                    }
 
-                #pragma endregion
+                    const int numPaths = rr_.Evaluate(rr_.PixelReference(rasterPos), throughput, rng->Next(), MaxNumSplitPaths - numSplitPaths + 1);
+                    if (numPaths == 0)
+                    {
+                        break;
+                    }
 
-                // --------------------------------------------------------------------------------
+                    #pragma endregion
 
-                #pragma region Update throughput
+                    // --------------------------------------------------------------------------------
 
-                assert(pdfD > 0_f);
-                throughput *= fs / pdfD;
+                    #pragma region Update information
 
-                #pragma endregion
+                    geom = isect.geom;
+                    primitive = isect.primitive;
+                    type = isect.primitive->Type() & ~SurfaceInteractionType::Emitter;
+                    wi = -ray.d;
+                    numVertices++;
 
-                // --------------------------------------------------------------------------------
+                    #pragma endregion
 
-                #pragma region Intersection
+                    // --------------------------------------------------------------------------------
 
-                // Setup next ray
-                Ray ray = { geom.p, wo };
+                    #pragma region Split path
 
-                // Intersection query
-                Intersection isect;
-                if (!scene->Intersect(ray, isect))
-                {
-                    break;
-                }
+                    for (int i = 1; i < numPaths; i++)
+                    {
+                        splitPaths[numSplitPaths++] = { throughput, primitive, type, geom, wi, numVertices };
+                    }
 
-                #pragma endregion
+                    #pragma endregion
+                }
 
                 // --------------------------------------------------------------------------------
 
-                #pragma region Path termination
+                #pragma region Continue with split path
 
-                if (isect.geom.infinite)
+                if (numSplitPaths == 0)
                 {
                     break;
                 }
-
-                Float rrProb = 0.5_f;
-                if (rng->Next() > rrProb)
-                {
-                    break;
-                }
-                else
-                {
-                    throughput /= rrProb;
-                }
+                const auto& path = splitPaths[--numSplitPaths];
+                throughput = path.throughput;
+                primitive = path.primitive;
+                type = path.type;
+                geom = path.geom;
+                wi = path.wi;
+                numVertices = path.numVertices;
 
                 #pragma endregion
+            }
+        };
 
-                // --------------------------------------------------------------------------------
-
-                #pragma region Update information
+        rr_.EstimatePixels(scene, film_, initRng, processSample);
+        const auto renderStartTime = std::chrono::high_resolution_clock::now();
+        const long long processed = sched_->Process(scene, film_, initRng, processSample);
+        const auto renderEndTime = std::chrono::high_resolution_clock::now();
 
-                geom = isect.geom;
-                primitive = isect.primitive;
-                type = isect.primitive->Type() & ~SurfaceInteractionType::Emitter;
-                wi = -ray.d;
-                numVertices++;
+        // --------------------------------------------------------------------------------
 
-                #pragma endregion
+        #pragma region Report throughput
+        {
+            const double elapsed = (double)(std::chrono::duration_cast<std::chrono::milliseconds>(renderEndTime - renderStartTime).count()) / 1000.0;
+            if (elapsed > 0)
+            {
+                LM_LOG_INFO(boost::str(boost::format("Samples per second: %.1f (effective %.1f with %d light samples per vertex)") % (processed / elapsed) % (processed * numLightSamples_ / elapsed) % numLightSamples_));
             }
-        });
+        }
+        #pragma endregion
 
         // --------------------------------------------------------------------------------
 
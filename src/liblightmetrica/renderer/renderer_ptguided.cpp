@@ -0,0 +1,431 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch.h>
+#include <lightmetrica/renderer.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/random.h>
+#include <lightmetrica/scene3.h>
+#include <lightmetrica/film.h>
+#include <lightmetrica/bsdf.h>
+#include <lightmetrica/ray.h>
+#include <lightmetrica/intersection.h>
+#include <lightmetrica/emitter.h>
+#include <lightmetrica/sensor.h>
+#include <lightmetrica/surfacegeometry.h>
+#include <lightmetrica/primitive.h>
+#include <lightmetrica/scheduler.h>
+#include <lightmetrica/logger.h>
+#include <lightmetrica/detail/sdtree.h>
+#include <lightmetrica/detail/russianroulette.h>
+#include <tbb/tbb.h>
+
+LM_NAMESPACE_BEGIN
+
+/*!
+    \brief Path tracing with path guiding.
+
+    Learns the incident radiance distribution online with SD-trees
+    and importance-samples it together with the BSDF [Müller et al. 2017].
+    Rendering is split into training passes with doubling sample budgets;
+    the image of the last pass is the output.
+    Guided sampling and BSDF sampling are combined with one-sample MIS
+    (balance heuristic) controlled by `bsdf_sampling_fraction`.
+    During a pass the SD-tree is read-only except the lock-free accumulation
+    into the building quadtrees, which are turned into the sampling distribution between passes.
+
+    References:
+      - [Müller et al. 2017] Practical path guiding for efficient light-transport simulation
+*/
+class Renderer_PTGuided final : public Renderer
+{
+public:
+
+    LM_IMPL_CLASS(Renderer_PTGuided, Renderer);
+
+private:
+
+    int maxNumVertices_;
+    int minNumVertices_;
+    long long numSamples_;                  // Total number of samples for all passes
+    int numTrainingPasses_;                 // Number of training passes before the final pass
+    long long grainSize_;
+    long long progressUpdateInterval_;
+    double progressImageUpdateInterval_;
+    double renderTime_;                     // Total render time for all passes (disabled if negative)
+    Float bsdfSamplingFraction_;            // Probability to sample the BSDF instead of the guiding distribution
+    Float spatialThreshold_;                // Number of records to split a spatial leaf (scaled by sqrt(2^pass))
+    Float directionalThreshold_;            // Energy fraction to subdivide a quadtree node
+    int maxQuadtreeDepth_;
+    RussianRoulette rr_;
+
+public:
+
+    LM_IMPL_F(Initialize) = [this](const PropertyNode* prop) -> bool
+    {
+        maxNumVertices_        = prop->ChildAs("max_num_vertices", -1);
+        minNumVertices_        = prop->ChildAs("min_num_vertices", 0);
+        numSamples_            = prop->ChildAs<long long>("num_samples", 10000000L);
+        numTrainingPasses_     = prop->ChildAs("num_training_passes", 5);
+        grainSize_             = prop->ChildAs<long long>("grain_size", 10000);
+        progressUpdateInterval_ = prop->ChildAs<long long>("progress_update_interval", 100000);
+        progressImageUpdateInterval_ = prop->ChildAs<double>("progress_image_update_interval", -1);
+        renderTime_            = prop->ChildAs<double>("render_time", -1);
+        bsdfSamplingFraction_  = prop->ChildAs<Float>("bsdf_sampling_fraction", 0.5_f);
+        spatialThreshold_      = prop->ChildAs<Float>("spatial_threshold", 12000_f);
+        directionalThreshold_  = prop->ChildAs<Float>("directional_threshold", 0.01_f);
+        maxQuadtreeDepth_      = prop->ChildAs("max_quadtree_depth", 20);
+        if (!rr_.Load(prop))
+        {
+            return false;
+        }
+        if (numTrainingPasses_ < 0 || numTrainingPasses_ > 30)
+        {
+            LM_LOG_ERROR("Invalid number of training passes: " + std::to_string(numTrainingPasses_));
+            return false;
+        }
+        if (bsdfSamplingFraction_ <= 0_f || bsdfSamplingFraction_ > 1_f)
+        {
+            LM_LOG_ERROR("bsdf_sampling_fraction must be in (0,1]");
+            return false;
+        }
+        return true;
+    };
+
+    LM_IMPL_F(Render) = [this](const Scene* scene_, Random* initRng, const std::string& outputPath) -> void
+    {
+        const auto* scene = static_cast<const Scene3*>(scene_);
+        auto* film_ = static_cast<const Sensor*>(scene->GetSensor()->emitter)->GetFilm();
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Initialize SD-tree
+
+        GuidingSTree stree;
+        stree.Initialize(scene->GetBound());
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Estimate pixels for the adaptive Russian roulette
+        // The prepass samples with the empty SD-tree, i.e., without guiding
+        rr_.EstimatePixels(scene, film_, initRng, [&](Film* film, Random* rng)
+        {
+            RenderSample(scene, stree, false, film, rng);
+        });
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Render passes
+
+        // Sample (or time) budgets are b, 2b, ..., 2^K b for K training passes and the final pass
+        const long long baseSamples = Math::Max(1LL, numSamples_ / ((1LL << (numTrainingPasses_ + 1)) - 1));
+        const double baseTime = renderTime_ / (double)((1LL << (numTrainingPasses_ + 1)) - 1);
+        for (int pass = 0; pass <= numTrainingPasses_; pass++)
+        {
+            const bool training = pass < numTrainingPasses_;
+            const long long passSamples = baseSamples << pass;
+            LM_LOG_INFO(boost::str(boost::format("Pass %d / %d (%s, %d samples)") % (pass + 1) % (numTrainingPasses_ + 1) % (training ? "training" : "final") % passSamples));
+            LM_LOG_INDENTER();
+
+            // Scheduler for the pass with the scheduler parameters of the renderer
+            const auto schedProp = ComponentFactory::Create<PropertyTree>();
+            schedProp->LoadFromString(boost::str(boost::format("num_samples: %d\ngrain_size: %d\nprogress_update_interval: %d\nprogress_image_update_interval: %.17g\nrender_time: %.17g")
+                % passSamples % grainSize_ % progressUpdateInterval_ % progressImageUpdateInterval_ % (renderTime_ < 0 ? -1.0 : baseTime * (double)(1LL << pass))));
+            const auto sched = ComponentFactory::Create<Scheduler>();
+            sched->Load(schedProp->Root());
+
+            // Each pass renders an independent image; only the image of the final pass is kept
+            film_->Clear();
+            sched->Process(scene, film_, initRng, [&](Film* film, Random* rng)
+            {
+                RenderSample(scene, stree, training, film, rng);
+            });
+
+            if (training)
+            {
+                LM_LOG_INFO("Updating SD-tree");
+                LM_LOG_INDENTER();
+                stree.EndPass(spatialThreshold_ * Math::Sqrt((Float)(1LL << pass)), directionalThreshold_, maxQuadtreeDepth_);
+                LM_LOG_INFO("# of spatial nodes: " + std::to_string(stree.nodes.size()));
+            }
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Save image
+        {
+            LM_LOG_INFO("Saving image");
+            LM_LOG_INDENTER();
+            film_->Save(outputPath);
+        }
+        #pragma endregion
+    };
+
+private:
+
+    auto RenderSample(const Scene3* scene, GuidingSTree& stree, bool training, Film* film, Random* rng) const -> void
+    {
+        #pragma region Sample a sensor
+
+        const auto* E = scene->SampleEmitter(SurfaceInteractionType::E, rng->Next());
+        const auto pdfE = scene->EvaluateEmitterPDF(E);
+        assert(pdfE.v > 0);
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Sample a position on the sensor and initial ray direction
+
+        SurfaceGeometry geomE;
+        Vec3 initWo;
+        E->SamplePositionAndDirection(rng->Next2D(), rng->Next2D(), geomE, initWo);
+        const auto pdfPE = E->EvaluatePositionGivenDirectionPDF(geomE, initWo, false);
+        assert(pdfPE.v > 0);
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Calculate raster position for initial vertex
+
+        Vec2 rasterPos;
+        if (!E->RasterPosition(initWo, geomE, rasterPos))
+        {
+            // This can happen due to numerical errors
+            return;
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Temporary variables
+
+        auto throughput = E->EvaluatePosition(geomE, false) / pdfPE / pdfE;
+        const auto* primitive = E;
+        int type = SurfaceInteractionType::E;
+        auto geom = geomE;
+        Vec3 wi;
+        int numVertices = 1;
+
+        // Guided vertices to be recorded to the SD-tree at the end of the path
+        struct GuidingRecord
+        {
+            GuidingDTree* dtree;
+            Vec2 p;             // Sampled direction in the canonical coordinates
+            Float pdf;          // Solid angle density of the sampled direction
+            SPD throughput;     // Throughput including the vertex
+            SPD L;              // Incident radiance estimate
+        };
+        const int MaxNumRecords = 64;
+        GuidingRecord records[MaxNumRecords];
+        int numRecords = 0;
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        while (true)
+        {
+            if (maxNumVertices_ != -1 && numVertices >= maxNumVertices_)
+            {
+                break;
+            }
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Sample direction
+
+            Vec3 wo;
+            PDFVal pdfD;
+            GuidingSTree::Node* snode = nullptr;
+            Float cosWo = 0_f;
+            if (type == SurfaceInteractionType::E)
+            {
+                wo = initWo;
+                pdfD = primitive->EvaluateDirectionPDF(geom, type, wi, wo, false);
+            }
+            else
+            {
+                // Guide only non-specular interactions
+                if ((type & (SurfaceInteractionType::D | SurfaceInteractionType::G)) > 0 && !primitive->IsDeltaDirection(type))
+                {
+                    snode = &stree.Lookup(geom.p);
+                }
+
+                const auto* dtree = snode && snode->sampling.Total() > 0_f ? &snode->sampling : nullptr;
+                if (dtree && rng->Next() >= bsdfSamplingFraction_)
+                {
+                    wo = GuidingDTree::CanonicalToDir(dtree->Sample(rng->Next2D()));
+                }
+                else
+                {
+                    primitive->SampleDirection(rng->Next2D(), rng->Next(), type, geom, wi, wo);
+                }
+
+                pdfD = primitive->EvaluateDirectionPDF(geom, type, wi, wo, false);
+                if (snode)
+                {
+                    cosWo = Math::Abs(Math::Dot(geom.sn, wo));
+                    if (cosWo == 0_f)
+                    {
+                        break;
+                    }
+                }
+                if (dtree)
+                {
+                    // One-sample MIS with the balance heuristic, in projected solid angle measure
+                    const auto pdfGuide = dtree->EvaluatePDF(GuidingDTree::DirToCanonical(wo)) / cosWo;
+                    pdfD.v = bsdfSamplingFraction_ * pdfD.v + (1_f - bsdfSamplingFraction_) * pdfGuide;
+                }
+            }
+
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Evaluate direction
+
+            const auto fs = primitive->EvaluateDirection(geom, type, wi, wo, TransportDirection::EL, false);
+            if (fs.Black())
+            {
+                break;
+            }
+
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Update throughput
+
+            assert(pdfD > 0_f);
+            throughput *= fs / pdfD;
+
+            if (training && snode && numRecords < MaxNumRecords)
+            {
+                records[numRecords++] = { &snode->building, GuidingDTree::DirToCanonical(wo), pdfD.v * cosWo, throughput, SPD() };
+            }
+
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Intersection
+
+            // Setup next ray
+            Ray ray = { geom.p, wo };
+
+            // Intersection query
+            Intersection isect;
+            if (!scene->Intersect(ray, isect))
+            {
+                break;
+            }
+
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Handle hit with light source
+
+            if ((isect.primitive->Type() & SurfaceInteractionType::L) > 0)
+            {
+                const auto C =
+                    throughput
+                    * isect.primitive->EvaluateDirection(isect.geom, SurfaceInteractionType::L, Vec3(), -ray.d, TransportDirection::EL, false)
+                    * isect.primitive->EvaluatePosition(isect.geom, false);
+
+                // Accumulate to film
+                if (numVertices + 1 >= minNumVertices_)
+                {
+                    film->Splat(rasterPos, C);
+                }
+
+                // Accumulate incident radiance for the guided vertices
+                for (int i = 0; i < numRecords; i++)
+                {
+                    auto& r = records[i];
+                    for (int c = 0; c < 3; c++)
+                    {
+                        if (r.throughput.v[c] > 0_f) r.L.v[c] += C.v[c] / r.throughput.v[c];
+                    }
+                }
+            }
+
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Path termination
+
+            if (isect.geom.infinite)
+            {
+                break;
+            }
+
+            if (rr_.Terminate(rr_.PixelReference(rasterPos), throughput, rng->Next()))
+            {
+                break;
+            }
+
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Update information
+
+            geom = isect.geom;
+            primitive = isect.primitive;
+            type = isect.primitive->Type() & ~SurfaceInteractionType::Emitter;
+            wi = -ray.d;
+            numVertices++;
+
+            #pragma endregion
+        }
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Record to SD-tree
+
+        for (int i = 0; i < numRecords; i++)
+        {
+            const auto& r = records[i];
+            r.dtree->Record(r.p, r.L.Luminance() / r.pdf);
+        }
+
+        #pragma endregion
+    }
+
+};
+
+LM_COMPONENT_REGISTER_IMPL(Renderer_PTGuided, "renderer::ptguided");
+
+LM_NAMESPACE_END
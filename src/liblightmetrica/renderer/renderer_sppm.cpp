@@ -39,6 +39,7 @@
 #include <lightmetrica/renderutils.h>
 #include <lightmetrica/detail/photonmap.h>
 #include <lightmetrica/detail/subpathsampler.h>
+#include <lightmetrica/detail/russianroulette.h>
 #include <lightmetrica/detail/parallel.h>
 #include <tbb/tbb.h>
 
@@ -64,6 +65,7 @@ public:
 private:
 
     int maxNumVertices_;
+    RussianRoulette rr_;
     long long numIterationPass_;                          // Number of photon scattering passes
     long long numPhotonTraceSamples_;                     // Number of photon trace samples for each pass
     Float initialRadius_;                                 // Initial photon gather radius
@@ -92,6 +94,10 @@ public:
         #if LM_SPPM_RENDER_WITH_TIME
         renderTime_            = prop->ChildAs("render_time", 10.0);
         #endif
+        if (!rr_.Load(prop))
+        {
+            return false;
+        }
         return true;
     };
 
@@ -128,6 +134,7 @@ public:
         }
 
         long long totalPhotonTraceSamples = 0;
+        rr_.EstimateLightReference(scene, initRng);
 
         #if LM_SPPM_RENDER_WITH_TIME
         const auto renderStartTime = std::chrono::high_resolution_clock::now();
@@ -220,7 +227,7 @@ public:
                 Parallel::For(numPhotonTraceSamples_, [&](long long index, int threadid, bool init)
                 {
                     auto& ctx = contexts[threadid];
-                    SubpathSampler::TraceSubpath(scene, &ctx.rng, maxNumVertices_, TransportDirection::LE, [&](int numVertices, const Vec2& /*rasterPos*/, const SubpathSampler::PathVertex& pv, const SubpathSampler::PathVertex& v, SPD& throughput) -> bool
+                    SubpathSampler::TraceSubpath(scene, &ctx.rng, maxNumVertices_, TransportDirection::LE, rr_, [&](int numVertices, const Vec2& /*rasterPos*/, const SubpathSampler::PathVertex& pv, const SubpathSampler::PathVertex& v, SPD& throughput) -> bool
                     {
                         // Skip initial vertex
                         if (numVertices == 1)
@@ -239,17 +246,6 @@ public:
                             ctx.photons.push_back(photon);
                         }
 
-                        // Path termination
-                        const Float rrProb = 0.5_f;
-                        if (ctx.rng.Next() > rrProb)
-                        {
-                            return false;
-                        }
-                        else
-                        {
-                            throughput /= rrProb;
-                        }
-
                         return true;
                     });
                 });
@@ -269,6 +265,7 @@ public:
             {
                 LM_LOG_INFO("Building photon map");
                 LM_LOG_INDENTER();
+                photonmap_->SetMaxRadius(std::accumulate(mps.begin(), mps.end(), 0_f, [](Float r, const MeasurementPoint& mp) { return std::max(r, mp.radius); }));
                 photonmap_->Build(std::move(photons));
             }
             #pragma endregion
@@ -35,7 +35,10 @@
 #include <lightmetrica/sensor.h>
 #include <lightmetrica/detail/parallel.h>
 #include <lightmetrica/detail/photonmap.h>
+#include <lightmetrica/detail/hashgrid.h>
 #include <lightmetrica/detail/subpathsampler.h>
+#include <lightmetrica/detail/arena.h>
+#include <tbb/tbb.h>
 
 #define LM_VCM_DEBUG 0
 
@@ -50,7 +53,7 @@ struct VCMPathVertex
 
 struct VCMSubpath
 {
-    std::vector<VCMPathVertex> vertices;
+    ArenaVector<VCMPathVertex> vertices;
     auto SampleSubpath(const Scene3* scene, Random* rng, TransportDirection transDir, int maxNumVertices) -> void
     {
         vertices.clear();
@@ -68,7 +71,7 @@ struct VCMSubpath
 
 struct VCMPath
 {
-    std::vector<VCMPathVertex> vertices;
+    ArenaVector<VCMPathVertex> vertices;
 
     auto ConnectSubpaths(const Scene3* scene, const VCMSubpath& subpathL, const VCMSubpath& subpathE, int s, int t) -> bool
     {
@@ -99,16 +102,16 @@ struct VCMPath
         return true;
     }
 
-    auto MergeSubpaths(const VCMSubpath& subpathL, const VCMSubpath& subpathE, int s, int t) -> bool
+    auto MergeSubpaths(const VCMPathVertex* subpathL, const VCMSubpath& subpathE, int s, int t) -> bool
     {
         assert(s >= 1);
         assert(t >= 1);
         vertices.clear();
-        const auto& vL = subpathL.vertices[s - 1];
+        const auto& vL = subpathL[s - 1];
         const auto& vE = subpathE.vertices[t - 1];
         if (vL.primitive->IsDeltaPosition(vL.type) || vE.primitive->IsDeltaPosition(vE.type)) { return false; }
         if (vL.geom.infinite || vE.geom.infinite) { return false; }
-        vertices.insert(vertices.end(), subpathL.vertices.begin(), subpathL.vertices.begin() + s);
+        vertices.insert(vertices.end(), subpathL, subpathL + s);
         vertices.insert(vertices.end(), subpathE.vertices.rend() - t, subpathE.vertices.rend());
         return true;
     }
@@ -353,155 +356,75 @@ struct VCMPath
 
 // --------------------------------------------------------------------------------
 
-struct VCMKdTree
+//! Vertices of the light subpaths of an iteration stored in a contiguous array.
+struct VCMLightSubpaths
 {
-    struct Node
-    {
-        bool isleaf;
-        Bound bound;
+    std::vector<VCMPathVertex> vertices;    // Vertices of all light subpaths
+    std::vector<int> offsets;               // Index of the first vertex of each subpath (with sentinel)
 
-        union
-        {
-            struct
-            {
-                int begin;
-                int end;
-            } leaf;
+    auto NumSubpaths() const -> int { return (int)(offsets.size()) - 1; }
+    auto NumVertices(int i) const -> int { return offsets[i + 1] - offsets[i]; }
+    auto Vertices(int i) const -> const VCMPathVertex* { return vertices.data() + offsets[i]; }
+};
 
-            struct
-            {
-                int child1;
-                int child2;
-            } internal;
-        };
-    };
+// --------------------------------------------------------------------------------
 
-    struct Index
+/*!
+    Range query structure for the vertices in the light subpaths.
+    The mergeable vertices are stored in `HashGrid` with the cell size of twice the merge radius
+    so that a query visits at most 2x2x2 cells.
+    The buffers are reused between iterations.
+*/
+struct VCMHashGrid
+{
+    struct Entry
     {
         int subpathIndex;
-        int vertexIndex;
+        int vertexIndex;                    // Index of the vertex in the subpath
     };
 
-    std::vector<std::unique_ptr<Node>> nodes_;
-    std::vector<int> indices_;
-    std::vector<Index> vertices_;
-    const std::vector<VCMSubpath>& subpathLs_;
+    HashGrid grid_;
+    std::vector<int> subpathIndices_;       // Index of the subpath of each vertex
+    std::vector<Entry> entries_;            // Entries in the sorted order of the grid
 
-    VCMKdTree(const std::vector<VCMSubpath>& subpathLs)
-        : subpathLs_(subpathLs)
-    {}
-
-    auto Build() -> void
+    auto Build(const VCMLightSubpaths& subpathLs, Float radius) -> void
     {
-        // Arrange in a vector
-        for (int i = 0; i < (int)subpathLs_.size(); i++)
+        const int numSubpaths = subpathLs.NumSubpaths();
+        const int numVertices = (int)(subpathLs.vertices.size());
+        subpathIndices_.resize(numVertices);
+        tbb::parallel_for(tbb::blocked_range<int>(0, numSubpaths, 256), [&](const tbb::blocked_range<int>& range) -> void
         {
-            const auto& subpathL = subpathLs_[i];
-            for (int j = 1; j < (int)subpathL.vertices.size(); j++)
+            for (int i = range.begin(); i != range.end(); i++)
             {
-                const auto& v = subpathL.vertices[j];
-                if (!v.geom.infinite && !v.primitive->IsDeltaPosition(v.type) && !v.primitive->IsDeltaDirection(v.type))
-                {
-                    vertices_.push_back({ i, j });
-                }
+                std::fill_n(subpathIndices_.begin() + subpathLs.offsets[i], subpathLs.NumVertices(i), i);
             }
-        }
+        });
 
-        // Build function
-        const std::function<int(int, int)> Build_ = [&](int begin, int end) -> int
+        entries_.resize(numVertices);
+        grid_.Build(numVertices, 2_f * radius, [&](int k, Vec3& p) -> bool
         {
-            int idx = (int)(nodes_.size());
-            nodes_.emplace_back(new Node);
-            auto* node = nodes_[idx].get();
-
-            // Current bound
-            node->bound = Bound();
-            for (int i = begin; i < end; i++)
+            // Vertices on the light and with delta components are not mergeable
+            const auto& v = subpathLs.vertices[k];
+            const int j = k - subpathLs.offsets[subpathIndices_[k]];
+            if (j < 1 || v.geom.infinite || v.primitive->IsDeltaPosition(v.type) || v.primitive->IsDeltaDirection(v.type))
             {
-                const auto& v = vertices_[indices_[i]];
-                node->bound = Math::Union(node->bound, subpathLs_[v.subpathIndex].vertices[v.vertexIndex].geom.p);
+                return false;
             }
-
-            // Create leaf node
-            const int LeafNumNodes = 10;
-            if (end - begin < LeafNumNodes)
-            {
-                node->isleaf = true;
-                node->leaf.begin = begin;
-                node->leaf.end = end;
-                return idx;
-            }
-
-            // Select longest axis as split axis
-            const int axis = node->bound.LongestAxis();
-
-            // Select split position
-            const Float split = node->bound.Centroid()[axis];
-
-            // Partition into two sets according to split position
-            const auto it = std::partition(indices_.begin() + begin, indices_.begin() + end, [&](int i) -> bool
-            {
-                const auto& v = vertices_[i];
-                return subpathLs_[v.subpathIndex].vertices[v.vertexIndex].geom.p[axis] < split;
-            });
-
-            // Create intermediate node
-            const int mid = (int)(std::distance(indices_.begin(), it));
-            node->isleaf = false;
-            node->internal.child1 = Build_(begin, mid);
-            node->internal.child2 = Build_(mid, end);
-
-            return idx;
-        };
-
-        nodes_.clear();
-        indices_.assign(vertices_.size(), 0);
-        std::iota(indices_.begin(), indices_.end(), 0);
-        Build_(0, (int)(vertices_.size()));
+            p = v.geom.p;
+            return true;
+        }, [&](int k, int sortedIndex) -> void
+        {
+            const int i = subpathIndices_[k];
+            entries_[sortedIndex] = { i, k - subpathLs.offsets[i] };
+        });
     }
 
     auto RangeQuery(const Vec3& p, Float radius, const std::function<void(int subpathIndex, int vertexIndex)>& queryFunc) const -> void
     {
-        const Float radius2 = radius * radius;
-        const std::function<void(int)> Collect = [&](int idx) -> void
+        grid_.RangeQuery(p, radius, [&](int sortedIndex) -> void
         {
-            const auto* node = nodes_.at(idx).get();
-
-            if (node->isleaf)
-            {
-                for (int i = node->leaf.begin; i < node->leaf.end; i++)
-                {
-                    const auto& v = vertices_[indices_[i]];
-                    if (Math::Length2(subpathLs_[v.subpathIndex].vertices[v.vertexIndex].geom.p - p) < radius2)
-                    {
-                        queryFunc(v.subpathIndex, v.vertexIndex);
-                    }
-                }
-                return;
-            }
-
-            const int axis = node->bound.LongestAxis();
-            const Float split = node->bound.Centroid()[axis];
-            const auto dist2 = (p[axis] - split) * (p[axis] - split);
-            if (p[axis] < split)
-            {
-                Collect(node->internal.child1);
-                if (dist2 < radius2)
-                {
-                    Collect(node->internal.child2);
-                }
-            }
-            else
-            {
-                Collect(node->internal.child2);
-                if (dist2 < radius2)
-                {
-                    Collect(node->internal.child1);
-                }
-            }
-        };
-
-        Collect(0);
+            queryFunc(entries_[sortedIndex].subpathIndex, entries_[sortedIndex].vertexIndex);
+        });
     }
 
 };
@@ -584,6 +507,20 @@ public:
 
         // --------------------------------------------------------------------------------
 
+        // Buffers reused between iterations
+        struct LightContext
+        {
+            Random rng;
+            VCMSubpath subpath;
+            std::vector<VCMPathVertex> vertices;    // Vertices of the light subpaths sampled in the thread
+            std::vector<int> offsets;               // Index of the first vertex of each subpath in `vertices`
+        };
+        std::vector<LightContext> lightContexts(Parallel::GetNumThreads());
+        VCMLightSubpaths subpathLs;
+        VCMHashGrid pm;
+
+        // --------------------------------------------------------------------------------
+
         Float mergeRadius = 0_f;
         for (long long pass = 0; pass < numIterationPass_; pass++)
         {
@@ -599,43 +536,61 @@ public:
             // --------------------------------------------------------------------------------
 
             #pragma region Sample light subpaths
-            std::vector<VCMSubpath> subpathLs;
             if (mode_ == Mode::VCM || mode_ == Mode::BDPM)
             {
                 LM_LOG_INFO("Sampling light subpaths");
                 LM_LOG_INDENTER();
 
-                struct Context
+                for (auto& ctx : lightContexts)
                 {
-                    Random rng;
-                    std::vector<VCMSubpath> subpathLs;
-                };
-                std::vector<Context> contexts(Parallel::GetNumThreads());
-                for (auto& ctx : contexts) { ctx.rng.SetSeed(initRng->NextUInt()); }
+                    ctx.rng.SetSeed(initRng->NextUInt());
+                    ctx.vertices.clear();
+                    ctx.offsets.clear();
+                }
 
+                // Sample light subpaths into the thread-local buffers
                 Parallel::For(numPhotonTraceSamples_, [&](long long index, int threadid, bool init)
                 {
-                    auto& ctx = contexts[threadid];
-                    ctx.subpathLs.emplace_back();
-                    ctx.subpathLs.back().SampleSubpath(scene, &ctx.rng, TransportDirection::LE, maxNumVertices_);
+                    auto& ctx = lightContexts[threadid];
+                    ctx.subpath.SampleSubpath(scene, &ctx.rng, TransportDirection::LE, maxNumVertices_);
+                    ctx.offsets.push_back((int)(ctx.vertices.size()));
+                    ctx.vertices.insert(ctx.vertices.end(), ctx.subpath.vertices.begin(), ctx.subpath.vertices.end());
                 });
 
-                for (auto& ctx : contexts)
+                // Copy into the contiguous array with the offsets given by the prefix sums of
+                // the numbers of vertices and subpaths of the threads.
+                // The subpaths are ordered by the threads and are identified by the index in the array.
+                const int numThreads = (int)(lightContexts.size());
+                std::vector<int> threadVertexOffsets(numThreads + 1, 0);
+                std::vector<int> threadSubpathOffsets(numThreads + 1, 0);
+                for (int i = 0; i < numThreads; i++)
                 {
-                    subpathLs.insert(subpathLs.end(), ctx.subpathLs.begin(), ctx.subpathLs.end());
+                    threadVertexOffsets[i + 1] = threadVertexOffsets[i] + (int)(lightContexts[i].vertices.size());
+                    threadSubpathOffsets[i + 1] = threadSubpathOffsets[i] + (int)(lightContexts[i].offsets.size());
                 }
+                subpathLs.vertices.resize(threadVertexOffsets.back());
+                subpathLs.offsets.resize(threadSubpathOffsets.back() + 1);
+                subpathLs.offsets.back() = threadVertexOffsets.back();
+                tbb::parallel_for(0, numThreads, [&](int i) -> void
+                {
+                    const auto& ctx = lightContexts[i];
+                    std::copy(ctx.vertices.begin(), ctx.vertices.end(), subpathLs.vertices.begin() + threadVertexOffsets[i]);
+                    for (size_t j = 0; j < ctx.offsets.size(); j++)
+                    {
+                        subpathLs.offsets[threadSubpathOffsets[i] + j] = threadVertexOffsets[i] + ctx.offsets[j];
+                    }
+                });
             }
             #pragma endregion
 
             // --------------------------------------------------------------------------------
 
             #pragma region Construct range query structure for vertices in light subpaths
-            VCMKdTree pm(subpathLs);
             if (mode_ == Mode::VCM || mode_ == Mode::BDPM)
             {
                 LM_LOG_INFO("Constructing range query structure");
                 LM_LOG_INDENTER();
-                pm.Build();
+                pm.Build(subpathLs, mergeRadius);
             }
             #pragma endregion
 
@@ -650,6 +605,7 @@ public:
                 {
                     Random rng;
                     Film::UniquePtr film{nullptr, nullptr};
+                    MemoryArena arena;      // Reset per eye subpath
                 };
                 std::vector<Context> contexts(Parallel::GetNumThreads());
                 for (auto& ctx : contexts)
@@ -666,12 +622,16 @@ public:
                     // --------------------------------------------------------------------------------
 
                     #pragma region Sample subpaths
-                    static thread_local VCMSubpath subpathE;
-                    static thread_local VCMSubpath subpathL;
+                    MemoryArena::Scope arenaScope(ctx.arena);
+                    VCMSubpath subpathE;
+                    VCMSubpath subpathL;
                     subpathE.SampleSubpath(scene, &ctx.rng, TransportDirection::EL, maxNumVertices_);
                     subpathL.SampleSubpath(scene, &ctx.rng, TransportDirection::LE, maxNumVertices_);
                     #pragma endregion
 
+                    // Full path reused for all combinations of the subpaths
+                    VCMPath fullpath;
+
                     // --------------------------------------------------------------------------------
 
                     #pragma region Combine subpaths
@@ -687,7 +647,6 @@ public:
                             for (int s = minS; s <= maxS; s++)
                             {
                                 // Connect vertices and create a full path
-                                static thread_local VCMPath fullpath;
                                 if (!fullpath.ConnectSubpaths(scene, subpathL, subpathE, s, t)) { continue; }
 
                                 // Evaluate contribution
@@ -731,8 +690,7 @@ public:
                                 if (n < minNumVertices_ || maxNumVertices_ < n) { return; }
 
                                 // Merge vertices and create a full path
-                                static thread_local VCMPath fullpath;
-                                if (!fullpath.MergeSubpaths(subpathLs[si], subpathE, s - 1, t)) { return; }
+                                if (!fullpath.MergeSubpaths(subpathLs.Vertices(si), subpathE, s - 1, t)) { return; }
 
                                 // Evaluate contribution
                                 const auto f = fullpath.EvaluateF(s - 1, true);
@@ -762,11 +720,14 @@ public:
                 });
 
                 film->Rescale((Float)(pass) / (1_f + pass));
+                long long numHeapAllocations = 0;
                 for (auto& ctx : contexts)
                 {
                     ctx.film->Rescale(1_f / (1_f + pass));
                     film->Accumulate(ctx.film.get());
+                    numHeapAllocations += ctx.arena.NumHeapAllocations();
                 }
+                LM_LOG_INFO(boost::str(boost::format("Heap allocations for eye subpaths: %d (%.3e per sample)") % numHeapAllocations % ((double)(numHeapAllocations) / numEyeTraceSamples_)));
             }
             #pragma endregion
 
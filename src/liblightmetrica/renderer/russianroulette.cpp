@@ -0,0 +1,251 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch.h>
+#include <lightmetrica/detail/russianroulette.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/logger.h>
+#include <lightmetrica/film.h>
+#include <lightmetrica/scheduler.h>
+#include <lightmetrica/scene3.h>
+#include <lightmetrica/random.h>
+#include <lightmetrica/surfaceinteraction.h>
+#include <lightmetrica/detail/subpathsampler.h>
+
+LM_NAMESPACE_BEGIN
+
+auto RussianRoulette::Load(const PropertyNode* prop) -> bool
+{
+    const auto mode = prop->ChildAs<std::string>("rr", "fixed");
+    if (mode == "fixed")
+    {
+        mode_ = Mode::Fixed;
+    }
+    else if (mode == "adaptive")
+    {
+        mode_ = Mode::Adaptive;
+    }
+    else
+    {
+        LM_LOG_ERROR("Invalid Russian roulette mode: " + mode);
+        return false;
+    }
+
+    prob_            = prop->ChildAs<Float>("rr_prob", 0.5_f);
+    windowSize_      = prop->ChildAs<Float>("rr_window_size", 5_f);
+    maxSurvivalProb_ = prop->ChildAs<Float>("rr_max_survival_prob", 0.95_f);
+    maxSplit_        = prop->ChildAs("rr_max_split", 4);
+    prepassSpp_      = prop->ChildAs("rr_prepass_spp", 4);
+    prepassPhotons_  = prop->ChildAs<long long>("rr_prepass_photons", 10000LL);
+    if (prob_ <= 0_f || prob_ > 1_f || maxSurvivalProb_ <= 0_f || maxSurvivalProb_ > 1_f)
+    {
+        LM_LOG_ERROR("Survival probability must be in (0,1]");
+        return false;
+    }
+    if (windowSize_ < 1_f || maxSplit_ < 1)
+    {
+        LM_LOG_ERROR("Invalid weight window");
+        return false;
+    }
+
+    reference_.clear();
+    lightReference_ = 1_f;
+    return true;
+}
+
+auto RussianRoulette::EstimatePixels(const Scene3* scene, Film* film, Random* initRng, const std::function<void(Film*, Random*)>& processSampleFunc) -> void
+{
+    const long long numSamples = NumPrepassSamples(film);
+    if (numSamples <= 0)
+    {
+        return;
+    }
+
+    LM_LOG_INFO("Estimating pixels for adaptive Russian roulette");
+    LM_LOG_INDENTER();
+
+    reference_.clear();
+    const auto schedProp = ComponentFactory::Create<PropertyTree>();
+    schedProp->LoadFromString(boost::str(boost::format("num_samples: %d") % numSamples));
+    const auto sched = ComponentFactory::Create<Scheduler>();
+    sched->Load(schedProp->Root());
+    const auto prepassFilm = ComponentFactory::Clone<Film>(film);
+    prepassFilm->Clear();
+    sched->Process(scene, prepassFilm.get(), initRng, processSampleFunc);
+    SetPixelEstimate(prepassFilm.get());
+}
+
+auto RussianRoulette::NumPrepassSamples(const Film* film) const -> long long
+{
+    if (mode_ != Mode::Adaptive || prepassSpp_ <= 0)
+    {
+        return 0;
+    }
+    return (long long)(film->Width()) * film->Height() * prepassSpp_;
+}
+
+auto RussianRoulette::SetPixelEstimate(const Film* film) -> void
+{
+    width_ = film->Width();
+    height_ = film->Height();
+
+    // Luminance of the image filtered with 3x3 box to suppress the noise of the prepass
+    std::vector<Float> lum(width_ * height_);
+    for (int y = 0; y < height_; y++)
+    {
+        for (int x = 0; x < width_; x++)
+        {
+            lum[y * width_ + x] = film->GetPixel(x, y).Luminance();
+        }
+    }
+
+    reference_.assign(width_ * height_, 0_f);
+    Float sum = 0_f;
+    for (int y = 0; y < height_; y++)
+    {
+        for (int x = 0; x < width_; x++)
+        {
+            Float v = 0_f;
+            int n = 0;
+            for (int yy = std::max(0, y - 1); yy <= std::min(height_ - 1, y + 1); yy++)
+            {
+                for (int xx = std::max(0, x - 1); xx <= std::min(width_ - 1, x + 1); xx++)
+                {
+                    if (std::isfinite(lum[yy * width_ + xx])) { v += lum[yy * width_ + xx]; n++; }
+                }
+            }
+            reference_[y * width_ + x] = n > 0 ? v / n : 0_f;
+            sum += reference_[y * width_ + x];
+        }
+    }
+
+    const auto mean = sum / (width_ * height_);
+    if (mean <= 0_f)
+    {
+        LM_LOG_WARN("Pixel estimate is black, using the default weight window");
+        reference_.clear();
+        return;
+    }
+
+    for (auto& r : reference_)
+    {
+        r = Math::Clamp(r / mean, 0.1_f, 10_f);
+    }
+}
+
+auto RussianRoulette::PixelReference(const Vec2& rasterPos) const -> Float
+{
+    if (reference_.empty())
+    {
+        return 1_f;
+    }
+    const int pX = Math::Clamp((int)(rasterPos.x * Float(width_)), 0, width_ - 1);
+    const int pY = Math::Clamp((int)(rasterPos.y * Float(height_)), 0, height_ - 1);
+    return reference_[pY * width_ + pX];
+}
+
+auto RussianRoulette::EstimateLightReference(const Scene3* scene, Random* initRng) -> void
+{
+    lightReference_ = 1_f;
+    if (mode_ != Mode::Adaptive || prepassPhotons_ <= 0)
+    {
+        return;
+    }
+
+    LM_LOG_INFO("Estimating flux per photon for adaptive Russian roulette");
+    LM_LOG_INDENTER();
+
+    Random rng;
+    rng.SetSeed(initRng->NextUInt());
+    double sum = 0;
+    long long numHits = 0;
+    for (long long i = 0; i < prepassPhotons_; i++)
+    {
+        SubpathSampler::TraceSubpath(scene, &rng, 2, TransportDirection::LE, [&](int numVertices, const Vec2& /*rasterPos*/, const SubpathSampler::PathVertex& /*pv*/, const SubpathSampler::PathVertex& /*v*/, SPD& throughput) -> bool
+        {
+            if (numVertices == 2)
+            {
+                const auto w = throughput.Luminance();
+                if (std::isfinite(w))
+                {
+                    sum += w;
+                    numHits++;
+                }
+            }
+            return true;
+        });
+    }
+
+    if (numHits == 0 || sum <= 0)
+    {
+        LM_LOG_WARN("No photon hits the scene, using the default weight window");
+        return;
+    }
+    lightReference_ = (Float)(sum / numHits);
+}
+
+auto RussianRoulette::Evaluate(Float reference, SPD& throughput, Float u, int maxSplit) const -> int
+{
+    if (mode_ == Mode::Fixed)
+    {
+        if (u > prob_)
+        {
+            return 0;
+        }
+        throughput /= prob_;
+        return 1;
+    }
+
+    const auto w = throughput.Luminance();
+    if (!(w > 0_f) || !std::isfinite(w))
+    {
+        return 0;
+    }
+
+    // Weight window centered at the reference
+    const auto lower = 2_f * reference / (1_f + windowSize_);
+    const auto upper = lower * windowSize_;
+    if (w > upper && maxSplit > 1)
+    {
+        // Split
+        const int n = std::min({ (int)(std::ceil(w / upper)), maxSplit_, maxSplit });
+        if (n > 1)
+        {
+            throughput /= (Float)(n);
+            return n;
+        }
+    }
+
+    // Terminate so that the weight of the surviving paths gets the lower bound of the window
+    const auto q = Math::Min(w / lower, maxSurvivalProb_);
+    if (u >= q)
+    {
+        return 0;
+    }
+    throughput /= q;
+    return 1;
+}
+
+LM_NAMESPACE_END
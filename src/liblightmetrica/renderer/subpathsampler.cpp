@@ -25,6 +25,7 @@
 #include <pch.h>
 #include <lightmetrica/detail/subpathsampler.h>
 #include <lightmetrica/detail/photonmap.h>
+#include <lightmetrica/detail/russianroulette.h>
 #include <lightmetrica/logger.h>
 #include <lightmetrica/random.h>
 #include <lightmetrica/light.h>
@@ -47,7 +48,9 @@ namespace
         int maxNumVertices,
         TransportDirection transDir,
         const SubpathSampler::ProcessPathVertexFunc& processPathVertexFunc,
-        const SubpathSampler::SamplerFunc& sampleNext) -> void
+        const SubpathSampler::SamplerFunc& sampleNext,
+        const RussianRoulette* rr = nullptr,
+        Random* rrRng = nullptr) -> void
     {
         const auto sampleNext2D = [&](int numVertices, const Primitive* primitive, SubpathSampler::SampleUsage usage) -> Vec2
         {
@@ -187,6 +190,15 @@ namespace
                     break;
                 }
 
+                if (rr)
+                {
+                    const auto reference = transDir == TransportDirection::EL ? rr->PixelReference(rasterPos) : rr->LightReference();
+                    if (rr->Terminate(reference, throughput, rrRng->Next()))
+                    {
+                        break;
+                    }
+                }
+
                 #pragma endregion
 
                 // --------------------------------------------------------------------------------
@@ -207,6 +219,11 @@ auto SubpathSampler::TraceSubpath(const Scene3* scene, Random* rng, int maxNumVe
     TraceSubpath_(scene, nullptr, nullptr, boost::none, maxNumVertices, transDir, processPathVertexFunc, [&](int numVertices, const Primitive* primitive, SampleUsage usage, int index) -> Float { return rng->Next(); });
 }
 
+auto SubpathSampler::TraceSubpath(const Scene3* scene, Random* rng, int maxNumVertices, TransportDirection transDir, const RussianRoulette& rr, const SubpathSampler::ProcessPathVertexFunc& processPathVertexFunc) -> void
+{
+    TraceSubpath_(scene, nullptr, nullptr, boost::none, maxNumVertices, transDir, processPathVertexFunc, [&](int numVertices, const Primitive* primitive, SampleUsage usage, int index) -> Float { return rng->Next(); }, &rr, rng);
+}
+
 auto SubpathSampler::TraceEyeSubpathFixedRasterPos(const Scene3* scene, Random* rng, int maxNumVertices, TransportDirection transDir, const Vec2& rasterPos, const SubpathSampler::ProcessPathVertexFunc& processPathVertexFunc) -> void
 {
     assert(transDir == TransportDirection::EL);
@@ -32,14 +32,25 @@
 #include <lightmetrica/trianglemesh.h>
 #include <lightmetrica/light.h>
 #include <lightmetrica/sensor.h>
+#include <lightmetrica/film.h>
 #include <lightmetrica/bsdf.h>
 #include <lightmetrica/ray.h>
 #include <lightmetrica/intersection.h>
+#include <lightmetrica/surfacegeometry.h>
+#include <lightmetrica/dist.h>
 #include <lightmetrica/detail/propertyutils.h>
 #include <lightmetrica/detail/serial.h>
+#include <lightmetrica/detail/lightbvh.h>
 
 LM_NAMESPACE_BEGIN
 
+enum class LightSelection : int
+{
+    Uniform,    // Uniform selection of the lights
+    BVH,        // Selection with the light BVH given the shading point
+    Power,      // Selection proportional to the power of the lights
+};
+
 class Scene3_ final : public Scene3
 {
 public:
@@ -48,12 +59,143 @@ public:
 
 private:
 
-    // Initialize function called after the primitives are loaded.
-    auto Initialize_PostLoadPrimitive(Assets* assets, Accel* accel) -> bool
+    // Parse the transform of a scene node.
+    // `transform` is the transform of the primitive and `childTransform` is passed to the child nodes.
+    static auto ParseTransform(const PropertyNode* propNode, const Mat4& parentTransform, Mat4& transform, Mat4& childTransform) -> bool
     {
-        #pragma region Compute scene bound
-        // AABB
-        bound_ = Bound();
+        const auto* transformNode = propNode->Child("transform");
+        if (!transformNode)
+        {
+            // Missing `transform` node, identity matrix is assumed
+            transform = Mat4::Identity();
+            childTransform = parentTransform;
+            return true;
+        }
+
+        // Parse transform from the node
+        // There are several ways to specify a transformation
+        const auto ParseTransformNode = [](const PropertyNode* transformNode, Mat4& transform) -> bool
+        {
+            // `matrix` node
+            const auto* matrixNode = transformNode->Child("matrix");
+            if (matrixNode)
+            {
+                // Parse 4x4 matrix
+                if (!matrixNode->As<Mat4>(transform))
+                {
+                    PropertyUtils::PrintPrettyError(matrixNode);
+                    return false;
+                }
+                return true;
+            }
+
+            // `lookat` node
+            const auto* lookatNode = transformNode->Child("lookat");
+            if (lookatNode)
+            {
+                Vec3 eye;
+                if (!lookatNode->ChildAs("eye", eye))
+                {
+                    PropertyUtils::PrintPrettyError(lookatNode);
+                    return false;
+                }
+                Vec3 center;
+                if (!lookatNode->ChildAs("center", center))
+                {
+                    PropertyUtils::PrintPrettyError(lookatNode);
+                    return false;
+                }
+                Vec3 up;
+                if (!lookatNode->ChildAs("up", up))
+                {
+                    PropertyUtils::PrintPrettyError(lookatNode);
+                    return false;
+                }
+
+                const auto vz = Math::Normalize(eye - center);
+                const auto vx = Math::Normalize(Math::Cross(up, vz));
+                const auto vy = Math::Cross(vz, vx);
+
+                transform = Mat4(
+                    vx.x, vx.y, vx.z, 0_f,
+                    vy.x, vy.y, vy.z, 0_f,
+                    vz.x, vz.y, vz.z, 0_f,
+                    eye.x, eye.y, eye.z, 1_f);
+
+                return true;
+            }
+
+            // `translate`, `rotate`, or `scale` node
+            const auto* translateNode = transformNode->Child("translate");
+            const auto* rotateNode    = transformNode->Child("rotate");
+            const auto* scaleNode     = transformNode->Child("scale");
+            if (translateNode || rotateNode || scaleNode)
+            {
+                transform = Mat4::Identity();
+
+                // Parse 'translate' node
+                if (translateNode)
+                {
+                    Vec3 v;
+                    if (!translateNode->As<Vec3>(v))
+                    {
+                        PropertyUtils::PrintPrettyError(translateNode);
+                        return false;
+                    }
+                    transform *= Math::Translate(v);
+                }
+
+                // Parse 'rotate' node
+                if (rotateNode)
+                {
+                    Float angle;
+                    if (!rotateNode->ChildAs("angle", angle))
+                    {
+                        PropertyUtils::PrintPrettyError(rotateNode);
+                        return false;
+                    }
+                    Vec3 axis;
+                    if (!rotateNode->ChildAs("axis", axis))
+                    {
+                        PropertyUtils::PrintPrettyError(rotateNode);
+                        return false;
+                    }
+                    transform *= Math::Rotate(Math::Radians(angle), axis);
+                }
+
+                // Parse 'scale' node
+                if (scaleNode)
+                {
+                    Vec3 v;
+                    if (!scaleNode->As<Vec3>(v))
+                    {
+                        PropertyUtils::PrintPrettyError(scaleNode);
+                        return false;
+                    }
+                    transform *= Math::Scale(v);
+                }
+
+                return true;
+            }
+
+            transform = Mat4::Identity();
+            return true;
+        };
+
+        if (!ParseTransformNode(transformNode, transform))
+        {
+            return false;
+        }
+
+        transform = parentTransform * transform;
+        childTransform = transform;
+        return true;
+    }
+
+    // Compute the AABB of the primitives with current transforms.
+    auto ComputeBound() const -> Bound
+    {
+        Bound bound;
         for (const auto& primitive : primitives_)
         {
             if (primitive->mesh)
@@ -63,16 +205,160 @@ private:
                 for (int i = 0; i < n; i++)
                 {
                     Vec3 p(primitive->transform * Vec4(ps[3 * i], ps[3 * i + 1], ps[3 * i + 2], 1_f));
-                    bound_ = Math::Union(bound_, p);
+                    bound = Math::Union(bound, p);
                 }
             }
 
             if (primitive->emitter && primitive->emitter->GetBound.Implemented())
             {
-                bound_ = Math::Union(bound_, primitive->emitter->GetBound());
+                bound = Math::Union(bound, primitive->emitter->GetBound());
+            }
+        }
+        return bound;
+    }
+
+    // Compute the bounds and the power of the light.
+    // Returns false if the light has no finite bound (e.g., environment lights).
+    auto ComputeLightBounds(const Primitive* primitive, LightBounds& b) const -> bool
+    {
+        const auto* light = primitive->light;
+        const auto Le = light->Emittance.Implemented() ? light->Emittance().Luminance() : 1_f;
+        if (primitive->mesh && light->Emittance.Implemented())
+        {
+            // Area light: bound the geometry normals of the triangles.
+            // The light emits according to the shading normals interpolated from the vertex normals,
+            // so the vertex normals are also bounded.
+            const auto* ps = primitive->mesh->Positions();
+            const auto* fs = primitive->mesh->Faces();
+            const auto* vns = primitive->mesh->Normals();
+            std::vector<Vec3> ns(primitive->mesh->NumFaces());
+            Vec3 axis;
+            Float area = 0_f;
+            for (int f = 0; f < primitive->mesh->NumFaces(); f++)
+            {
+                Vec3 p[3];
+                for (int j = 0; j < 3; j++)
+                {
+                    const auto vi = fs[3 * f + j];
+                    p[j] = Vec3(primitive->transform * Vec4(ps[3 * vi], ps[3 * vi + 1], ps[3 * vi + 2], 1_f));
+                    b.bound = Math::Union(b.bound, p[j]);
+                }
+                const auto n = Math::Cross(p[1] - p[0], p[2] - p[0]);
+                const auto l = Math::Length(n);
+                area += l * .5_f;
+                axis += n;
+                ns[f] = l > 0_f ? n / l : Vec3();
+            }
+            if (Math::Length2(axis) > 0_f)
+            {
+                b.axis = Math::Normalize(axis);
+                b.cosThetaO = 1_f;
+                for (const auto& n : ns)
+                {
+                    if (Math::Length2(n) > 0_f) b.cosThetaO = std::min(b.cosThetaO, Math::Dot(b.axis, n));
+                }
+                if (vns)
+                {
+                    for (int v = 0; v < primitive->mesh->NumVertices(); v++)
+                    {
+                        const auto n = primitive->normalTransform * Vec3(vns[3 * v], vns[3 * v + 1], vns[3 * v + 2]);
+                        if (Math::Length2(n) > 0_f) b.cosThetaO = std::min(b.cosThetaO, Math::Dot(b.axis, Math::Normalize(n)));
+                    }
+                }
+            }
+            else
+            {
+                b.axis = Vec3(0_f, 0_f, 1_f);
+                b.cosThetaO = -1_f;
             }
+            b.cosThetaE = 0_f;
+            b.power = Math::Pi() * area * Le;
+            return true;
         }
         
+        if (light->IsDeltaPosition(SurfaceInteractionType::L) && !light->IsDeltaDirection(SurfaceInteractionType::L))
+        {
+            // Point light: emits to all directions from the fixed position
+            SurfaceGeometry geom;
+            light->SamplePositionGivenPreviousPosition(Vec2(), SurfaceGeometry(), geom);
+            b.bound = Math::Union(b.bound, geom.p);
+            b.axis = Vec3(0_f, 0_f, 1_f);
+            b.cosThetaO = -1_f;
+            b.cosThetaE = 0_f;
+            b.power = 4_f * Math::Pi() * Le;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Build the light BVH from the bounds of the lights.
+    // The lights without finite bounds are sampled separately.
+    auto BuildLightBVH() -> void
+    {
+        unboundedLightIndices_.clear();
+        std::vector<LightBounds> lights(lightPrimitiveIndices_.size());
+        for (size_t i = 0; i < lightPrimitiveIndices_.size(); i++)
+        {
+            if (!ComputeLightBounds(primitives_[lightPrimitiveIndices_[i]].get(), lights[i]))
+            {
+                unboundedLightIndices_.push_back(i);
+            }
+        }
+        lightBVH_.Build(lights);
+        LM_LOG_INFO(boost::str(boost::format("Bounded lights: %d, unbounded lights: %d, nodes: %d")
+            % (lightPrimitiveIndices_.size() - unboundedLightIndices_.size()) % unboundedLightIndices_.size() % lightBVH_.Nodes().size()));
+    }
+
+    // Build the distribution of the lights proportional to the power.
+    // The lights without finite bounds are assigned the average power of the other lights
+    // because the power cannot be computed from the emittance and the area.
+    auto BuildLightPowerDist() -> void
+    {
+        lightPowerDist_.Clear();
+        if (lightPrimitiveIndices_.empty())
+        {
+            return;
+        }
+
+        std::vector<Float> powers(lightPrimitiveIndices_.size(), -1_f);
+        Float sum = 0_f;
+        int n = 0;
+        for (size_t i = 0; i < lightPrimitiveIndices_.size(); i++)
+        {
+            LightBounds b;
+            if (ComputeLightBounds(primitives_[lightPrimitiveIndices_[i]].get(), b))
+            {
+                powers[i] = b.power;
+                sum += b.power;
+                n++;
+            }
+        }
+        const auto defaultPower = n > 0 && sum > 0_f ? sum / Float(n) : 1_f;
+        const bool uniform = sum == 0_f && n == (int)(powers.size());
+        for (const auto& power : powers)
+        {
+            // Fall back to the uniform selection if no light has power
+            lightPowerDist_.Add(uniform ? 1_f : power < 0_f ? defaultPower : power);
+        }
+        lightPowerDist_.Normalize();
+        LM_LOG_INFO(boost::str(boost::format("Lights with power: %d, lights with default power: %d") % n % (powers.size() - n)));
+    }
+
+    // Probability to select one of the unbounded lights in the light BVH mode
+    auto UnboundedLightSelectionProb() const -> Float
+    {
+        const int n = (int)(unboundedLightIndices_.size());
+        return n == 0 ? 0_f : Float(n) / Float(n + (lightBVH_.Empty() ? 0 : 1));
+    }
+
+    // Initialize function called after the primitives are loaded.
+    auto Initialize_PostLoadPrimitive(Assets* assets, Accel* accel) -> bool
+    {
+        #pragma region Compute scene bound
+        // AABB
+        bound_ = ComputeBound();
+        
         // Bounding sphere
         sphereBound_.center = (bound_.max + bound_.min) * .5_f;
         sphereBound_.radius = Math::Length(sphereBound_.center - bound_.max) * 1.01_f;  // Grow slightly
@@ -89,6 +375,45 @@ private:
 
         // --------------------------------------------------------------------------------
 
+        #pragma region Spread angle of a pixel
+        // Used to estimate the ray footprints for the texture filtering.
+        // Available only for the sensors with the perspective projection.
+        {
+            pixelSpread_ = 0_f;
+            const auto* sensor = primitives_.at(sensorPrimitiveIndex_)->sensor;
+            if (sensor && sensor->GetProjectionMatrix.Implemented() && sensor->GetFilm() && sensor->GetFilm()->Height() > 0)
+            {
+                const auto P = sensor->GetProjectionMatrix(0.1_f, 1_f);
+                pixelSpread_ = 2_f / (P[1][1] * (Float)(sensor->GetFilm()->Height()));
+            }
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Build light selection
+        {
+            for (size_t i = 0; i < lightPrimitiveIndices_.size(); i++)
+            {
+                primitives_[lightPrimitiveIndices_[i]]->lightIndex = i;
+            }
+            if (lightSelection_ == LightSelection::BVH)
+            {
+                LM_LOG_INFO("Building light BVH");
+                LM_LOG_INDENTER();
+                BuildLightBVH();
+            }
+            else if (lightSelection_ == LightSelection::Power)
+            {
+                LM_LOG_INFO("Building light distribution according to power");
+                LM_LOG_INDENTER();
+                BuildLightPowerDist();
+            }
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
         #pragma region Create emitter shapes
         for (const auto& primitive : primitives_)
         {
@@ -127,6 +452,32 @@ public:
 
     LM_IMPL_F(Initialize) = [this](const PropertyNode* sceneNode, Assets* assets, Accel* accel) -> bool
     {
+        #pragma region Load parameters
+        {
+            const auto lightSelection = sceneNode->ChildAs<std::string>("light_selection", "uniform");
+            if (lightSelection == "uniform")
+            {
+                lightSelection_ = LightSelection::Uniform;
+            }
+            else if (lightSelection == "bvh")
+            {
+                lightSelection_ = LightSelection::BVH;
+            }
+            else if (lightSelection == "power")
+            {
+                lightSelection_ = LightSelection::Power;
+            }
+            else
+            {
+                LM_LOG_ERROR("Invalid light selection: " + lightSelection);
+                PropertyUtils::PrintPrettyError(sceneNode->Child("light_selection"));
+                return false;
+            }
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
         #pragma region Load primitives
         {
             LM_LOG_INFO("Loading primitives");
@@ -161,132 +512,9 @@ public:
                 {
                     LM_LOG_INFO("Parsing transform");
                     LM_LOG_INDENTER();
-
-                    const auto* transformNode = propNode->Child("transform");
-                    if (!transformNode)
-                    {
-                        // Missing `transform` node, identity matrix is assumed
-                        primitive->transform = Mat4::Identity();
-                    }
-                    else
+                    if (!ParseTransform(propNode, parentTransform, primitive->transform, transform))
                     {
-                        // Parse transform from the node
-                        // There are several ways to specify a transformation
-                        const auto ParseTransform = [](const PropertyNode* transformNode, Mat4& transform) -> bool
-                        {
-                            // `matrix` node
-                            const auto* matrixNode = transformNode->Child("matrix");
-                            if (matrixNode)
-                            {
-                                // Parse 4x4 matrix
-                                if (!matrixNode->As<Mat4>(transform))
-                                {
-                                    PropertyUtils::PrintPrettyError(matrixNode);
-                                    return false;
-                                }
-                                return true;
-                            }
-
-                            // `lookat` node
-                            const auto* lookatNode = transformNode->Child("lookat");
-                            if (lookatNode)
-                            {
-                                Vec3 eye;
-                                if (!lookatNode->ChildAs("eye", eye))
-                                {
-                                    PropertyUtils::PrintPrettyError(lookatNode);
-                                    return false;
-                                }
-                                Vec3 center;
-                                if (!lookatNode->ChildAs("center", center))
-                                {
-                                    PropertyUtils::PrintPrettyError(lookatNode);
-                                    return false;
-                                }
-                                Vec3 up;
-                                if (!lookatNode->ChildAs("up", up))
-                                {
-                                    PropertyUtils::PrintPrettyError(lookatNode);
-                                    return false;
-                                }
-
-                                const auto vz = Math::Normalize(eye - center);
-                                const auto vx = Math::Normalize(Math::Cross(up, vz));
-                                const auto vy = Math::Cross(vz, vx);
-
-                                transform = Mat4(
-                                    vx.x, vx.y, vx.z, 0_f,
-                                    vy.x, vy.y, vy.z, 0_f,
-                                    vz.x, vz.y, vz.z, 0_f,
-                                    eye.x, eye.y, eye.z, 1_f);
-
-                                return true;
-                            }
-
-                            // `translate`, `rotate`, or `scale` node
-                            const auto* translateNode = transformNode->Child("translate");
-                            const auto* rotateNode    = transformNode->Child("rotate");
-                            const auto* scaleNode     = transformNode->Child("scale");
-                            if (translateNode || rotateNode || scaleNode)
-                            {
-                                transform = Mat4::Identity();
-
-                                // Parse 'translate' node
-                                if (translateNode)
-                                {
-                                    Vec3 v;
-                                    if (!translateNode->As<Vec3>(v))
-                                    {
-                                        PropertyUtils::PrintPrettyError(translateNode);
-                                        return false;
-                                    }
-                                    transform *= Math::Translate(v);
-                                }
-
-                                // Parse 'rotate' node
-                                if (rotateNode)
-                                {
-                                    Float angle;
-                                    if (!rotateNode->ChildAs("angle", angle))
-                                    {
-                                        PropertyUtils::PrintPrettyError(rotateNode);
-                                        return false;
-                                    }
-                                    Vec3 axis;
-                                    if (!rotateNode->ChildAs("axis", axis))
-                                    {
-                                        PropertyUtils::PrintPrettyError(rotateNode);
-                                        return false;
-                                    }
-                                    transform *= Math::Rotate(Math::Radians(angle), axis);
-                                }
-
-                                // Parse 'scale' node
-                                if (scaleNode)
-                                {
-                                    Vec3 v;
-                                    if (!scaleNode->As<Vec3>(v))
-                                    {
-                                        PropertyUtils::PrintPrettyError(scaleNode);
-                                        return false;
-                                    }
-                                    transform *= Math::Scale(v);
-                                }
-
-                                return true;
-                            }
-
-                            transform = Mat4::Identity();
-                            return true;
-                        };
-                        
-                        if (!ParseTransform(transformNode, transform))
-                        {
-                            return false;
-                        }
-
-                        transform = parentTransform * transform;
-                        primitive->transform = transform;
+                        return false;
                     }
 
                     // Compute normal transform
@@ -397,6 +625,51 @@ public:
                 PropertyUtils::PrintPrettyError(sceneNode);
                 return false;
             }
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Preload assets
+            // Triangle meshes and BSDFs are independent of the primitives,
+            // so they can be loaded in parallel before the traversal.
+            // Lights and sensors are loaded in the traversal as they require the primitive.
+            if (assets->Preload.Implemented())
+            {
+                std::vector<std::string> ids;
+                const std::function<void(const PropertyNode*)> CollectAssetIDs = [&](const PropertyNode* propNode) -> void
+                {
+                    for (const auto* name : { "mesh", "bsdf" })
+                    {
+                        const auto* node = propNode->Child(name);
+                        if (node)
+                        {
+                            ids.push_back(node->RawScalar());
+                        }
+                    }
+                    const auto* childNode = propNode->Child("child");
+                    if (childNode)
+                    {
+                        for (int i = 0; i < childNode->Size(); i++)
+                        {
+                            CollectAssetIDs(childNode->At(i));
+                        }
+                    }
+                };
+                for (int i = 0; i < nodesNode->Size(); i++)
+                {
+                    CollectAssetIDs(nodesNode->At(i));
+                }
+
+                // Assets failed to load are not retried. The errors are reported here only
+                // and the references to them in the traversal get null assets
+                if (!assets->Preload(ids))
+                {
+                    LM_LOG_WARN("Failed to preload some assets");
+                }
+            }
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
             for (int i = 0; i < nodesNode->Size(); i++)
             {
                 if (!Traverse(nodesNode->At(i), Mat4::Identity()))
@@ -473,13 +746,79 @@ public:
                 }
             }
         }
+        else
+        {
+            SetFootprint(ray, isect);
+        }
         
         return hit;
     };
 
     LM_IMPL_F(IntersectWithRange) = [this](const Ray& ray, Intersection& isect, Float minT, Float maxT) -> bool
     {
-        return accel_->Intersect(this, ray, isect, minT, maxT);
+        if (!accel_->Intersect(this, ray, isect, minT, maxT))
+        {
+            return false;
+        }
+        SetFootprint(ray, isect);
+        return true;
+    };
+
+    LM_IMPL_F(Occluded) = [this](const Ray& ray, Float minT, Float maxT) -> bool
+    {
+        if (accel_->Occluded.Implemented())
+        {
+            return accel_->Occluded(this, ray, minT, maxT);
+        }
+        Intersection _;
+        return accel_->Intersect(this, ray, _, minT, maxT);
+    };
+
+    LM_IMPL_F(IntersectStream) = [this](int numRays, const Ray* rays, const Float* minT, const Float* maxT, Intersection* isects, bool* hits) -> void
+    {
+        if (accel_->IntersectStream.Implemented())
+        {
+            accel_->IntersectStream(this, numRays, rays, minT, maxT, isects, hits);
+        }
+        else
+        {
+            for (int i = 0; i < numRays; i++)
+            {
+                hits[i] = accel_->Intersect(this, rays[i], isects[i], minT[i], maxT[i]);
+            }
+        }
+        for (int i = 0; i < numRays; i++)
+        {
+            if (hits[i])
+            {
+                SetFootprint(rays[i], isects[i]);
+                continue;
+            }
+
+            // Intersect the missed rays with emitter shapes, as `Intersect` does
+            Float t = maxT[i];
+            for (size_t j = 0; j < emitterShapes_.size(); j++)
+            {
+                if (emitterShapes_[j]->Intersect(rays[i], minT[i], t, isects[i]))
+                {
+                    t = Math::Length(isects[i].geom.p - rays[i].o);
+                    hits[i] = true;
+                }
+            }
+        }
+    };
+
+    LM_IMPL_F(OccludedStream) = [this](int numRays, const Ray* rays, const Float* minT, const Float* maxT, bool* occluded) -> void
+    {
+        if (accel_->OccludedStream.Implemented())
+        {
+            accel_->OccludedStream(this, numRays, rays, minT, maxT, occluded);
+            return;
+        }
+        for (int i = 0; i < numRays; i++)
+        {
+            occluded[i] = Occluded(rays[i], minT[i], maxT[i]);
+        }
     };
 
     LM_IMPL_F(PrimitiveByID) = [this](const std::string& id) -> const Primitive*
@@ -505,6 +844,11 @@ public:
 
     LM_IMPL_F(SampleEmitter) = [this](int type, Float u) -> const Primitive*
     {
+        if ((type & SurfaceInteractionType::L) > 0 && lightSelection_ == LightSelection::Power)
+        {
+            return primitives_.at(lightPrimitiveIndices_[lightPowerDist_.Sample(u)]).get();
+        }
+
         if ((type & SurfaceInteractionType::L) > 0)
         {
             int n = static_cast<int>(lightPrimitiveIndices_.size());
@@ -523,6 +867,11 @@ public:
 
     LM_IMPL_F(EvaluateEmitterPDF) = [this](const Primitive* primitive) -> PDFVal
     {
+        if ((primitive->emitter->Type() & SurfaceInteractionType::L) > 0 && lightSelection_ == LightSelection::Power)
+        {
+            return PDFVal(PDFMeasure::Discrete, lightPowerDist_.EvaluatePDF((int)(primitive->lightIndex)));
+        }
+
         if ((primitive->emitter->Type() & SurfaceInteractionType::L) > 0)
         {
             const int n = static_cast<int>(lightPrimitiveIndices_.size());
@@ -538,6 +887,67 @@ public:
         return PDFVal(PDFMeasure::Discrete, 0_f);
     };
 
+    LM_IMPL_F(SampleEmitter_Inverse) = [this](const Primitive* primitive, Float u2, Float uSel) -> Float
+    {
+        if ((primitive->emitter->Type() & SurfaceInteractionType::L) > 0 && lightSelection_ == LightSelection::Power)
+        {
+            return lightPowerDist_.Sample_Inverse((int)(primitive->lightIndex), u2, uSel);
+        }
+
+        if ((primitive->emitter->Type() & SurfaceInteractionType::L) > 0)
+        {
+            // SampleEmitter selects uniformly also with the light BVH
+            const int n = static_cast<int>(lightPrimitiveIndices_.size());
+            return Math::Clamp((Float(primitive->lightIndex) + u2) / Float(n), 0_f, 1_f);
+        }
+
+        if ((primitive->emitter->Type() & SurfaceInteractionType::E) > 0)
+        {
+            return u2;
+        }
+
+        LM_UNREACHABLE();
+        return 0_f;
+    };
+
+    LM_IMPL_F(SampleEmitterGivenPosition) = [this](int type, const SurfaceGeometry& geom, Float u) -> const Primitive*
+    {
+        if ((type & SurfaceInteractionType::L) > 0 && lightSelection_ == LightSelection::BVH)
+        {
+            // Select one of the unbounded lights uniformly
+            const auto pU = UnboundedLightSelectionProb();
+            if (u < pU)
+            {
+                const int n = (int)(unboundedLightIndices_.size());
+                const int i = Math::Clamp((int)(u / pU * n), 0, n - 1);
+                return primitives_.at(lightPrimitiveIndices_[unboundedLightIndices_[i]]).get();
+            }
+
+            // Select a light with the light BVH
+            u = std::min((u - pU) / (1_f - pU), 1_f - Math::Eps());
+            Float pdf;
+            const int i = lightBVH_.Sample(geom.p, geom.degenerated ? Vec3() : geom.sn, u, pdf);
+            return i < 0 ? nullptr : primitives_.at(lightPrimitiveIndices_[i]).get();
+        }
+
+        return SampleEmitter(type, u);
+    };
+
+    LM_IMPL_F(EvaluateEmitterGivenPositionPDF) = [this](const Primitive* primitive, const SurfaceGeometry& geom) -> PDFVal
+    {
+        if ((primitive->emitter->Type() & SurfaceInteractionType::L) > 0 && lightSelection_ == LightSelection::BVH)
+        {
+            const auto pU = UnboundedLightSelectionProb();
+            if (std::find(unboundedLightIndices_.begin(), unboundedLightIndices_.end(), primitive->lightIndex) != unboundedLightIndices_.end())
+            {
+                return PDFVal(PDFMeasure::Discrete, pU / Float(unboundedLightIndices_.size()));
+            }
+            return PDFVal(PDFMeasure::Discrete, (1_f - pU) * lightBVH_.EvaluatePDF((int)(primitive->lightIndex), geom.p, geom.degenerated ? Vec3() : geom.sn));
+        }
+
+        return EvaluateEmitterPDF(primitive);
+    };
+
     LM_IMPL_F(GetBound) = [this]() -> Bound
     {
         return bound_;
@@ -570,7 +980,7 @@ public:
         // Serialize into binary
         {
             cereal::PortableBinaryOutputArchive oa(stream);
-            oa(serializablePrimitives, primitiveIDMap_, sensorPrimitiveIndex_, lightPrimitiveIndices_);
+            oa(serializablePrimitives, primitiveIDMap_, sensorPrimitiveIndex_, lightPrimitiveIndices_, (int)(lightSelection_));
         }
 
         return true;
@@ -580,10 +990,12 @@ public:
     {
         // Deserialize
         std::vector<SerializablePrimitive> serializablePrimitives;
+        int lightSelection;
         {
             cereal::PortableBinaryInputArchive ia(stream);
-            ia(serializablePrimitives, primitiveIDMap_, sensorPrimitiveIndex_, lightPrimitiveIndices_);
+            ia(serializablePrimitives, primitiveIDMap_, sensorPrimitiveIndex_, lightPrimitiveIndices_, lightSelection);
         }
+        lightSelection_ = (LightSelection)(lightSelection);
         
         // Recover primitives
         auto* assets = static_cast<Assets*>(userdata.at("assets"));
@@ -627,18 +1039,197 @@ public:
         return (int)(lightPrimitiveIndices_.size());
     };
 
+    LM_IMPL_F(UpdateTransforms) = [this](const PropertyNode* sceneNode) -> bool
+    {
+        LM_LOG_INFO("Updating primitive transforms");
+        LM_LOG_INDENTER();
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Traverse scene nodes and update transforms
+        // Primitives are created in the traversal order in Initialize,
+        // so that the same traversal visits the primitives in the same order.
+        size_t index = 0;
+        int numUpdated = 0;
+        const std::function<bool(const PropertyNode*, const Mat4&)> Traverse = [&](const PropertyNode* propNode, const Mat4& parentTransform) -> bool
+        {
+            #pragma region Check topology
+            if (index >= primitives_.size())
+            {
+                LM_LOG_ERROR("Number of primitives is changed from the initial frame");
+                PropertyUtils::PrintPrettyError(propNode);
+                return false;
+            }
+            auto* primitive = primitives_[index++].get();
+            const auto* idNode = propNode->Child("id");
+            const std::string id = idNode ? idNode->RawScalar() : "";
+            if (id != primitive->id)
+            {
+                LM_LOG_ERROR("Primitive ID is changed from the initial frame: '" + primitive->id + "' -> '" + id + "'");
+                PropertyUtils::PrintPrettyError(propNode);
+                return false;
+            }
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Update transform
+            Mat4 transform;
+            Mat4 childTransform;
+            if (!ParseTransform(propNode, parentTransform, transform, childTransform))
+            {
+                return false;
+            }
+            bool changed = false;
+            for (int i = 0; i < 4; i++)
+            {
+                if (!(transform[i] == primitive->transform[i]))
+                {
+                    changed = true;
+                    break;
+                }
+            }
+            if (changed)
+            {
+                // Emitters cache the transform when they are loaded
+                if (primitive->emitter)
+                {
+                    LM_LOG_ERROR("Transform of the emitter primitive '" + primitive->id + "' cannot be changed");
+                    PropertyUtils::PrintPrettyError(propNode);
+                    return false;
+                }
+                primitive->transform = transform;
+                primitive->normalTransform = Mat3(Math::Transpose(Math::Inverse(transform)));
+                numUpdated++;
+            }
+            #pragma endregion
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Traverse child nodes
+            const auto* childNode = propNode->Child("child");
+            if (childNode)
+            {
+                for (int i = 0; i < childNode->Size(); i++)
+                {
+                    if (!Traverse(childNode->At(i), childTransform))
+                    {
+                        return false;
+                    }
+                }
+            }
+            #pragma endregion
+
+            return true;
+        };
+
+        const auto* nodesNode = sceneNode->Child("nodes");
+        if (!nodesNode)
+        {
+            LM_LOG_ERROR("Missing 'nodes' node");
+            PropertyUtils::PrintPrettyError(sceneNode);
+            return false;
+        }
+        for (int i = 0; i < nodesNode->Size(); i++)
+        {
+            if (!Traverse(nodesNode->At(i), Mat4::Identity()))
+            {
+                return false;
+            }
+        }
+        if (index != primitives_.size())
+        {
+            LM_LOG_ERROR("Number of primitives is changed from the initial frame");
+            PropertyUtils::PrintPrettyError(nodesNode);
+            return false;
+        }
+        LM_LOG_INFO("Updated primitives: " + std::to_string(numUpdated));
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        if (numUpdated == 0)
+        {
+            return true;
+        }
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Update scene bound
+        {
+            // The bound only grows because some emitters (e.g., environment lights)
+            // capture the bounding sphere of the scene when they are loaded.
+            const auto bound = Math::Union(bound_, ComputeBound());
+            if (!(bound.min == bound_.min) || !(bound.max == bound_.max))
+            {
+                LM_LOG_WARN("Scene bound is enlarged. Emitters depending on the scene bound use the bound of the initial frame.");
+                bound_ = bound;
+            }
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Refit accel
+        {
+            const auto start = std::chrono::high_resolution_clock::now();
+            if (accel_->Refit.Implemented())
+            {
+                LM_LOG_INFO("Refitting acceleration structure");
+                LM_LOG_INDENTER();
+                if (!accel_->Refit(this))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                LM_LOG_INFO("Rebuilding acceleration structure (refit is not supported)");
+                LM_LOG_INDENTER();
+                if (!accel_->Build(this))
+                {
+                    return false;
+                }
+            }
+            const auto end = std::chrono::high_resolution_clock::now();
+            const double elapsed = (double)(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()) / 1000.0;
+            LM_LOG_INFO(boost::str(boost::format("Elapsed time: %.3fs") % elapsed));
+        }
+        #pragma endregion
+
+        return true;
+    };
+
+private:
+
+    /*
+        Estimates the footprint of the ray on the surface with the ray cone
+        whose spread angle is the one of a pixel [Akenine-Moller et al. 2019].
+        The spread of the cone by the reflections is not considered,
+        so the footprints of the secondary rays are underestimated.
+    */
+    auto SetFootprint(const Ray& ray, Intersection& isect) const -> void
+    {
+        isect.geom.footprint = pixelSpread_ * Math::Length(isect.geom.p - ray.o);
+    }
+
 private:
 
     std::vector<std::unique_ptr<Primitive>> primitives_;                // Primitives
     std::unordered_map<std::string, size_t> primitiveIDMap_;            // Mapping from ID to primitive index
     size_t sensorPrimitiveIndex_;                                       // Sensor primitive index
     std::vector<size_t> lightPrimitiveIndices_;                         // Pointers to light primitives
+    LightSelection lightSelection_ = LightSelection::Uniform;           // Strategy of the light selection
+    LightBVH lightBVH_;                                                 // Light BVH for bounded lights
+    std::vector<size_t> unboundedLightIndices_;                         // Indices of the lights excluded from the light BVH
+    AliasTable lightPowerDist_;                                         // Distribution of the lights proportional to the power
 
     const Assets* assets_;                                              // Asset manager
     const Accel3* accel_;                                               // Acceleration structure
     Bound bound_;                                                       // Scene bound (AABB)
     SphereBound sphereBound_;                                           // Scene bound (sphere)
     std::vector<const EmitterShape*> emitterShapes_;                    // Special shapes for emitters
+    Float pixelSpread_ = 0_f;                                           // Spread angle of a pixel of the sensor
 
     // Predefined assets
     BSDF::UniquePtr nullBSDF_ = ComponentFactory::Create<BSDF>("bsdf::null");
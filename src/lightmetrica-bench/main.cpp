@@ -0,0 +1,947 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <lightmetrica/logger.h>
+#include <lightmetrica/exception.h>
+#include <lightmetrica/scene3.h>
+#include <lightmetrica/accel3.h>
+#include <lightmetrica/trianglemesh.h>
+#include <lightmetrica/primitive.h>
+#include <lightmetrica/intersection.h>
+#include <lightmetrica/ray.h>
+#include <lightmetrica/random.h>
+#include <lightmetrica/sampler.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/dist.h>
+#include <lightmetrica/detail/parallel.h>
+#include <lightmetrica/detail/photonmap.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <atomic>
+
+#include <boost/program_options.hpp>
+#include <boost/format.hpp>
+#include <boost/optional.hpp>
+#include <boost/filesystem.hpp>
+#include <tbb/tbb.h>
+
+#if LM_PLATFORM_WINDOWS
+#include <windows.h>
+#include <psapi.h>
+#elif LM_PLATFORM_LINUX
+#include <unistd.h>
+#include <malloc.h>
+#elif LM_PLATFORM_APPLE
+#include <mach-o/dyld.h>
+#include <mach/mach.h>
+#endif
+
+using namespace lightmetrica_v2;
+
+// --------------------------------------------------------------------------------
+
+#pragma region Helper functions
+
+namespace
+{
+    auto ExecutablePath() -> boost::optional<boost::filesystem::path>
+    {
+        #if LM_PLATFORM_WINDOWS
+        char buf[MAX_PATH];
+        if (!GetModuleFileNameA(nullptr, buf, sizeof(buf)))
+        {
+            return boost::none;
+        }
+        return boost::filesystem::path(buf);
+        #elif LM_PLATFORM_LINUX
+        char buf[1024];
+        ssize_t size = readlink("/proc/self/exe", buf, sizeof(buf));
+        if (size <= 0)
+        {
+            return boost::none;
+        }
+        return boost::filesystem::path(boost::filesystem::canonical(std::string(buf, size)));
+        #elif LM_PLATFORM_APPLE
+        char buf[1024];
+        uint32_t size = sizeof(buf);
+        if (_NSGetExecutablePath(buf, &size) != 0)
+        {
+            return boost::none;
+        }
+        return boost::filesystem::path(boost::filesystem::canonical(buf));
+        #endif
+    }
+
+    auto ElapsedSeconds(const std::chrono::high_resolution_clock::time_point& start) -> double
+    {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    /*!
+        Memory usage of the process in bytes.
+        Private bytes on Windows and the resident set size otherwise.
+        On Linux the free heap memory is returned to the system beforehand
+        so that the difference between two calls reflects the live allocations.
+    */
+    auto MemoryUsage() -> long long
+    {
+        #if LM_PLATFORM_WINDOWS
+        PROCESS_MEMORY_COUNTERS_EX pmc;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&pmc), sizeof(pmc)))
+        {
+            return 0;
+        }
+        return (long long)(pmc.PrivateUsage);
+        #elif LM_PLATFORM_LINUX
+        malloc_trim(0);
+        long long size, resident;
+        std::ifstream statm("/proc/self/statm");
+        if (!(statm >> size >> resident))
+        {
+            return 0;
+        }
+        return resident * sysconf(_SC_PAGESIZE);
+        #elif LM_PLATFORM_APPLE
+        mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+        {
+            return 0;
+        }
+        return (long long)(info.resident_size);
+        #endif
+    }
+}
+
+#pragma endregion
+
+// --------------------------------------------------------------------------------
+
+#pragma region Procedural scene
+
+/*!
+    Triangle mesh procedurally generated for the benchmark.
+    A ground plane and randomly placed spheres in [0, 1]^3,
+    where the number of spheres is determined by the requested number of triangles.
+*/
+class TriangleMesh_Bench final : public TriangleMesh
+{
+public:
+
+    LM_IMPL_CLASS(TriangleMesh_Bench, TriangleMesh);
+
+public:
+
+    LM_IMPL_F(NumVertices) = [this]() -> int { return (int)(ps_.size()) / 3; };
+    LM_IMPL_F(NumFaces)    = [this]() -> int { return (int)(fs_.size()) / 3; };
+    LM_IMPL_F(Positions)   = [this]() -> const GeomFloat* { return ps_.data(); };
+    LM_IMPL_F(Normals)     = [this]() -> const GeomFloat* { return ns_.data(); };
+    LM_IMPL_F(Texcoords)   = [this]() -> const GeomFloat* { return nullptr; };
+    LM_IMPL_F(Faces)       = [this]() -> const unsigned int* { return fs_.data(); };
+
+public:
+
+    auto Generate(int numTriangles, unsigned int seed) -> void
+    {
+        Random rng;
+        rng.SetSeed(seed);
+
+        // Ground plane
+        AddVertex(Vec3(-1_f, 0_f, -1_f), Vec3(0_f, 1_f, 0_f));
+        AddVertex(Vec3( 2_f, 0_f, -1_f), Vec3(0_f, 1_f, 0_f));
+        AddVertex(Vec3( 2_f, 0_f,  2_f), Vec3(0_f, 1_f, 0_f));
+        AddVertex(Vec3(-1_f, 0_f,  2_f), Vec3(0_f, 1_f, 0_f));
+        AddFace(0, 2, 1);
+        AddFace(0, 3, 2);
+
+        // Spheres
+        const int Slices = 16;
+        const int Stacks = 8;
+        const int numSpheres = std::max(1, (numTriangles - 2) / (2 * Slices * Stacks));
+        const Float baseRadius = 0.5_f / std::cbrt((Float)(numSpheres));
+        for (int i = 0; i < numSpheres; i++)
+        {
+            const Vec3 center(rng.Next(), rng.Next(), rng.Next());
+            const Float radius = baseRadius * (0.3_f + 0.7_f * rng.Next());
+            const auto offset = (unsigned int)(ps_.size() / 3);
+            for (int j = 0; j <= Stacks; j++)
+            {
+                const Float theta = Math::Pi() * (Float)(j) / Stacks;
+                for (int k = 0; k <= Slices; k++)
+                {
+                    const Float phi = 2_f * Math::Pi() * (Float)(k) / Slices;
+                    const Vec3 n(Math::Sin(theta) * Math::Cos(phi), Math::Cos(theta), Math::Sin(theta) * Math::Sin(phi));
+                    AddVertex(center + n * radius, n);
+                }
+            }
+            for (int j = 0; j < Stacks; j++)
+            {
+                for (int k = 0; k < Slices; k++)
+                {
+                    const unsigned int v1 = offset + j * (Slices + 1) + k;
+                    const unsigned int v2 = v1 + Slices + 1;
+                    AddFace(v1, v2, v1 + 1);
+                    AddFace(v1 + 1, v2, v2 + 1);
+                }
+            }
+        }
+
+        // Padding after the last position (see TriangleMesh::Positions)
+        ps_.push_back(0);
+    }
+
+private:
+
+    auto AddVertex(const Vec3& p, const Vec3& n) -> void
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            ps_.push_back((GeomFloat)(p[i]));
+            ns_.push_back((GeomFloat)(n[i]));
+        }
+    }
+
+    auto AddFace(unsigned int i1, unsigned int i2, unsigned int i3) -> void
+    {
+        fs_.push_back(i1);
+        fs_.push_back(i2);
+        fs_.push_back(i3);
+    }
+
+private:
+
+    std::vector<GeomFloat> ps_;
+    std::vector<GeomFloat> ns_;
+    std::vector<unsigned int> fs_;
+
+};
+
+//! Scene with a single primitive of the benchmark mesh.
+class Scene3_Bench final : public Scene3
+{
+public:
+
+    LM_IMPL_CLASS(Scene3_Bench, Scene3);
+
+public:
+
+    LM_IMPL_F(NumPrimitives) = [this]() -> int { return 1; };
+    LM_IMPL_F(PrimitiveAt) = [this](int index) -> const Primitive* { return &primitive_; };
+
+public:
+
+    Scene3_Bench(const TriangleMesh* mesh)
+    {
+        primitive_.id = "bench";
+        primitive_.transform = Mat4::Identity();
+        primitive_.normalTransform = Mat3(primitive_.transform);
+        primitive_.mesh = mesh;
+    }
+
+private:
+
+    Primitive primitive_;
+
+};
+
+#pragma endregion
+
+// --------------------------------------------------------------------------------
+
+#pragma region Ray distributions
+
+//! Set of rays for a benchmark.
+struct RaySet
+{
+    std::vector<Ray> rays;
+    std::vector<Float> maxTs;
+};
+
+/*!
+    Ray distributions.
+      - primary : Coherent rays from a pinhole camera toward the scene.
+      - diffuse : Incoherent rays from the hit points of the primary rays
+                  with cosine-weighted directions.
+      - shadow  : Occlusion rays from the hit points of the primary rays
+                  toward an area light above the scene.
+*/
+struct RayDistributions
+{
+    RaySet primary;
+    RaySet diffuse;
+    RaySet shadow;
+
+    auto Generate(const Scene3* scene, const Accel3* accel, int numRays, unsigned int seed) -> void
+    {
+        Random rng;
+        rng.SetSeed(seed);
+
+        #pragma region Primary rays
+
+        // Jittered pixels of a square image in scanline order
+        const Vec3 eye(0.5_f, 0.6_f, 3_f);
+        const Float tanHalfFov = Math::Tan(Math::Radians(22.5_f));
+        const int resolution = Math::Max(1, (int)(std::ceil(std::sqrt((double)(numRays)))));
+        for (int i = 0; i < numRays; i++)
+        {
+            const Vec2 pixel((Float)(i % resolution) + rng.Next(), (Float)(i / resolution) + rng.Next());
+            const auto u = pixel * (2_f / resolution) - Vec2(1_f);
+            Ray ray;
+            ray.o = eye;
+            ray.d = Math::Normalize(Vec3(u.x * tanHalfFov, u.y * tanHalfFov, -1_f));
+            primary.rays.push_back(ray);
+            primary.maxTs.push_back(Math::Inf());
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Secondary rays from the hit points
+
+        for (const auto& ray : primary.rays)
+        {
+            Intersection isect;
+            if (!accel->Intersect(scene, ray, isect, Math::EpsIsect(), Math::Inf()))
+            {
+                continue;
+            }
+
+            // Shading frame facing toward the incident direction
+            const auto n = Math::Dot(isect.geom.gn, ray.d) < 0_f ? isect.geom.gn : -isect.geom.gn;
+            Vec3 t, b;
+            Math::OrthonormalBasis(n, t, b);
+
+            // Diffuse bounce
+            {
+                const auto d = Sampler::CosineSampleHemisphere(rng.Next2D());
+                Ray diffuseRay;
+                diffuseRay.o = isect.geom.p;
+                diffuseRay.d = Math::Normalize(t * d.x + b * d.y + n * d.z);
+                diffuse.rays.push_back(diffuseRay);
+                diffuse.maxTs.push_back(Math::Inf());
+            }
+
+            // Shadow ray toward the light in [0, 1]^2 at y = 2
+            {
+                const auto u = rng.Next2D();
+                const Vec3 lp(u.x, 2_f, u.y);
+                const auto d = lp - isect.geom.p;
+                const auto dist = Math::Length(d);
+                Ray shadowRay;
+                shadowRay.o = isect.geom.p;
+                shadowRay.d = d / dist;
+                shadow.rays.push_back(shadowRay);
+                shadow.maxTs.push_back(dist * (1_f - Math::EpsIsect()));
+            }
+        }
+
+        #pragma endregion
+    }
+};
+
+#pragma endregion
+
+// --------------------------------------------------------------------------------
+
+#pragma region Benchmark
+
+//! Result of a benchmark for an accel and a scene.
+struct BenchResult
+{
+    std::string accel;
+    int numTriangles;
+    double buildTime;               // in seconds
+    double memory;                  // Memory usage of the built accel, in MB
+    double primaryMrays;
+    double diffuseMrays;
+    double shadowMrays;
+    bool occluded;                  // True if the shadow rays are processed by the occlusion query
+    double primaryHitRatio;         // For validation
+};
+
+//! Result of a benchmark for an OBJ file and a parser.
+struct ImportResult
+{
+    std::string file;
+    std::string parser;
+    double fileSize;                // in MB
+    int numVertices;
+    int numFaces;
+    double loadTime;                // in seconds
+};
+
+//! Result of a benchmark for a discrete distribution.
+struct DistResult
+{
+    std::string type;
+    int size;
+    double buildTime;               // in seconds
+    double msamples;                // Million samples per second
+};
+
+//! Result of a benchmark for a photon map.
+struct PhotonMapResult
+{
+    std::string type;
+    int size;
+    double buildTime;               // Average over passes, in seconds
+    double mqueries;                // Million queries per second
+    double avgCollected;            // Average number of collected photons per query
+};
+
+class Bench
+{
+public:
+
+    auto Run(int argc, char** argv) -> bool
+    {
+        #pragma region Parse arguments
+
+        namespace po = boost::program_options;
+        po::options_description opt("Options");
+        opt.add_options()
+            ("help", "Display help message (this message)")
+            ("accel,a", po::value<std::vector<std::string>>()->multitoken(), "Accels to be benchmarked (default: all registered accels including plugins, except accel::naive, which must be specified explicitly)")
+            ("num-triangles,n", po::value<std::vector<int>>()->multitoken()->default_value(std::vector<int>{ 1000, 10000, 100000, 1000000 }, "1000 10000 100000 1000000"), "Number of triangles of the generated scenes")
+            ("num-rays,r", po::value<int>()->default_value(1 << 20), "Number of rays for each ray distribution (or number of samples for the distribution benchmark)")
+            ("num-threads,j", po::value<int>(), "Number of threads")
+            ("seed", po::value<int>()->default_value(42), "Seed for the scene and ray generation")
+            ("obj", po::value<std::vector<std::string>>()->multitoken(), "OBJ files for the import benchmark. If specified, the import benchmark is executed instead of the accel benchmark")
+            ("obj-parser", po::value<std::vector<std::string>>()->multitoken()->default_value(std::vector<std::string>{ "parallel", "tinyobj" }, "parallel tinyobj"), "OBJ parsers to be benchmarked")
+            ("dist", po::value<std::vector<int>>()->multitoken(), "Sizes of the discrete distributions for the sampling benchmark (Distribution1D vs. AliasTable). If specified, the sampling benchmark is executed instead of the accel benchmark")
+            ("photonmap", po::value<std::vector<int>>()->multitoken(), "Numbers of photons for the photon map benchmark (per-pass rebuild and query). If specified, the photon map benchmark is executed instead of the accel benchmark")
+            ("photonmap-type", po::value<std::vector<std::string>>()->multitoken()->default_value(std::vector<std::string>{ "kdtree", "flatkdtree", "hashgrid", "hashgrid_compact" }, "kdtree flatkdtree hashgrid hashgrid_compact"), "Photon maps to be benchmarked")
+            ("photonmap-radius", po::value<double>()->default_value(0.01), "Gather radius for the photon map benchmark (photons are distributed in the unit cube)")
+            ("photonmap-passes", po::value<int>()->default_value(8), "Number of rebuilds for the photon map benchmark")
+            ("output,o", po::value<std::string>()->default_value("-"), "Output CSV file ('-' : standard output)")
+            ("verbose,v", po::bool_switch()->default_value(false), "Adds detailed information on the output");
+
+        po::variables_map vm;
+        try
+        {
+            po::store(po::parse_command_line(argc, argv, opt), vm);
+            if (vm.count("help"))
+            {
+                std::cout << "Usage: lightmetrica-bench [options]" << std::endl << opt << std::endl;
+                return true;
+            }
+            po::notify(vm);
+        }
+        catch (po::error& e)
+        {
+            LM_LOG_ERROR_SIMPLE("Error on program options : " + std::string(e.what()));
+            return false;
+        }
+
+        Logger::SetVerboseLevel(vm["verbose"].as<bool>() ? 2 : 0);
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Run benchmarks with the given number of threads
+
+        // The benchmarks use TBB directly, so the number of threads is limited by the arena
+        int numThreads = tbb::task_arena::automatic;
+        if (vm.count("num-threads"))
+        {
+            Parallel::SetNumThreads(vm["num-threads"].as<int>());
+            numThreads = Parallel::GetNumThreads();
+        }
+        tbb::task_arena arena(numThreads);
+        bool result = false;
+        arena.execute([&]() -> void { result = RunBenchmarks(vm); });
+        return result;
+
+        #pragma endregion
+    }
+
+private:
+
+    auto RunBenchmarks(const boost::program_options::variables_map& vm) -> bool
+    {
+        const auto numTriangles = vm["num-triangles"].as<std::vector<int>>();
+        const int numRays = vm["num-rays"].as<int>();
+        const auto seed = (unsigned int)(vm["seed"].as<int>());
+        const auto outputPath = vm["output"].as<std::string>();
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Load plugins
+
+        {
+            const auto executablePath = ExecutablePath();
+            if (!executablePath)
+            {
+                LM_LOG_ERROR("Failed to get executable path");
+                return false;
+            }
+
+            LM_LOG_INFO("Loading plugins");
+            LM_LOG_INDENTER();
+            ComponentFactory::LoadPlugins((executablePath->parent_path() / "plugin").string());
+        }
+
+        #pragma endregion
+
+        // The default accels are enumerated after the plugins are loaded
+        const auto accels = vm.count("accel") ? vm["accel"].as<std::vector<std::string>>() : DefaultAccels();
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Run import benchmarks
+
+        if (vm.count("obj"))
+        {
+            std::vector<ImportResult> results;
+            for (const auto& file : vm["obj"].as<std::vector<std::string>>())
+            {
+                for (const auto& parser : vm["obj-parser"].as<std::vector<std::string>>())
+                {
+                    LM_LOG_INFO("Importing '" + file + "' with '" + parser + "'");
+                    LM_LOG_INDENTER();
+
+                    ImportResult result;
+                    if (!RunImport(file, parser, result))
+                    {
+                        LM_LOG_WARN("Skipped '" + parser + "'");
+                        continue;
+                    }
+                    results.push_back(result);
+                }
+            }
+
+            return Output(outputPath, [&](std::ostream& os) { WriteImportCSV(os, results); });
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Run distribution benchmarks
+
+        if (vm.count("dist"))
+        {
+            std::vector<DistResult> results;
+            for (const int n : vm["dist"].as<std::vector<int>>())
+            {
+                LM_LOG_INFO(boost::str(boost::format("Sampling distributions (%d entries)") % n));
+                LM_LOG_INDENTER();
+
+                // Random weights shared among the distributions
+                Random rng;
+                rng.SetSeed(seed);
+                std::vector<Float> weights(n);
+                for (auto& w : weights) { w = rng.Next(); }
+
+                results.push_back(RunDist<Distribution1D>("cdf", weights, numRays, seed));
+                results.push_back(RunDist<AliasTable>("alias", weights, numRays, seed));
+            }
+
+            return Output(outputPath, [&](std::ostream& os) { WriteDistCSV(os, results); });
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Run photon map benchmarks
+
+        if (vm.count("photonmap"))
+        {
+            const auto radius = (Float)(vm["photonmap-radius"].as<double>());
+            const int numPasses = vm["photonmap-passes"].as<int>();
+            std::vector<PhotonMapResult> results;
+            for (const int n : vm["photonmap"].as<std::vector<int>>())
+            {
+                LM_LOG_INFO(boost::str(boost::format("Photon maps (%d photons)") % n));
+                LM_LOG_INDENTER();
+                for (const auto& type : vm["photonmap-type"].as<std::vector<std::string>>())
+                {
+                    PhotonMapResult result;
+                    if (!RunPhotonMap(type, n, numRays, numPasses, radius, seed, result))
+                    {
+                        LM_LOG_WARN("Skipped '" + type + "'");
+                        continue;
+                    }
+                    results.push_back(result);
+                }
+            }
+
+            return Output(outputPath, [&](std::ostream& os) { WritePhotonMapCSV(os, results); });
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Run benchmarks
+
+        std::vector<BenchResult> results;
+        for (const int n : numTriangles)
+        {
+            LM_LOG_INFO(boost::str(boost::format("Generating scene (%d triangles)") % n));
+            LM_LOG_INDENTER();
+
+            TriangleMesh_Bench mesh;
+            mesh.Generate(n, seed);
+            Scene3_Bench scene(&mesh);
+
+            // Rays are generated with the reference accel and shared among the accels
+            RayDistributions dists;
+            {
+                const auto refAccel = ComponentFactory::Create<Accel3>("accel::bvh_sahbin");
+                if (!refAccel || !refAccel->Initialize(nullptr) || !refAccel->Build(&scene))
+                {
+                    LM_LOG_ERROR("Failed to build the reference accel");
+                    return false;
+                }
+                dists.Generate(&scene, refAccel.get(), numRays, seed);
+            }
+
+            for (const auto& accelType : accels)
+            {
+                LM_LOG_INFO("Benchmarking '" + accelType + "'");
+                LM_LOG_INDENTER();
+
+                BenchResult result;
+                if (!RunAccel(accelType, &scene, dists, result))
+                {
+                    LM_LOG_WARN("Skipped '" + accelType + "'");
+                    continue;
+                }
+                result.numTriangles = mesh.NumFaces();
+                results.push_back(result);
+            }
+        }
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Output results
+
+        return Output(outputPath, [&](std::ostream& os) { WriteCSV(os, results); });
+
+        #pragma endregion
+    }
+
+    static auto DefaultAccels() -> std::vector<std::string>
+    {
+        auto accels = ComponentFactory::Keys("accel::");
+        accels.erase(std::remove(accels.begin(), accels.end(), "accel::naive"), accels.end());
+        return accels;
+    }
+
+    static auto RunAccel(const std::string& accelType, const Scene3* scene, const RayDistributions& dists, BenchResult& result) -> bool
+    {
+        result.accel = accelType;
+
+        #pragma region Build
+
+        const auto memoryBefore = MemoryUsage();
+        const auto accel = ComponentFactory::Create<Accel3>(accelType);
+        if (!accel || !accel->Initialize(nullptr))
+        {
+            return false;
+        }
+        {
+            const auto start = std::chrono::high_resolution_clock::now();
+            if (!accel->Build(scene))
+            {
+                return false;
+            }
+            result.buildTime = ElapsedSeconds(start);
+        }
+        result.memory = (double)(std::max(0LL, MemoryUsage() - memoryBefore)) / (1 << 20);
+        LM_LOG_INFO(boost::str(boost::format("Build: %.3f s, Memory: %.2f MB") % result.buildTime % result.memory));
+
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Trace rays
+
+        const auto Trace = [&](const RaySet& raySet, bool occlusion, long long& hits) -> double
+        {
+            std::atomic<long long> numHits(0);
+            const auto start = std::chrono::high_resolution_clock::now();
+            tbb::parallel_for(tbb::blocked_range<size_t>(0, raySet.rays.size(), 1024), [&](const tbb::blocked_range<size_t>& range) -> void
+            {
+                long long localHits = 0;
+                Intersection isect;
+                for (size_t i = range.begin(); i != range.end(); i++)
+                {
+                    const bool hit = occlusion
+                        ? accel->Occluded(scene, raySet.rays[i], Math::EpsIsect(), raySet.maxTs[i])
+                        : accel->Intersect(scene, raySet.rays[i], isect, Math::EpsIsect(), raySet.maxTs[i]);
+                    if (hit) localHits++;
+                }
+                numHits += localHits;
+            });
+            const double elapsed = ElapsedSeconds(start);
+            hits = numHits;
+            return elapsed > 0 ? (double)(raySet.rays.size()) / elapsed * 1e-6 : 0.0;
+        };
+
+        long long primaryHits, diffuseHits, shadowHits;
+        result.occluded = accel->Occluded.Implemented();
+        result.primaryMrays = Trace(dists.primary, false, primaryHits);
+        result.diffuseMrays = Trace(dists.diffuse, false, diffuseHits);
+        result.shadowMrays  = Trace(dists.shadow, result.occluded, shadowHits);
+        result.primaryHitRatio = dists.primary.rays.empty() ? 0.0 : (double)(primaryHits) / dists.primary.rays.size();
+        LM_LOG_INFO(boost::str(boost::format("Primary: %.3f Mrays/s, Diffuse: %.3f Mrays/s, Shadow: %.3f Mrays/s")
+            % result.primaryMrays % result.diffuseMrays % result.shadowMrays));
+
+        #pragma endregion
+
+        return true;
+    }
+
+    static auto RunImport(const std::string& file, const std::string& parser, ImportResult& result) -> bool
+    {
+        result.file = file;
+        result.parser = parser;
+        result.fileSize = (double)(boost::filesystem::file_size(file)) / (1 << 20);
+
+        const auto path = boost::filesystem::path(file);
+        const auto params = ComponentFactory::Create<PropertyTree>();
+        const auto input = boost::str(boost::format("path: '%s'\nparser: %s") % path.filename().string() % parser);
+        if (!params->LoadFromStringWithFilename(input, "", path.parent_path().string()))
+        {
+            return false;
+        }
+
+        const auto mesh = ComponentFactory::Create<TriangleMesh>("trianglemesh::obj");
+        const auto start = std::chrono::high_resolution_clock::now();
+        if (!mesh || !mesh->Load(params->Root(), nullptr, nullptr))
+        {
+            return false;
+        }
+        result.loadTime = ElapsedSeconds(start);
+        result.numVertices = mesh->NumVertices();
+        result.numFaces = mesh->NumFaces();
+        LM_LOG_INFO(boost::str(boost::format("Load: %.3f s, %.1f MB/s") % result.loadTime % (result.loadTime > 0 ? result.fileSize / result.loadTime : 0.0)));
+
+        return true;
+    }
+
+    template <typename DistT>
+    static auto RunDist(const std::string& type, const std::vector<Float>& weights, int numSamples, unsigned int seed) -> DistResult
+    {
+        DistResult result;
+        result.type = type;
+        result.size = (int)(weights.size());
+
+        // Build
+        DistT dist;
+        {
+            const auto start = std::chrono::high_resolution_clock::now();
+            for (const auto& w : weights) { dist.Add(w); }
+            dist.Normalize();
+            result.buildTime = ElapsedSeconds(start);
+        }
+
+        // Sample with SampleReuse as in the triangle sampling
+        // Random numbers are generated in advance to measure only the sampling
+        Random rng;
+        rng.SetSeed(seed);
+        std::vector<Float> us(numSamples);
+        for (auto& u : us) { u = rng.Next(); }
+        long long checksum = 0;
+        const auto start = std::chrono::high_resolution_clock::now();
+        for (const auto& u : us)
+        {
+            Float u2;
+            checksum += dist.SampleReuse(u, u2);
+        }
+        const double elapsed = ElapsedSeconds(start);
+        result.msamples = elapsed > 0 ? (double)(numSamples) / elapsed * 1e-6 : 0.0;
+        LM_LOG_INFO(boost::str(boost::format("%s: build %.3f s, %.3f Msamples/s (checksum %d)") % type % result.buildTime % result.msamples % checksum));
+
+        return result;
+    }
+
+    static auto RunPhotonMap(const std::string& type, int numPhotons, int numQueries, int numPasses, Float radius, unsigned int seed, PhotonMapResult& result) -> bool
+    {
+        result.type = type;
+        result.size = numPhotons;
+
+        const auto pm = ComponentFactory::Create<PhotonMap>("photonmap::" + type);
+        if (!pm)
+        {
+            LM_LOG_ERROR("Invalid photon map type: " + type);
+            return false;
+        }
+
+        // Photons on the three axis-aligned planes through the origin, a new set for each pass as in SPPM
+        const auto GeneratePhotons = [&](Random& rng) -> std::vector<Photon>
+        {
+            std::vector<Photon> photons(numPhotons);
+            for (int i = 0; i < numPhotons; i++)
+            {
+                const Float u = rng.Next();
+                const Float v = rng.Next();
+                const int axis = i % 3;
+                photons[i].p = axis == 0 ? Vec3(0_f, u, v) : axis == 1 ? Vec3(u, 0_f, v) : Vec3(u, v, 0_f);
+                photons[i].throughput = SPD(1_f);
+                photons[i].wi = Vec3(0_f, 0_f, 1_f);
+                photons[i].numVertices = 2;
+            }
+            return photons;
+        };
+
+        // Rebuild
+        Random rng;
+        rng.SetSeed(seed);
+        double buildTime = 0;
+        for (int pass = 0; pass < numPasses; pass++)
+        {
+            auto photons = GeneratePhotons(rng);
+            const auto start = std::chrono::high_resolution_clock::now();
+            pm->SetMaxRadius(radius);
+            pm->Build(std::move(photons));
+            buildTime += ElapsedSeconds(start);
+        }
+        result.buildTime = numPasses > 0 ? buildTime / numPasses : 0.0;
+
+        // Query with the last photon map
+        std::vector<Vec3> queries(numQueries);
+        for (auto& q : queries)
+        {
+            const Float u = rng.Next();
+            const Float v = rng.Next();
+            q = Vec3(0_f, u, v);
+        }
+        long long collected = 0;
+        const auto start = std::chrono::high_resolution_clock::now();
+        for (const auto& q : queries)
+        {
+            pm->CollectPhotons(q, radius, [&](const Photon&) -> void { collected++; });
+        }
+        const double elapsed = ElapsedSeconds(start);
+        result.mqueries = elapsed > 0 ? (double)(numQueries) / elapsed * 1e-6 : 0.0;
+        result.avgCollected = numQueries > 0 ? (double)(collected) / numQueries : 0.0;
+        LM_LOG_INFO(boost::str(boost::format("%s: build %.3f s/pass, %.3f Mqueries/s, %.1f photons/query") % type % result.buildTime % result.mqueries % result.avgCollected));
+
+        return true;
+    }
+
+    static auto Output(const std::string& outputPath, const std::function<void(std::ostream&)>& write) -> bool
+    {
+        Logger::Flush();
+        if (outputPath == "-")
+        {
+            write(std::cout);
+        }
+        else
+        {
+            std::ofstream ofs(outputPath);
+            if (!ofs)
+            {
+                LM_LOG_ERROR("Failed to open output file: " + outputPath);
+                return false;
+            }
+            write(ofs);
+            LM_LOG_INFO("Results are written to '" + outputPath + "'");
+        }
+        return true;
+    }
+
+    static auto WriteImportCSV(std::ostream& os, const std::vector<ImportResult>& results) -> void
+    {
+        os << "file,parser,file_size_mb,num_vertices,num_faces,load_time_s,throughput_mbs" << std::endl;
+        for (const auto& r : results)
+        {
+            os << boost::format("%s,%s,%.3f,%d,%d,%.6f,%.3f")
+                % r.file % r.parser % r.fileSize % r.numVertices % r.numFaces % r.loadTime
+                % (r.loadTime > 0 ? r.fileSize / r.loadTime : 0.0) << std::endl;
+        }
+    }
+
+    static auto WriteDistCSV(std::ostream& os, const std::vector<DistResult>& results) -> void
+    {
+        os << "type,size,build_time_s,msamples" << std::endl;
+        for (const auto& r : results)
+        {
+            os << boost::format("%s,%d,%.6f,%.4f") % r.type % r.size % r.buildTime % r.msamples << std::endl;
+        }
+    }
+
+    static auto WritePhotonMapCSV(std::ostream& os, const std::vector<PhotonMapResult>& results) -> void
+    {
+        os << "type,size,build_time_s,mqueries,avg_collected" << std::endl;
+        for (const auto& r : results)
+        {
+            os << boost::format("%s,%d,%.6f,%.4f,%.2f") % r.type % r.size % r.buildTime % r.mqueries % r.avgCollected << std::endl;
+        }
+    }
+
+    static auto WriteCSV(std::ostream& os, const std::vector<BenchResult>& results) -> void
+    {
+        os << "accel,num_triangles,build_time_s,memory_mb,primary_mrays,diffuse_mrays,shadow_mrays,shadow_occluded,primary_hit_ratio" << std::endl;
+        for (const auto& r : results)
+        {
+            os << boost::format("%s,%d,%.6f,%.3f,%.4f,%.4f,%.4f,%d,%.4f")
+                % r.accel % r.numTriangles % r.buildTime % r.memory
+                % r.primaryMrays % r.diffuseMrays % r.shadowMrays % (r.occluded ? 1 : 0) % r.primaryHitRatio << std::endl;
+        }
+    }
+
+};
+
+#pragma endregion
+
+// --------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    SEHUtils::EnableStructuralException();
+    Logger::Run();
+
+    int result = EXIT_SUCCESS;
+    try
+    {
+        Bench bench;
+        if (!bench.Run(argc, argv))
+        {
+            result = EXIT_FAILURE;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        LM_LOG_ERROR("EXCEPTION : " + std::string(e.what()));
+        result = EXIT_FAILURE;
+    }
+
+    Logger::Stop();
+    SEHUtils::DisableStructuralException();
+
+    return result;
+}
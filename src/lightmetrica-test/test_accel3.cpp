@@ -28,6 +28,7 @@
 #include <lightmetrica/primitive.h>
 #include <lightmetrica/trianglemesh.h>
 #include <lightmetrica/ray.h>
+#include <lightmetrica/detail/sbvhbuilder.h>
 #include <lightmetrica/intersection.h>
 #include <lightmetrica/exception.h>
 #include <lightmetrica-test/mathutils.h>
@@ -59,10 +60,10 @@ struct Accel3Test : public ::testing::TestWithParam<const char*>
     }
 };
 
-#if LM_SSE && LM_SINGLE_PRECISION
-INSTANTIATE_TEST_CASE_P(AccelTypes, Accel3Test, ::testing::Values("accel::naive", "accel::embree", "accel::bvh", "accel::bvh_sah", "accel::bvh_sahbin", "accel::bvh_sahxyz", "accel::qbvh"));
+#if LM_SSE && LM_SINGLE_PRECISION_GEOMETRY
+INSTANTIATE_TEST_CASE_P(AccelTypes, Accel3Test, ::testing::Values("accel::naive", "accel::embree", "accel::bvh", "accel::bvh_sah", "accel::bvh_sahbin", "accel::bvh_sahxyz", "accel::sbvh", "accel::qbvh"));
 #else
-INSTANTIATE_TEST_CASE_P(AccelTypes, Accel3Test, ::testing::Values("accel::naive", "accel::embree", "accel::bvh", "accel::bvh_sah", "accel::bvh_sahbin", "accel::bvh_sahxyz"));
+INSTANTIATE_TEST_CASE_P(AccelTypes, Accel3Test, ::testing::Values("accel::naive", "accel::embree", "accel::bvh", "accel::bvh_sah", "accel::bvh_sahbin", "accel::bvh_sahxyz", "accel::sbvh"));
 #endif
 
 #pragma endregion
@@ -82,14 +83,14 @@ public:
 
     LM_IMPL_F(NumVertices) = [this]() -> int { return (int)(ps.size()) / 3; };
     LM_IMPL_F(NumFaces)    = [this]() -> int { return (int)(fs.size()) / 3; };
-    LM_IMPL_F(Positions)   = [this]() -> const Float* { return ps.data(); };
-    LM_IMPL_F(Normals)     = [this]() -> const Float* { return ns.data(); };
-    LM_IMPL_F(Texcoords)   = [this]() -> const Float* { return ts.data(); };
+    LM_IMPL_F(Positions)   = [this]() -> const GeomFloat* { return ps.data(); };
+    LM_IMPL_F(Normals)     = [this]() -> const GeomFloat* { return ns.data(); };
+    LM_IMPL_F(Texcoords)   = [this]() -> const GeomFloat* { return ts.data(); };
     LM_IMPL_F(Faces)       = [this]() -> const unsigned int* { return fs.data(); };
 
 protected:
 
-    std::vector<Float> ps{
+    std::vector<GeomFloat> ps{
         0, 0, 0,
         1, 0, 0,
         1, 1, 0,
@@ -97,9 +98,10 @@ protected:
         0, 0, -1,
         1, 0, -1,
         1, 1, -1,
-        0, 1, -1
+        0, 1, -1,
+        0               // Padding (see TriangleMesh::Positions)
     };
-    std::vector<Float> ns{
+    std::vector<GeomFloat> ns{
         0, 0, 1,
         0, 0, 1,
         0, 0, 1,
@@ -109,7 +111,7 @@ protected:
         0, 0, 1,
         0, 0, 1
     };
-    std::vector<Float> ts{
+    std::vector<GeomFloat> ts{
         0, 0,
         1, 0,
         1, 1,
@@ -138,26 +140,27 @@ public:
 
     LM_IMPL_F(NumVertices) = [this]() -> int { return (int)(ps.size()) / 3; };
     LM_IMPL_F(NumFaces)    = [this]() -> int { return (int)(fs.size()) / 3; };
-    LM_IMPL_F(Positions)   = [this]() -> const Float* { return ps.data(); };
-    LM_IMPL_F(Normals)     = [this]() -> const Float* { return ns.data(); };
-    LM_IMPL_F(Texcoords)   = [this]() -> const Float* { return ts.data(); };
+    LM_IMPL_F(Positions)   = [this]() -> const GeomFloat* { return ps.data(); };
+    LM_IMPL_F(Normals)     = [this]() -> const GeomFloat* { return ns.data(); };
+    LM_IMPL_F(Texcoords)   = [this]() -> const GeomFloat* { return ts.data(); };
     LM_IMPL_F(Faces)       = [this]() -> const unsigned int* { return fs.data(); };
 
 protected:
 
-    std::vector<Float> ps{
+    std::vector<GeomFloat> ps{
         0, 0, 0,
         1, 0, -1,
         1, 1, -1,
-        0, 1, 0
+        0, 1, 0,
+        0               // Padding (see TriangleMesh::Positions)
     };
-    std::vector<Float> ns{
-        0.707106781186547_f, 0_f, 0.707106781186547_f,
-        0.707106781186547_f, 0_f, 0.707106781186547_f,
-        0.707106781186547_f, 0_f, 0.707106781186547_f,
-        0.707106781186547_f, 0_f, 0.707106781186547_f,
+    std::vector<GeomFloat> ns{
+        0.707106781186547, 0, 0.707106781186547,
+        0.707106781186547, 0, 0.707106781186547,
+        0.707106781186547, 0, 0.707106781186547,
+        0.707106781186547, 0, 0.707106781186547,
     };
-    std::vector<Float> ts{
+    std::vector<GeomFloat> ts{
         0, 0,
         1, 0,
         1, 1,
@@ -181,9 +184,9 @@ public:
 
     LM_IMPL_F(NumVertices) = [this]() -> int { return (int)(ps.size()) / 3; };
     LM_IMPL_F(NumFaces)    = [this]() -> int { return (int)(fs.size()) / 3; };
-    LM_IMPL_F(Positions)   = [this]() -> const Float* { return ps.data(); };
-    LM_IMPL_F(Normals)     = [this]() -> const Float* { return ns.data(); };
-    LM_IMPL_F(Texcoords)   = [this]() -> const Float* { return ts.data(); };
+    LM_IMPL_F(Positions)   = [this]() -> const GeomFloat* { return ps.data(); };
+    LM_IMPL_F(Normals)     = [this]() -> const GeomFloat* { return ns.data(); };
+    LM_IMPL_F(Texcoords)   = [this]() -> const GeomFloat* { return ts.data(); };
     LM_IMPL_F(Faces)       = [this]() -> const unsigned int* { return fs.data(); };
 
 public:
@@ -221,13 +224,16 @@ public:
 
             fs.push_back(3 * i + 2);
         }
+
+        // Padding (see TriangleMesh::Positions)
+        ps.push_back(0);
     }
 
 private:
 
-    std::vector<Float> ps;
-    std::vector<Float> ns;
-    std::vector<Float> ts;
+    std::vector<GeomFloat> ps;
+    std::vector<GeomFloat> ns;
+    std::vector<GeomFloat> ts;
     std::vector<unsigned int> fs;
 
 };
@@ -263,6 +269,31 @@ private:
 
 };
 
+class Stub_TransformableScene : public Scene3
+{
+public:
+
+    LM_IMPL_CLASS(Stub_TransformableScene, Scene3);
+
+public:
+
+    LM_IMPL_F(NumPrimitives) = [this]() -> int { return 1; };
+    LM_IMPL_F(PrimitiveAt) = [this](int index) -> const Primitive* { return &primitive_; };
+
+public:
+
+    Stub_TransformableScene(const TriangleMesh& mesh)
+    {
+        primitive_.transform = Mat4::Identity();
+        primitive_.mesh = &mesh;
+    }
+
+public:
+
+    Primitive primitive_;
+
+};
+
 #pragma endregion
 
 // --------------------------------------------------------------------------------
@@ -344,6 +375,176 @@ TEST_P(Accel3Test, Simple2)
     }
 }
 
+TEST_P(Accel3Test, Refit)
+{
+    const auto accel = ComponentFactory::Create<Accel3>(GetParam());
+    ASSERT_NE(nullptr, accel);
+    if (!accel->Refit.Implemented())
+    {
+        // Refit is optional
+        return;
+    }
+
+    StubTriangleMesh_Simple mesh;
+    Stub_TransformableScene scene(mesh);
+    EXPECT_TRUE(accel->Initialize(nullptr));
+    EXPECT_TRUE(accel->Build(&scene));
+
+    // Move the mesh and refit
+    const Vec3 offset(2, 0, 0);
+    scene.primitive_.transform = Math::Translate(offset);
+    EXPECT_TRUE(accel->Refit(&scene));
+
+    // Trace rays in the region of [2, 3] x [0, 1]
+    Ray ray;
+    Intersection isect;
+    const int Steps = 10;
+    const Float Delta = 1_f / Float(Steps);
+    for (int i = 1; i < Steps; i++)
+    {
+        const Float y = Delta * Float(i);
+        for (int j = 1; j < Steps; j++)
+        {
+            const Float x = Delta * Float(j);
+
+            // Hit with the moved mesh
+            ray.o = Vec3(x, y, 1) + offset;
+            ray.d = Vec3(0, 0, -1);
+            ASSERT_TRUE(accel->Intersect(&scene, ray, isect, 0_f, Math::Inf()));
+            EXPECT_TRUE(ExpectVecNear(Vec3(x, y, 0) + offset, isect.geom.p, Math::EpsLarge()));
+
+            // No hit in the original region
+            ray.o = Vec3(x, y, 1);
+            EXPECT_FALSE(accel->Intersect(&scene, ray, isect, 0_f, Math::Inf()));
+        }
+    }
+}
+
+TEST_P(Accel3Test, OccludedAndStream)
+{
+    StubTriangleMesh_Simple mesh;
+    Stub_Scene scene(mesh);
+
+    const auto accel = ComponentFactory::Create<Accel3>(GetParam());
+    ASSERT_NE(nullptr, accel);
+    EXPECT_TRUE(accel->Initialize(nullptr));
+    EXPECT_TRUE(accel->Build(&scene));
+
+    // Rays toward the plane z=0 from z=1, with the range reaching the plane or not
+    std::vector<Ray> rays;
+    std::vector<Float> minTs;
+    std::vector<Float> maxTs;
+    std::vector<bool> expected;
+    const int Steps = 10;
+    const Float Delta = 1_f / Float(Steps);
+    for (int i = 1; i < Steps; i++)
+    {
+        for (int j = 1; j < Steps; j++)
+        {
+            Ray ray;
+            ray.o = Vec3(Delta * Float(j), Delta * Float(i), 1);
+            ray.d = Vec3(0, 0, -1);
+            for (const Float maxT : { 0.5_f, Math::Inf() })
+            {
+                rays.push_back(ray);
+                minTs.push_back(0_f);
+                maxTs.push_back(maxT);
+                expected.push_back(maxT > 1_f);
+            }
+        }
+    }
+    const int N = (int)(rays.size());
+
+    if (accel->Occluded.Implemented())
+    {
+        for (int i = 0; i < N; i++)
+        {
+            EXPECT_EQ(expected[i], accel->Occluded(&scene, rays[i], minTs[i], maxTs[i]));
+        }
+    }
+
+    if (accel->IntersectStream.Implemented())
+    {
+        std::vector<Intersection> isects(N);
+        std::unique_ptr<bool[]> hits(new bool[N]);
+        accel->IntersectStream(&scene, N, rays.data(), minTs.data(), maxTs.data(), isects.data(), hits.get());
+        for (int i = 0; i < N; i++)
+        {
+            EXPECT_EQ(expected[i], hits[i]);
+            if (hits[i])
+            {
+                EXPECT_TRUE(ExpectVecNear(Vec3(rays[i].o.x, rays[i].o.y, 0), isects[i].geom.p, Math::EpsLarge()));
+            }
+        }
+    }
+
+    if (accel->OccludedStream.Implemented())
+    {
+        std::unique_ptr<bool[]> occluded(new bool[N]);
+        accel->OccludedStream(&scene, N, rays.data(), minTs.data(), maxTs.data(), occluded.get());
+        for (int i = 0; i < N; i++)
+        {
+            EXPECT_EQ(expected[i], occluded[i]);
+        }
+    }
+}
+
+#pragma endregion
+
+// --------------------------------------------------------------------------------
+
+#pragma region SBVH builder
+
+// Long thin triangles which overlap each other, where spatial splits are effective
+TEST(SBVHBuilderTest, References)
+{
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist;
+    std::vector<Vec3> ps;
+    const int NumTriangles = 500;
+    for (int i = 0; i < NumTriangles; i++)
+    {
+        const Float y = Float(dist(gen));
+        const Float z = Float(dist(gen));
+        ps.push_back(Vec3(0_f, y, z));
+        ps.push_back(Vec3(1_f, y + 0.01_f, z));
+        ps.push_back(Vec3(1_f, y, z + 0.01_f));
+    }
+
+    SBVHBuilder::Params params;
+    std::vector<SBVHNode> nodes;
+    std::vector<int> indices;
+    SBVHBuilder::Build(ps, params, nodes, indices);
+
+    // All triangles are referenced at least once within the budget of the duplication
+    std::vector<int> counts(NumTriangles, 0);
+    for (int i : indices) { counts[i]++; }
+    for (int c : counts) { EXPECT_LT(0, c); }
+    EXPECT_GE(Float(NumTriangles) * (1_f + params.maxDuplication), Float(indices.size()));
+
+    // Leaf sizes are bounded and child bounds are contained in the parent bounds
+    const auto Contains = [](const Bound& b1, const Bound& b2) -> bool
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (b2.min[axis] < b1.min[axis] || b1.max[axis] < b2.max[axis]) { return false; }
+        }
+        return true;
+    };
+    for (const auto& node : nodes)
+    {
+        if (node.isleaf)
+        {
+            EXPECT_GE(params.maxLeafSize, node.leaf.end - node.leaf.begin);
+        }
+        else
+        {
+            EXPECT_TRUE(Contains(node.bound.ToBound(), nodes[node.internal.child1].bound.ToBound()));
+            EXPECT_TRUE(Contains(node.bound.ToBound(), nodes[node.internal.child2].bound.ToBound()));
+        }
+    }
+}
+
 #pragma endregion
 
 LM_TEST_NAMESPACE_END
@@ -0,0 +1,118 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch_test.h>
+#include <lightmetrica/detail/arena.h>
+#include <lightmetrica-test/utils.h>
+
+LM_TEST_NAMESPACE_BEGIN
+
+TEST(MemoryArenaTest, Alignment)
+{
+    MemoryArena arena(256);
+    for (size_t align : { 1, 2, 4, 8, 16, 32 })
+    {
+        auto* p = arena.Allocate(3, align);
+        EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(p) % align);
+    }
+
+    // Larger than the block size
+    auto* p = static_cast<unsigned char*>(arena.Allocate(1000, 16));
+    std::fill(p, p + 1000, 0xff);
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(p) % 16);
+}
+
+TEST(MemoryArenaTest, ScopedAllocator)
+{
+    MemoryArena arena;
+    ArenaVector<int> outside;
+    {
+        MemoryArena::Scope scope(arena);
+        ArenaVector<int> inside;
+        EXPECT_NE(outside.get_allocator(), inside.get_allocator());
+        EXPECT_EQ(MemoryArena::Current(), &arena);
+    }
+    EXPECT_EQ(nullptr, MemoryArena::Current());
+}
+
+TEST(MemoryArenaTest, NestedScope)
+{
+    // Nested scope of the same arena does not release the allocations of the outer scope
+    MemoryArena arena;
+    MemoryArena::Scope scope(arena);
+    ArenaVector<int> outer(100, 1);
+    {
+        MemoryArena::Scope nested(arena);
+        ArenaVector<int> inner(100, 2);
+        EXPECT_EQ(MemoryArena::Current(), &arena);
+    }
+    EXPECT_EQ(1, arena.NumResets());
+    EXPECT_EQ(MemoryArena::Current(), &arena);
+    EXPECT_TRUE(std::all_of(outer.begin(), outer.end(), [](int v) { return v == 1; }));
+}
+
+TEST(MemoryArenaTest, Swap)
+{
+    // Swapped containers keep the allocators of their storage
+    MemoryArena arena;
+    ArenaVector<int> outside(10, 1);
+    {
+        MemoryArena::Scope scope(arena);
+        ArenaVector<int> inside(10, 2);
+        const auto insideAllocator = inside.get_allocator();
+        std::swap(outside, inside);
+        EXPECT_EQ(insideAllocator, outside.get_allocator());
+        EXPECT_NE(insideAllocator, inside.get_allocator());
+        EXPECT_EQ(2, outside[0]);
+        EXPECT_EQ(1, inside[0]);
+        std::swap(outside, inside);
+    }
+    EXPECT_EQ(1, outside[0]);
+}
+
+TEST(MemoryArenaTest, SteadyState)
+{
+    // Paths with varying lengths; the arena stops allocating once the longest has been seen
+    MemoryArena arena(64);
+    ArenaVector<double> kept;
+    for (int sample = 0; sample < 1000; sample++)
+    {
+        MemoryArena::Scope scope(arena);
+        const int n = sample < 500 ? (sample % 50) : (sample % 37);
+        ArenaVector<double> vs;
+        for (int i = 0; i < n; i++) { vs.push_back(i); }
+        ArenaVector<double> copied = vs;
+        EXPECT_TRUE(std::equal(vs.begin(), vs.end(), copied.begin()));
+
+        // Assignment to the container outside the scope keeps its heap storage
+        kept = copied;
+    }
+    EXPECT_EQ(1000, arena.NumResets());
+    EXPECT_GE(arena.NumResetsSinceHeapAllocation(), 500);
+    EXPECT_LE(arena.NumHeapAllocations(), 16);
+    EXPECT_EQ(999 % 37, (int)(kept.size()));
+}
+
+LM_TEST_NAMESPACE_END
@@ -56,8 +56,22 @@ struct TestAsset2 : public TestAsset
     LM_IMPL_F(Func) = [this]() -> int { return 43; };
 };
 
+// Asset depending on another asset
+struct TestAsset3 : public TestAsset
+{
+    LM_IMPL_CLASS(TestAsset3, TestAsset);
+    LM_IMPL_F(Load) = [this](const PropertyNode* prop, Assets* assets, const Primitive* primitive) -> bool
+    {
+        dep_ = static_cast<const TestAsset*>(assets->AssetByIDAndType(prop->Child("dep")->RawScalar(), "testasset", primitive));
+        return dep_ != nullptr;
+    };
+    LM_IMPL_F(Func) = [this]() -> int { return dep_->Func() + 1; };
+    const TestAsset* dep_ = nullptr;
+};
+
 LM_COMPONENT_REGISTER_IMPL(TestAsset1, "testasset::testasset1");
 LM_COMPONENT_REGISTER_IMPL(TestAsset2, "testasset::testasset2");
+LM_COMPONENT_REGISTER_IMPL(TestAsset3, "testasset::testasset3");
 
 TEST_F(AssetsTest, AssetByIDAndType)
 {
@@ -90,4 +104,73 @@ TEST_F(AssetsTest, AssetByIDAndType)
     }
 }
 
+TEST_F(AssetsTest, Preload)
+{
+    const std::string Preload_Input = TestUtils::MultiLineLiteral(R"x(
+    | test_1:
+    |   interface: testasset
+    |   type: testasset1
+    |
+    | test_2:
+    |   interface: testasset
+    |   type: testasset2
+    |
+    | test_3:
+    |   interface: testasset
+    |   type: testasset3
+    |   params:
+    |     dep: test_1
+    |
+    | test_4:
+    |   interface: testasset
+    |   type: testasset3
+    |   params:
+    |     dep: test_3
+    )x");
+
+    const auto prop = ComponentFactory::Create<PropertyTree>();
+    EXPECT_TRUE(prop->LoadFromString(Preload_Input));
+
+    const auto assets = ComponentFactory::Create<Assets>("assets::assets3");
+    EXPECT_TRUE(assets->Initialize(prop->Root()));
+    EXPECT_TRUE(assets->Preload({ "test_4", "test_3", "test_2", "test_1", "test_4" }));
+
+    // Each asset is loaded only once
+    const auto* asset1 = static_cast<const TestAsset*>(assets->AssetByIDAndType("test_1", "testasset", nullptr));
+    ASSERT_NE(nullptr, asset1);
+    EXPECT_EQ(42, asset1->Func());
+    for (int i = 0; i < 4; i++)
+    {
+        EXPECT_EQ(assets->GetByIndex(i), assets->AssetByIDAndType(assets->GetByIndex(i)->ID(), "testasset", nullptr));
+    }
+
+    const auto* asset4 = static_cast<const TestAsset*>(assets->AssetByIDAndType("test_4", "testasset", nullptr));
+    ASSERT_NE(nullptr, asset4);
+    EXPECT_EQ(44, asset4->Func());
+}
+
+TEST_F(AssetsTest, Preload_Failed)
+{
+    const std::string Preload_Failed_Input = TestUtils::MultiLineLiteral(R"x(
+    | test_1:
+    |   interface: testasset
+    |   type: testasset1
+    |
+    | test_2:
+    |   interface: testasset
+    |   type: testasset3
+    |   params:
+    |     dep: missing
+    )x");
+
+    const auto prop = ComponentFactory::Create<PropertyTree>();
+    EXPECT_TRUE(prop->LoadFromString(Preload_Failed_Input));
+
+    const auto assets = ComponentFactory::Create<Assets>("assets::assets3");
+    EXPECT_TRUE(assets->Initialize(prop->Root()));
+    EXPECT_FALSE(assets->Preload({ "test_1", "test_2" }));
+    EXPECT_NE(nullptr, assets->AssetByIDAndType("test_1", "testasset", nullptr));
+    EXPECT_EQ(nullptr, assets->AssetByIDAndType("test_2", "testasset", nullptr));
+}
+
 LM_TEST_NAMESPACE_END
@@ -0,0 +1,321 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch_test.h>
+#include <lightmetrica/scene3.h>
+#include <lightmetrica/assets.h>
+#include <lightmetrica/accel3.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/detail/bdptpath.h>
+#include <lightmetrica-test/utils.h>
+
+LM_TEST_NAMESPACE_BEGIN
+
+struct BDPTPathTest : public ::testing::Test
+{
+    virtual auto SetUp() -> void override { Logger::SetVerboseLevel(2); Logger::Run(); }
+    virtual auto TearDown() -> void override { Logger::Stop(); }
+};
+
+// --------------------------------------------------------------------------------
+
+namespace
+{
+    // Open box with diffuse, glossy, and specular walls lit by an area light on the ceiling
+    const std::string BDPTTestScene = TestUtils::MultiLineLiteral(R"x(
+    | assets:
+    |   film_1:
+    |     interface: film
+    |     type: hdr
+    |     params:
+    |       w: 16
+    |       h: 16
+    |
+    |   sensor_1:
+    |     interface: sensor
+    |     type: pinhole
+    |     params:
+    |       film: film_1
+    |       fov: 60
+    |
+    |   floor_mesh:
+    |     interface: trianglemesh
+    |     type: raw
+    |     params:
+    |       positions: -1 0 -1 1 0 -1 1 0 1 -1 0 1
+    |       normals: 0 1 0 0 1 0 0 1 0 0 1 0
+    |       faces: 0 2 1 0 3 2
+    |
+    |   left_mesh:
+    |     interface: trianglemesh
+    |     type: raw
+    |     params:
+    |       positions: -1 0 -1 -1 0 1 -1 2 1 -1 2 -1
+    |       normals: 1 0 0 1 0 0 1 0 0 1 0 0
+    |       faces: 0 1 2 0 2 3
+    |
+    |   right_mesh:
+    |     interface: trianglemesh
+    |     type: raw
+    |     params:
+    |       positions: 1 0 -1 1 0 1 1 2 1 1 2 -1
+    |       normals: -1 0 0 -1 0 0 -1 0 0 -1 0 0
+    |       faces: 0 2 1 0 3 2
+    |
+    |   light_mesh:
+    |     interface: trianglemesh
+    |     type: raw
+    |     params:
+    |       positions: -0.5 1.9 -0.5 0.5 1.9 -0.5 0.5 1.9 0.5 -0.5 1.9 0.5
+    |       normals: 0 -1 0 0 -1 0 0 -1 0 0 -1 0
+    |       faces: 0 1 2 0 2 3
+    |
+    |   diffuse_white:
+    |     interface: bsdf
+    |     type: diffuse
+    |     params:
+    |       R: 0.8 0.8 0.8
+    |
+    |   diffuse_black:
+    |     interface: bsdf
+    |     type: diffuse
+    |     params:
+    |       R: 0 0 0
+    |
+    |   glossy:
+    |     interface: bsdf
+    |     type: cook_torrance
+    |     params:
+    |       R: 0.8 0.8 0.8
+    |       roughness: 0.3
+    |
+    |   mirror:
+    |     interface: bsdf
+    |     type: reflect_all
+    |     params:
+    |       R: 0.8 0.8 0.8
+    |
+    |   light_1:
+    |     interface: light
+    |     type: area
+    |     params:
+    |       Le: 1 1 1
+    |
+    | scene:
+    |   sensor: sensor_node
+    |   nodes:
+    |     - id: sensor_node
+    |       transform:
+    |         lookat:
+    |           eye: 0 1 3
+    |           center: 0 1 0
+    |           up: 0 1 0
+    |       sensor: sensor_1
+    |
+    |     - id: floor
+    |       mesh: floor_mesh
+    |       bsdf: diffuse_white
+    |
+    |     - id: left
+    |       mesh: left_mesh
+    |       bsdf: glossy
+    |
+    |     - id: right
+    |       mesh: right_mesh
+    |       bsdf: mirror
+    |
+    |     - id: light
+    |       mesh: light_mesh
+    |       bsdf: diffuse_black
+    |       light: light_1
+    )x");
+
+    // PDF of the strategy evaluated from scratch,
+    // the implementation used before the PDFs are cached in the subpaths
+    auto ReferencePDF(const Path& path, const Scene3* scene, int s, bool direct) -> Float
+    {
+        if (!path.Samplable(s, direct))
+        {
+            return 0_f;
+        }
+
+        const auto& vertices = path.vertices;
+        PDFVal pdf(PDFMeasure::ProdArea, 1_f);
+        const int n = (int)(vertices.size());
+        const int t = n - s;
+        if (s > 0)
+        {
+            pdf *= vertices[0].primitive->EvaluatePositionGivenDirectionPDF(vertices[0].geom, Math::Normalize(vertices[1].geom.p - vertices[0].geom.p), false) * scene->EvaluateEmitterPDF(vertices[0].primitive).v;
+            for (int i = 0; i < s - 1; i++)
+            {
+                const auto* vi = &vertices[i];
+                const auto* vip = i - 1 >= 0 ? &vertices[i - 1] : nullptr;
+                const auto* vin = &vertices[i + 1];
+                if (t == 0 && i == s - 2 && direct)
+                {
+                    pdf *= vin->primitive->EvaluatePositionGivenPreviousPositionPDF(vin->geom, vi->geom, false) * scene->EvaluateEmitterGivenPositionPDF(vin->primitive, vi->geom).v;
+                }
+                else
+                {
+                    pdf *= vi->primitive->EvaluateDirectionPDF(vi->geom, vi->type, vip ? Math::Normalize(vip->geom.p - vi->geom.p) : Vec3(), Math::Normalize(vin->geom.p - vi->geom.p), false).ConvertToArea(vi->geom, vin->geom);
+                }
+            }
+        }
+        if (t > 0)
+        {
+            pdf *= vertices[n - 1].primitive->EvaluatePositionGivenDirectionPDF(vertices[n - 1].geom, Math::Normalize(vertices[n - 2].geom.p - vertices[n - 1].geom.p), false) * scene->EvaluateEmitterPDF(vertices[n - 1].primitive).v;
+            for (int i = n - 1; i >= s + 1; i--)
+            {
+                const auto* vi = &vertices[i];
+                const auto* vip = &vertices[i - 1];
+                const auto* vin = i + 1 < n ? &vertices[i + 1] : nullptr;
+                if (s == 0 && i == s + 1 && direct)
+                {
+                    pdf *= vip->primitive->EvaluatePositionGivenPreviousPositionPDF(vip->geom, vi->geom, false) * scene->EvaluateEmitterGivenPositionPDF(vip->primitive, vi->geom).v;
+                }
+                else
+                {
+                    pdf *= vi->primitive->EvaluateDirectionPDF(vi->geom, vi->type, vin ? Math::Normalize(vin->geom.p - vi->geom.p) : Vec3(), Math::Normalize(vip->geom.p - vi->geom.p), false).ConvertToArea(vi->geom, vip->geom);
+                }
+            }
+        }
+
+        return pdf.v;
+    }
+
+    // Power heuristic weight with the reference PDFs
+    auto ReferencePowerHeuristics(const Path& path, const Scene3* scene, int s_, bool direct_) -> Float
+    {
+        const int n = (int)(path.vertices.size());
+        const auto ps = ReferencePDF(path, scene, s_, direct_);
+        Float invWeight = 0;
+        for (int s = 0; s <= n; s++)
+        {
+            for (int d = 0; d < 2; d++)
+            {
+                if (s > 0 && n - s > 0 && d == 1)
+                {
+                    continue;
+                }
+                const auto pi = ReferencePDF(path, scene, s, d == 1);
+                if (pi > 0_f)
+                {
+                    const auto r = pi / ps;
+                    invWeight += r * r;
+                }
+            }
+        }
+        return 1_f / invWeight;
+    }
+
+    auto ExpectRelativeNear(Float expected, Float actual, Float tolerance) -> ::testing::AssertionResult
+    {
+        const auto diff = Math::Abs(expected - actual);
+        if (diff > tolerance * Math::Max(Math::Abs(expected), Math::Abs(actual)))
+        {
+            return ::testing::AssertionFailure() << "Expected " << expected << ", Actual " << actual;
+        }
+        return ::testing::AssertionSuccess();
+    }
+}
+
+// The PDFs of all strategies and the MIS weights evaluated from the cached PDFs
+// agree with the ones evaluated from scratch for each strategy
+TEST_F(BDPTPathTest, EvaluatePDFsMatchesReference)
+{
+    const auto prop = ComponentFactory::Create<PropertyTree>();
+    ASSERT_TRUE(prop->LoadFromString(BDPTTestScene));
+    const auto assets = ComponentFactory::Create<Assets>("assets::assets3");
+    ASSERT_TRUE(assets->Initialize(prop->Root()->Child("assets")));
+    const auto accel = ComponentFactory::Create<Accel3>("accel::naive");
+    ASSERT_TRUE(accel->Initialize(nullptr));
+    const auto scene = ComponentFactory::Create<Scene3>("scene::scene3");
+    ASSERT_TRUE(scene->Initialize(prop->Root()->Child("scene"), assets.get(), accel.get()));
+    const auto mis = ComponentFactory::Create<MISWeight>("misweight::powerheuristics");
+    ASSERT_TRUE(mis);
+
+    Random rng;
+    rng.SetSeed(42);
+    MemoryArena arena;
+    int numPaths = 0;
+    int maxPathVertices = 0;
+    for (int sample = 0; sample < 2000; sample++)
+    {
+        MemoryArena::Scope arenaScope(arena);
+        Subpath subpathL, subpathE;
+        Path path;
+        ArenaVector<Float> pdfs;
+        subpathL.Sample(scene.get(), &rng, TransportDirection::LE, 8);
+        subpathE.Sample(scene.get(), &rng, TransportDirection::EL, 8);
+
+        const int nL = (int)(subpathL.vertices.size());
+        const int nE = (int)(subpathE.vertices.size());
+        for (int s = 0; s <= nL; s++)
+        {
+            for (int t = 0; t <= nE; t++)
+            {
+                for (int d = 0; d < 2; d++)
+                {
+                    const bool direct = d == 1;
+                    if (s + t < 2 || (s > 0 && t > 0 && direct))
+                    {
+                        continue;
+                    }
+                    if (!path.Connect(scene.get(), s, t, direct, subpathL, subpathE))
+                    {
+                        continue;
+                    }
+
+                    const int n = (int)(path.vertices.size());
+                    path.EvaluatePDFs(scene.get(), pdfs);
+                    for (int s2 = 0; s2 <= n; s2++)
+                    {
+                        for (int d2 = 0; d2 < 2; d2++)
+                        {
+                            if (s2 > 0 && n - s2 > 0 && d2 == 1)
+                            {
+                                continue;
+                            }
+                            ASSERT_TRUE(ExpectRelativeNear(ReferencePDF(path, scene.get(), s2, d2 == 1), pdfs[2 * s2 + d2], 1e-3_f)) << "s = " << s2 << ", direct = " << d2 << ", n = " << n;
+                        }
+                    }
+
+                    if (pdfs[2 * s + d] > 0_f)
+                    {
+                        EXPECT_NEAR(ReferencePowerHeuristics(path, scene.get(), s, direct), mis->Evaluate(path, scene.get(), s, direct), 1e-4_f);
+                    }
+
+                    numPaths++;
+                    maxPathVertices = std::max(maxPathVertices, n);
+                }
+            }
+        }
+    }
+
+    EXPECT_GT(numPaths, 1000);
+    EXPECT_GE(maxPathVertices, 5);
+}
+
+LM_TEST_NAMESPACE_END
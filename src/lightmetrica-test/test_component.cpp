@@ -138,6 +138,15 @@ TEST(ComponentTest, FailedToCreate)
     ASSERT_TRUE(p == nullptr);
 }
 
+TEST(ComponentTest, Keys)
+{
+    const auto keys = ComponentFactory::Keys("A");
+    EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+    EXPECT_NE(keys.end(), std::find(keys.begin(), keys.end(), "A1"));
+    EXPECT_NE(keys.end(), std::find(keys.begin(), keys.end(), "A2"));
+    EXPECT_EQ(keys.end(), std::find(keys.begin(), keys.end(), "B1"));
+}
+
 TEST(ComponentTest, InheritedInterface)
 {
     auto p = ComponentFactory::Create<B>("B1");
@@ -0,0 +1,155 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <pch_test.h>
+#include <lightmetrica-test/mathutils.h>
+#include <lightmetrica/dist.h>
+
+LM_TEST_NAMESPACE_BEGIN
+
+TEST(DistTest, AliasTable)
+{
+    AliasTable dist;
+    const std::vector<Float> vs{ 1_f, 2_f, 0_f, 3_f, 4_f };
+    for (const auto& v : vs) { dist.Add(v); }
+    dist.Normalize();
+
+    for (int i = 0; i < (int)(vs.size()); i++)
+    {
+        EXPECT_TRUE(ExpectNear(vs[i] / 10_f, dist.EvaluatePDF(i)));
+    }
+
+    // Frequencies of the samples with stratified random numbers
+    const int N = 100000;
+    std::vector<int> counts(vs.size(), 0);
+    for (int j = 0; j < N; j++)
+    {
+        counts[dist.Sample((Float(j) + .5_f) / Float(N))]++;
+    }
+    EXPECT_EQ(0, counts[2]);
+    for (int i = 0; i < (int)(vs.size()); i++)
+    {
+        EXPECT_NEAR(vs[i] / 10.0, (double)(counts[i]) / N, 1e-3);
+    }
+}
+
+TEST(DistTest, AliasTable_SampleReuse)
+{
+    AliasTable dist;
+    dist.Add(1_f);
+    dist.Add(2_f);
+    dist.Add(3_f);
+    dist.Normalize();
+
+    // Reused random numbers are uniformly distributed in [0, 1)
+    const int N = 100000;
+    double mean = 0;
+    for (int j = 0; j < N; j++)
+    {
+        Float u2;
+        const int i = dist.SampleReuse((Float(j) + .5_f) / Float(N), u2);
+        EXPECT_TRUE(0 <= i && i < 3);
+        EXPECT_TRUE(0_f <= u2 && u2 < 1_f);
+        mean += u2;
+    }
+    EXPECT_NEAR(0.5, mean / N, 1e-3);
+}
+
+TEST(DistTest, AliasTable_SampleReuse_Inverse)
+{
+    AliasTable dist;
+    const std::vector<Float> vs{ 1_f, 5_f, 0_f, 2_f, 2_f };
+    for (const auto& v : vs) { dist.Add(v); }
+    dist.Normalize();
+
+    // The inverse is mapped back to the same entry and reused random number,
+    // and the inverses of the samples are uniformly distributed in [0, 1)
+    const int N = 100000;
+    const int NumBins = 10;
+    std::vector<int> counts(NumBins, 0);
+    for (int j = 0; j < N; j++)
+    {
+        Float u2;
+        const int i = dist.SampleReuse((Float(j) + .5_f) / Float(N), u2);
+        const auto u = dist.SampleReuse_Inverse(i, u2, Float((j * 7919) % N) / Float(N));
+        Float u2Inv;
+        EXPECT_EQ(i, dist.SampleReuse(u, u2Inv));
+        EXPECT_TRUE(ExpectNear(u2, u2Inv, 1e-3_f));
+        counts[std::min((int)(u * NumBins), NumBins - 1)]++;
+    }
+    for (int k = 0; k < NumBins; k++)
+    {
+        EXPECT_NEAR(1.0 / NumBins, (double)(counts[k]) / N, 1e-2);
+    }
+}
+
+TEST(DistTest, AliasTable_Sample_Inverse)
+{
+    AliasTable dist;
+    const std::vector<Float> vs{ 3_f, 0_f, 1_f, 8_f, 1_f, 1_f, 2_f };
+    for (const auto& v : vs) { dist.Add(v); }
+    dist.Normalize();
+
+    // The slots aliased to each entry cover the probability of the entry
+    const int n = (int)(vs.size());
+    for (int i = 0; i < n; i++)
+    {
+        Float p = dist.prob[i];
+        for (int j = dist.aliasedBegin[i]; j < dist.aliasedBegin[i + 1]; j++)
+        {
+            EXPECT_EQ(i, dist.alias[dist.aliased[j]]);
+            p += 1_f - dist.prob[dist.aliased[j]];
+        }
+        EXPECT_TRUE(ExpectNear(dist.EvaluatePDF(i) * Float(n), p, 1e-4_f));
+    }
+
+    // The inverse is mapped back to the same entry
+    const int N = 10000;
+    for (int j = 0; j < N; j++)
+    {
+        const int i = dist.Sample((Float(j) + .5_f) / Float(N));
+        const auto u = dist.Sample_Inverse(i, Float((j * 7919) % N) / Float(N), Float((j * 104729) % N) / Float(N));
+        EXPECT_EQ(i, dist.Sample(u));
+    }
+}
+
+TEST(DistTest, AliasTable_ZeroSum)
+{
+    // Falls back to the uniform distribution
+    AliasTable dist;
+    for (int i = 0; i < 4; i++) { dist.Add(0_f); }
+    dist.Normalize();
+    for (int i = 0; i < 4; i++)
+    {
+        EXPECT_TRUE(ExpectNear(0.25_f, dist.EvaluatePDF(i)));
+        EXPECT_EQ(i, dist.Sample((Float(i) + 0.5_f) / 4_f));
+    }
+
+    // Empty table stays empty
+    AliasTable empty;
+    empty.Normalize();
+    EXPECT_TRUE(empty.Empty());
+}
+
+LM_TEST_NAMESPACE_END
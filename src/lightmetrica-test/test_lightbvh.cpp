@@ -0,0 +1,109 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <pch_test.h>
+#include <lightmetrica/detail/lightbvh.h>
+#include <lightmetrica-test/utils.h>
+#include <random>
+
+LM_TEST_NAMESPACE_BEGIN
+
+namespace
+{
+    // Random lights on the grid facing +z or -z, with a light of zero power
+    auto CreateLights(std::mt19937& gen) -> std::vector<LightBounds>
+    {
+        std::uniform_real_distribution<double> dist;
+        std::vector<LightBounds> lights;
+        for (int i = 0; i < 100; i++)
+        {
+            LightBounds b;
+            const Vec3 p(Float(dist(gen) * 10), Float(dist(gen) * 10), Float(dist(gen) * 2));
+            b.bound = Math::Union(b.bound, p);
+            b.bound = Math::Union(b.bound, p + Vec3(0.1_f, 0.1_f, 0_f));
+            b.axis = Vec3(0_f, 0_f, i % 2 == 0 ? 1_f : -1_f);
+            b.cosThetaO = 1_f;
+            b.cosThetaE = 0_f;
+            b.power = i == 0 ? 0_f : Float(dist(gen) * 10);
+            lights.push_back(b);
+        }
+        return lights;
+    }
+}
+
+TEST(LightBVHTest, ConsistentPDF)
+{
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist;
+    const auto lights = CreateLights(gen);
+    LightBVH bvh;
+    bvh.Build(lights);
+    ASSERT_FALSE(bvh.Empty());
+
+    for (int k = 0; k < 20; k++)
+    {
+        // Shading points above the lights so that the lights facing +z always contribute
+        const Vec3 p(Float(dist(gen) * 10), Float(dist(gen) * 10), Float(3 + dist(gen) * 2));
+        const Vec3 n(0_f, 0_f, 1_f);
+
+        // PDFs sum up to one
+        Float sum = 0_f;
+        for (int i = 0; i < (int)(lights.size()); i++)
+        {
+            sum += bvh.EvaluatePDF(i, p, n);
+        }
+        EXPECT_NEAR(1.0, sum, 1e-4);
+        EXPECT_EQ(0_f, bvh.EvaluatePDF(0, p, n));
+
+        // Sampled PDF matches the evaluated PDF
+        for (int j = 0; j < 20; j++)
+        {
+            Float pdf;
+            const int i = bvh.Sample(p, n, Float(dist(gen)), pdf);
+            ASSERT_GT(i, 0);
+            EXPECT_NEAR(bvh.EvaluatePDF(i, p, n), pdf, 1e-4);
+        }
+    }
+}
+
+TEST(LightBVHTest, Importance)
+{
+    // Light facing +z
+    LightBounds b;
+    b.bound = Math::Union(b.bound, Vec3(-1_f, -1_f, 0_f));
+    b.bound = Math::Union(b.bound, Vec3(1_f, 1_f, 0_f));
+    b.axis = Vec3(0_f, 0_f, 1_f);
+    b.cosThetaO = 1_f;
+    b.cosThetaE = 0_f;
+    b.power = 1_f;
+
+    // No contribution behind the light
+    EXPECT_GT(LightBVH::Importance(b, Vec3(0_f, 0_f, 10_f), Vec3()), 0_f);
+    EXPECT_EQ(0_f, LightBVH::Importance(b, Vec3(0_f, 0_f, -10_f), Vec3()));
+
+    // Closer points have larger importance
+    EXPECT_GT(LightBVH::Importance(b, Vec3(0_f, 0_f, 5_f), Vec3()), LightBVH::Importance(b, Vec3(0_f, 0_f, 10_f), Vec3()));
+}
+
+LM_TEST_NAMESPACE_END
@@ -0,0 +1,212 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch_test.h>
+#include <lightmetrica/light.h>
+#include <lightmetrica/texture.h>
+#include <lightmetrica/assets.h>
+#include <lightmetrica/scene3.h>
+#include <lightmetrica/primitive.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/intersection.h>
+#include <lightmetrica-test/utils.h>
+#include <random>
+
+LM_TEST_NAMESPACE_BEGIN
+
+// Stubs
+struct Stub_EnvmapTexture : public Texture
+{
+    LM_IMPL_CLASS(Stub_EnvmapTexture, Texture);
+    LM_IMPL_F(Evaluate) = [this](const Vec2& uv) -> Vec3
+    {
+        // Bright spot on the smooth gradient
+        const auto d = uv - Vec2(0.7_f, 0.35_f);
+        if (Math::Dot(d, d) < 0.08_f * 0.08_f) return Vec3(100_f);
+        return Vec3(uv.x + 0.1_f, uv.y, 0.5_f);
+    };
+};
+
+struct Stub_EnvLightAssets : public Assets
+{
+    LM_IMPL_CLASS(Stub_EnvLightAssets, Assets);
+    LM_IMPL_F(AssetByIDAndType) = [this](const std::string& id, const std::string& type, const Primitive* primitive) -> Asset* { return envmap; };
+    Asset* envmap = nullptr;
+};
+
+struct Stub_EnvLightScene : public Scene3
+{
+    LM_IMPL_CLASS(Stub_EnvLightScene, Scene3);
+    LM_IMPL_F(GetSphereBound) = [this]() -> SphereBound { return SphereBound{ Vec3(), 1_f }; };
+    LM_IMPL_F(NumPrimitives) = [this]() -> int { return 1; };
+    LM_IMPL_F(PrimitiveAt) = [this](int index) -> const Primitive* { return &primitive; };
+    Primitive primitive;
+};
+
+LM_COMPONENT_REGISTER_IMPL(Stub_EnvmapTexture, "texture::stub_envmap");
+LM_COMPONENT_REGISTER_IMPL(Stub_EnvLightAssets, "assets::stub_envlight");
+LM_COMPONENT_REGISTER_IMPL(Stub_EnvLightScene, "scene::stub_envlight");
+
+// --------------------------------------------------------------------------------
+
+struct LightEnvTest : public ::testing::Test
+{
+    virtual auto SetUp() -> void override
+    {
+        Logger::SetVerboseLevel(2);
+        Logger::Run();
+
+        const auto Input = TestUtils::MultiLineLiteral(R"x(
+        | envmap: envmap_1
+        | rotate: 60
+        | dist_res: 32
+        )x");
+        prop = ComponentFactory::Create<PropertyTree>();
+        ASSERT_TRUE(prop->LoadFromString(Input));
+
+        envmap = ComponentFactory::Create<Texture>("texture::stub_envmap");
+        assets = ComponentFactory::Create<Assets>("assets::stub_envlight");
+        static_cast<Stub_EnvLightAssets*>(assets.get())->envmap = envmap.get();
+
+        light = ComponentFactory::Create<Light>("light::env");
+        scene = ComponentFactory::Create<Scene3>("scene::stub_envlight");
+        static_cast<Stub_EnvLightScene*>(scene.get())->primitive.light = light.get();
+        ASSERT_TRUE(light->Load(prop->Root(), assets.get(), nullptr));
+        ASSERT_TRUE(light->PostLoad(scene.get()));
+    }
+
+    virtual auto TearDown() -> void override
+    {
+        Logger::Stop();
+    }
+
+    // Checks the histogram of the sampled directions against the expected probabilities
+    // of the bins over the spherical coordinates, computed by integrating `pdfSA`.
+    template <typename SampleFunc, typename PDFFunc>
+    auto ExpectConsistent(const SampleFunc& sample, const PDFFunc& pdfSA) const -> void
+    {
+        const int NumTheta = 4;
+        const int NumPhi = 8;
+        const int NumSub = 64;
+        const auto Dir = [](Float theta, Float phi) -> Vec3
+        {
+            return Vec3(Math::Sin(theta) * Math::Cos(phi), Math::Sin(theta) * Math::Sin(phi), Math::Cos(theta));
+        };
+        const auto Bin = [&](const Vec3& d) -> int
+        {
+            const auto theta = Math::Acos(Math::Clamp(d.z, -1_f, 1_f));
+            auto phi = std::atan2(d.y, d.x);
+            if (phi < 0_f) phi += 2_f * Math::Pi();
+            const int y = Math::Clamp((int)(theta / Math::Pi() * NumTheta), 0, NumTheta - 1);
+            const int x = Math::Clamp((int)(phi / (2_f * Math::Pi()) * NumPhi), 0, NumPhi - 1);
+            return y * NumPhi + x;
+        };
+
+        // Expected probabilities with the midpoint rule
+        std::vector<double> expected(NumTheta * NumPhi, 0);
+        const double dTheta = Math::Pi() / (NumTheta * NumSub);
+        const double dPhi = 2 * Math::Pi() / (NumPhi * NumSub);
+        for (int y = 0; y < NumTheta * NumSub; y++)
+        {
+            for (int x = 0; x < NumPhi * NumSub; x++)
+            {
+                const auto theta = Float((y + .5) * dTheta);
+                const auto phi = Float((x + .5) * dPhi);
+                expected[(y / NumSub) * NumPhi + x / NumSub] += pdfSA(Dir(theta, phi)) * Math::Sin(theta) * dTheta * dPhi;
+            }
+        }
+
+        // PDF integrates to one
+        double sum = 0;
+        for (const auto& p : expected) { sum += p; }
+        EXPECT_NEAR(1.0, sum, 1e-3);
+
+        // Frequencies of the samples
+        const int N = 200000;
+        std::mt19937 gen(42);
+        std::uniform_real_distribution<double> dist;
+        std::vector<int> counts(NumTheta * NumPhi, 0);
+        for (int j = 0; j < N; j++)
+        {
+            counts[Bin(sample(Vec2(Float(dist(gen)), Float(dist(gen)))))]++;
+        }
+        for (int i = 0; i < NumTheta * NumPhi; i++)
+        {
+            const double tol = 5 * std::sqrt(expected[i] / N) + 1e-3;
+            EXPECT_NEAR(expected[i], (double)(counts[i]) / N, tol) << "bin " << i;
+        }
+    }
+
+    PropertyTree::UniquePtr prop{ nullptr, nullptr };
+    Texture::UniquePtr envmap{ nullptr, nullptr };
+    Assets::UniquePtr assets{ nullptr, nullptr };
+    Light::UniquePtr light{ nullptr, nullptr };
+    Scene3::UniquePtr scene{ nullptr, nullptr };
+};
+
+// Directions sampled by SamplePositionAndDirection follow EvaluateDirectionPDF
+TEST_F(LightEnvTest, ConsistentDirectionPDF)
+{
+    ExpectConsistent(
+        [&](const Vec2& u) -> Vec3
+        {
+            SurfaceGeometry geom;
+            Vec3 wo;
+            light->SamplePositionAndDirection(u, Vec2(0.5_f), geom, wo);
+            return -wo;
+        },
+        [&](const Vec3& d) -> double
+        {
+            return light->EvaluateDirectionPDF(SurfaceGeometry(), SurfaceInteractionType::L, Vec3(), -d, false).v;
+        });
+}
+
+// Positions sampled by SamplePositionGivenPreviousPosition follow EvaluatePositionGivenPreviousPositionPDF
+// evaluated at the intersections with the emitter shape
+TEST_F(LightEnvTest, ConsistentPositionGivenPreviousPositionPDF)
+{
+    SurfaceGeometry geomPrev;
+    geomPrev.degenerated = false;
+    geomPrev.p = Vec3(0.2_f, -0.1_f, 0.3_f);
+
+    ExpectConsistent(
+        [&](const Vec2& u) -> Vec3
+        {
+            SurfaceGeometry geom;
+            light->SamplePositionGivenPreviousPosition(u, geomPrev, geom);
+            return Math::Normalize(geom.p - geomPrev.p);
+        },
+        [&](const Vec3& d) -> double
+        {
+            // Convert the PDF to the solid angle measure at the previous position
+            Intersection isect;
+            if (!light->GetEmitterShape()->Intersect(Ray{ geomPrev.p, d }, 0_f, Math::Inf(), isect)) return 0;
+            const auto pdfA = light->EvaluatePositionGivenPreviousPositionPDF(isect.geom, geomPrev, false).v;
+            const auto pp = isect.geom.p - geomPrev.p;
+            return pdfA * Math::Length2(pp) / Math::Abs(Math::Dot(isect.geom.sn, d));
+        });
+}
+
+LM_TEST_NAMESPACE_END
@@ -0,0 +1,197 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch_test.h>
+#include <lightmetrica/detail/photonmap.h>
+#include <lightmetrica/detail/hashgrid.h>
+#include <lightmetrica/random.h>
+#include <lightmetrica-test/utils.h>
+
+LM_TEST_NAMESPACE_BEGIN
+
+struct PhotonMapTest : public ::testing::TestWithParam<const char*> {};
+
+INSTANTIATE_TEST_CASE_P(PhotonMapTypes, PhotonMapTest, ::testing::Values("photonmap::naive", "photonmap::kdtree", "photonmap::flatkdtree", "photonmap::hashgrid", "photonmap::hashgrid_compact"));
+
+namespace
+{
+    // Photons clustered around a few points to produce unbalanced trees.
+    // The positions are representable in single precision as the hash grid stores them so.
+    auto GeneratePhotons(Random& rng, int n) -> std::vector<Photon>
+    {
+        std::vector<Photon> photons(n);
+        for (int i = 0; i < n; i++)
+        {
+            const Vec3 center((Float)(i % 3), 0_f, (Float)(i % 5) * 0.1_f);
+            const auto p = center + Vec3(rng.Next(), rng.Next(), rng.Next()) * (i % 2 == 0 ? 0.1_f : 1_f);
+            photons[i].p = Vec3(Float(float(p.x)), Float(float(p.y)), Float(float(p.z)));
+            photons[i].throughput = SPD(1_f);
+            photons[i].wi = Vec3(0_f, 1_f, 0_f);
+            photons[i].numVertices = i;
+        }
+        return photons;
+    }
+}
+
+TEST_P(PhotonMapTest, CollectPhotons)
+{
+    Random rng;
+    rng.SetSeed(42);
+    const int N = 20000;
+    auto photons = GeneratePhotons(rng, N);
+    const auto reference = photons;
+
+    const auto pm = ComponentFactory::Create<PhotonMap>(GetParam());
+    ASSERT_TRUE(pm != nullptr);
+    pm->SetMaxRadius(0.25_f);
+    pm->Build(std::move(photons));
+
+    for (int q = 0; q < 100; q++)
+    {
+        const Vec3 p(rng.Next() * 3_f, rng.Next(), rng.Next());
+        const Float radius = 0.05_f + rng.Next() * 0.2_f;    // Within the max radius
+
+        // Photons are identified by the number of vertices
+        std::vector<int> expected;
+        for (const auto& photon : reference)
+        {
+            if (Math::Length2(photon.p - p) < radius * radius)
+            {
+                expected.push_back(photon.numVertices);
+            }
+        }
+
+        std::vector<int> collected;
+        pm->CollectPhotons(p, radius, [&](const Photon& photon) -> void
+        {
+            collected.push_back(photon.numVertices);
+        });
+
+        std::sort(expected.begin(), expected.end());
+        std::sort(collected.begin(), collected.end());
+        EXPECT_EQ(expected, collected);
+    }
+}
+
+// Queries with the radii larger than the one assumed in the build, with the excluded points
+TEST(HashGridTest, RangeQuery)
+{
+    Random rng;
+    rng.SetSeed(42);
+    const int N = 1000;
+    const auto photons = GeneratePhotons(rng, N);
+
+    HashGrid grid;
+    std::vector<int> sortedToIndex(N, -1);
+    grid.Build(N, 0.1_f, [&](int i, Vec3& p) -> bool
+    {
+        p = photons[i].p;
+        return i % 3 != 0;
+    }, [&](int i, int j) -> void
+    {
+        sortedToIndex[j] = i;
+    });
+    EXPECT_EQ(N - (N + 2) / 3, grid.NumPoints());
+
+    for (int q = 0; q < 100; q++)
+    {
+        const Vec3 p(rng.Next() * 3_f, rng.Next(), rng.Next());
+        const Float radius = q < 50 ? 0.05_f : rng.Next() * 3_f;
+
+        std::vector<int> expected;
+        for (int i = 0; i < N; i++)
+        {
+            if (i % 3 != 0 && Math::Length2(photons[i].p - p) < radius * radius)
+            {
+                expected.push_back(i);
+            }
+        }
+
+        std::vector<int> found;
+        grid.RangeQuery(p, radius, [&](int j) -> void
+        {
+            EXPECT_EQ(photons[sortedToIndex[j]].p, grid.Position(j));
+            found.push_back(sortedToIndex[j]);
+        });
+
+        std::sort(expected.begin(), expected.end());
+        std::sort(found.begin(), found.end());
+        EXPECT_EQ(expected, found);
+    }
+}
+
+// Inputs exceeding the index range are rejected without touching the points
+TEST(HashGridTest, TooManyPoints)
+{
+    HashGrid grid;
+    ASSERT_TRUE(grid.Build(1, 0.1_f, [](int i, Vec3& p) -> bool { p = Vec3(); return true; }, [](int i, int j) -> void {}));
+    EXPECT_EQ(1, grid.NumPoints());
+
+    bool called = false;
+    EXPECT_FALSE(grid.Build(HashGrid::MaxNumPoints + 1, 0.1_f, [&](int i, Vec3& p) -> bool
+    {
+        called = true;
+        return false;
+    }, [&](int i, int j) -> void
+    {
+        called = true;
+    }));
+    EXPECT_FALSE(called);
+    EXPECT_EQ(0, grid.NumPoints());
+
+    int count = 0;
+    grid.RangeQuery(Vec3(), 1_f, [&](int j) -> void { count++; });
+    EXPECT_EQ(0, count);
+}
+
+TEST(CompactPhotonTest, EncodeDecode)
+{
+    Random rng;
+    rng.SetSeed(42);
+    for (int i = 0; i < 1000; i++)
+    {
+        Photon photon;
+        photon.p = Vec3(rng.Next(), rng.Next(), rng.Next());
+        photon.throughput = SPD(Vec3(rng.Next(), rng.Next(), rng.Next()) * 100_f);
+        photon.wi = Math::Normalize(Vec3(rng.Next(), rng.Next(), rng.Next()) * 2_f - Vec3(1_f));
+        photon.numVertices = i;
+
+        const auto decoded = CompactPhoton::Encode(photon).Decode(photon.p);
+        EXPECT_EQ(photon.p, decoded.p);
+        EXPECT_EQ(photon.numVertices, decoded.numVertices);
+
+        // Error bounds documented in CompactPhoton
+        const auto c1 = photon.throughput.ToRGB();
+        const auto c2 = decoded.throughput.ToRGB();
+        const auto m = std::max(c1.x, std::max(c1.y, c1.z));
+        for (int j = 0; j < 3; j++)
+        {
+            EXPECT_LE(Math::Abs(c1[j] - c2[j]), m * 0.0040_f);
+        }
+        EXPECT_GT(Math::Dot(photon.wi, decoded.wi), Math::Cos(Math::Radians(2.1_f)));
+    }
+}
+
+LM_TEST_NAMESPACE_END
@@ -0,0 +1,268 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch_test.h>
+#include <lightmetrica/renderer.h>
+#include <lightmetrica/scene3.h>
+#include <lightmetrica/assets.h>
+#include <lightmetrica/accel3.h>
+#include <lightmetrica/film.h>
+#include <lightmetrica/sensor.h>
+#include <lightmetrica/primitive.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/random.h>
+#include <lightmetrica/detail/russianroulette.h>
+#include <lightmetrica/detail/subpathsampler.h>
+#include <lightmetrica-test/utils.h>
+
+LM_TEST_NAMESPACE_BEGIN
+
+struct RendererPMTest : public ::testing::Test
+{
+    virtual auto SetUp() -> void override { Logger::SetVerboseLevel(2); Logger::Run(); }
+    virtual auto TearDown() -> void override { Logger::Stop(); }
+};
+
+// --------------------------------------------------------------------------------
+
+namespace
+{
+    // Diffuse floor lit by an area light facing down, seen from straight above.
+    // Every pixel sees the floor so that the noise of the eye rays is small even with one sample per pixel.
+    const std::string PMTestScene = TestUtils::MultiLineLiteral(R"x(
+    | assets:
+    |   film_1:
+    |     interface: film
+    |     type: hdr
+    |     params:
+    |       w: 16
+    |       h: 16
+    |
+    |   sensor_1:
+    |     interface: sensor
+    |     type: pinhole
+    |     params:
+    |       film: film_1
+    |       fov: 45
+    |
+    |   floor_mesh:
+    |     interface: trianglemesh
+    |     type: raw
+    |     params:
+    |       positions: -1 0 -1 1 0 -1 1 0 1 -1 0 1
+    |       normals: 0 1 0 0 1 0 0 1 0 0 1 0
+    |       faces: 0 2 1 0 3 2
+    |
+    |   light_mesh:
+    |     interface: trianglemesh
+    |     type: raw
+    |     params:
+    |       positions: -0.5 1 -0.5 0.5 1 -0.5 0.5 1 0.5 -0.5 1 0.5
+    |       normals: 0 -1 0 0 -1 0 0 -1 0 0 -1 0
+    |       faces: 0 1 2 0 2 3
+    |
+    |   diffuse_white:
+    |     interface: bsdf
+    |     type: diffuse
+    |     params:
+    |       R: 0.8 0.8 0.8
+    |
+    |   light_1:
+    |     interface: light
+    |     type: area
+    |     params:
+    |       Le: 1 1 1
+    |
+    | scene:
+    |   sensor: sensor_node
+    |   nodes:
+    |     - id: sensor_node
+    |       transform:
+    |         lookat:
+    |           eye: 0 0.5 0
+    |           center: 0 0 0
+    |           up: 0 0 1
+    |       sensor: sensor_1
+    |
+    |     - id: floor
+    |       mesh: floor_mesh
+    |       bsdf: diffuse_white
+    |
+    |     - id: light
+    |       mesh: light_mesh
+    |       light: light_1
+    )x");
+
+    // Luminance of the pixels of the image rendered by the photon mapping with the batch size
+    auto RenderPM(long long photonBatchSize) -> std::vector<double>
+    {
+        const auto prop = ComponentFactory::Create<PropertyTree>();
+        EXPECT_TRUE(prop->LoadFromString(PMTestScene));
+
+        const auto assets = ComponentFactory::Create<Assets>("assets::assets3");
+        EXPECT_TRUE(assets->Initialize(prop->Root()->Child("assets")));
+        const auto accel = ComponentFactory::Create<Accel3>("accel::naive");
+        EXPECT_TRUE(accel->Initialize(nullptr));
+        const auto scene = ComponentFactory::Create<Scene3>("scene::scene3");
+        EXPECT_TRUE(scene->Initialize(prop->Root()->Child("scene"), assets.get(), accel.get()));
+
+        const auto rendererProp = ComponentFactory::Create<PropertyTree>();
+        EXPECT_TRUE(rendererProp->LoadFromString(boost::str(boost::format(TestUtils::MultiLineLiteral(R"x(
+        | num_samples: 256
+        | num_photon_trace_samples: 400000
+        | photon_batch_size: %d
+        | max_num_vertices: 3
+        | finalgather: 0
+        | radius: 0.5
+        | photonmap: naive
+        )x")) % photonBatchSize)));
+        const auto renderer = ComponentFactory::Create<Renderer>("renderer::pm");
+        EXPECT_TRUE(renderer->Initialize(rendererProp->Root()));
+
+        Random initRng;
+        initRng.SetSeed(42);
+        // The film appends the extension to the output path
+        const auto outputPath = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("lightmetrica-test-%%%%-%%%%")).string();
+        renderer->Render(scene.get(), &initRng, outputPath);
+        boost::filesystem::remove(outputPath + ".hdr");
+
+        const auto* film = static_cast<const Sensor*>(scene->GetSensor()->emitter)->GetFilm();
+        std::vector<double> pixels;
+        for (int y = 0; y < film->Height(); y++)
+        {
+            for (int x = 0; x < film->Width(); x++)
+            {
+                pixels.push_back(film->GetPixel(x, y).Luminance());
+            }
+        }
+        return pixels;
+    }
+}
+
+// Images rendered with and without batches of photons agree pixel by pixel.
+// The gather points are traced with the same seed so the images differ only by the noise of the photons,
+// and with one sample per pixel, the image of a batch leaking into the next one is not hidden by the scheduler's rescaling.
+TEST_F(RendererPMTest, BatchedMatchesUnbatched)
+{
+    const auto unbatched = RenderPM(0);
+    const auto batched = RenderPM(100000);
+    ASSERT_EQ(unbatched.size(), batched.size());
+    EXPECT_GT(std::accumulate(unbatched.begin(), unbatched.end(), 0.0), 0);
+    for (size_t i = 0; i < unbatched.size(); i++)
+    {
+        // The pixels without eye samples are zero in both images
+        EXPECT_NEAR(unbatched[i], batched[i], 0.05 * unbatched[i]) << "pixel " << i;
+    }
+}
+
+namespace
+{
+    struct PMTestSceneInstance
+    {
+        PropertyTree::UniquePtr prop{ nullptr, nullptr };
+        Assets::UniquePtr assets{ nullptr, nullptr };
+        Accel3::UniquePtr accel{ nullptr, nullptr };
+        Scene3::UniquePtr scene{ nullptr, nullptr };
+    };
+
+    auto LoadPMTestScene(PMTestSceneInstance& instance) -> bool
+    {
+        instance.prop = ComponentFactory::Create<PropertyTree>();
+        instance.assets = ComponentFactory::Create<Assets>("assets::assets3");
+        instance.accel = ComponentFactory::Create<Accel3>("accel::naive");
+        instance.scene = ComponentFactory::Create<Scene3>("scene::scene3");
+        return instance.prop->LoadFromString(PMTestScene)
+            && instance.assets->Initialize(instance.prop->Root()->Child("assets"))
+            && instance.accel->Initialize(nullptr)
+            && instance.scene->Initialize(instance.prop->Root()->Child("scene"), instance.assets.get(), instance.accel.get());
+    }
+
+    auto LoadRussianRoulette(const std::string& props, RussianRoulette& rr) -> bool
+    {
+        const auto prop = ComponentFactory::Create<PropertyTree>();
+        return prop->LoadFromString(props) && rr.Load(prop->Root());
+    }
+}
+
+// The reference of the adaptive Russian roulette for the photons is the flux per photon.
+// The photons leave the area light with the constant throughput pi * Le * area.
+TEST_F(RendererPMTest, LightReference)
+{
+    PMTestSceneInstance instance;
+    ASSERT_TRUE(LoadPMTestScene(instance));
+
+    RussianRoulette rr;
+    ASSERT_TRUE(LoadRussianRoulette("rr: adaptive", rr));
+    EXPECT_EQ(1_f, rr.LightReference());
+
+    Random initRng;
+    initRng.SetSeed(42);
+    rr.EstimateLightReference(instance.scene.get(), &initRng);
+    EXPECT_NEAR(Math::Pi(), rr.LightReference(), 1e-2_f);
+}
+
+// Subpaths traced with the Russian roulette reach the vertices after the first hit with the survival probability
+// and keep the expected throughput
+TEST_F(RendererPMTest, TraceSubpathWithRussianRoulette)
+{
+    PMTestSceneInstance instance;
+    ASSERT_TRUE(LoadPMTestScene(instance));
+
+    RussianRoulette rr;
+    ASSERT_TRUE(LoadRussianRoulette("rr_prob: 0.25", rr));
+
+    const int N = 200000;
+    const auto Trace = [&](bool useRR, long long& count, double& sum) -> void
+    {
+        Random rng;
+        rng.SetSeed(42);
+        count = 0;
+        sum = 0;
+        const auto process = [&](int numVertices, const Vec2& /*rasterPos*/, const SubpathSampler::PathVertex& /*pv*/, const SubpathSampler::PathVertex& /*v*/, SPD& throughput) -> bool
+        {
+            if (numVertices == 3)
+            {
+                count++;
+                sum += throughput.Luminance();
+            }
+            return true;
+        };
+        for (int i = 0; i < N; i++)
+        {
+            if (useRR) SubpathSampler::TraceSubpath(instance.scene.get(), &rng, 3, TransportDirection::EL, rr, process);
+            else       SubpathSampler::TraceSubpath(instance.scene.get(), &rng, 3, TransportDirection::EL, process);
+        }
+    };
+
+    long long countRR, count;
+    double sumRR, sum;
+    Trace(true, countRR, sumRR);
+    Trace(false, count, sum);
+    ASSERT_GT(count, 1000);
+    EXPECT_NEAR(0.25, (double)(countRR) / count, 0.02);
+    EXPECT_NEAR(sum / N, sumRR / N, 0.05 * sum / N);
+}
+
+LM_TEST_NAMESPACE_END
@@ -0,0 +1,92 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch_test.h>
+#include <lightmetrica/detail/russianroulette.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica-test/utils.h>
+
+LM_TEST_NAMESPACE_BEGIN
+
+namespace
+{
+    // Expected total weight of the paths continued from the path with the weight `w`
+    auto ExpectedWeight(const RussianRoulette& rr, Float reference, Float w) -> double
+    {
+        const int N = 100000;
+        double sum = 0;
+        for (int j = 0; j < N; j++)
+        {
+            SPD throughput(w);
+            const int n = rr.Evaluate(reference, throughput, (Float(j) + .5_f) / Float(N), 8);
+            sum += n * throughput.Luminance();
+        }
+        return sum / N;
+    }
+}
+
+TEST(RussianRouletteTest, Fixed)
+{
+    const auto prop = ComponentFactory::Create<PropertyTree>();
+    ASSERT_TRUE(prop->LoadFromString("rr_prob: 0.25"));
+    RussianRoulette rr;
+    ASSERT_TRUE(rr.Load(prop->Root()));
+    EXPECT_EQ(RussianRoulette::Mode::Fixed, rr.GetMode());
+
+    SPD throughput(1_f);
+    EXPECT_EQ(1, rr.Evaluate(1_f, throughput, 0.1_f, 8));
+    EXPECT_NEAR(4.0, throughput.Luminance(), 1e-4);
+    EXPECT_EQ(0, rr.Evaluate(1_f, throughput, 0.5_f, 8));
+}
+
+TEST(RussianRouletteTest, Adaptive_Unbiased)
+{
+    const auto prop = ComponentFactory::Create<PropertyTree>();
+    ASSERT_TRUE(prop->LoadFromString(TestUtils::MultiLineLiteral(R"x(
+    | rr: adaptive
+    | rr_window_size: 5
+    | rr_max_split: 4
+    )x")));
+    RussianRoulette rr;
+    ASSERT_TRUE(rr.Load(prop->Root()));
+    EXPECT_EQ(RussianRoulette::Mode::Adaptive, rr.GetMode());
+
+    // Below, inside, and above the weight window
+    for (const auto w : { 0.01_f, 0.1_f, 1_f, 2_f, 10_f })
+    {
+        EXPECT_NEAR(w, ExpectedWeight(rr, 1_f, w), 1e-3 * w);
+    }
+
+    // Paths above the window are split
+    SPD throughput(10_f);
+    EXPECT_EQ(4, rr.Evaluate(1_f, throughput, 0.5_f, 8));
+    EXPECT_NEAR(2.5, throughput.Luminance(), 1e-4);
+
+    // Splitting is limited by the caller
+    throughput = SPD(10_f);
+    EXPECT_EQ(2, rr.Evaluate(1_f, throughput, 0.5_f, 2));
+}
+
+LM_TEST_NAMESPACE_END
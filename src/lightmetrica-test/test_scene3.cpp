@@ -29,6 +29,8 @@
 #include <lightmetrica-test/utils.h>
 #include <lightmetrica/assets.h>
 #include <lightmetrica/accel3.h>
+#include <lightmetrica/intersection.h>
+#include <lightmetrica/emitter.h>
 #include <lightmetrica/light.h>
 #include <lightmetrica/sensor.h>
 #include <lightmetrica/bsdf.h>
@@ -125,7 +127,7 @@ struct Stub_TriangleMesh_1 : public TriangleMesh
     LM_IMPL_CLASS(Stub_TriangleMesh_1, TriangleMesh);
     LM_IMPL_F(Load) = [this](const PropertyNode* prop, Assets* assets, const Primitive* primitive) -> bool { return true; };
     LM_IMPL_F(NumVertices) = [this]() -> int { return 0; };
-    LM_IMPL_F(Positions) = [this]() -> const Float*{ return nullptr; };
+    LM_IMPL_F(Positions) = [this]() -> const GeomFloat* { return nullptr; };
 };
 
 struct Stub_TriangleMesh_2 : public TriangleMesh
@@ -133,7 +135,7 @@ struct Stub_TriangleMesh_2 : public TriangleMesh
     LM_IMPL_CLASS(Stub_TriangleMesh_2, TriangleMesh);
     LM_IMPL_F(Load) = [this](const PropertyNode* prop, Assets* assets, const Primitive* primitive) -> bool { return true; };
     LM_IMPL_F(NumVertices) = [this]() -> int { return 0; };
-    LM_IMPL_F(Positions) = [this]() -> const Float*{ return nullptr; };
+    LM_IMPL_F(Positions) = [this]() -> const GeomFloat* { return nullptr; };
 };
 
 LM_COMPONENT_REGISTER_IMPL(Stub_Sensor, "sensor::stub_sensor");
@@ -376,11 +378,11 @@ struct Stub_BSDF_Serializable : public BSDF
 struct Stub_TriangleMesh_Serializable : public TriangleMesh
 {
     int nv_ = 1;
-    std::vector<Float> ps_{ 1_f, 2_f, 3_f };
+    std::vector<GeomFloat> ps_{ 1, 2, 3 };
     LM_IMPL_CLASS(Stub_TriangleMesh_Serializable, TriangleMesh);
     LM_IMPL_F(Load) = [this](const PropertyNode* prop, Assets* assets, const Primitive* primitive) -> bool { return true; };
     LM_IMPL_F(NumVertices) = [this]() -> int { return nv_; };
-    LM_IMPL_F(Positions) = [this]() -> const Float* { return ps_.data(); };
+    LM_IMPL_F(Positions) = [this]() -> const GeomFloat* { return ps_.data(); };
     LM_IMPL_F(Serialize) = [this](std::ostream& stream) -> bool
     {
         cereal::PortableBinaryOutputArchive oa(stream);
@@ -456,9 +458,193 @@ TEST_F(Scene3Test, SerializationWithAssets)
     ASSERT_NE(nullptr, n2->mesh);
     EXPECT_EQ("mesh_1", n2->mesh->ID());
     EXPECT_EQ(1, n2->mesh->NumVertices());
-    EXPECT_TRUE(ExpectNear(1_f, n2->mesh->Positions()[0]));
-    EXPECT_TRUE(ExpectNear(2_f, n2->mesh->Positions()[1]));
-    EXPECT_TRUE(ExpectNear(3_f, n2->mesh->Positions()[2]));
+    EXPECT_TRUE(ExpectNear(1_f, Float(n2->mesh->Positions()[0])));
+    EXPECT_TRUE(ExpectNear(2_f, Float(n2->mesh->Positions()[1])));
+    EXPECT_TRUE(ExpectNear(3_f, Float(n2->mesh->Positions()[2])));
+}
+
+// --------------------------------------------------------------------------------
+
+// Tests the inverse of the emitter selection with the light selection strategies
+TEST_F(Scene3Test, SampleEmitter_Inverse)
+{
+    // Three area lights with different power
+    const auto Input = TestUtils::MultiLineLiteral(R"x(
+    | assets:
+    |   film_1:
+    |     interface: film
+    |     type: hdr
+    |     params:
+    |       w: 4
+    |       h: 4
+    |   sensor_1:
+    |     interface: sensor
+    |     type: pinhole
+    |     params:
+    |       film: film_1
+    |       fov: 45
+    |   light_mesh:
+    |     interface: trianglemesh
+    |     type: raw
+    |     params:
+    |       positions: -0.5 1 -0.5 0.5 1 -0.5 0.5 1 0.5 -0.5 1 0.5
+    |       normals: 0 -1 0 0 -1 0 0 -1 0 0 -1 0
+    |       faces: 0 1 2 0 2 3
+    |   light_1:
+    |     interface: light
+    |     type: area
+    |     params:
+    |       Le: 1 1 1
+    |   light_2:
+    |     interface: light
+    |     type: area
+    |     params:
+    |       Le: 5 5 5
+    |   light_3:
+    |     interface: light
+    |     type: area
+    |     params:
+    |       Le: 2 2 2
+    |
+    | scene:
+    |   sensor: n1
+    |   light_selection: %s
+    |   nodes:
+    |     - id: n1
+    |       sensor: sensor_1
+    |     - id: l1
+    |       mesh: light_mesh
+    |       light: light_1
+    |     - id: l2
+    |       mesh: light_mesh
+    |       light: light_2
+    |     - id: l3
+    |       mesh: light_mesh
+    |       light: light_3
+    )x");
+
+    for (const std::string selection : { "uniform", "power", "bvh" })
+    {
+        const auto prop = ComponentFactory::Create<PropertyTree>();
+        ASSERT_TRUE(prop->LoadFromString(boost::str(boost::format(Input) % selection)));
+        const auto assets = ComponentFactory::Create<Assets>("assets::assets3");
+        ASSERT_TRUE(assets->Initialize(prop->Root()->Child("assets")));
+        const auto accel = ComponentFactory::Create<Accel3>("Stub_Accel");
+        const auto scene = ComponentFactory::Create<Scene3>("scene::scene3");
+        ASSERT_TRUE(scene->Initialize(prop->Root()->Child("scene"), assets.get(), accel.get()));
+
+        // The inverse is mapped back to the same emitter,
+        // and the inverses of the samples are uniformly distributed in [0, 1)
+        const int N = 10000;
+        const int NumBins = 10;
+        std::vector<int> counts(NumBins, 0);
+        for (int j = 0; j < N; j++)
+        {
+            const auto* L = scene->SampleEmitter(SurfaceInteractionType::L, (Float(j) + .5_f) / Float(N));
+            ASSERT_NE(nullptr, L);
+            const auto u = scene->SampleEmitter_Inverse(L, Float((j * 7919) % N) / Float(N), Float((j * 104729) % N) / Float(N));
+            EXPECT_EQ(L, scene->SampleEmitter(SurfaceInteractionType::L, u));
+            counts[std::min((int)(u * NumBins), NumBins - 1)]++;
+        }
+        for (int k = 0; k < NumBins; k++)
+        {
+            EXPECT_NEAR(1.0 / NumBins, (double)(counts[k]) / N, 2e-2);
+        }
+
+        const auto* E = scene->GetSensor();
+        EXPECT_EQ(E, scene->SampleEmitter(SurfaceInteractionType::E, scene->SampleEmitter_Inverse(E, 0.3_f, 0.7_f)));
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+// The stream query agrees with `Intersect` including the emitter shapes
+TEST_F(Scene3Test, IntersectStream_EmitterShapes)
+{
+    const auto prop = ComponentFactory::Create<PropertyTree>();
+    ASSERT_TRUE(prop->LoadFromString(TestUtils::MultiLineLiteral(R"x(
+    | assets:
+    |   film_1:
+    |     interface: film
+    |     type: hdr
+    |     params:
+    |       w: 4
+    |       h: 4
+    |   sensor_1:
+    |     interface: sensor
+    |     type: pinhole
+    |     params:
+    |       film: film_1
+    |       fov: 45
+    |   quad:
+    |     interface: trianglemesh
+    |     type: raw
+    |     params:
+    |       positions: -1 1 -1 1 1 -1 1 1 1 -1 1 1
+    |       normals: 0 -1 0 0 -1 0 0 -1 0 0 -1 0
+    |       faces: 0 1 2 0 2 3
+    |   light_1:
+    |     interface: light
+    |     type: area
+    |     params:
+    |       Le: 1 1 1
+    |   light_env:
+    |     interface: light
+    |     type: env
+    |     params:
+    |       Le: 1 1 1
+    |
+    | scene:
+    |   sensor: n1
+    |   nodes:
+    |     - id: n1
+    |       sensor: sensor_1
+    |     - id: l1
+    |       mesh: quad
+    |       light: light_1
+    |     - id: l2
+    |       light: light_env
+    )x")));
+    const auto assets = ComponentFactory::Create<Assets>("assets::assets3");
+    ASSERT_TRUE(assets->Initialize(prop->Root()->Child("assets")));
+    const auto accel = ComponentFactory::Create<Accel3>("accel::bvh");
+    ASSERT_TRUE(accel->Initialize(nullptr));
+    const auto scene = ComponentFactory::Create<Scene3>("scene::scene3");
+    ASSERT_TRUE(scene->Initialize(prop->Root()->Child("scene"), assets.get(), accel.get()));
+
+    // Rays from the origin toward the whole sphere; about a quarter hits the quad
+    const int N = 1000;
+    std::vector<Ray> rays(N);
+    std::vector<Float> minT(N, Math::EpsIsect());
+    std::vector<Float> maxT(N, Math::Inf());
+    std::vector<Intersection> isects(N);
+    std::unique_ptr<bool[]> hits(new bool[N]);
+    for (int i = 0; i < N; i++)
+    {
+        const Float z = 1_f - 2_f * (Float(i) + .5_f) / Float(N);
+        const Float r = Math::Sqrt(std::max(0_f, 1_f - z * z));
+        const Float phi = Float(i) * 2.399963_f;
+        rays[i].o = Vec3();
+        rays[i].d = Vec3(r * Math::Cos(phi), z, r * Math::Sin(phi));
+    }
+    scene->IntersectStream(N, rays.data(), minT.data(), maxT.data(), isects.data(), hits.get());
+
+    int numEnvHits = 0;
+    for (int i = 0; i < N; i++)
+    {
+        Intersection isect;
+        const bool hit = scene->Intersect(rays[i], isect);
+        ASSERT_EQ(hit, hits[i]);
+        ASSERT_TRUE(hit);
+        EXPECT_EQ(isect.primitive, isects[i].primitive);
+        EXPECT_TRUE(ExpectVecNear(isect.geom.p, isects[i].geom.p, Math::EpsLarge()));
+        if (isects[i].primitive->emitter->GetEmitterShape.Implemented())
+        {
+            numEnvHits++;
+        }
+    }
+    EXPECT_GT(numEnvHits, 0);
+    EXPECT_LT(numEnvHits, N);
 }
 
 // --------------------------------------------------------------------------------
@@ -0,0 +1,164 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch_test.h>
+#include <lightmetrica/detail/sdtree.h>
+#include <lightmetrica-test/utils.h>
+#include <random>
+
+LM_TEST_NAMESPACE_BEGIN
+
+namespace
+{
+    // Incident radiance with a bright lobe on a smooth gradient
+    auto TestRadiance(const Vec3& d) -> Float
+    {
+        const auto c = Math::Dot(d, Math::Normalize(Vec3(0.3_f, -0.5_f, 0.8_f)));
+        return 0.1_f + 0.5_f * (d.x + 1_f) + (c > 0.9_f ? 50_f : 0_f);
+    }
+
+    // Learns the radiance with the same schedule as the renderer: the tree refined by the records
+    // of a pass receives the records of the next pass
+    auto TrainDTree(int numPasses) -> GuidingDTree
+    {
+        std::mt19937 gen(42);
+        std::uniform_real_distribution<double> dist;
+        GuidingDTree dtree;
+        for (int pass = 0; pass < numPasses; pass++)
+        {
+            if (pass > 0)
+            {
+                dtree.Refine(0.01_f, 20);
+            }
+            for (int j = 0; j < 100000; j++)
+            {
+                const Vec2 p(Float(dist(gen)), Float(dist(gen)));
+                dtree.Record(p, TestRadiance(GuidingDTree::CanonicalToDir(p)));
+            }
+        }
+        return dtree;
+    }
+}
+
+// --------------------------------------------------------------------------------
+
+// Directions sampled from the quadtree follow EvaluatePDF
+TEST(SDTreeTest, ConsistentDTree)
+{
+    const auto dtree = TrainDTree(4);
+    ASSERT_GT(dtree.nodes.size(), 1u);
+
+    const int NumTheta = 4;
+    const int NumPhi = 8;
+    const int NumSub = 64;
+    const auto Dir = [](Float theta, Float phi) -> Vec3
+    {
+        return Vec3(Math::Sin(theta) * Math::Cos(phi), Math::Sin(theta) * Math::Sin(phi), Math::Cos(theta));
+    };
+    const auto Bin = [&](const Vec3& d) -> int
+    {
+        const auto theta = Math::Acos(Math::Clamp(d.z, -1_f, 1_f));
+        auto phi = std::atan2(d.y, d.x);
+        if (phi < 0_f) phi += 2_f * Math::Pi();
+        const int y = Math::Clamp((int)(theta / Math::Pi() * NumTheta), 0, NumTheta - 1);
+        const int x = Math::Clamp((int)(phi / (2_f * Math::Pi()) * NumPhi), 0, NumPhi - 1);
+        return y * NumPhi + x;
+    };
+
+    // Expected probabilities with the midpoint rule
+    std::vector<double> expected(NumTheta * NumPhi, 0);
+    const double dTheta = Math::Pi() / (NumTheta * NumSub);
+    const double dPhi = 2 * Math::Pi() / (NumPhi * NumSub);
+    for (int y = 0; y < NumTheta * NumSub; y++)
+    {
+        for (int x = 0; x < NumPhi * NumSub; x++)
+        {
+            const auto theta = Float((y + .5) * dTheta);
+            const auto phi = Float((x + .5) * dPhi);
+            const auto d = Dir(theta, phi);
+            expected[(y / NumSub) * NumPhi + x / NumSub] += dtree.EvaluatePDF(GuidingDTree::DirToCanonical(d)) * Math::Sin(theta) * dTheta * dPhi;
+        }
+    }
+
+    // PDF integrates to one
+    double sum = 0;
+    for (const auto& p : expected) { sum += p; }
+    EXPECT_NEAR(1.0, sum, 1e-2);
+
+    // Frequencies of the samples
+    const int N = 200000;
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist;
+    std::vector<int> counts(NumTheta * NumPhi, 0);
+    for (int j = 0; j < N; j++)
+    {
+        const auto p = dtree.Sample(Vec2(Float(dist(gen)), Float(dist(gen))));
+        counts[Bin(GuidingDTree::CanonicalToDir(p))]++;
+    }
+    for (int i = 0; i < NumTheta * NumPhi; i++)
+    {
+        const double tol = 5 * std::sqrt(expected[i] / N) + 1e-3;
+        EXPECT_NEAR(expected[i], (double)(counts[i]) / N, tol) << "bin " << i;
+    }
+}
+
+// The density of a sampled point matches EvaluatePDF of the leaf containing it
+TEST(SDTreeTest, SampleInsideNonZeroLeaf)
+{
+    const auto dtree = TrainDTree(3);
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> dist;
+    for (int j = 0; j < 10000; j++)
+    {
+        const auto p = dtree.Sample(Vec2(Float(dist(gen)), Float(dist(gen))));
+        EXPECT_GE(p.x, 0_f); EXPECT_LE(p.x, 1_f);
+        EXPECT_GE(p.y, 0_f); EXPECT_LE(p.y, 1_f);
+        EXPECT_GT(dtree.EvaluatePDF(p), 0_f);
+    }
+}
+
+// Spatial leaves are split by the number of the records and keep the learned distributions
+TEST(SDTreeTest, STreeEndPass)
+{
+    Bound bound;
+    bound.min = Vec3(-1_f);
+    bound.max = Vec3(1_f);
+    GuidingSTree stree;
+    stree.Initialize(bound);
+    const Vec3 p(0.3_f, -0.2_f, 0.5_f);
+    for (int j = 0; j < 1000; j++)
+    {
+        stree.Lookup(p).building.Record(Vec2(0.75_f, 0.25_f), 1_f);
+    }
+    stree.EndPass(100_f, 0.01_f, 20);
+    EXPECT_GT(stree.nodes.size(), 1u);
+
+    // The leaf containing the records samples the quadrant of the records
+    const auto& leaf = stree.Lookup(p);
+    EXPECT_NEAR(4_f * 0.25_f * Math::InvPi(), leaf.sampling.EvaluatePDF(Vec2(0.75_f, 0.25_f)), 1e-4_f);
+    EXPECT_EQ(0_f, leaf.sampling.EvaluatePDF(Vec2(0.25_f, 0.75_f)));
+}
+
+LM_TEST_NAMESPACE_END
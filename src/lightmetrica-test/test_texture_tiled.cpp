@@ -0,0 +1,123 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+
+#include <pch_test.h>
+#include <lightmetrica/texture.h>
+#include <lightmetrica/property.h>
+#include <lightmetrica/detail/texturecache.h>
+#include <lightmetrica-test/utils.h>
+
+LM_TEST_NAMESPACE_BEGIN
+
+struct TiledTextureTest : public ::testing::Test
+{
+    virtual auto SetUp() -> void override
+    {
+        Logger::Run();
+
+        // 4x4 PFM image whose red channel is the x coordinate of the texel
+        dir_ = boost::filesystem::temp_directory_path();
+        filename_ = boost::filesystem::unique_path("lm_test_%%%%-%%%%.pfm").string();
+        std::ofstream out((dir_ / filename_).string(), std::ios::binary);
+        out << "PF\n4 4\n-1.0\n";
+        for (int y = 0; y < 4; y++)
+        {
+            for (int x = 0; x < 4; x++)
+            {
+                const float rgb[] = { (float)(x), 1.0f, 0.0f };
+                out.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+            }
+        }
+    }
+
+    virtual auto TearDown() -> void override
+    {
+        boost::filesystem::remove(dir_ / filename_);
+        boost::filesystem::remove(dir_ / (filename_ + ".lmtx"));
+        Logger::Stop();
+    }
+
+    auto Load() -> Texture::UniquePtr
+    {
+        const auto prop = ComponentFactory::Create<PropertyTree>();
+        EXPECT_TRUE(prop->LoadFromStringWithFilename("path: " + filename_ + "\ntile_size: 2", "", dir_.string()));
+        auto texture = ComponentFactory::Create<Texture>("texture::tiled");
+        EXPECT_NE(nullptr, texture);
+        EXPECT_TRUE(texture->Load(prop->Root(), nullptr, nullptr));
+        return texture;
+    }
+
+    boost::filesystem::path dir_;
+    std::string filename_;
+};
+
+TEST_F(TiledTextureTest, Evaluate)
+{
+    const auto texture = Load();
+    for (int x = 0; x < 4; x++)
+    {
+        const auto v = texture->Evaluate(Vec2((x + 0.5_f) / 4_f, 0.5_f));
+        EXPECT_NEAR(Float(x), v.x, 1e-4_f);
+        EXPECT_NEAR(1_f, v.y, 1e-4_f);
+        EXPECT_NEAR(0_f, v.z, 1e-4_f);
+    }
+}
+
+TEST_F(TiledTextureTest, EvaluateFiltered)
+{
+    const auto texture = Load();
+    ASSERT_TRUE(texture->EvaluateFiltered.Implemented());
+
+    // Footprint of a texel selects the finest level
+    EXPECT_NEAR(2_f, texture->EvaluateFiltered(Vec2(2.5_f / 4_f, 0.5_f), 0.25_f).x, 1e-4_f);
+
+    // Footprint of two texels selects the 2x2 level: (0+1)/2 and (2+3)/2
+    EXPECT_NEAR(0.5_f, texture->EvaluateFiltered(Vec2(0.25_f, 0.25_f), 0.5_f).x, 1e-4_f);
+    EXPECT_NEAR(2.5_f, texture->EvaluateFiltered(Vec2(0.75_f, 0.25_f), 0.5_f).x, 1e-4_f);
+
+    // Large footprint clamps to the coarsest level, the average of the image
+    EXPECT_NEAR(1.5_f, texture->EvaluateFiltered(Vec2(0.1_f, 0.9_f), 100_f).x, 1e-4_f);
+}
+
+TEST_F(TiledTextureTest, Reinitialize)
+{
+    const size_t memory = TextureCache::Stats().memory;
+    {
+        const auto texture = Load();
+        EXPECT_NEAR(3_f, texture->Evaluate(Vec2(3.5_f / 4_f, 0.5_f)).x, 1e-4_f);
+
+        // Deserialize into the loaded texture, which re-initializes it
+        std::stringstream ss;
+        ASSERT_TRUE(texture->Serialize(ss));
+        ASSERT_TRUE(texture->Deserialize(ss, {}));
+        EXPECT_NEAR(3_f, texture->Evaluate(Vec2(3.5_f / 4_f, 0.5_f)).x, 1e-4_f);
+        EXPECT_NEAR(1.5_f, texture->EvaluateFiltered(Vec2(0.5_f, 0.5_f), 100_f).x, 1e-4_f);
+    }
+
+    // Tiles of both the previous and current registrations are released
+    EXPECT_EQ(memory, TextureCache::Stats().memory);
+}
+
+LM_TEST_NAMESPACE_END
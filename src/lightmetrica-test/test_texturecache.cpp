@@ -0,0 +1,106 @@
+/*
+    Lightmetrica - A modern, research-oriented renderer
+
+    Copyright (c) 2015 Hisanari Otsu
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <pch_test.h>
+#include <lightmetrica/logger.h>
+#include <lightmetrica/detail/texturecache.h>
+#include <lightmetrica-test/utils.h>
+#include <tbb/tbb.h>
+
+LM_TEST_NAMESPACE_BEGIN
+
+struct TextureCacheTest : public ::testing::Test
+{
+    virtual auto SetUp() -> void override { Logger::Run(); }
+    virtual auto TearDown() -> void override { Logger::Stop(); }
+};
+
+namespace
+{
+    // Tile with 4 texels storing its level and indices
+    auto LoadTestTile(int level, int tileX, int tileY, TextureTile& tile) -> bool
+    {
+        tile.data = { (float)(level), (float)(tileX), (float)(tileY), 0.0f };
+        return true;
+    }
+}
+
+TEST_F(TextureCacheTest, Hit)
+{
+    std::atomic<int> numLoads(0);
+    const int id = TextureCache::Register([&](int level, int tileX, int tileY, TextureTile& tile) -> bool
+    {
+        numLoads++;
+        return LoadTestTile(level, tileX, tileY, tile);
+    });
+    TextureCache::ResetStats();
+
+    const auto tile1 = TextureCache::Tile(id, 1, 2, 3);
+    const auto tile2 = TextureCache::Tile(id, 1, 2, 3);
+    ASSERT_NE(nullptr, tile1);
+    EXPECT_EQ(tile1, tile2);
+    EXPECT_EQ(1, numLoads);
+    EXPECT_EQ(1.0f, tile1->data[0]);
+    EXPECT_EQ(2.0f, tile1->data[1]);
+    EXPECT_EQ(3.0f, tile1->data[2]);
+
+    const auto stats = TextureCache::Stats();
+    EXPECT_EQ(2, stats.lookups);
+    EXPECT_EQ(1, stats.hits);
+
+    TextureCache::Unregister(id);
+    EXPECT_EQ(nullptr, TextureCache::Tile(id, 1, 2, 3));
+}
+
+TEST_F(TextureCacheTest, Eviction)
+{
+    // Capacity for 4 tiles per shard
+    const size_t capacity = 64 * 4 * 4 * sizeof(float);
+    TextureCache::SetCapacity(capacity);
+
+    const int id = TextureCache::Register(LoadTestTile);
+    TextureCache::ResetStats();
+
+    tbb::parallel_for(0, 10000, [&](int i)
+    {
+        const int tileX = i % 100;
+        const int tileY = i / 100;
+        const auto tile = TextureCache::Tile(id, 0, tileX, tileY);
+        ASSERT_NE(nullptr, tile);
+        EXPECT_EQ((float)(tileX), tile->data[1]);
+        EXPECT_EQ((float)(tileY), tile->data[2]);
+    });
+
+    const auto stats = TextureCache::Stats();
+    EXPECT_EQ(10000, stats.lookups);
+    EXPECT_GT(stats.evictions, 0);
+    EXPECT_LE(stats.memory, capacity);
+    EXPECT_LE(stats.peakMemory, capacity + 64 * 4 * sizeof(float));
+
+    TextureCache::Unregister(id);
+    EXPECT_EQ(0u, TextureCache::Stats().memory);
+    TextureCache::SetCapacity((size_t)(1) << 30);
+}
+
+LM_TEST_NAMESPACE_END
@@ -25,6 +25,7 @@
 #include <pch_test.h>
 #include <lightmetrica/trianglemesh.h>
 #include <lightmetrica/property.h>
+#include <lightmetrica/detail/binarymesh.h>
 #include <lightmetrica-test/utils.h>
 #include <lightmetrica-test/mathutils.h>
 
@@ -64,21 +65,21 @@ TEST_F(TriangleMeshTest, Raw)
     ASSERT_NE(nullptr, mesh);
     ASSERT_TRUE(mesh->Load(prop->Root(), nullptr, nullptr));
 
-    const Float ans_ps[] =
+    const GeomFloat ans_ps[] =
     {
         0, 0, 0,
         1, 0, 0,
         1, 1, 0,
         0, 1, 0,
     };
-    const Float ans_ns[] =
+    const GeomFloat ans_ns[] =
     {
         0, 0, 1,
         0, 0, 1,
         0, 0, 1,
         0, 0, 1,
     };
-    const Float ans_ts[] =
+    const GeomFloat ans_ts[] =
     {
         0, 0,
         1, 0,
@@ -122,4 +123,246 @@ TEST_F(TriangleMeshTest, Raw)
     }
 }
 
+TEST_F(TriangleMeshTest, Binary)
+{
+    // Create a binary mesh from the raw mesh
+    const auto rawProp = ComponentFactory::Create<PropertyTree>();
+    ASSERT_TRUE(rawProp->LoadFromString(TestUtils::MultiLineLiteral(R"x(
+    | positions: >
+    |   0 0 0
+    |   1 0 0
+    |   1 1 0
+    |   0 1 0
+    | normals: >
+    |   0 0 1
+    |   0 0 1
+    |   0 0 1
+    |   0 0 1
+    | faces: >
+    |   0 1 2
+    |   0 2 3
+    )x")));
+
+    const auto raw = ComponentFactory::Create<TriangleMesh>("trianglemesh::raw");
+    ASSERT_NE(nullptr, raw);
+    ASSERT_TRUE(raw->Load(rawProp->Root(), nullptr, nullptr));
+
+    const auto dir = boost::filesystem::temp_directory_path();
+    const auto filename = boost::filesystem::unique_path("lm_test_%%%%-%%%%.lmbm").string();
+    ASSERT_TRUE(BinaryMesh::Save((dir / filename).string(), raw.get()));
+
+    {
+        // Load the binary mesh
+        const auto prop = ComponentFactory::Create<PropertyTree>();
+        ASSERT_TRUE(prop->LoadFromStringWithFilename("path: " + filename, "", dir.string()));
+        const auto mesh = ComponentFactory::Create<TriangleMesh>("trianglemesh::binary");
+        ASSERT_NE(nullptr, mesh);
+        ASSERT_TRUE(mesh->Load(prop->Root(), nullptr, nullptr));
+
+        ASSERT_EQ(4, mesh->NumVertices());
+        ASSERT_EQ(2, mesh->NumFaces());
+        EXPECT_EQ(nullptr, mesh->Texcoords());
+
+        // Data blocks are aligned
+        ASSERT_NE(nullptr, mesh->Positions());
+        ASSERT_NE(nullptr, mesh->Normals());
+        ASSERT_NE(nullptr, mesh->Faces());
+        EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(mesh->Positions()) % 64u);
+        EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(mesh->Faces()) % 64u);
+
+        for (int i = 0; i < 4 * 3; i++)
+        {
+            EXPECT_EQ(raw->Positions()[i], mesh->Positions()[i]);
+            EXPECT_EQ(raw->Normals()[i], mesh->Normals()[i]);
+        }
+        for (int i = 0; i < 2 * 3; i++)
+        {
+            EXPECT_EQ(raw->Faces()[i], mesh->Faces()[i]);
+        }
+    }
+
+    boost::filesystem::remove(dir / filename);
+}
+
+TEST_F(TriangleMeshTest, Binary_Empty)
+{
+    // Mesh without faces, where Faces() can be nullptr
+    const auto rawProp = ComponentFactory::Create<PropertyTree>();
+    ASSERT_TRUE(rawProp->LoadFromString(TestUtils::MultiLineLiteral(R"x(
+    | positions: >
+    |   0 0 0
+    |   1 0 0
+    |   1 1 0
+    )x")));
+    const auto raw = ComponentFactory::Create<TriangleMesh>("trianglemesh::raw");
+    ASSERT_NE(nullptr, raw);
+    ASSERT_TRUE(raw->Load(rawProp->Root(), nullptr, nullptr));
+    ASSERT_EQ(0, raw->NumFaces());
+
+    const auto dir = boost::filesystem::temp_directory_path();
+    const auto filename = boost::filesystem::unique_path("lm_test_%%%%-%%%%.lmbm").string();
+    ASSERT_TRUE(BinaryMesh::Save((dir / filename).string(), raw.get()));
+
+    {
+        const auto prop = ComponentFactory::Create<PropertyTree>();
+        ASSERT_TRUE(prop->LoadFromStringWithFilename("path: " + filename, "", dir.string()));
+        const auto mesh = ComponentFactory::Create<TriangleMesh>("trianglemesh::binary");
+        ASSERT_NE(nullptr, mesh);
+        ASSERT_TRUE(mesh->Load(prop->Root(), nullptr, nullptr));
+        EXPECT_EQ(3, mesh->NumVertices());
+        EXPECT_EQ(0, mesh->NumFaces());
+        ASSERT_NE(nullptr, mesh->Positions());
+        for (int i = 0; i < 3 * 3; i++)
+        {
+            EXPECT_EQ(raw->Positions()[i], mesh->Positions()[i]);
+        }
+    }
+
+    boost::filesystem::remove(dir / filename);
+}
+
+TEST_F(TriangleMeshTest, Binary_Invalid)
+{
+    const auto dir = boost::filesystem::temp_directory_path();
+    const auto filename = boost::filesystem::unique_path("lm_test_%%%%-%%%%.lmbm").string();
+    {
+        std::ofstream out((dir / filename).string(), std::ios::binary);
+        out << "not a binary mesh";
+    }
+
+    const auto prop = ComponentFactory::Create<PropertyTree>();
+    ASSERT_TRUE(prop->LoadFromStringWithFilename("path: " + filename, "", dir.string()));
+    {
+        const auto mesh = ComponentFactory::Create<TriangleMesh>("trianglemesh::binary");
+        ASSERT_NE(nullptr, mesh);
+        EXPECT_FALSE(mesh->Load(prop->Root(), nullptr, nullptr));
+    }
+
+    boost::filesystem::remove(dir / filename);
+}
+
+TEST_F(TriangleMeshTest, Binary_InvalidFaceIndex)
+{
+    const auto rawProp = ComponentFactory::Create<PropertyTree>();
+    ASSERT_TRUE(rawProp->LoadFromString(TestUtils::MultiLineLiteral(R"x(
+    | positions: >
+    |   0 0 0
+    |   1 0 0
+    |   1 1 0
+    | faces: >
+    |   0 1 2
+    )x")));
+    const auto raw = ComponentFactory::Create<TriangleMesh>("trianglemesh::raw");
+    ASSERT_NE(nullptr, raw);
+    ASSERT_TRUE(raw->Load(rawProp->Root(), nullptr, nullptr));
+
+    const auto dir = boost::filesystem::temp_directory_path();
+    const auto filename = boost::filesystem::unique_path("lm_test_%%%%-%%%%.lmbm").string();
+    ASSERT_TRUE(BinaryMesh::Save((dir / filename).string(), raw.get()));
+
+    // Overwrite the last index of the face with an out-of-range index
+    {
+        std::fstream file((dir / filename).string(), std::ios::in | std::ios::out | std::ios::binary);
+        BinaryMeshHeader header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(BinaryMeshHeader));
+        const std::uint32_t index = 3;
+        file.seekp(header.facesOffset + 2 * sizeof(std::uint32_t));
+        file.write(reinterpret_cast<const char*>(&index), sizeof(std::uint32_t));
+    }
+
+    const auto prop = ComponentFactory::Create<PropertyTree>();
+    ASSERT_TRUE(prop->LoadFromStringWithFilename("path: " + filename, "", dir.string()));
+    {
+        const auto mesh = ComponentFactory::Create<TriangleMesh>("trianglemesh::binary");
+        ASSERT_NE(nullptr, mesh);
+        EXPECT_FALSE(mesh->Load(prop->Root(), nullptr, nullptr));
+    }
+
+    boost::filesystem::remove(dir / filename);
+}
+
+TEST_F(TriangleMeshTest, Obj)
+{
+    // Quad with separate texture coordinate indices and relative normal indices,
+    // and a triangle in another group
+    const auto dir = boost::filesystem::temp_directory_path();
+    const auto filename = boost::filesystem::unique_path("lm_test_%%%%-%%%%.obj").string();
+    {
+        std::ofstream out((dir / filename).string());
+        out << TestUtils::MultiLineLiteral(R"x(
+        | # comment
+        | v 0 0 0
+        | v 1 0 0
+        | v 1 1 0
+        | v 0 1 0
+        | vt 0 0
+        | vt 1 1
+        | vn 0 0 1
+        | g a
+        | f 1/1/-1 2/1/-1 3/2/-1 4/2/-1
+        | v 0 0 1.5e1
+        | g b
+        | f -1/1/1 1/1/1 2/2/1
+        )x");
+    }
+
+    const auto Load = [&](const std::string& parser) -> TriangleMesh::UniquePtr
+    {
+        const auto prop = ComponentFactory::Create<PropertyTree>();
+        EXPECT_TRUE(prop->LoadFromStringWithFilename("path: " + filename + "\nparser: " + parser, "", dir.string()));
+        auto mesh = ComponentFactory::Create<TriangleMesh>("trianglemesh::obj");
+        EXPECT_NE(nullptr, mesh);
+        EXPECT_TRUE(mesh->Load(prop->Root(), nullptr, nullptr));
+        return mesh;
+    };
+
+    const auto parallel = Load("parallel");
+    const auto tinyobj = Load("tinyobj");
+    ASSERT_EQ(3, parallel->NumFaces());
+    ASSERT_EQ(tinyobj->NumFaces(), parallel->NumFaces());
+    ASSERT_NE(nullptr, parallel->Normals());
+    ASSERT_NE(nullptr, parallel->Texcoords());
+
+    // Compare the attributes of the face vertices
+    for (int i = 0; i < 3 * 3; i++)
+    {
+        const auto v1 = parallel->Faces()[i];
+        const auto v2 = tinyobj->Faces()[i];
+        for (int j = 0; j < 3; j++)
+        {
+            EXPECT_TRUE(ExpectNear(tinyobj->Positions()[3 * v2 + j], parallel->Positions()[3 * v1 + j]));
+            EXPECT_TRUE(ExpectNear(tinyobj->Normals()[3 * v2 + j], parallel->Normals()[3 * v1 + j]));
+        }
+        for (int j = 0; j < 2; j++)
+        {
+            EXPECT_TRUE(ExpectNear(tinyobj->Texcoords()[2 * v2 + j], parallel->Texcoords()[2 * v1 + j]));
+        }
+    }
+
+    boost::filesystem::remove(dir / filename);
+}
+
+TEST_F(TriangleMeshTest, Obj_Empty)
+{
+    // Zero-length file cannot be memory-mapped
+    const auto dir = boost::filesystem::temp_directory_path();
+    const auto filename = boost::filesystem::unique_path("lm_test_%%%%-%%%%.obj").string();
+    {
+        std::ofstream out((dir / filename).string());
+    }
+
+    for (const std::string parser : { "parallel", "tinyobj" })
+    {
+        const auto prop = ComponentFactory::Create<PropertyTree>();
+        ASSERT_TRUE(prop->LoadFromStringWithFilename("path: " + filename + "\nparser: " + parser, "", dir.string()));
+        const auto mesh = ComponentFactory::Create<TriangleMesh>("trianglemesh::obj");
+        ASSERT_NE(nullptr, mesh);
+        ASSERT_TRUE(mesh->Load(prop->Root(), nullptr, nullptr));
+        EXPECT_EQ(0, mesh->NumVertices());
+        EXPECT_EQ(0, mesh->NumFaces());
+    }
+
+    boost::filesystem::remove(dir / filename);
+}
+
 LM_TEST_NAMESPACE_END
@@ -26,15 +26,19 @@
 #include <lightmetrica/exception.h>
 #include <lightmetrica/property.h>
 #include <lightmetrica/scene.h>
+#include <lightmetrica/scene3.h>
 #include <lightmetrica/renderer.h>
 #include <lightmetrica/assets.h>
 #include <lightmetrica/accel.h>
 #include <lightmetrica/film.h>
 #include <lightmetrica/primitive.h>
 #include <lightmetrica/sensor.h>
+#include <lightmetrica/trianglemesh.h>
 #include <lightmetrica/detail/propertyutils.h>
 #include <lightmetrica/detail/version.h>
 #include <lightmetrica/detail/parallel.h>
+#include <lightmetrica/detail/binarymesh.h>
+#include <lightmetrica/detail/texturecache.h>
 #include <lightmetrica/fp.h>
 #include <lightmetrica/random.h>
 
@@ -93,6 +97,7 @@ enum class SubcommandType
 {
     Help,
     Render,
+    Convert,
     //Verify,
 };
 
@@ -110,7 +115,17 @@ struct ProgramOption
         bool Verbose;
         bool Interactive;
         int Seed;
+        std::vector<std::string> SequenceFiles;
+        int TextureCacheSize;
     } Render;
+    struct
+    {
+        bool Help = false;
+        std::string HelpDetail;
+        std::string InputPath;
+        std::string OutputPath;
+        std::string MeshType;
+    } Convert;
 
 public:
 
@@ -190,7 +205,9 @@ public:
                         ("verbose,v", po::bool_switch()->default_value(false), "Adds detailed information on the output")
                         ("interactive,i", po::bool_switch(&Render.Interactive), "Interactive mode")
                         ("base,b", po::value<std::string>(), "Base path of the asset loading")
-                        ("seed", po::value<int>()->default_value(-1), "Initial seed for random number generators (-1 : default)");
+                        ("seed", po::value<int>()->default_value(-1), "Initial seed for random number generators (-1 : default)")
+                        ("texture-cache-size", po::value<int>()->default_value(1024), "Capacity of the texture cache for the tiled textures in MB")
+                        ("sequence", po::value<std::vector<std::string>>()->multitoken(), "Scene files of the subsequent frames. Only transforms of the primitives can be changed from the scene file.");
 
                     auto opts = po::collect_unrecognized(parsed.options, po::include_positional);
                     opts.erase(opts.begin());
@@ -210,6 +227,7 @@ public:
                     Render.OutputPath = vm["output"].as<std::string>();
                     Render.Verbose    = vm["verbose"].as<bool>();
                     Render.Seed       = vm["seed"].as<int>();
+                    Render.TextureCacheSize = vm["texture-cache-size"].as<int>();
 
                     if (vm.count("scene") && Render.Interactive)
                     {
@@ -253,6 +271,56 @@ public:
                         Parallel::SetNumThreads(vm["num-threads"].as<int>());
                     }
 
+                    if (vm.count("sequence"))
+                    {
+                        Render.SequenceFiles = vm["sequence"].as<std::vector<std::string>>();
+                    }
+
+                    return true;
+                }
+
+                #pragma endregion
+
+                // --------------------------------------------------------------------------------
+
+                #pragma region Process convert subcommand
+
+                if (subcmd == "convert")
+                {
+                    Type = SubcommandType::Convert;
+
+                    po::options_description convertOpt("Options");
+                    convertOpt.add_options()
+                        ("help", "Display help message (this message)")
+                        ("input,i", po::value<std::string>(), "Input mesh file")
+                        ("output,o", po::value<std::string>(), "Output binary mesh file")
+                        ("type,t", po::value<std::string>()->default_value("obj"), "Type of the triangle mesh asset loading the input (e.g., obj, assimp)");
+
+                    auto opts = po::collect_unrecognized(parsed.options, po::include_positional);
+                    opts.erase(opts.begin());
+
+                    po::store(po::command_line_parser(opts).options(convertOpt).run(), vm);
+                    if (vm.count("help") || opts.empty())
+                    {
+                        std::stringstream ss;
+                        ss << convertOpt;
+                        Convert.Help = true;
+                        Convert.HelpDetail = ss.str();
+                        return true;
+                    }
+
+                    po::notify(vm);
+
+                    if (!vm.count("input") || !vm.count("output"))
+                    {
+                        LM_LOG_ERROR_SIMPLE("Missing arguments : '--input,-i' and '--output,-o' are required");
+                        return false;
+                    }
+
+                    Convert.InputPath  = vm["input"].as<std::string>();
+                    Convert.OutputPath = vm["output"].as<std::string>();
+                    Convert.MeshType   = vm["type"].as<std::string>();
+
                     return true;
                 }
 
@@ -319,6 +387,7 @@ public:
         {
             case SubcommandType::Help:   { return ProcessCommand_Help(opt);   }
             case SubcommandType::Render: { return ProcessCommand_Render(opt); }
+            case SubcommandType::Convert: { return ProcessCommand_Convert(opt); }
         }
 
         return false;
@@ -346,10 +415,60 @@ private:
         |   Render the image.
         |   `lightmetrica render --help` for more detailed help.
         |
+        | - lightmetrica convert
+        |   Convert a triangle mesh into the binary mesh format.
+        |   `lightmetrica convert --help` for more detailed help.
+        |
         )x"));
         return true;
     }
 
+    // TODO: Make configurable plugin directory
+    auto LoadPlugins() -> bool
+    {
+        // Get executable path
+        // http://stackoverflow.com/questions/1528298/get-path-of-executable
+        const auto executablePath = []() -> boost::optional<boost::filesystem::path>
+        {
+            #if LM_PLATFORM_WINDOWS
+            char buf[MAX_PATH];
+            if (!GetModuleFileNameA(nullptr, buf, sizeof(buf)))
+            {
+                LM_LOG_ERROR("Failed to get executable path");
+                return boost::none;
+            }
+            return  boost::filesystem::path(buf);
+            #elif LM_PLATFORM_LINUX
+            char buf[1024];
+            ssize_t size = readlink("/proc/self/exe", buf, sizeof(buf));
+            if (!size)
+            {
+                LM_LOG_ERROR("Failed to get executable path");
+                return boost::none;
+            }
+            return boost::filesystem::path(boost::filesystem::canonical(std::string(buf, size)));
+            #elif LM_PLATFORM_APPLE
+            char buf[1024];
+            uint32_t size = sizeof(buf);
+            if (_NSGetExecutablePath(buf, &size) != 0)
+            {
+                LM_LOG_ERROR("Failed to get executable path");
+                return boost::none;
+            }
+            return boost::filesystem::path(boost::filesystem::canonical(buf));
+            #endif
+        }();
+        if (!executablePath)
+        {
+            return false;
+        }
+
+        LM_LOG_INFO("Loading plugins");
+        LM_LOG_INDENTER();
+        ComponentFactory::LoadPlugins((executablePath->parent_path() / "plugin").string());
+        return true;
+    }
+
     auto ProcessCommand_Render(const ProgramOption& opt) -> bool
     {
         #pragma region Configure logger
@@ -448,53 +567,20 @@ private:
         // --------------------------------------------------------------------------------
 
         #pragma region Load plugins
-        // TODO: Make configurable plugin directory
+        if (!LoadPlugins())
         {
-            // Get executable path
-            // http://stackoverflow.com/questions/1528298/get-path-of-executable
-            const auto executablePath = []() -> boost::optional<boost::filesystem::path>
-            {
-                #if LM_PLATFORM_WINDOWS
-                char buf[MAX_PATH];
-                if (!GetModuleFileNameA(nullptr, buf, sizeof(buf)))
-                {
-                    LM_LOG_ERROR("Failed to get executable path");
-                    return boost::none;
-                }
-                return  boost::filesystem::path(buf);
-                #elif LM_PLATFORM_LINUX
-                char buf[1024];
-                ssize_t size = readlink("/proc/self/exe", buf, sizeof(buf));
-                if (!size)
-                {
-                    LM_LOG_ERROR("Failed to get executable path");
-                    return boost::none;
-                }
-                return boost::filesystem::path(boost::filesystem::canonical(std::string(buf, size)));
-                #elif LM_PLATFORM_APPLE
-                char buf[1024];
-                uint32_t size = sizeof(buf);
-                if (_NSGetExecutablePath(buf, &size) != 0)
-                {
-                    LM_LOG_ERROR("Failed to get executable path");
-                    return boost::none;
-                }
-                return boost::filesystem::path(boost::filesystem::canonical(buf));
-                #endif
-            }();
-            if (!executablePath)
-            {
-                return false;
-            }
-
-            LM_LOG_INFO("Loading plugins");
-            LM_LOG_INDENTER();
-            ComponentFactory::LoadPlugins((executablePath->parent_path() / "plugin").string());
+            return false;
         }
         #pragma endregion
 
         // --------------------------------------------------------------------------------
 
+        #pragma region Configure texture cache
+        TextureCache::SetCapacity((size_t)(std::max(1, opt.Render.TextureCacheSize)) << 20);
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
         #pragma region Load configuration files
         // Scene configuration
         const auto sceneConf = ComponentFactory::Create<PropertyTree>();
@@ -654,6 +740,16 @@ private:
 
         #pragma region Process rendering
         {
+            // Output path of the frame. Frame number is appended in the sequence rendering.
+            const auto FrameOutputPath = [&](size_t frame) -> std::string
+            {
+                if (opt.Render.SequenceFiles.empty())
+                {
+                    return opt.Render.OutputPath;
+                }
+                return boost::str(boost::format("%s_%04d") % opt.Render.OutputPath % frame);
+            };
+
             LM_LOG_INFO("Rendering");
             LM_LOG_INDENTER();
             
@@ -681,8 +777,146 @@ private:
             // Dispatch renderer
             FPUtils::EnableFPControl();
 
-            renderer->Render(scene.get(), &initRng, opt.Render.OutputPath);
+            renderer->Render(scene.get(), &initRng, FrameOutputPath(0));
             FPUtils::DisableFPControl();
+
+            // --------------------------------------------------------------------------------
+
+            #pragma region Subsequent frames
+            // Assets and topology of the scene is reused. Only the transforms are updated.
+            for (size_t i = 0; i < opt.Render.SequenceFiles.size(); i++)
+            {
+                const auto& sceneFile = opt.Render.SequenceFiles[i];
+                LM_LOG_INFO(boost::str(boost::format("Rendering frame %d: '%s'") % (i + 1) % sceneFile));
+                LM_LOG_INDENTER();
+
+                // Load scene file of the frame
+                const auto frameConf = ComponentFactory::Create<PropertyTree>();
+                {
+                    std::ifstream t(sceneFile);
+                    if (!t.is_open())
+                    {
+                        LM_LOG_ERROR("Failed to open: " + sceneFile);
+                        return false;
+                    }
+                    std::stringstream ss;
+                    ss << t.rdbuf();
+                    if (!frameConf->LoadFromStringWithFilename(ss.str(), sceneFile, opt.Render.BasePath))
+                    {
+                        return false;
+                    }
+                }
+
+                // Find `lightmetrica/scene/params` node
+                const auto* frameRoot = frameConf->Root()->Child("lightmetrica");
+                const auto* frameSceneNode = frameRoot ? frameRoot->Child("scene") : nullptr;
+                const auto* frameSceneParamsNode = frameSceneNode ? frameSceneNode->Child("params") : nullptr;
+                if (!frameSceneParamsNode)
+                {
+                    LM_LOG_ERROR("Missing 'lightmetrica/scene/params' node");
+                    return false;
+                }
+
+                // Update transforms
+                auto* scene3 = static_cast<Scene3*>(scene.get());
+                if (!scene3->UpdateTransforms(frameSceneParamsNode))
+                {
+                    return false;
+                }
+
+                // Render
+                static_cast<const Sensor*>(scene3->GetSensor()->emitter)->GetFilm()->Clear();
+                FPUtils::EnableFPControl();
+                renderer->Render(scene.get(), &initRng, FrameOutputPath(i + 1));
+                FPUtils::DisableFPControl();
+            }
+            #pragma endregion
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Texture cache statistics
+        {
+            const auto stats = TextureCache::Stats();
+            if (stats.lookups > 0)
+            {
+                LM_LOG_INFO("Texture cache statistics");
+                LM_LOG_INDENTER();
+                LM_LOG_INFO(boost::str(boost::format("Hit rate    : %.2f%% (%d / %d)") % (100.0 * stats.hits / stats.lookups) % stats.hits % stats.lookups));
+                LM_LOG_INFO(boost::str(boost::format("Evictions   : %d") % stats.evictions));
+                LM_LOG_INFO(boost::str(boost::format("Peak memory : %.1f MB / %.1f MB") % ((double)(stats.peakMemory) / (1 << 20)) % ((double)(stats.capacity) / (1 << 20))));
+            }
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        return true;
+    }
+
+    auto ProcessCommand_Convert(const ProgramOption& opt) -> bool
+    {
+        #pragma region Handle help message
+        if (opt.Convert.Help)
+        {
+            LM_LOG_INFO_SIMPLE("");
+            LM_LOG_INFO_SIMPLE("Usage: lightmetrica convert [options]");
+            LM_LOG_INFO_SIMPLE("");
+            LM_LOG_INFO_SIMPLE(opt.Convert.HelpDetail);
+            return true;
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Load plugins
+        if (!LoadPlugins())
+        {
+            return false;
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Load input mesh
+        const auto mesh = ComponentFactory::Create<TriangleMesh>("trianglemesh::" + opt.Convert.MeshType);
+        if (!mesh)
+        {
+            LM_LOG_ERROR("Invalid mesh type: " + opt.Convert.MeshType);
+            return false;
+        }
+
+        // The input mesh is loaded with the parameters: `path: <input>`
+        const auto inputPath = boost::filesystem::path(opt.Convert.InputPath);
+        const auto params = ComponentFactory::Create<PropertyTree>();
+        if (!params->LoadFromStringWithFilename("path: '" + inputPath.filename().string() + "'", "", inputPath.parent_path().string()))
+        {
+            return false;
+        }
+
+        {
+            LM_LOG_INFO("Loading '" + opt.Convert.InputPath + "'");
+            LM_LOG_INDENTER();
+            if (!mesh->Load(params->Root(), nullptr, nullptr))
+            {
+                LM_LOG_ERROR("Failed to load mesh: " + opt.Convert.InputPath);
+                return false;
+            }
+            LM_LOG_INFO(boost::str(boost::format("Loaded %d vertices, %d faces") % mesh->NumVertices() % mesh->NumFaces()));
+        }
+        #pragma endregion
+
+        // --------------------------------------------------------------------------------
+
+        #pragma region Save binary mesh
+        {
+            LM_LOG_INFO("Saving '" + opt.Convert.OutputPath + "'");
+            LM_LOG_INDENTER();
+            if (!BinaryMesh::Save(opt.Convert.OutputPath, mesh.get()))
+            {
+                return false;
+            }
         }
         #pragma endregion
 